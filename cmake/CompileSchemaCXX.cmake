@@ -60,3 +60,11 @@ execute_process(
 if(result)
     message(FATAL_ERROR "flatc failed to compile insert_result.fbs (${result})")
 endif()
+
+execute_process(
+    COMMAND ${FLATBUFFERS_FLATC_PATH} --cpp -o "${OZKS_BUILD_DIR}/oZKS" "${OZKS_SOURCE_DIR}/oZKS/key_filter.fbs"
+    OUTPUT_QUIET
+    RESULT_VARIABLE result)
+if(result)
+    message(FATAL_ERROR "flatc failed to compile key_filter.fbs (${result})")
+endif()
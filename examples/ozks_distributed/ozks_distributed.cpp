@@ -101,7 +101,7 @@ void OZKS::insert(const key_payload_batch_type &input)
     size_t thread_count = utils::get_insertion_thread_limit(nullptr, config_.thread_count());
     thread_count = std::min<size_t>(thread_count, pending_insertions_.size());
     size_t batch_size = (pending_insertions_.size() + thread_count - 1) / thread_count;
-    ThreadPool tp(thread_count);
+    shared_ptr<ThreadPool> tp = config_.thread_pool();
 
     // Protects the storage_ from concurrent access
     mutex storage_mutex;
@@ -110,10 +110,22 @@ void OZKS::insert(const key_payload_batch_type &input)
         [batch_size, &label_commit_batch, &storage_mutex, this](size_t i) {
             size_t begin_idx = i * batch_size;
             size_t end_idx = std::min((i + 1) * batch_size, pending_insertions_.size());
+            if (begin_idx >= end_idx) {
+                return;
+            }
+
+            // Compute the labels for this range as a single batch
+            vector<key_type> keys;
+            keys.reserve(end_idx - begin_idx);
+            for (size_t j = begin_idx; j < end_idx; j++) {
+                keys.push_back(pending_insertions_[j].first);
+            }
+            vector<hash_type> labels =
+                utils::get_node_labels(keys, vrf_sk_, config_.label_type());
+
             for (size_t j = begin_idx; j < end_idx; j++) {
                 const auto &key_payload = pending_insertions_[j];
-                hash_type label =
-                    utils::get_node_label(key_payload.first, vrf_sk_, config_.label_type());
+                const hash_type &label = labels[j - begin_idx];
                 auto payload_commit =
                     utils::commit_payload(key_payload.second, config_.payload_commitment());
                 label_commit_batch[j] = { label, payload_commit.first };
@@ -134,10 +146,14 @@ void OZKS::insert(const key_payload_batch_type &input)
     // Perform VRF and commit payload computations
     vector<future<void>> labels_and_hashes_results(thread_count);
     for (size_t idx = 0; idx < thread_count; idx++) {
-        labels_and_hashes_results[idx] = tp.enqueue(labels_and_hashes_lambda, idx);
+        labels_and_hashes_results[idx] = tp->enqueue(labels_and_hashes_lambda, idx);
     }
 
-    // Wait until the VRF and commit payload computations are done
+    // Wait until the VRF and commit payload computations are done. The thread pool outlives this
+    // function, so all tasks must have finished before an exception from any of them is rethrown.
+    for (auto &lh_result : labels_and_hashes_results) {
+        lh_result.wait();
+    }
     for (auto &lh_result : labels_and_hashes_results) {
         lh_result.get();
     }
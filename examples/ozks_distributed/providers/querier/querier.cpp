@@ -23,9 +23,20 @@ Querier::Querier(trie_id_type trie_id, shared_ptr<Storage> storage)
     trie_ = loaded.first;
 }
 
+Querier::Querier(shared_ptr<TrieImage> image) : image_(image)
+{
+    if (nullptr == image_) {
+        throw invalid_argument("image is null");
+    }
+}
+
 bool Querier::query(const hash_type &label, lookup_path_type &lookup_path) const
 {
     PartialLabel plabel(label);
+    if (nullptr != image_) {
+        return image_->lookup(plabel, lookup_path);
+    }
+
     return trie_->lookup(plabel, lookup_path);
 }
 
@@ -44,6 +55,10 @@ void Querier::query(
 
 void Querier::check_for_update(shared_ptr<Storage> storage)
 {
+    if (nullptr != image_) {
+        throw runtime_error("Cannot update a querier that uses a trie image");
+    }
+
     size_t new_epoch = storage->get_compressed_trie_epoch(trie_->id());
     size_t epoch = trie_->epoch();
 
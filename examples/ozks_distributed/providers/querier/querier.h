@@ -11,6 +11,7 @@
 #include "oZKS/compressed_trie.h"
 #include "oZKS/ozks_config.h"
 #include "oZKS/storage/storage.h"
+#include "oZKS/trie_image.h"
 
 namespace ozks_distributed {
     namespace providers {
@@ -22,6 +23,13 @@ namespace ozks_distributed {
             public:
                 Querier(
                     ozks::trie_id_type trie_id, std::shared_ptr<ozks::storage::Storage> storage);
+
+                /**
+                Creates a querier that answers queries from a read-only trie image. Such a
+                querier cannot be updated; open a newer image instead.
+                */
+                Querier(std::shared_ptr<ozks::TrieImage> image);
+
                 Querier() = delete;
 
                 bool query(const ozks::hash_type &label, ozks::lookup_path_type &lookup_path) const;
@@ -33,13 +41,15 @@ namespace ozks_distributed {
 
                 std::size_t epoch() const
                 {
-                    return trie_->epoch();
+                    return nullptr != image_ ? image_->epoch() : trie_->epoch();
                 }
 
                 void check_for_update(std::shared_ptr<ozks::storage::Storage> storage);
 
             private:
                 std::shared_ptr<ozks::CompressedTrie> trie_;
+
+                std::shared_ptr<ozks::TrieImage> image_;
             };
         } // namespace querier
     }     // namespace providers
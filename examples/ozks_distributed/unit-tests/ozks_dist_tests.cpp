@@ -2,6 +2,9 @@
 // Licensed under the MIT license.
 
 // STD
+#include <algorithm>
+#include <filesystem>
+#include <string>
 
 // OZKS
 #include "oZKS/compressed_trie.h"
@@ -9,9 +12,11 @@
 #include "oZKS/storage/memory_storage.h"
 #include "oZKS/storage/memory_storage_batch_inserter.h"
 #include "oZKS/storage/memory_storage_cache.h"
+#include "oZKS/trie_image.h"
 #include "oZKS/utilities.h"
 #include "../ozks_config_dist.h"
 #include "../ozks_distributed.h"
+#include "../providers/querier/querier.h"
 
 // GTest
 #include "gtest/gtest.h"
@@ -21,6 +26,7 @@ using namespace ozks;
 using namespace ozks::storage;
 using namespace ozks::utils;
 using namespace ozks_distributed;
+using namespace ozks_distributed::providers::querier;
 
 constexpr size_t random_iterations = 50000;
 
@@ -213,8 +219,9 @@ namespace {
 
     class TestCachedStorage : public storage::Storage {
     public:
-        TestCachedStorage(shared_ptr<storage::Storage> backing_storage, size_t cache_size)
-            : storage_(backing_storage, cache_size)
+        TestCachedStorage(
+            shared_ptr<storage::Storage> backing_storage, storage::CacheBytes cache_bytes)
+            : storage_(backing_storage, cache_bytes)
         {}
 
         virtual ~TestCachedStorage()
@@ -392,7 +399,9 @@ TEST(OZKSDistTests, UpdatedNodesTest)
     shared_ptr<storage::MemoryStorageBatchInserter> batch_inserter =
         make_shared<storage::MemoryStorageBatchInserter>(backing_storage);
     shared_ptr<storage::MemoryStorageCache> cache_storage =
-        make_shared<storage::MemoryStorageCache>(backing_storage, /* cache_size */ 1'000'000);
+        make_shared<storage::MemoryStorageCache>(
+            backing_storage,
+            storage::CacheBytes(1'000'000 * storage::MemoryStorageCache::NodeCharge()));
 
     OZKSConfigDist config(
         PayloadCommitmentType::CommitedPayload,
@@ -405,8 +414,9 @@ TEST(OZKSDistTests, UpdatedNodesTest)
     // Insert one element to ensure trie is saved in backing storage
     RandomInsertTestCore(ozks, 1);
 
-    shared_ptr<TestCachedStorage> cached_storage =
-        make_shared<TestCachedStorage>(backing_storage, 5000);
+    shared_ptr<TestCachedStorage> cached_storage = make_shared<TestCachedStorage>(
+        backing_storage,
+        storage::CacheBytes(5000 * storage::MemoryStorageCache::NodeCharge()));
     OZKSConfigDist config2(
         PayloadCommitmentType::CommitedPayload,
         LabelType::VRFLabels,
@@ -467,8 +477,9 @@ TEST(OZKSDistTests, BatchInserterCallbackTest)
 
     shared_ptr<storage::MemoryStorageBatchInserter> batch_inserter2 =
         make_shared<storage::MemoryStorageBatchInserter>(backing_storage);
-    shared_ptr<TestCachedStorage> cached_storage =
-        make_shared<TestCachedStorage>(batch_inserter2, 10000);
+    shared_ptr<TestCachedStorage> cached_storage = make_shared<TestCachedStorage>(
+        batch_inserter2,
+        storage::CacheBytes(10000 * storage::MemoryStorageCache::NodeCharge()));
 
     OZKSConfigDist config2(
         PayloadCommitmentType::CommitedPayload,
@@ -509,3 +520,54 @@ TEST(OZKSDistTests, BatchInserterCallbackTest)
     EXPECT_EQ(cached_storage->added_nodes_count(), 0);
     EXPECT_EQ(cached_storage->added_tries_count(), 0);
 }
+
+TEST(OZKSDistTests, TrieImageQuerierTest)
+{
+    string path = "ozks_dist_trie_image_test.img";
+    shared_ptr<Storage> storage = make_shared<MemoryStorage>();
+
+    CompressedTrie trie(storage, TrieType::Stored);
+    vector<hash_type> labels(200);
+    partial_label_hash_batch_type label_payload_batch;
+    for (size_t i = 0; i < labels.size(); i++) {
+        get_random_bytes(labels[i].data(), labels[i].size());
+        label_payload_batch.emplace_back(labels[i], make_bytes<hash_type>(i, i + 1, i + 2));
+    }
+    append_proof_batch_type append_proofs;
+    trie.insert(label_payload_batch, append_proofs);
+
+    TrieImage::Export(trie, path);
+    Querier stored_querier(trie.id(), storage);
+    Querier image_querier(make_shared<TrieImage>(path));
+    EXPECT_EQ(stored_querier.epoch(), image_querier.epoch());
+
+    // Add labels that are not in the trie
+    for (size_t i = 0; i < 50; i++) {
+        hash_type label;
+        get_random_bytes(label.data(), label.size());
+        labels.push_back(label);
+    }
+
+    for (const auto &label : labels) {
+        lookup_path_type stored_path;
+        lookup_path_type image_path;
+        EXPECT_EQ(stored_querier.query(label, stored_path), image_querier.query(label, image_path));
+        EXPECT_EQ(stored_path, image_path);
+    }
+
+    vector<bool> stored_found;
+    vector<bool> image_found;
+    vector<lookup_path_type> stored_paths;
+    vector<lookup_path_type> image_paths;
+    stored_querier.query(labels, stored_found, stored_paths);
+    image_querier.query(labels, image_found, image_paths);
+    EXPECT_EQ(stored_found, image_found);
+    EXPECT_EQ(stored_paths, image_paths);
+    EXPECT_EQ(200, count(stored_found.begin(), stored_found.end(), true));
+
+    // A querier built from an image cannot be updated from storage
+    EXPECT_THROW(image_querier.check_for_update(storage), runtime_error);
+    EXPECT_THROW(Querier(shared_ptr<TrieImage>()), invalid_argument);
+
+    filesystem::remove(path);
+}
@@ -3,7 +3,9 @@
 
 // STD
 #include <algorithm>
-#include <mutex>
+#include <atomic>
+#include <exception>
+#include <functional>
 #include <thread>
 
 // oZKS
@@ -23,6 +25,27 @@ using namespace ozks::storage;
 using namespace ozks_simple;
 using namespace ozks_simple::providers;
 
+namespace {
+    bool has_duplicate_keys(const vector<key_type> &keys)
+    {
+        vector<const key_type *> sorted_keys;
+        sorted_keys.reserve(keys.size());
+        for (const auto &key : keys) {
+            sorted_keys.push_back(&key);
+        }
+
+        sort(sorted_keys.begin(), sorted_keys.end(), [](const key_type *a, const key_type *b) {
+            return *a < *b;
+        });
+        auto it = adjacent_find(
+            sorted_keys.begin(), sorted_keys.end(), [](const key_type *a, const key_type *b) {
+                return *a == *b;
+            });
+
+        return it != sorted_keys.end();
+    }
+} // namespace
+
 OZKS::OZKS(const OZKSConfig &config) : config_(config), vrf_cache_(config.vrf_cache_size())
 {
     initialize();
@@ -69,52 +92,110 @@ void OZKS::do_pending_insertions()
         return;
     }
 
-    InsertResultBatch result;
     label_hash_batch_type label_commit_batch(pending_insertions_.size());
+    vector<store_value_type> store_elements(pending_insertions_.size());
+    vector<key_type> keys;
+    keys.reserve(pending_insertions_.size());
+    for (const auto &key_payload : pending_insertions_) {
+        keys.push_back(key_payload.first);
+    }
 
-    // We parallelize the VRF and commit payload computations
+    // The insertions are processed as a pipeline: chunks of VRF labels and payload commitments
+    // are computed on the thread pool while the calling thread checks for duplicate keys and then
+    // writes the already finished chunks to storage. Storage is only accessed from the calling
+    // thread, so no locking is needed. Using more chunks than threads lets the storage writes
+    // start early.
+    constexpr size_t chunks_per_thread = 4;
     size_t thread_count = utils::get_insertion_thread_limit(nullptr, config_.thread_count());
-    thread_count = std::min<size_t>(thread_count, pending_insertions_.size());
-    size_t batch_size = (pending_insertions_.size() + thread_count - 1) / thread_count;
-    ThreadPool tp(thread_count);
-
-    // Protects the storage_ from concurrent access
-    mutex storage_mutex;
+    size_t chunk_count = std::min<size_t>(thread_count * chunks_per_thread, keys.size());
+    size_t chunk_size = (keys.size() + chunk_count - 1) / chunk_count;
+    shared_ptr<ThreadPool> tp = config_.thread_pool();
 
     auto labels_and_hashes_lambda =
-        [batch_size, &label_commit_batch, &storage_mutex, this](size_t i) {
-            size_t begin_idx = i * batch_size;
-            size_t end_idx = std::min((i + 1) * batch_size, pending_insertions_.size());
-            for (size_t j = begin_idx; j < end_idx; j++) {
-                const auto &key_payload = pending_insertions_[j];
-                hash_type label =
-                    utils::get_node_label(key_payload.first, vrf_sk_, config_.label_type());
-                auto payload_commit =
-                    utils::commit_payload(key_payload.second, config_.payload_commitment());
-                label_commit_batch[j] = { label, payload_commit.first };
-
-                // Get a lock guard to the mutex for writing to storage_
-                lock_guard<mutex> lock(storage_mutex);
-
-                store_value_type store_element;
-                if (storage()->load_store_element(id(), key_payload.first, store_element)) {
-                    throw runtime_error("Key is already contained");
-                }
+        [chunk_size, &keys, &label_commit_batch, &store_elements, this](size_t i) {
+            size_t begin_idx = i * chunk_size;
+            size_t end_idx = std::min((i + 1) * chunk_size, keys.size());
+            if (begin_idx >= end_idx) {
+                return;
+            }
+
+            // Compute the labels for this range as a single batch
+            vector<hash_type> labels = utils::get_node_labels(
+                gsl::span<const key_type>(keys).subspan(begin_idx, end_idx - begin_idx),
+                vrf_sk_,
+                config_.label_type());
 
-                store_element = store_value_type{ key_payload.second, payload_commit.second };
-                storage()->save_store_element(id(), key_payload.first, store_element);
+            for (size_t j = begin_idx; j < end_idx; j++) {
+                const auto &payload = pending_insertions_[j].second;
+                auto payload_commit = utils::commit_payload(payload, config_.payload_commitment());
+                label_commit_batch[j] = { labels[j - begin_idx], payload_commit.first };
+                store_elements[j] = store_value_type{ payload, payload_commit.second };
             }
         };
 
     // Perform VRF and commit payload computations
-    vector<future<void>> labels_and_hashes_results(thread_count);
-    for (size_t idx = 0; idx < thread_count; idx++) {
-        labels_and_hashes_results[idx] = tp.enqueue(labels_and_hashes_lambda, idx);
+    vector<future<void>> labels_and_hashes_results(chunk_count);
+    for (size_t idx = 0; idx < chunk_count; idx++) {
+        labels_and_hashes_results[idx] = tp->enqueue(labels_and_hashes_lambda, idx);
     }
 
-    // Wait until the VRF and commit payload computations are done
-    for (auto &lh_result : labels_and_hashes_results) {
-        lh_result.get();
+    // The thread pool outlives this function, so all tasks must have finished before an
+    // exception is rethrown
+    try {
+        // Check for duplicates, first within the batch and then in storage, while the labels are
+        // being computed. Nothing is written if any of the keys is already contained.
+        if (has_duplicate_keys(keys)) {
+            throw runtime_error("Key is already contained");
+        }
+
+        // Only the keys the filter cannot rule out are looked up in storage
+        vector<hash_type> key_hashes;
+        vector<key_type> possible_keys;
+        const vector<key_type> *stored_keys = &keys;
+        if (key_filter_) {
+            key_hashes.reserve(keys.size());
+            for (const auto &key : keys) {
+                key_hashes.push_back(utils::compute_key_hash(key));
+                if (key_filter_->might_contain(key_hashes.back())) {
+                    possible_keys.push_back(key);
+                }
+            }
+            stored_keys = &possible_keys;
+        }
+
+        vector<optional<store_value_type>> existing_elements;
+        if (!stored_keys->empty() &&
+            storage()->load_store_elements(id(), *stored_keys, existing_elements) != 0) {
+            throw runtime_error("Key is already contained");
+        }
+
+        // Write the store elements as the chunks finish
+        for (size_t idx = 0; idx < chunk_count; idx++) {
+            labels_and_hashes_results[idx].get();
+
+            size_t begin_idx = idx * chunk_size;
+            size_t end_idx = std::min((idx + 1) * chunk_size, keys.size());
+            vector<pair<key_type, store_value_type>> chunk_elements;
+            chunk_elements.reserve(end_idx - begin_idx);
+            for (size_t j = begin_idx; j < end_idx; j++) {
+                chunk_elements.emplace_back(keys[j], std::move(store_elements[j]));
+            }
+            storage()->save_store_elements(id(), chunk_elements);
+
+            // Keys are added to the filter as soon as they are in storage
+            if (key_filter_) {
+                for (size_t j = begin_idx; j < end_idx; j++) {
+                    key_filter_->add(key_hashes[j]);
+                }
+            }
+        }
+    } catch (...) {
+        for (auto &lh_result : labels_and_hashes_results) {
+            if (lh_result.valid()) {
+                lh_result.wait();
+            }
+        }
+        throw;
     }
 
     append_proof_batch_type append_proofs;
@@ -130,6 +211,17 @@ void OZKS::do_pending_insertions()
         pr->init_result(commitment, std::move(append_proofs[idx]));
     }
 
+    // Compute the VRF proofs for the new keys in the background, if enabled in the VRF cache
+    if (config_.label_type() == LabelType::VRFLabels && vrf_cache_.prewarm_budget()) {
+        size_t prewarm_count = std::min(pending_insertions_.size(), vrf_cache_.prewarm_budget());
+        vector<hash_type> key_hashes;
+        key_hashes.reserve(prewarm_count);
+        for (size_t idx = 0; idx < prewarm_count; idx++) {
+            key_hashes.push_back(utils::compute_key_hash(pending_insertions_[idx].first));
+        }
+        vrf_cache_.prewarm(vrf_sk_, key_hashes);
+    }
+
     pending_insertions_.clear();
     pending_results_.clear();
     storage()->flush(id());
@@ -142,6 +234,208 @@ QueryResult OZKS::query(const key_type &key) const
     hash_type label =
         utils::get_node_label(key, vrf_sk_, vrf_cache_, config_.label_type(), vrf_proof);
 
+    return lookup(key, label, vrf_proof.value_or(VRFProof{}));
+}
+
+future<QueryResult> OZKS::query_async(const key_type &key) const
+{
+    auto result = make_shared<promise<QueryResult>>();
+    future<QueryResult> future_result = result->get_future();
+    enqueue_queries({ key }, [result](vector<QueryResult> results, exception_ptr error) {
+        if (error) {
+            result->set_exception(error);
+        } else {
+            result->set_value(std::move(results.front()));
+        }
+    });
+
+    return future_result;
+}
+
+future<vector<QueryResult>> OZKS::query_async(const vector<key_type> &keys) const
+{
+    auto results = make_shared<promise<vector<QueryResult>>>();
+    future<vector<QueryResult>> future_results = results->get_future();
+    enqueue_queries(keys, [results](vector<QueryResult> query_results, exception_ptr error) {
+        if (error) {
+            results->set_exception(error);
+        } else {
+            results->set_value(std::move(query_results));
+        }
+    });
+
+    return future_results;
+}
+
+void OZKS::enqueue_queries(
+    vector<key_type> keys, function<void(vector<QueryResult>, exception_ptr)> done) const
+{
+    // Number of keys handled by a single task
+    constexpr size_t chunk_size = 16;
+
+    if (keys.empty()) {
+        done({}, nullptr);
+        return;
+    }
+
+    // State shared by the tasks. The proof tasks compute the VRF proofs missing from the cache
+    // while the lookup tasks run; the last task to finish attaches the proofs and calls done.
+    struct QueryState {
+        vector<key_type> keys;
+
+        vector<hash_type> key_hashes;
+
+        vector<optional<VRFProof>> cached_proofs;
+
+        vector<size_t> missing;
+
+        vector<vector<VRFProof>> missing_proofs;
+
+        vector<vector<QueryResult>> chunk_results;
+
+        atomic<size_t> remaining;
+
+        atomic_bool failed = false;
+
+        function<void(vector<QueryResult>, exception_ptr)> done;
+    };
+
+    auto state = make_shared<QueryState>();
+    state->keys = std::move(keys);
+    state->done = std::move(done);
+    state->cached_proofs.resize(state->keys.size());
+    state->key_hashes.reserve(state->keys.size());
+    for (const auto &key : state->keys) {
+        state->key_hashes.push_back(utils::compute_key_hash(key));
+    }
+
+    bool use_vrf = config_.label_type() == LabelType::VRFLabels;
+    if (use_vrf) {
+        for (size_t idx = 0; idx < state->keys.size(); idx++) {
+            state->cached_proofs[idx] = vrf_cache_.get(state->key_hashes[idx]);
+            if (!state->cached_proofs[idx].has_value()) {
+                state->missing.push_back(idx);
+            }
+        }
+    }
+
+    size_t lookup_count = (state->keys.size() + chunk_size - 1) / chunk_size;
+    size_t proof_count = (state->missing.size() + chunk_size - 1) / chunk_size;
+    state->chunk_results.resize(lookup_count);
+    state->missing_proofs.resize(proof_count);
+    state->remaining = lookup_count + proof_count;
+
+    // Called at the end of every task. No task waits for another, so the queries can also be
+    // started from a task on the pool.
+    auto finish_task = [this](const shared_ptr<QueryState> &state, exception_ptr error) {
+        if (error && !state->failed.exchange(true)) {
+            state->done({}, error);
+        }
+        if (1 != state->remaining.fetch_sub(1) || state->failed) {
+            return;
+        }
+
+        vector<QueryResult> results;
+        try {
+            results.reserve(state->keys.size());
+            for (auto &chunk_result : state->chunk_results) {
+                for (auto &result : chunk_result) {
+                    results.push_back(std::move(result));
+                }
+            }
+
+            for (size_t j = 0; j < state->missing.size(); j++) {
+                QueryResult &r = results[state->missing[j]];
+                r = QueryResult(
+                    config_,
+                    r.is_member(),
+                    r.key(),
+                    r.payload(),
+                    r.lookup_proof(),
+                    state->missing_proofs[j / chunk_size][j % chunk_size],
+                    r.randomness());
+            }
+        } catch (...) {
+            state->done({}, current_exception());
+            return;
+        }
+        state->done(std::move(results), nullptr);
+    };
+
+    // The proof tasks are enqueued first, as they take longer than the lookups
+    shared_ptr<ThreadPool> tp = config_.thread_pool();
+    for (size_t chunk = 0; chunk < proof_count; chunk++) {
+        tp->enqueue([this, state, finish_task, chunk]() {
+            exception_ptr error;
+            try {
+                size_t begin = chunk * chunk_size;
+                size_t end = std::min(begin + chunk_size, state->missing.size());
+                vector<hash_type> chunk_hashes;
+                chunk_hashes.reserve(end - begin);
+                for (size_t j = begin; j < end; j++) {
+                    chunk_hashes.push_back(state->key_hashes[state->missing[j]]);
+                }
+
+                vector<VRFProof> proofs = vrf_sk_.get_vrf_proofs(chunk_hashes);
+                for (size_t j = 0; j < chunk_hashes.size(); j++) {
+                    vrf_cache_.add(chunk_hashes[j], proofs[j]);
+                }
+                state->missing_proofs[chunk] = std::move(proofs);
+            } catch (...) {
+                error = current_exception();
+            }
+            finish_task(state, error);
+        });
+    }
+
+    // The lookups do not wait for the proofs: the labels for cache misses only need the VRF
+    // values, which are much cheaper than the proofs. A cache miss therefore costs about
+    // max(proof, value + lookup) rather than proof + lookup.
+    for (size_t chunk = 0; chunk < lookup_count; chunk++) {
+        tp->enqueue([this, state, finish_task, chunk, use_vrf]() {
+            exception_ptr error;
+            try {
+                size_t begin = chunk * chunk_size;
+                size_t end = std::min(begin + chunk_size, state->keys.size());
+                vector<hash_type> labels(
+                    state->key_hashes.begin() + begin, state->key_hashes.begin() + end);
+                if (use_vrf) {
+                    vector<hash_type> uncached_hashes;
+                    for (size_t idx = begin; idx < end; idx++) {
+                        if (!state->cached_proofs[idx].has_value()) {
+                            uncached_hashes.push_back(state->key_hashes[idx]);
+                        }
+                    }
+                    vector<hash_type> uncached_values = vrf_sk_.get_vrf_values(uncached_hashes);
+
+                    auto value_it = uncached_values.begin();
+                    for (size_t idx = begin; idx < end; idx++) {
+                        labels[idx - begin] = state->cached_proofs[idx].has_value()
+                                                  ? state->cached_proofs[idx]->compute_vrf_value()
+                                                  : *value_it++;
+                    }
+                }
+
+                vector<QueryResult> results;
+                results.reserve(end - begin);
+                for (size_t idx = begin; idx < end; idx++) {
+                    results.push_back(lookup(
+                        state->keys[idx],
+                        labels[idx - begin],
+                        state->cached_proofs[idx].value_or(VRFProof{})));
+                }
+                state->chunk_results[chunk] = std::move(results);
+            } catch (...) {
+                error = current_exception();
+            }
+            finish_task(state, error);
+        });
+    }
+}
+
+QueryResult OZKS::lookup(
+    const key_type &key, const hash_type &label, const VRFProof &vrf_proof) const
+{
     append_proof_type lookup_path;
     if (!query_provider_->query(id(), label, lookup_path)) {
         // Non-existence: return path to partial label that matches key and its two children
@@ -150,7 +444,7 @@ QueryResult OZKS::query(const key_type &key) const
                  key,
                  /* payload */ {},
                  lookup_path,
-                 vrf_proof.value_or(VRFProof{}),
+                 vrf_proof,
                  /* randomness */ {} };
     }
 
@@ -165,13 +459,14 @@ QueryResult OZKS::query(const key_type &key) const
              key,
              store_element.payload,
              lookup_path,
-             vrf_proof.value_or(VRFProof{}),
+             vrf_proof,
              store_element.randomness };
 }
 
 void OZKS::flush()
 {
     do_pending_insertions();
+    vrf_cache_.flush_backing_file();
 }
 
 void OZKS::check_for_update()
@@ -180,6 +475,9 @@ void OZKS::check_for_update()
     size_t epoch = get_epoch();
 
     if (new_epoch > epoch) {
+        // The keys inserted by another instance are not in the filter
+        key_filter_.reset();
+
         for (; epoch <= new_epoch; epoch++) {
             storage()->load_updated_elements(epoch, id(), storage());
         }
@@ -215,6 +513,22 @@ Commitment OZKS::get_commitment() const
     return { vrf_public_key, trie_info_provider_->get_root_hash(id()) };
 }
 
+void OZKS::set_vrf_cache_file(const string &path)
+{
+    vector<byte> vrf_pk_saved(VRFPublicKey::save_size);
+    get_vrf_public_key().save(gsl::span<byte, VRFPublicKey::save_size>(vrf_pk_saved));
+    vrf_cache_.open_backing_file(path, vrf_pk_saved);
+}
+
+void OZKS::enable_key_filter(size_t expected_key_count, size_t bits_per_key)
+{
+    if (get_epoch() != 0) {
+        throw logic_error("Key filter can only be enabled before any key is inserted");
+    }
+
+    key_filter_.emplace(expected_key_count, bits_per_key);
+}
+
 const OZKSConfig &OZKS::get_config() const
 {
     return config_;
@@ -228,6 +542,11 @@ void OZKS::clear()
     // Clear the cache and hit/miss counters
     vrf_cache_.clear();
 
+    // The filter is kept, but the keys are gone
+    if (key_filter_) {
+        key_filter_->clear();
+    }
+
     // Save the VRF secret key and ID so we can replace them
     VRFSecretKey old_vrf_sk = vrf_sk_;
     trie_id_type ozks_id = ozks_id_;
@@ -256,11 +575,22 @@ size_t OZKS::save(SerializationWriter &writer) const
             fbs_builder.CreateVector(reinterpret_cast<uint8_t *>(sk_saved.data()), sk_saved.size());
     }
 
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> key_filter_data = 0;
+    if (key_filter_) {
+        vector<uint8_t> key_filter_saved;
+        key_filter_->save(key_filter_saved);
+        key_filter_data = fbs_builder.CreateVector(key_filter_saved);
+    }
+
     fbs::OZKSBuilder ozks_builder(fbs_builder);
     ozks_builder.add_version(ozks_serialization_version);
     ozks_builder.add_vrf_sk(sk_data);
     ozks_builder.add_configuration(config_data);
     ozks_builder.add_trie_id(id());
+    ozks_builder.add_key_filter(key_filter_data);
+    if (key_filter_) {
+        ozks_builder.add_key_filter_epoch(get_epoch());
+    }
 
     auto fbs_ozks = ozks_builder.Finish();
     fbs_builder.FinishSizePrefixed(fbs_ozks);
@@ -319,6 +649,16 @@ pair<OZKS, size_t> OZKS::Load(SerializationReader &reader, shared_ptr<Storage> s
 
     ozks.ozks_id_ = fbs_ozks->trie_id();
 
+    // A filter saved at an older epoch misses the keys inserted since, so it would let
+    // duplicates through. The keys cannot be read back from storage to rebuild it, so it is
+    // dropped instead.
+    if (nullptr != fbs_ozks->key_filter() &&
+        fbs_ozks->key_filter_epoch() == storage->get_compressed_trie_epoch(ozks.ozks_id_)) {
+        vector<uint8_t> key_filter_vec(
+            fbs_ozks->key_filter()->begin(), fbs_ozks->key_filter()->end());
+        ozks.key_filter_ = KeyFilter::Load(key_filter_vec).first;
+    }
+
     return { ozks, in_data.size() };
 }
 
@@ -4,15 +4,21 @@
 #pragma once
 
 // STD
+#include <exception>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <optional>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 // oZKS
 #include "oZKS/commitment.h"
 #include "oZKS/defines.h"
 #include "oZKS/insert_result.h"
+#include "oZKS/key_filter.h"
 #include "oZKS/ozks_config.h"
 #include "oZKS/providers/query_provider.h"
 #include "oZKS/providers/trie_info_provider.h"
@@ -67,7 +73,27 @@ namespace ozks_simple {
         ozks::QueryResult query(const ozks::key_type &key) const;
 
         /**
-        Flush any pending insertions
+        Perform a query for a given key asynchronously. On a VRF cache miss the VRF proof is
+        computed on the thread pool concurrently with the trie lookup and storage reads, which
+        only need the much cheaper VRF value. This function returns without waiting for either,
+        so it can also be called from a task on the thread pool. This instance must outlive the
+        returned future.
+        */
+        std::future<ozks::QueryResult> query_async(const ozks::key_type &key) const;
+
+        /**
+        Perform queries for a batch of keys asynchronously. The VRF proofs missing from the
+        cache are computed in batches on the thread pool, overlapping with the trie lookups and
+        storage reads, which run in separate chunks. This function returns without waiting for
+        any of the tasks, and none of the tasks waits for another, so it can also be called from
+        a task on the thread pool. This instance must outlive the returned future.
+        */
+        std::future<std::vector<ozks::QueryResult>> query_async(
+            const std::vector<ozks::key_type> &keys) const;
+
+        /**
+        Flush any pending insertions. If a prewarm budget is set in the VRF cache, the VRF proofs
+        for the inserted keys are computed in the background and added to the cache.
         */
         void flush();
 
@@ -127,6 +153,34 @@ namespace ozks_simple {
         */
         void clear();
 
+        /**
+        Attach a file to the VRF cache so that cached VRF proofs survive restarts. Proofs in an
+        existing file are loaded in the background. The file is tied to the VRF public key of
+        this instance, so a file written with a different key is discarded.
+        */
+        void set_vrf_cache_file(const std::string &path);
+
+        /**
+        Keep a filter over the keys of this instance, so that inserting new keys does not need to
+        look them up in storage to check they are not already contained. The filter is updated
+        as insertions are flushed and is saved together with the instance. It can only be enabled
+        before any key is inserted, as the filter cannot be built from the keys already in
+        storage.
+        */
+        void enable_key_filter(
+            std::size_t expected_key_count,
+            std::size_t bits_per_key = ozks::KeyFilter::default_bits_per_key);
+
+        /**
+        Get the key filter of this instance, if there is one. The filter is dropped when
+        check_for_update finds keys inserted by another instance, and a loaded instance only
+        keeps the saved filter if the trie in storage is still at the epoch it was saved at.
+        */
+        const std::optional<ozks::KeyFilter> &get_key_filter() const noexcept
+        {
+            return key_filter_;
+        }
+
         /**
         Get a reference to the VRF cache.
         */
@@ -144,6 +198,7 @@ namespace ozks_simple {
         ozks::VRFSecretKey vrf_sk_;
         std::vector<pending_insertion> pending_insertions_;
         std::vector<pending_result> pending_results_;
+        std::optional<ozks::KeyFilter> key_filter_;
         std::shared_ptr<ozks::providers::QueryProvider> query_provider_;
         std::shared_ptr<ozks::providers::UpdateProvider> update_provider_;
         std::shared_ptr<ozks::providers::TrieInfoProvider> trie_info_provider_;
@@ -161,5 +216,14 @@ namespace ozks_simple {
         void initialize();
 
         std::shared_ptr<ozks::storage::Storage> storage() const;
+
+        ozks::QueryResult lookup(
+            const ozks::key_type &key,
+            const ozks::hash_type &label,
+            const ozks::VRFProof &vrf_proof) const;
+
+        void enqueue_queries(
+            std::vector<ozks::key_type> keys,
+            std::function<void(std::vector<ozks::QueryResult>, std::exception_ptr)> done) const;
     };
 } // namespace ozks_simple
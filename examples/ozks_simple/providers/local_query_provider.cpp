@@ -13,7 +13,8 @@ using namespace ozks_simple::providers;
 
 LocalQueryProvider::LocalQueryProvider(const OZKSConfig &config)
 {
-    set_config(config.storage(), config.trie_type(), config.thread_count());
+    set_config(
+        config.storage(), config.trie_type(), config.thread_count(), config.thread_pool());
 }
 
 bool LocalQueryProvider::query(
@@ -12,7 +12,8 @@ using namespace ozks_simple::providers;
 
 LocalTrieInfoProvider::LocalTrieInfoProvider(const OZKSConfig &config)
 {
-    set_config(config.storage(), config.trie_type(), config.thread_count());
+    set_config(
+        config.storage(), config.trie_type(), config.thread_count(), config.thread_pool());
 }
 
 hash_type LocalTrieInfoProvider::get_root_hash(trie_id_type trie_id)
@@ -57,7 +57,8 @@ namespace {
 
 LocalUpdateProvider::LocalUpdateProvider(const OZKSConfig &config)
 {
-    set_config(config.storage(), config.trie_type(), config.thread_count());
+    set_config(
+        config.storage(), config.trie_type(), config.thread_count(), config.thread_pool());
 }
 
 void LocalUpdateProvider::insert(
@@ -17,16 +17,21 @@ using namespace ozks_simple::providers;
 namespace {
     unordered_map<trie_id_type, shared_ptr<CompressedTrie>> tries_;
     size_t thread_count_ = 0;
+    shared_ptr<ThreadPool> thread_pool_;
     TrieType trie_type_ = TrieType::Stored;
     shared_ptr<storage::Storage> storage_;
 } // namespace
 
 void ozks_simple::providers::set_config(
-    shared_ptr<storage::Storage> storage, TrieType trie_type, size_t thread_count)
+    shared_ptr<storage::Storage> storage,
+    TrieType trie_type,
+    size_t thread_count,
+    shared_ptr<ThreadPool> thread_pool)
 {
     storage_ = storage;
     trie_type_ = trie_type;
     thread_count_ = thread_count;
+    thread_pool_ = thread_pool;
 }
 
 shared_ptr<CompressedTrie> ozks_simple::providers::get_compressed_trie(trie_id_type trie_id)
@@ -41,10 +46,12 @@ shared_ptr<CompressedTrie> ozks_simple::providers::get_compressed_trie(trie_id_t
             result = make_shared<CompressedTrie>(storage_, TrieType::Stored);
             break;
         case TrieType::Linked:
-            result = make_shared<CompressedTrie>(storage_, TrieType::Linked, thread_count_);
+            result = make_shared<CompressedTrie>(
+                storage_, TrieType::Linked, thread_count_, thread_pool_);
             break;
         case TrieType::LinkedNoStorage:
-            result = make_shared<CompressedTrie>(nullptr, TrieType::Linked, thread_count_);
+            result = make_shared<CompressedTrie>(
+                nullptr, TrieType::Linked, thread_count_, thread_pool_);
             break;
         default:
             throw logic_error("Invalid Trie Type");
@@ -8,6 +8,7 @@
 
 // OZKS
 #include "oZKS/compressed_trie.h"
+#include "oZKS/thread_pool.h"
 
 namespace ozks_simple {
     namespace providers {
@@ -17,7 +18,8 @@ namespace ozks_simple {
         void set_config(
             std::shared_ptr<ozks::storage::Storage> storage,
             ozks::TrieType trie_type,
-            std::size_t thread_count);
+            std::size_t thread_count,
+            std::shared_ptr<ozks::ThreadPool> thread_pool);
 
         /**
         Get the Compressed Trie that has the given trie ID
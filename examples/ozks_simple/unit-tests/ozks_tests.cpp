@@ -8,6 +8,7 @@
 #include "oZKS/storage/memory_storage.h"
 #include "oZKS/storage/memory_storage_batch_inserter.h"
 #include "oZKS/storage/memory_storage_cache.h"
+#include "oZKS/thread_pool.h"
 #include "oZKS/utilities.h"
 #include "../ozks.h"
 
@@ -216,8 +217,9 @@ namespace {
 
     class TestCachedStorage : public storage::Storage {
     public:
-        TestCachedStorage(shared_ptr<storage::Storage> backing_storage, size_t cache_size)
-            : storage_(backing_storage, cache_size)
+        TestCachedStorage(
+            shared_ptr<storage::Storage> backing_storage, storage::CacheBytes cache_bytes)
+            : storage_(backing_storage, cache_bytes)
         {}
 
         virtual ~TestCachedStorage()
@@ -328,6 +330,29 @@ namespace {
         vector<CompressedTrie> added_tries_;
     };
 
+    /**
+    Memory storage that counts the store elements that are looked up in a batch
+    */
+    class StoreLookupCountingStorage : public storage::MemoryStorage {
+    public:
+        size_t load_store_elements(
+            trie_id_type trie_id,
+            const vector<vector<byte>> &keys,
+            vector<optional<store_value_type>> &values) override
+        {
+            looked_up_count_ += keys.size();
+            return MemoryStorage::load_store_elements(trie_id, keys, values);
+        }
+
+        size_t looked_up_count() const
+        {
+            return looked_up_count_;
+        }
+
+    private:
+        size_t looked_up_count_ = 0;
+    };
+
 } // namespace
 
 vector<key_type> RandomInsertTestCore(OZKS &ozks, size_t iterations, bool flush_at_end = false)
@@ -583,6 +608,137 @@ TEST(OZKSTests, InsertBatchTest)
     EXPECT_GT(result[5]->append_proof().size(), 0);
 }
 
+TEST(OZKSTests, DuplicateKeyTest)
+{
+    auto storage = make_shared<storage::MemoryStorage>();
+    OZKSConfig config{
+        PayloadCommitmentType::UncommitedPayload, LabelType::HashedLabels, TrieType::Stored, storage
+    };
+
+    auto key1 = make_bytes<key_type>(0x01, 0x02, 0x03);
+    auto key2 = make_bytes<key_type>(0x02, 0x03, 0x04);
+    auto payload = make_bytes<payload_type>(0xFF, 0xFE, 0xFD, 0xFC, 0xFB, 0xFA);
+
+    // Duplicate key within a batch: nothing should be written
+    {
+        OZKS ozks(config);
+        key_payload_batch_type batch{ { key1, payload }, { key2, payload }, { key1, payload } };
+        ozks.insert(batch);
+
+        EXPECT_THROW(ozks.flush(), runtime_error);
+        EXPECT_EQ(0, storage->store_element_count());
+        EXPECT_EQ(0, ozks.get_epoch());
+    }
+
+    // Key that was inserted in an earlier epoch
+    {
+        OZKS ozks(config);
+        ozks.insert(key1, payload);
+        ozks.flush();
+        EXPECT_EQ(1, storage->store_element_count());
+
+        ozks.insert(key2, payload);
+        ozks.insert(key1, payload);
+        EXPECT_THROW(ozks.flush(), runtime_error);
+        EXPECT_EQ(1, storage->store_element_count());
+        EXPECT_EQ(1, ozks.get_epoch());
+    }
+}
+
+TEST(OZKSTests, KeyFilterTest)
+{
+    auto storage = make_shared<StoreLookupCountingStorage>();
+    OZKSConfig config{
+        PayloadCommitmentType::UncommitedPayload, LabelType::HashedLabels, TrieType::Stored, storage
+    };
+    OZKS ozks(config);
+    EXPECT_FALSE(ozks.get_key_filter().has_value());
+    ozks.enable_key_filter(1000);
+    ASSERT_TRUE(ozks.get_key_filter().has_value());
+
+    key_type key(40);
+    payload_type payload(40);
+    vector<key_type> keys;
+    for (size_t i = 0; i < 1000; i++) {
+        get_random_bytes(key.data(), key.size());
+        get_random_bytes(payload.data(), payload.size());
+        ozks.insert(key, payload);
+        keys.push_back(key);
+    }
+
+    // The filter is empty, so none of the keys is looked up in storage
+    ozks.flush();
+    EXPECT_EQ(0, storage->looked_up_count());
+    EXPECT_EQ(1000, ozks.get_key_filter()->key_count());
+    EXPECT_THROW(ozks.enable_key_filter(1000), logic_error);
+
+    // New keys are only looked up in storage when the filter reports a false positive
+    for (size_t i = 0; i < 100; i++) {
+        get_random_bytes(key.data(), key.size());
+        ozks.insert(key, payload);
+    }
+    ozks.flush();
+    EXPECT_GT(10, storage->looked_up_count());
+
+    // Keys that are already contained are still found
+    ozks.insert(keys[0], payload);
+    EXPECT_THROW(ozks.flush(), runtime_error);
+    EXPECT_EQ(1100, storage->store_element_count());
+
+    // The filter is saved together with the instance
+    stringstream ss;
+    ozks.save(ss);
+    auto loaded = OZKS::Load(storage, ss);
+    ASSERT_TRUE(loaded.first.get_key_filter().has_value());
+    EXPECT_EQ(1100, loaded.first.get_key_filter()->key_count());
+    for (const auto &k : keys) {
+        EXPECT_TRUE(loaded.first.get_key_filter()->might_contain(compute_key_hash(k)));
+    }
+
+    ozks.clear();
+    EXPECT_EQ(0, ozks.get_key_filter()->key_count());
+}
+
+TEST(OZKSTests, KeyFilterStaleSaveTest)
+{
+    auto storage = make_shared<MemoryStorage>();
+    OZKSConfig config{
+        PayloadCommitmentType::UncommitedPayload, LabelType::HashedLabels, TrieType::Stored, storage
+    };
+    OZKS ozks(config);
+    ozks.enable_key_filter(100);
+
+    key_type key(40);
+    payload_type payload(40);
+    for (size_t i = 0; i < 10; i++) {
+        get_random_bytes(key.data(), key.size());
+        get_random_bytes(payload.data(), payload.size());
+        ozks.insert(key, payload);
+    }
+    ozks.flush();
+
+    stringstream old_save;
+    ozks.save(old_save);
+
+    // A save at the current epoch keeps the filter
+    stringstream current_save(old_save.str());
+    auto loaded = OZKS::Load(storage, current_save);
+    ASSERT_TRUE(loaded.first.get_key_filter().has_value());
+    EXPECT_EQ(10, loaded.first.get_key_filter()->key_count());
+
+    get_random_bytes(key.data(), key.size());
+    ozks.insert(key, payload);
+    ozks.flush();
+
+    // The old save does not know about the new key, so its filter is dropped
+    auto stale = OZKS::Load(storage, old_save);
+    EXPECT_FALSE(stale.first.get_key_filter().has_value());
+
+    // The new key is found in storage and inserting it again is rejected
+    stale.first.insert(key, payload);
+    EXPECT_THROW(stale.first.flush(), runtime_error);
+}
+
 TEST(OZKSTests, QueryTest)
 {
     OZKS ozks;
@@ -671,6 +827,126 @@ TEST(OZKSTests, MultiInsertQueryTest)
     EXPECT_EQ(true, query_result.verify(commitment));
 }
 
+TEST(OZKSTests, QueryAsyncTest)
+{
+    auto expect_same_result = [](const QueryResult &expected, const QueryResult &actual) {
+        EXPECT_EQ(expected.is_member(), actual.is_member());
+        EXPECT_EQ(expected.key(), actual.key());
+        EXPECT_EQ(expected.payload(), actual.payload());
+        EXPECT_EQ(expected.lookup_proof(), actual.lookup_proof());
+        EXPECT_EQ(expected.vrf_proof().gamma, actual.vrf_proof().gamma);
+        EXPECT_EQ(expected.vrf_proof().c, actual.vrf_proof().c);
+        EXPECT_EQ(expected.vrf_proof().s, actual.vrf_proof().s);
+        EXPECT_EQ(expected.randomness(), actual.randomness());
+    };
+
+    for (LabelType label_type : { LabelType::VRFLabels, LabelType::HashedLabels }) {
+        // A single worker makes any task that waits for another task on the pool deadlock
+        auto thread_pool = make_shared<ThreadPool>(1);
+        OZKSConfig config(
+            PayloadCommitmentType::CommitedPayload,
+            label_type,
+            TrieType::Stored,
+            make_shared<MemoryStorage>(),
+            {},
+            /* vrf_cache_size */ 20,
+            /* thread_count */ 0,
+            thread_pool);
+        OZKS ozks(config);
+
+        // Members and non-members, in more than one chunk
+        vector<key_type> keys;
+        for (size_t i = 0; i < 50; i++) {
+            keys.push_back(make_bytes<key_type>(i, i >> 8, 0x01));
+            if (i < 40) {
+                ozks.insert(keys.back(), make_bytes<payload_type>(i, 0x02, 0x03));
+            }
+        }
+        ozks.flush();
+        Commitment commitment = ozks.get_commitment();
+
+        vector<QueryResult> async_results = ozks.query_async(keys).get();
+        ASSERT_EQ(keys.size(), async_results.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            QueryResult query_result = ozks.query(keys[i]);
+            EXPECT_EQ(i < 40, query_result.is_member());
+            expect_same_result(query_result, async_results[i]);
+            expect_same_result(query_result, ozks.query_async(keys[i]).get());
+            EXPECT_TRUE(async_results[i].verify(commitment));
+        }
+
+        EXPECT_TRUE(ozks.query_async(vector<key_type>{}).get().empty());
+
+        // Queries can be started from a task on the pool without blocking it
+        auto worker_results =
+            thread_pool->enqueue([&ozks, &keys]() { return ozks.query_async(keys); });
+        async_results = worker_results.get().get();
+        ASSERT_EQ(keys.size(), async_results.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            expect_same_result(ozks.query(keys[i]), async_results[i]);
+        }
+    }
+}
+
+TEST(OZKSTests, QueryAsyncCacheMissTest)
+{
+    OZKSConfig config(
+        PayloadCommitmentType::CommitedPayload,
+        LabelType::VRFLabels,
+        TrieType::Stored,
+        make_shared<MemoryStorage>(),
+        {},
+        /* vrf_cache_size */ 100,
+        /* thread_count */ 0,
+        make_shared<ThreadPool>(4));
+    OZKS ozks(config);
+
+    vector<key_type> keys;
+    for (size_t i = 0; i < 50; i++) {
+        keys.push_back(make_bytes<key_type>(i, i >> 8, 0x04));
+        if (i < 40) {
+            ozks.insert(keys.back(), make_bytes<payload_type>(i, 0x05, 0x06));
+        }
+    }
+    ozks.flush();
+    Commitment commitment = ozks.get_commitment();
+    VRFPublicKey pk = ozks.get_vrf_public_key();
+
+    // None of the proofs is cached, so every lookup runs with the VRF value while the proofs
+    // are computed on the side
+    ozks.get_vrf_cache().clear();
+    vector<QueryResult> async_results = ozks.query_async(keys).get();
+    EXPECT_EQ(0, ozks.get_vrf_cache().cache_hits());
+    EXPECT_EQ(keys.size(), ozks.get_vrf_cache().cache_misses());
+    EXPECT_EQ(keys.size(), ozks.get_vrf_cache().size());
+
+    ASSERT_EQ(keys.size(), async_results.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(i < 40, async_results[i].is_member());
+        EXPECT_EQ(keys[i], async_results[i].key());
+        if (i < 40) {
+            EXPECT_EQ(make_bytes<payload_type>(i, 0x05, 0x06), async_results[i].payload());
+        }
+        EXPECT_TRUE(pk.verify_vrf_proof(keys[i], async_results[i].vrf_proof()));
+        EXPECT_TRUE(async_results[i].verify(commitment));
+
+        QueryResult query_result = ozks.query(keys[i]);
+        EXPECT_EQ(query_result.lookup_proof(), async_results[i].lookup_proof());
+        EXPECT_EQ(query_result.vrf_proof().gamma, async_results[i].vrf_proof().gamma);
+        EXPECT_EQ(query_result.vrf_proof().c, async_results[i].vrf_proof().c);
+        EXPECT_EQ(query_result.vrf_proof().s, async_results[i].vrf_proof().s);
+    }
+
+    // Same for a single key
+    ozks.get_vrf_cache().clear();
+    QueryResult async_result = ozks.query_async(keys[0]).get();
+    EXPECT_EQ(1, ozks.get_vrf_cache().cache_misses());
+    EXPECT_TRUE(async_result.is_member());
+    EXPECT_TRUE(pk.verify_vrf_proof(keys[0], async_result.vrf_proof()));
+    EXPECT_TRUE(async_result.verify(commitment));
+    EXPECT_EQ(ozks.query(keys[0]).lookup_proof(), async_result.lookup_proof());
+}
+
 TEST(OZKSTests, FailedQueryTest)
 {
     key_payload_batch_type label_payload_batch{
@@ -911,20 +1187,26 @@ TEST(OZKSTests, RandomInsertVerificationCacheTest)
 {
     shared_ptr<ozks::storage::Storage> backing_storage =
         make_shared<ozks::storage::MemoryStorage>();
-    shared_ptr<ozks::storage::Storage> storage = make_shared<ozks::storage::MemoryStorageCache>(
-        backing_storage, /* cache_size */ random_iterations);
+    auto storage = make_shared<ozks::storage::MemoryStorageCache>(
+        backing_storage,
+        ozks::storage::CacheBytes(
+            random_iterations * ozks::storage::MemoryStorageCache::NodeCharge()));
 
     RandomInsertTestCore(storage, random_iterations);
+    EXPECT_LT(0, storage->eviction_count());
 }
 
 TEST(OZKSTests, RandomInsertVerificationSmallerCacheTest)
 {
     shared_ptr<ozks::storage::Storage> backing_storage =
         make_shared<ozks::storage::MemoryStorage>();
-    shared_ptr<ozks::storage::Storage> storage = make_shared<ozks::storage::MemoryStorageCache>(
-        backing_storage, /* cache_size */ random_iterations / 4);
+    auto storage = make_shared<ozks::storage::MemoryStorageCache>(
+        backing_storage,
+        ozks::storage::CacheBytes(
+            random_iterations / 4 * ozks::storage::MemoryStorageCache::NodeCharge()));
 
     RandomInsertTestCore(storage, random_iterations);
+    EXPECT_LT(0, storage->eviction_count());
 }
 
 TEST(OZKSTests, RandomInsertVerificationBatchInserterTest)
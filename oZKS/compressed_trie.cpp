@@ -4,9 +4,11 @@
 // STD
 #include <algorithm>
 #include <cstring>
+#include <deque>
 #include <memory>
 #include <stdexcept>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 
 // OZKS
@@ -24,16 +26,26 @@ using namespace ozks;
 using namespace ozks::storage;
 using namespace ozks::utils;
 
-CompressedTrie::CompressedTrie(shared_ptr<Storage> storage, TrieType trie_type, size_t thread_count)
-    : epoch_(0), storage_(storage), thread_count_(thread_count), trie_type_(trie_type)
+CompressedTrie::CompressedTrie(
+    shared_ptr<Storage> storage,
+    TrieType trie_type,
+    size_t thread_count,
+    shared_ptr<ThreadPool> thread_pool)
+    : epoch_(0), storage_(storage), thread_count_(thread_count), thread_pool_(thread_pool),
+      trie_type_(trie_type)
 {
     init_random_id();
     init_empty_root();
 }
 
 CompressedTrie::CompressedTrie(
-    trie_id_type trie_id, shared_ptr<Storage> storage, TrieType trie_type, size_t thread_count)
-    : epoch_(0), id_(trie_id), storage_(storage), thread_count_(thread_count), trie_type_(trie_type)
+    trie_id_type trie_id,
+    shared_ptr<Storage> storage,
+    TrieType trie_type,
+    size_t thread_count,
+    shared_ptr<ThreadPool> thread_pool)
+    : epoch_(0), id_(trie_id), storage_(storage), thread_count_(thread_count),
+      thread_pool_(thread_pool), trie_type_(trie_type)
 {
     init_empty_root();
 }
@@ -72,7 +84,7 @@ void CompressedTrie::insert(
     }
 
     size_t bit_count = utils::get_log2(thread_count);
-    ThreadPool tp(thread_count);
+    shared_ptr<ThreadPool> tp = thread_pool();
     vector<vector<pair<const PartialLabel &, const hash_type &>>> batches(thread_count);
 
     append_proofs.resize(label_commit_batch.size());
@@ -90,51 +102,40 @@ void CompressedTrie::insert(
 
     vector<unordered_map<PartialLabel, shared_ptr<CTNode>>> updated_nodes(thread_count);
 
-    auto insertion_lambda = [&batches, &updated_nodes, this](size_t i) {
-        for (size_t bi = 0; bi < batches[i].size(); bi++) {
-            unordered_map<PartialLabel, shared_ptr<CTNode>> *updated_nodes_ptr = nullptr;
-            if (this->storage() != nullptr) {
-                // Only save updated nodes if they are actually going to be saved to storage
-                updated_nodes_ptr = &updated_nodes[i];
+    auto insertion_lambda = [&batches, &updated_nodes, this](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            for (size_t bi = 0; bi < batches[i].size(); bi++) {
+                unordered_map<PartialLabel, shared_ptr<CTNode>> *updated_nodes_ptr = nullptr;
+                if (this->storage() != nullptr) {
+                    // Only save updated nodes if they are actually going to be saved to storage
+                    updated_nodes_ptr = &updated_nodes[i];
+                }
+
+                pair<PartialLabel, hash_type> entry = batches[i][bi];
+                root_->insert(entry.first, entry.second, epoch_, updated_nodes_ptr);
             }
-
-            pair<PartialLabel, hash_type> entry = batches[i][bi];
-            root_->insert(entry.first, entry.second, epoch_, updated_nodes_ptr);
         }
     };
 
-    // Perform node insertion
-    vector<future<void>> insert_results(batches.size());
-    for (size_t idx = 0; idx < batches.size(); idx++) {
-        insert_results[idx] = tp.enqueue(insertion_lambda, idx);
-    }
+    // Perform node insertion. Each batch covers a separate subtree, so a batch is one chunk.
+    tp->parallel_for(0, batches.size(), 1, insertion_lambda);
 
-    // Wait until insertion is done
-    for (auto &ins_result : insert_results) {
-        ins_result.get();
-    }
+    auto hash_update_lambda = [&batches, &bit_count, &updated_nodes, this](
+                                  size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            for (auto &entry : batches[i]) {
+                unordered_map<PartialLabel, shared_ptr<CTNode>> *updated_nodes_ptr = nullptr;
+                if (this->storage() != nullptr) {
+                    updated_nodes_ptr = &updated_nodes[i];
+                }
 
-    auto hash_update_lambda = [&batches, &bit_count, &updated_nodes, this](size_t i) {
-        for (auto &entry : batches[i]) {
-            unordered_map<PartialLabel, shared_ptr<CTNode>> *updated_nodes_ptr = nullptr;
-            if (this->storage() != nullptr) {
-                updated_nodes_ptr = &updated_nodes[i];
+                root_->update_hashes(entry.first, bit_count + 1, updated_nodes_ptr);
             }
-
-            root_->update_hashes(entry.first, bit_count + 1, updated_nodes_ptr);
         }
     };
 
     // Update node hashes
-    vector<future<void>> update_hashes_results(batches.size());
-    for (size_t idx = 0; idx < batches.size(); idx++) {
-        update_hashes_results[idx] = tp.enqueue(hash_update_lambda, idx);
-    }
-
-    // Wait until hash computation is done
-    for (auto &hash_result : update_hashes_results) {
-        hash_result.get();
-    }
+    tp->parallel_for(0, batches.size(), 1, hash_update_lambda);
 
     // Now we need to update the top level hashes. Gather top leaves to update.
     vector<CTNode *> nodes_to_compute;
@@ -192,33 +193,19 @@ void CompressedTrie::insert(
         }
     }
 
-    // To get the append proof we need to lookup the items we just inserted
-    auto lookup_lambda = [&append_proofs, &label_commit_batch, this](size_t i, size_t stride) {
-        for (size_t idx = i; idx < append_proofs.size(); idx += stride) {
-            PartialLabel label = label_commit_batch[idx].first;
-            append_proof_type append_proof;
-
-            if (!lookup(label, append_proof, /* include_searched */ true)) {
-                append_proofs[idx] = std::move(append_proof);
-                return pair<bool, PartialLabel>(false, label);
+    // To get the append proof we need to lookup the items we just inserted. The lookups are
+    // independent, so they are split into small chunks that balance well across the workers.
+    constexpr size_t lookup_grain_size = 32;
+    auto lookup_lambda = [&append_proofs, &label_commit_batch, this](size_t begin, size_t end) {
+        for (size_t idx = begin; idx < end; idx++) {
+            const PartialLabel &label = label_commit_batch[idx].first;
+            if (!lookup(label, append_proofs[idx], /* include_searched */ true)) {
+                throw runtime_error("Should have been able to find the item we just inserted");
             }
-
-            append_proofs[idx] = std::move(append_proof);
         }
-
-        return pair<bool, PartialLabel>(true, {});
     };
 
-    vector<future<pair<bool, PartialLabel>>> lookup_results(thread_count);
-    for (size_t idx = 0; idx < thread_count; idx++) {
-        lookup_results[idx] = tp.enqueue(lookup_lambda, idx, thread_count);
-    }
-
-    for (auto &lookup_result : lookup_results) {
-        if (!lookup_result.get().first) {
-            throw runtime_error("Should have been able to find the item we just inserted");
-        }
-    }
+    tp->parallel_for(0, append_proofs.size(), lookup_grain_size, lookup_lambda);
 
     save_to_storage();
 }
@@ -233,9 +220,126 @@ bool CompressedTrie::lookup(
 {
     path.clear();
     root_->init(this);
+    if (TrieType::Stored == trie_type_ && nullptr != storage_) {
+        return lookup_stored(label, path, include_searched);
+    }
+
     return CTNode::lookup(label, root_, path, include_searched);
 }
 
+bool CompressedTrie::lookup_stored(
+    const PartialLabel &label, lookup_path_type &path, bool include_searched) const
+{
+    vector<CTNodeStored> path_nodes;
+    storage_->load_path(id_, label, storage_, path_nodes);
+
+    unordered_map<PartialLabel, const CTNodeStored *> loaded_nodes;
+    for (const auto &node : path_nodes) {
+        loaded_nodes.emplace(node.label(), &node);
+    }
+
+    // Nodes that load_path did not return are loaded one at a time
+    deque<CTNodeStored> extra_nodes;
+    auto get_node = [&](const PartialLabel &node_label) -> const CTNodeStored * {
+        if (node_label.empty()) {
+            return nullptr;
+        }
+
+        auto loaded_node = loaded_nodes.find(node_label);
+        if (loaded_node != loaded_nodes.end()) {
+            return loaded_node->second;
+        }
+
+        CTNodeStored node;
+        if (!storage_->load_ctnode(id_, node_label, storage_, node)) {
+            return nullptr;
+        }
+        extra_nodes.push_back(std::move(node));
+        loaded_nodes.emplace(node_label, &extra_nodes.back());
+        return &extra_nodes.back();
+    };
+
+    // Same walk as CTNode::lookup. The root is taken from memory, as it is always up to date.
+    const CTNodeStored *current = static_cast<const CTNodeStored *>(root_.get());
+    const CTNodeStored *sibling = nullptr;
+    bool sibling_is_left = false;
+    bool found = false;
+    vector<const CTNodeStored *> lookup_path;
+
+    while (nullptr != current) {
+        if (current->get_dirty_bit()) {
+            throw runtime_error("Cannot perform lookup with a dirty node - current");
+        }
+
+        if (current->label() == label) {
+            if (include_searched) {
+                // This node is the result
+                lookup_path.push_back(current);
+            }
+
+            found = true;
+            break;
+        }
+
+        if (current->is_leaf()) {
+            // Not found. Need to include non-existence proof in result.
+            if (sibling_is_left) {
+                lookup_path.push_back(current);
+            } else {
+                // When sibling is right we need to insert at n-1
+                auto position = lookup_path.begin();
+                if (lookup_path.size() > 0) {
+                    position = lookup_path.end() - 1;
+                }
+
+                lookup_path.insert(position, current);
+            }
+            break;
+        }
+
+        uint32_t common_count = PartialLabel::CommonPrefixCount(label, current->label());
+        bool next_bit = label[common_count];
+
+        const CTNodeStored *left_node = get_node(current->left_label());
+        const CTNodeStored *right_node = get_node(current->right_label());
+
+        // If there is a route to follow, follow it
+        if (next_bit == 1) {
+            current = right_node;
+            sibling = left_node;
+            sibling_is_left = true;
+        } else {
+            current = left_node;
+            sibling = right_node;
+            sibling_is_left = false;
+        }
+
+        if (nullptr != sibling) {
+            if (sibling->get_dirty_bit()) {
+                throw runtime_error("Cannot perform lookup with a dirty node - sibling");
+            }
+            // Add sibling to the path
+            lookup_path.push_back(sibling);
+        }
+    }
+
+    // Lookup path is in reverse order
+    path.reserve(lookup_path.size());
+    for (auto it = lookup_path.rbegin(); it != lookup_path.rend(); it++) {
+        path.push_back({ (*it)->label(), (*it)->hash() });
+    }
+
+    return found;
+}
+
+shared_ptr<ThreadPool> CompressedTrie::thread_pool() const
+{
+    if (nullptr != thread_pool_) {
+        return thread_pool_;
+    }
+    return ThreadPool::Shared();
+}
+
 string CompressedTrie::to_string() const
 {
     return root_->to_string();
@@ -18,6 +18,10 @@ namespace ozks {
         class Storage;
     }
 
+    class ThreadPool;
+
+    class TrieImage;
+
     using partial_label_hash_batch_type = std::vector<std::pair<PartialLabel, hash_type>>;
 
     class CompressedTrie {
@@ -28,7 +32,8 @@ namespace ozks {
         CompressedTrie(
             std::shared_ptr<ozks::storage::Storage> storage,
             TrieType trie_type,
-            std::size_t thread_count = 0);
+            std::size_t thread_count = 0,
+            std::shared_ptr<ThreadPool> thread_pool = nullptr);
 
         /**
         Constructor
@@ -37,7 +42,8 @@ namespace ozks {
             trie_id_type trie_id,
             std::shared_ptr<ozks::storage::Storage> storage,
             TrieType trie_type,
-            std::size_t thread_count = 0);
+            std::size_t thread_count = 0,
+            std::shared_ptr<ThreadPool> thread_pool = nullptr);
 
         /**
         Constructor
@@ -108,6 +114,20 @@ namespace ozks {
             return trie_type_;
         }
 
+        /**
+        Get the thread pool used for batch insertion. If none was given, the process-wide
+        ThreadPool::Shared() pool is used.
+        */
+        std::shared_ptr<ThreadPool> thread_pool() const;
+
+        /**
+        Set the thread pool used for batch insertion
+        */
+        void set_thread_pool(std::shared_ptr<ThreadPool> thread_pool)
+        {
+            thread_pool_ = thread_pool;
+        }
+
         /**
         Return a string representation of the tree
         */
@@ -176,10 +196,18 @@ namespace ozks {
         trie_id_type id_;
         std::shared_ptr<ozks::storage::Storage> storage_;
         std::size_t thread_count_;
+        std::shared_ptr<ThreadPool> thread_pool_;
         TrieType trie_type_;
 
         bool lookup(const PartialLabel &label, lookup_path_type &path, bool include_searched) const;
 
+        /**
+        Lookup in a stored trie. The nodes on the path are fetched from storage with a single
+        call to load_path instead of one load per node.
+        */
+        bool lookup_stored(
+            const PartialLabel &label, lookup_path_type &path, bool include_searched) const;
+
         void init_random_id();
 
         void init(std::shared_ptr<CTNode> root);
@@ -188,5 +216,7 @@ namespace ozks {
         std::size_t save(SerializationWriter &writer) const;
         static std::pair<std::shared_ptr<CompressedTrie>, std::size_t> Load(
             SerializationReader &reader, std::shared_ptr<storage::Storage> storage);
+
+        friend class TrieImage;
     };
 } // namespace ozks
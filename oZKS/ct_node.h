@@ -173,6 +173,7 @@ namespace ozks {
             return false;
         }
 
+        friend class CompressedTrie;
         friend class ::Utilities_InsertionThreadLimitTest_Test;
 
     private:
@@ -11,6 +11,131 @@
 using namespace std;
 using namespace ozks;
 
+namespace {
+    constexpr uint8_t compact_left_flag = 0x01;
+    constexpr uint8_t compact_right_flag = 0x02;
+
+    constexpr size_t label_word_count = PartialLabel::ByteCount / sizeof(uint64_t);
+
+    size_t varint_size(uint32_t value)
+    {
+        size_t size = 1;
+        for (; value >= 0x80; value >>= 7) {
+            size++;
+        }
+        return size;
+    }
+
+    size_t write_varint(gsl::span<byte> buffer, size_t position, uint32_t value)
+    {
+        for (; value >= 0x80; value >>= 7) {
+            buffer[position++] = static_cast<byte>((value & 0x7F) | 0x80);
+        }
+        buffer[position++] = static_cast<byte>(value);
+        return position;
+    }
+
+    uint32_t read_varint(gsl::span<const byte> buffer, size_t &position)
+    {
+        // Bit counts never need more than two bytes
+        uint32_t value = 0;
+        for (uint32_t shift = 0; shift < 14; shift += 7) {
+            if (position >= buffer.size()) {
+                break;
+            }
+
+            uint8_t b = static_cast<uint8_t>(buffer[position++]);
+            value |= static_cast<uint32_t>(b & 0x7F) << shift;
+            if (0 == (b & 0x80)) {
+                return value;
+            }
+        }
+
+        throw runtime_error("Failed to load CTNode: invalid buffer");
+    }
+
+    /**
+    Write the bits of the label that come after the given bit offset, high-order bit first
+    */
+    size_t write_label_bits(
+        gsl::span<byte> buffer, size_t position, const PartialLabel &label, uint32_t offset)
+    {
+        uint32_t count = label.bit_count() - offset;
+        size_t word_shift = offset / 64;
+        uint32_t bit_shift = offset % 64;
+        array<uint64_t, label_word_count> shifted{};
+        for (size_t idx = 0; idx + word_shift < label_word_count; idx++) {
+            shifted[idx] = label.data()[idx + word_shift] << bit_shift;
+            if (0 != bit_shift && idx + word_shift + 1 < label_word_count) {
+                shifted[idx] |= label.data()[idx + word_shift + 1] >> (64 - bit_shift);
+            }
+        }
+
+        size_t byte_count = (count + 7) / 8;
+        for (size_t idx = 0; idx < byte_count; idx++) {
+            buffer[position + idx] = static_cast<byte>(shifted[idx / 8] >> (56 - 8 * (idx % 8)));
+        }
+        if (0 != count % 8) {
+            buffer[position + byte_count - 1] &= static_cast<byte>(0xFF << (8 - count % 8));
+        }
+
+        return position + byte_count;
+    }
+
+    /**
+    Read the given number of bits written by write_label_bits and append them to the first bits
+    of the base label
+    */
+    PartialLabel read_label_bits(
+        gsl::span<const byte> buffer,
+        size_t &position,
+        const PartialLabel &base,
+        uint32_t offset,
+        uint32_t count)
+    {
+        size_t byte_count = (count + 7) / 8;
+        if (static_cast<size_t>(offset) + count > PartialLabel::MaxBitCount ||
+            byte_count > buffer.size() - position) {
+            throw runtime_error("Failed to load CTNode: invalid buffer");
+        }
+
+        array<uint64_t, label_word_count> bits{};
+        for (size_t idx = 0; idx < byte_count; idx++) {
+            bits[idx / 8] |= static_cast<uint64_t>(buffer[position + idx]) << (56 - 8 * (idx % 8));
+        }
+        position += byte_count;
+
+        // Shift the bits into place and add the bits of the base label before them
+        size_t word_shift = offset / 64;
+        uint32_t bit_shift = offset % 64;
+        array<byte, PartialLabel::ByteCount> label_bytes{};
+        for (size_t idx = 0; idx < label_word_count; idx++) {
+            uint64_t word = 0;
+            if (idx >= word_shift) {
+                word = bits[idx - word_shift] >> bit_shift;
+                if (0 != bit_shift && idx > word_shift) {
+                    word |= bits[idx - word_shift - 1] << (64 - bit_shift);
+                }
+            }
+
+            size_t prefix_bits = std::min<size_t>(
+                64, static_cast<size_t>(offset) - std::min<size_t>(offset, idx * 64));
+            if (64 == prefix_bits) {
+                word = base.data()[idx];
+            } else if (0 != prefix_bits) {
+                word |= base.data()[idx] & ~(~uint64_t(0) >> prefix_bits);
+            }
+
+            for (size_t b = 0; b < sizeof(uint64_t); b++) {
+                label_bytes[idx * 8 + b] = static_cast<byte>(word >> (56 - 8 * b));
+            }
+        }
+
+        uint32_t bit_count = offset + count;
+        return 0 == bit_count ? PartialLabel() : PartialLabel(label_bytes, bit_count);
+    }
+} // namespace
+
 bool CTNodeStored::is_leaf() const
 {
     return left_.empty() && right_.empty();
@@ -269,6 +394,115 @@ tuple<CTNodeStored, PartialLabel, PartialLabel, size_t> CTNodeStored::Load(
     return Load(reader, trie);
 }
 
+size_t CTNodeStored::compact_save_size() const
+{
+    size_t size = 2 + varint_size(label().bit_count()) + (label().bit_count() + 7) / 8 + hash_size;
+    for (const auto *child : { &left_, &right_ }) {
+        if (!child->empty()) {
+            uint32_t prefix = PartialLabel::CommonPrefixCount(label(), *child);
+            uint32_t suffix = child->bit_count() - prefix;
+            size += varint_size(label().bit_count() - prefix) + varint_size(suffix) +
+                    (suffix + 7) / 8;
+        }
+    }
+
+    return size;
+}
+
+size_t CTNodeStored::save_compact(gsl::span<byte> buffer) const
+{
+    if (buffer.size() < compact_save_size()) {
+        throw invalid_argument("Buffer is too small to save CTNode");
+    }
+
+    uint8_t flags = (left_.empty() ? 0 : compact_left_flag) |
+                    (right_.empty() ? 0 : compact_right_flag);
+    buffer[0] = static_cast<byte>(CompactVersion);
+    buffer[1] = static_cast<byte>(flags);
+
+    size_t position = write_varint(buffer, 2, label().bit_count());
+    position = write_label_bits(buffer, position, label(), 0);
+    utils::copy_bytes(hash_.data(), hash_size, buffer.data() + position);
+    position += hash_size;
+
+    // A child extends the label of its parent, so only the bits after the common prefix are
+    // written, together with how many bits of the parent label are not part of the prefix
+    for (const auto *child : { &left_, &right_ }) {
+        if (!child->empty()) {
+            uint32_t prefix = PartialLabel::CommonPrefixCount(label(), *child);
+            position = write_varint(buffer, position, label().bit_count() - prefix);
+            position = write_varint(buffer, position, child->bit_count() - prefix);
+            position = write_label_bits(buffer, position, *child, prefix);
+        }
+    }
+
+    return position;
+}
+
+size_t CTNodeStored::LoadCompact(
+    gsl::span<const byte> buffer, CTNodeStored &node, const CompressedTrie *trie)
+{
+    if (buffer.size() < 2 || static_cast<uint8_t>(buffer[0]) != CompactVersion) {
+        throw runtime_error("Failed to load CTNode: unsupported version");
+    }
+
+    uint8_t flags = static_cast<uint8_t>(buffer[1]);
+    if (0 != (flags & ~(compact_left_flag | compact_right_flag))) {
+        throw runtime_error("Failed to load CTNode: invalid buffer");
+    }
+
+    size_t position = 2;
+    uint32_t bit_count = read_varint(buffer, position);
+    PartialLabel label = read_label_bits(buffer, position, {}, 0, bit_count);
+
+    if (hash_size > buffer.size() - position) {
+        throw runtime_error("Failed to load CTNode: invalid buffer");
+    }
+    hash_type hash{};
+    utils::copy_bytes(buffer.data() + position, hash_size, hash.data());
+    position += hash_size;
+
+    auto read_child = [&](uint8_t flag) {
+        if (0 == (flags & flag)) {
+            return PartialLabel();
+        }
+
+        uint32_t dropped = read_varint(buffer, position);
+        uint32_t suffix = read_varint(buffer, position);
+        if (dropped > label.bit_count()) {
+            throw runtime_error("Failed to load CTNode: invalid buffer");
+        }
+        return read_label_bits(buffer, position, label, label.bit_count() - dropped, suffix);
+    };
+
+    PartialLabel left = read_child(compact_left_flag);
+    PartialLabel right = read_child(compact_right_flag);
+
+    node.init(label, hash);
+    node.init(trie);
+    node.left_ = left;
+    node.right_ = right;
+
+    return position;
+}
+
+bool CTNodeStored::IsCompact(gsl::span<const byte> buffer)
+{
+    // A buffer written by save starts with the size of the rest of the buffer as a 32-bit
+    // integer. A compact buffer starts with the version followed by the flags, so read as an
+    // integer its first four bytes are either at least 256 or too small to be its size.
+    if (buffer.empty() || static_cast<uint8_t>(buffer[0]) != CompactVersion) {
+        return false;
+    }
+    if (buffer.size() < sizeof(uint32_t)) {
+        return true;
+    }
+
+    uint32_t size_prefix = 0;
+    utils::copy_bytes(buffer.data(), sizeof(uint32_t), &size_prefix);
+    return size_prefix != buffer.size() - sizeof(uint32_t);
+}
+
 void CTNodeStored::save_to_storage(
     unordered_map<PartialLabel, shared_ptr<CTNode>> * /* updated_nodes */)
 {
@@ -4,10 +4,15 @@
 #pragma once
 
 // STL
+#include <cstddef>
+#include <cstdint>
 
 // OZKS
 #include "oZKS/ct_node.h"
 
+// GSL
+#include "gsl/span"
+
 class CTNodeTests_StoredSaveLoadTest_Test;
 class CTNodeTests_StoredSaveLoadToVectorTest_Test;
 
@@ -128,6 +133,44 @@ namespace ozks {
             const std::vector<T> &vec, const CompressedTrie *trie, std::size_t position = 0)
             -> std::tuple<CTNodeStored, PartialLabel, PartialLabel, std::size_t>;
 
+        /**
+        Version of the compact format written by save_compact
+        */
+        constexpr static std::uint8_t CompactVersion = 1;
+
+        /**
+        Maximum number of bytes save_compact writes for a node
+        */
+        constexpr static std::size_t CompactMaxSaveSize =
+            2 + (2 + PartialLabel::ByteCount) + hash_size + 2 * (4 + PartialLabel::ByteCount);
+
+        /**
+        Get the number of bytes save_compact writes for this node
+        */
+        std::size_t compact_save_size() const;
+
+        /**
+        Save this node to the given buffer in the compact format, which is much smaller than the
+        format written by save. Labels are written with only as many bytes as their bit count
+        needs, and the labels of the children are written as the bits they add to the label of
+        this node. Nothing is allocated. Returns the number of bytes written.
+        */
+        std::size_t save_compact(gsl::span<std::byte> buffer) const;
+
+        /**
+        Load a node saved with save_compact from the given buffer. Nothing is allocated. Returns
+        the number of bytes read.
+        */
+        static std::size_t LoadCompact(
+            gsl::span<const std::byte> buffer,
+            CTNodeStored &node,
+            const CompressedTrie *trie = nullptr);
+
+        /**
+        Whether the given buffer holds a node saved with save_compact rather than with save
+        */
+        static bool IsCompact(gsl::span<const std::byte> buffer);
+
         /**
         Save a node to storage
          */
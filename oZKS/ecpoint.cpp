@@ -15,14 +15,79 @@ using namespace ozks;
 
 #ifdef OZKS_USE_OPENSSL_P256
 
+// EC_GROUP_precompute_mult is deprecated in OpenSSL 3.0 but remains the only way to request a
+// generator table for EC_GROUP implementations that do not include one
+#define OPENSSL_SUPPRESS_DEPRECATED
+
 #include <memory>
+#include <openssl/crypto.h>
 #include <openssl/ec.h>
 #include <openssl/obj_mac.h>
 
 namespace {
+    class BN_CTX_guard {
+    public:
+        BN_CTX_guard()
+        {
+            bn_ctx_ = BN_CTX_secure_new();
+            if (!bn_ctx_) {
+                throw runtime_error("Failed to create BN_CTX");
+            }
+        }
+
+        ~BN_CTX_guard()
+        {
+            BN_CTX_free(bn_ctx_);
+            bn_ctx_ = nullptr;
+        }
+
+        BN_CTX *get()
+        {
+            return bn_ctx_;
+        }
+
+        const BN_CTX *get() const
+        {
+            return bn_ctx_;
+        }
+
+        BN_CTX *release()
+        {
+            BN_CTX *ret = bn_ctx_;
+            bn_ctx_ = nullptr;
+            return ret;
+        }
+
+    private:
+        BN_CTX *bn_ctx_;
+    };
+
+    /**
+    Returns a BN_CTX owned by the calling thread. OpenSSL allocates a new BN_CTX internally for
+    every call that is given a null context, so all arithmetic goes through this one instead.
+    */
+    BN_CTX *get_bn_ctx()
+    {
+        thread_local BN_CTX_guard bcg;
+        return bcg.get();
+    }
+
     struct EC_GROUP_wrapper {
         EC_GROUP_wrapper() : ec_group(EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1))
-        {}
+        {
+            if (!ec_group) {
+                throw runtime_error("Failed to create EC_GROUP");
+            }
+
+            // Precompute multiples of the generator; this speeds up MakeGeneratorMultiple and
+            // double_scalar_multiply unless the implementation already has a built-in table
+            if (!EC_GROUP_have_precompute_mult(ec_group)) {
+                BN_CTX_guard bcg;
+                if (1 != EC_GROUP_precompute_mult(ec_group, bcg.get())) {
+                    throw runtime_error("Call to EC_GROUP_precompute_mult failed");
+                }
+            }
+        }
 
         ~EC_GROUP_wrapper()
         {
@@ -38,184 +103,191 @@ namespace {
         return gw.ec_group;
     }
 
-    class BIGNUM_guard {
+    /**
+    Scoped access to temporary BIGNUMs from the thread-local BN_CTX. The BIGNUMs are returned to
+    the BN_CTX when the frame goes out of scope, so repeated operations reuse the same memory.
+    */
+    class BN_CTX_frame {
     public:
-        BIGNUM_guard()
+        BN_CTX_frame() : bn_ctx_(get_bn_ctx())
         {
-            bn_ = BN_secure_new();
-            if (!bn_) {
-                throw runtime_error("Failed to create BIGNUM");
-            }
+            BN_CTX_start(bn_ctx_);
         }
 
-        ~BIGNUM_guard()
+        ~BN_CTX_frame()
         {
-            BN_clear_free(bn_);
-            bn_ = nullptr;
+            BN_CTX_end(bn_ctx_);
         }
 
-        BIGNUM *get()
+        BN_CTX_frame(const BN_CTX_frame &) = delete;
+
+        BN_CTX_frame &operator=(const BN_CTX_frame &) = delete;
+
+        BN_CTX *ctx()
         {
-            return bn_;
+            return bn_ctx_;
         }
 
-        const BIGNUM *get() const
+        BIGNUM *get()
         {
-            return bn_;
+            BIGNUM *bn = BN_CTX_get(bn_ctx_);
+            if (!bn) {
+                throw runtime_error("Call to BN_CTX_get failed");
+            }
+            return bn;
         }
 
-        BIGNUM *release()
+        BIGNUM *get(const utils::P256Point::scalar_type &scalar)
         {
-            BIGNUM *ret = bn_;
-            bn_ = nullptr;
-            return ret;
+            BIGNUM *bn = get();
+            if (!BN_lebin2bn(
+                    reinterpret_cast<const unsigned char *>(scalar.data()),
+                    static_cast<int>(scalar.size()),
+                    bn)) {
+                throw runtime_error("Call to BN_lebin2bn failed");
+            }
+            return bn;
         }
 
     private:
-        BIGNUM *bn_;
+        BN_CTX *bn_ctx_;
     };
 
-    class BN_CTX_guard {
+    /**
+    A small per-thread pool of EC_POINT objects. Temporary points are created and destroyed
+    constantly in VRF computations; reusing them avoids going to the allocator each time.
+    */
+    class EC_POINT_pool {
     public:
-        BN_CTX_guard()
+        EC_POINT_pool()
         {
-            bn_ctx_ = BN_CTX_secure_new();
-            if (!bn_ctx_) {
-                throw runtime_error("Failed to create BN_CTX");
-            }
+            pool_.reserve(max_size);
         }
 
-        ~BN_CTX_guard()
+        ~EC_POINT_pool()
         {
-            BN_CTX_free(bn_ctx_);
-            bn_ctx_ = nullptr;
+            for (EC_POINT *pt : pool_) {
+                EC_POINT_clear_free(pt);
+            }
+            destroyed_ = true;
         }
 
-        BN_CTX *get()
+        static EC_POINT *Acquire()
         {
-            return bn_ctx_;
+            if (!destroyed_) {
+                vector<EC_POINT *> &pool = Get().pool_;
+                if (!pool.empty()) {
+                    EC_POINT *pt = pool.back();
+                    pool.pop_back();
+                    return pt;
+                }
+            }
+
+            EC_POINT *pt = EC_POINT_new(get_ec_group());
+            if (!pt) {
+                throw runtime_error("Failed to create EC_POINT");
+            }
+            return pt;
         }
 
-        const BN_CTX *get() const
+        static void Release(EC_POINT *pt)
         {
-            return bn_ctx_;
+            // Points released after the pool of this thread is gone (e.g., by static objects
+            // destroyed at exit) are freed directly
+            if (!destroyed_) {
+                vector<EC_POINT *> &pool = Get().pool_;
+                if (pool.size() < max_size) {
+                    pool.push_back(pt);
+                    return;
+                }
+            }
+            EC_POINT_clear_free(pt);
         }
 
-        BN_CTX *release()
+    private:
+        static EC_POINT_pool &Get()
         {
-            BN_CTX *ret = bn_ctx_;
-            bn_ctx_ = nullptr;
-            return ret;
+            thread_local EC_POINT_pool pool;
+            return pool;
         }
 
-    private:
-        BN_CTX *bn_ctx_;
+        static constexpr size_t max_size = 64;
+
+        static thread_local bool destroyed_;
+
+        vector<EC_POINT *> pool_;
     };
 
+    thread_local bool EC_POINT_pool::destroyed_ = false;
+
     template <typename T>
     void zero_span(T sp)
     {
         fill(sp.begin(), sp.end(), typename T::value_type{ 0 });
     }
 
-    void reduce_mod_group_order(BIGNUM *value)
+    void reduce_mod_group_order(BIGNUM *value, BN_CTX_frame &frame)
     {
         const BIGNUM *order = EC_GROUP_get0_order(get_ec_group());
 
-        // BN_mod requires an allocated BN_CTX
-        BN_CTX_guard bcg;
-        BIGNUM_guard bn_temp;
-        if (1 != BN_mod(bn_temp.get(), value, order, bcg.get())) {
-            throw runtime_error("Call to BN_mod failed");
+        BIGNUM *bn_temp = frame.get();
+        if (1 != BN_nnmod(bn_temp, value, order, frame.ctx())) {
+            throw runtime_error("Call to BN_nnmod failed");
         }
-        if (!BN_copy(value, bn_temp.get())) {
+        if (!BN_copy(value, bn_temp)) {
             throw runtime_error("Call to BN_copy failed");
         }
     }
 
+    void save_scalar(const BIGNUM *value, utils::P256Point::scalar_type &out)
+    {
+        int out_size = static_cast<int>(out.size());
+        if (out_size !=
+            BN_bn2lebinpad(value, reinterpret_cast<unsigned char *>(out.data()), out_size)) {
+            throw runtime_error("Call to BN_bn2lebinpad failed");
+        }
+    }
+
     void random_scalar(utils::P256Point::scalar_type &value)
     {
-        BIGNUM *value_bn = reinterpret_cast<BIGNUM *>(value.ptr());
+        BN_CTX_frame frame;
+        BIGNUM *value_bn = frame.get();
         int bit_count = 2 * 8 * static_cast<int>(value.size()) - 1;
         if (1 != BN_priv_rand_ex(
-                     value_bn, bit_count, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY, 256, nullptr)) {
+                     value_bn, bit_count, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY, 256, frame.ctx())) {
             throw runtime_error("Call to BN_priv_rand_ex failed");
         }
 
-        reduce_mod_group_order(value_bn);
+        reduce_mod_group_order(value_bn, frame);
+        save_scalar(value_bn, value);
     }
 
-    uint64_t is_nonzero_scalar(const utils::P256Point::scalar_type &value)
+    bool is_on_curve(const EC_POINT *pt, BN_CTX *ctx)
     {
-        return 1 != BN_is_zero(reinterpret_cast<const BIGNUM *>(value.ptr()));
+        int poc = EC_POINT_is_on_curve(get_ec_group(), pt, ctx);
+        if (-1 == poc) {
+            throw runtime_error("Call to EC_POINT_is_on_curve failed");
+        }
+        return 1 == poc;
     }
 } // namespace
 
-void utils::P256Point::scalar_type::clean_up()
-{
-    if (scalar_) {
-        BN_clear_free(reinterpret_cast<BIGNUM *>(scalar_));
-        scalar_ = nullptr;
-    }
-}
-
-utils::P256Point::scalar_type::scalar_type()
-{
-    scalar_ = BN_secure_new();
-    if (!scalar_) {
-        throw runtime_error("Failed to create BIGNUM");
-    }
-}
-
-utils::P256Point::scalar_type::scalar_type(void *scalar_ptr)
-{
-    if (scalar_ptr != scalar_) {
-        clean_up();
-        scalar_ = scalar_ptr;
-    }
-}
+utils::P256Point::scalar_type::scalar_type() : array<byte, order_size>{}
+{}
 
-utils::P256Point::scalar_type::scalar_type(scalar_span_const_type in) : scalar_type()
+utils::P256Point::scalar_type::scalar_type(scalar_span_const_type in)
 {
     load(in);
 }
 
 utils::P256Point::scalar_type::~scalar_type()
 {
-    clean_up();
-}
-
-auto utils::P256Point::scalar_type::operator=(const scalar_type &assign) -> scalar_type &
-{
-    BIGNUM *bn_this = reinterpret_cast<BIGNUM *>(scalar_);
-    const BIGNUM *bn_assign = reinterpret_cast<const BIGNUM *>(assign.scalar_);
-    if (&assign != this) {
-        if (!BN_copy(bn_this, bn_assign)) {
-            throw runtime_error("Call to BN_copy failed");
-        }
-    }
-    return *this;
-}
-
-auto utils::P256Point::scalar_type::scalar_type::operator=(scalar_type &&source) noexcept
-    -> scalar_type &
-{
-    if (&source != this) {
-        swap(scalar_, source.scalar_);
-    }
-    return *this;
-}
-
-bool utils::P256Point::scalar_type::scalar_type::operator==(const scalar_type &other) const
-{
-    BIGNUM *bn_this = reinterpret_cast<BIGNUM *>(scalar_);
-    const BIGNUM *bn_other = reinterpret_cast<const BIGNUM *>(other.scalar_);
-    return 0 == BN_cmp(bn_this, bn_other);
+    OPENSSL_cleanse(data(), size());
 }
 
-void utils::P256Point::scalar_type::scalar_type::set_zero()
+void utils::P256Point::scalar_type::set_zero()
 {
-    BN_zero_ex(reinterpret_cast<BIGNUM *>(scalar_));
+    fill(byte{ 0 });
 }
 
 template <typename T>
@@ -225,25 +297,8 @@ void utils::P256Point::scalar_type::scalar_type::set_byte(size_t index, T value)
         throw out_of_range("Byte index is out of range");
     }
 
-    // Read the current value into an array
-    array<byte, order_size> value_bytes;
-    if (order_size != BN_bn2lebinpad(
-                          reinterpret_cast<const BIGNUM *>(scalar_),
-                          reinterpret_cast<unsigned char *>(value_bytes.data()),
-                          order_size)) {
-        throw runtime_error("Call to BN_bn2lebinpad failed");
-    }
-
-    // Set the appropriate byte
-    value_bytes[index] = static_cast<byte>(value);
-
-    // Read back the bytes
-    if (!BN_lebin2bn(
-            reinterpret_cast<const unsigned char *>(value_bytes.data()),
-            order_size,
-            reinterpret_cast<BIGNUM *>(scalar_))) {
-        throw runtime_error("Call to BN_lebin2bn failed");
-    }
+    // Bytes are stored in little-endian order, just like in the serialized form
+    (*this)[index] = static_cast<byte>(value);
 }
 
 template void utils::P256Point::scalar_type::scalar_type::set_byte(size_t index, byte value);
@@ -261,48 +316,32 @@ template void utils::P256Point::scalar_type::scalar_type::set_byte(size_t index,
 
 bool utils::P256Point::scalar_type::is_zero() const
 {
-    return 1 == BN_is_zero(reinterpret_cast<const BIGNUM *>(scalar_));
+    return all_of(begin(), end(), [](byte b) { return b == byte{ 0 }; });
 }
 
 void utils::P256Point::scalar_type::load(scalar_span_const_type in)
 {
-    BIGNUM *bn_scalar = reinterpret_cast<BIGNUM *>(scalar_);
-
-    if (!BN_lebin2bn(
-            reinterpret_cast<const unsigned char *>(in.data()),
-            static_cast<int>(in.size()),
-            bn_scalar)) {
-        throw runtime_error("Call to BN_lebin2bn failed");
-    }
+    copy(in.begin(), in.end(), begin());
 }
 
 void utils::P256Point::scalar_type::save(scalar_span_type out) const
 {
-    if (order_size != BN_bn2lebinpad(
-                          reinterpret_cast<const BIGNUM *>(scalar_),
-                          reinterpret_cast<unsigned char *>(out.data()),
-                          order_size)) {
-        throw runtime_error("Call to BN_bn2lebinpad failed");
-    }
+    copy(begin(), end(), out.begin());
 }
 
 utils::P256Point::P256Point()
 {
-    EC_GROUP *group = get_ec_group();
-    EC_POINT *pt = EC_POINT_new(group);
-    if (!pt) {
-        throw runtime_error("Failed to create EC_POINT");
-    }
-    if (1 != EC_POINT_set_to_infinity(group, pt)) {
+    EC_POINT *pt = EC_POINT_pool::Acquire();
+    pt_ = pt;
+    if (1 != EC_POINT_set_to_infinity(get_ec_group(), pt)) {
         throw runtime_error("Call to EC_POINT_set_to_infinity failed");
     }
-    pt_ = pt;
 }
 
 void utils::P256Point::clean_up()
 {
     if (pt_) {
-        EC_POINT_clear_free(reinterpret_cast<EC_POINT *>(pt_));
+        EC_POINT_pool::Release(reinterpret_cast<EC_POINT *>(pt_));
         pt_ = nullptr;
     }
 }
@@ -366,7 +405,7 @@ utils::P256Point::P256Point(const hash_type &data, encode_to_curve_salt_type sal
             reinterpret_cast<EC_POINT *>(pt_),
             reinterpret_cast<const unsigned char *>(str_to_point_in.data()),
             save_size,
-            nullptr);
+            get_bn_ctx());
 
         ctr++;
     } while (1 != ret);
@@ -401,26 +440,23 @@ void utils::P256Point::MakeRandomNonzeroScalar(scalar_type &out)
     // Loop until we find a non-zero element
     do {
         random_scalar(out);
-    } while (!is_nonzero_scalar(out));
+    } while (out.is_zero());
 }
 
 void utils::P256Point::MakeSeededScalar(input_span_const_type seed, scalar_type &out)
 {
-    BIGNUM *out_bn = reinterpret_cast<BIGNUM *>(out.ptr());
     constexpr int byte_count = 2 * static_cast<int>(scalar_type::Size());
-    vector<unsigned char> buf(byte_count);
-    vector<byte> hash(byte_count);
+    array<byte, byte_count> hash;
     compute_hash(seed, "seeded_scalar", gsl::span<byte, byte_count>{ hash.data(), byte_count });
-    if (byte_count > hash.size()) {
-        throw logic_error("Output should be at least equal in size to hash");
-    }
 
-    copy_n(reinterpret_cast<const unsigned char *>(hash.data()), byte_count, buf.data());
-    if (!BN_bin2bn(buf.data(), byte_count, out_bn)) {
+    BN_CTX_frame frame;
+    BIGNUM *out_bn = frame.get();
+    if (!BN_bin2bn(reinterpret_cast<const unsigned char *>(hash.data()), byte_count, out_bn)) {
         throw logic_error("Unable to convert hash to bignum");
     }
 
-    reduce_mod_group_order(out_bn);
+    reduce_mod_group_order(out_bn, frame);
+    save_scalar(out_bn, out);
 }
 
 utils::P256Point utils::P256Point::MakeGenerator()
@@ -436,29 +472,43 @@ utils::P256Point utils::P256Point::MakeGenerator()
 utils::P256Point utils::P256Point::MakeGeneratorMultiple(const scalar_type &scalar)
 {
     P256Point result;
+    BN_CTX_frame frame;
     if (1 != EC_POINT_mul(
                  get_ec_group(),
                  reinterpret_cast<EC_POINT *>(result.pt_),
-                 reinterpret_cast<const BIGNUM *>(scalar.ptr()),
+                 frame.get(scalar),
                  nullptr,
                  nullptr,
-                 nullptr)) {
+                 frame.ctx())) {
         throw runtime_error("Call to EC_POINT_mul failed");
     }
 
     return result;
 }
 
+vector<utils::P256Point> utils::P256Point::MakeHashToCurveBatch(
+    gsl::span<const hash_type> data, encode_to_curve_salt_type salt)
+{
+    // The try-and-increment encoding does not benefit from batching
+    vector<P256Point> result;
+    result.reserve(data.size());
+    for (const auto &value : data) {
+        result.emplace_back(value, salt);
+    }
+
+    return result;
+}
+
 void utils::P256Point::InvertScalar(const scalar_type &in, scalar_type &out)
 {
     const BIGNUM *order = EC_GROUP_get0_order(get_ec_group());
-    if (!BN_mod_inverse(
-            reinterpret_cast<BIGNUM *>(out.ptr()),
-            reinterpret_cast<const BIGNUM *>(in.ptr()),
-            order,
-            nullptr)) {
+
+    BN_CTX_frame frame;
+    BIGNUM *out_bn = frame.get();
+    if (!BN_mod_inverse(out_bn, frame.get(in), order, frame.ctx())) {
         throw runtime_error("Call to BN_mod_inverse failed");
     }
+    save_scalar(out_bn, out);
 }
 
 void utils::P256Point::MultiplyScalar(
@@ -466,44 +516,25 @@ void utils::P256Point::MultiplyScalar(
 {
     const BIGNUM *order = EC_GROUP_get0_order(get_ec_group());
 
-    // BN_mod_mul requires an allocated BN_CTX
-    BN_CTX_guard bcg;
-    if (1 != BN_mod_mul(
-                 reinterpret_cast<BIGNUM *>(out.ptr()),
-                 reinterpret_cast<const BIGNUM *>(in1.ptr()),
-                 reinterpret_cast<const BIGNUM *>(in2.ptr()),
-                 order,
-                 bcg.get())) {
+    BN_CTX_frame frame;
+    BIGNUM *out_bn = frame.get();
+    if (1 != BN_mod_mul(out_bn, frame.get(in1), frame.get(in2), order, frame.ctx())) {
         throw runtime_error("Call to BN_mod_mul failed");
     }
+    save_scalar(out_bn, out);
 }
 
 void utils::P256Point::AddScalar(const scalar_type &in1, const scalar_type &in2, scalar_type &out)
 {
     const BIGNUM *order = EC_GROUP_get0_order(get_ec_group());
 
-    // We require that the output is different from inputs
-    if (out.ptr() == in1.ptr() || out.ptr() == in2.ptr()) {
-        BIGNUM_guard bn_temp;
-        if (1 != BN_mod_add_quick(
-                     reinterpret_cast<BIGNUM *>(bn_temp.get()),
-                     reinterpret_cast<const BIGNUM *>(in1.ptr()),
-                     reinterpret_cast<const BIGNUM *>(in2.ptr()),
-                     order)) {
-            throw runtime_error("Call to BN_mod_add_quick failed");
-        }
-        if (!BN_copy(reinterpret_cast<BIGNUM *>(out.ptr()), bn_temp.get())) {
-            throw runtime_error("Call to BN_copy failed");
-        }
-    } else {
-        if (1 != BN_mod_add_quick(
-                     reinterpret_cast<BIGNUM *>(out.ptr()),
-                     reinterpret_cast<const BIGNUM *>(in1.ptr()),
-                     reinterpret_cast<const BIGNUM *>(in2.ptr()),
-                     order)) {
-            throw runtime_error("Call to BN_mod_add_quick failed");
-        }
+    // The result is computed in a temporary, so the output may alias the inputs
+    BN_CTX_frame frame;
+    BIGNUM *out_bn = frame.get();
+    if (1 != BN_mod_add_quick(out_bn, frame.get(in1), frame.get(in2), order)) {
+        throw runtime_error("Call to BN_mod_add_quick failed");
     }
+    save_scalar(out_bn, out);
 }
 
 void utils::P256Point::SubtractScalar(
@@ -511,51 +542,35 @@ void utils::P256Point::SubtractScalar(
 {
     const BIGNUM *order = EC_GROUP_get0_order(get_ec_group());
 
-    // We require that the output is different from inputs
-    if (out.ptr() == in1.ptr() || out.ptr() == in2.ptr()) {
-        BIGNUM_guard bn_temp;
-        if (1 != BN_mod_sub_quick(
-                     reinterpret_cast<BIGNUM *>(bn_temp.get()),
-                     reinterpret_cast<const BIGNUM *>(in1.ptr()),
-                     reinterpret_cast<const BIGNUM *>(in2.ptr()),
-                     order)) {
-            throw runtime_error("Call to BN_mod_sub_quick failed");
-        }
-        if (!BN_copy(reinterpret_cast<BIGNUM *>(out.ptr()), bn_temp.get())) {
-            throw runtime_error("Call to BN_copy failed");
-        }
-    } else {
-        if (1 != BN_mod_sub_quick(
-                     reinterpret_cast<BIGNUM *>(out.ptr()),
-                     reinterpret_cast<const BIGNUM *>(in1.ptr()),
-                     reinterpret_cast<const BIGNUM *>(in2.ptr()),
-                     order)) {
-            throw runtime_error("Call to BN_mod_sub_quick failed");
-        }
+    // The result is computed in a temporary, so the output may alias the inputs
+    BN_CTX_frame frame;
+    BIGNUM *out_bn = frame.get();
+    if (1 != BN_mod_sub_quick(out_bn, frame.get(in1), frame.get(in2), order)) {
+        throw runtime_error("Call to BN_mod_sub_quick failed");
     }
+    save_scalar(out_bn, out);
 }
 
 void utils::P256Point::ReduceModOrder(scalar_type &scalar)
 {
-    reduce_mod_group_order(reinterpret_cast<BIGNUM *>(scalar.ptr()));
+    BN_CTX_frame frame;
+    BIGNUM *bn = frame.get(scalar);
+    reduce_mod_group_order(bn, frame);
+    save_scalar(bn, scalar);
 }
 
 void utils::P256Point::ReduceModOrder(hash_type &value)
 {
-    BIGNUM_guard bn;
-    if (!BN_lebin2bn(
-            reinterpret_cast<const unsigned char *>(value.data()),
-            hash_size,
-            reinterpret_cast<BIGNUM *>(bn.get()))) {
+    BN_CTX_frame frame;
+    BIGNUM *bn = frame.get();
+    if (!BN_lebin2bn(reinterpret_cast<const unsigned char *>(value.data()), hash_size, bn)) {
         throw runtime_error("Call to BN_lebin2bn failed");
     }
 
-    reduce_mod_group_order(reinterpret_cast<BIGNUM *>(bn.get()));
+    reduce_mod_group_order(bn, frame);
 
-    if (hash_size != BN_bn2lebinpad(
-                         reinterpret_cast<const BIGNUM *>(bn.get()),
-                         reinterpret_cast<unsigned char *>(value.data()),
-                         hash_size)) {
+    if (hash_size !=
+        BN_bn2lebinpad(bn, reinterpret_cast<unsigned char *>(value.data()), hash_size)) {
         throw runtime_error("Call to BN_bn2lebinpad failed");
     }
 }
@@ -563,49 +578,58 @@ void utils::P256Point::ReduceModOrder(hash_type &value)
 bool utils::P256Point::scalar_multiply(
     const scalar_type &scalar, bool clear_cofactor [[maybe_unused]])
 {
-    int poc = EC_POINT_is_on_curve(get_ec_group(), reinterpret_cast<EC_POINT *>(pt_), nullptr);
-    if (0 == poc) {
+    BN_CTX_frame frame;
+    if (!is_on_curve(reinterpret_cast<EC_POINT *>(pt_), frame.ctx())) {
         // If this point is not on curve, return false
         return false;
     }
-    if (1 != poc) {
-        throw runtime_error("Call to EC_POINT_is_on_curve failed");
-    }
 
     if (1 != EC_POINT_mul(
                  get_ec_group(),
                  reinterpret_cast<EC_POINT *>(pt_),
                  nullptr,
                  reinterpret_cast<const EC_POINT *>(pt_),
-                 reinterpret_cast<const BIGNUM *>(scalar.ptr()),
-                 nullptr)) {
+                 frame.get(scalar),
+                 frame.ctx())) {
         throw runtime_error("Call to EC_POINT_mul failed");
     }
 
     return true;
 }
 
+bool utils::P256Point::ScalarMultiplyBatch(
+    gsl::span<P256Point> points, gsl::span<const scalar_type> scalars, bool clear_cofactor)
+{
+    if (points.size() != scalars.size()) {
+        throw invalid_argument("Number of points and scalars must match");
+    }
+
+    bool result = true;
+    for (size_t i = 0; i < points.size(); i++) {
+        result = points[i].scalar_multiply(scalars[i], clear_cofactor) && result;
+    }
+
+    return result;
+}
+
 bool utils::P256Point::double_scalar_multiply(
     const scalar_type &scalar1, const scalar_type &scalar2)
 {
     // Computes scalar1*this + scalar2*generator
 
-    int poc = EC_POINT_is_on_curve(get_ec_group(), reinterpret_cast<EC_POINT *>(pt_), nullptr);
-    if (0 == poc) {
+    BN_CTX_frame frame;
+    if (!is_on_curve(reinterpret_cast<EC_POINT *>(pt_), frame.ctx())) {
         // If this point is not on curve, return false
         return false;
     }
-    if (1 != poc) {
-        throw runtime_error("Call to EC_POINT_is_on_curve failed");
-    }
 
     if (1 != EC_POINT_mul(
                  get_ec_group(),
                  reinterpret_cast<EC_POINT *>(pt_),
-                 reinterpret_cast<const BIGNUM *>(scalar2.ptr()),
+                 frame.get(scalar2),
                  reinterpret_cast<EC_POINT *>(pt_),
-                 reinterpret_cast<const BIGNUM *>(scalar1.ptr()),
-                 nullptr)) {
+                 frame.get(scalar1),
+                 frame.ctx())) {
         throw runtime_error("Call to EC_POINT_mul failed");
     }
 
@@ -614,12 +638,7 @@ bool utils::P256Point::double_scalar_multiply(
 
 bool utils::P256Point::in_prime_order_subgroup() const
 {
-    int poc = EC_POINT_is_on_curve(get_ec_group(), reinterpret_cast<EC_POINT *>(pt_), nullptr);
-    if (-1 == poc) {
-        throw runtime_error("Call to EC_POINT_is_on_curve failed");
-    }
-
-    return poc == 1;
+    return is_on_curve(reinterpret_cast<EC_POINT *>(pt_), get_bn_ctx());
 }
 
 void utils::P256Point::add(const P256Point &other)
@@ -629,7 +648,7 @@ void utils::P256Point::add(const P256Point &other)
                  reinterpret_cast<EC_POINT *>(pt_),
                  reinterpret_cast<EC_POINT *>(pt_),
                  reinterpret_cast<EC_POINT *>(other.pt_),
-                 nullptr)) {
+                 get_bn_ctx())) {
         throw runtime_error("Call to EC_POINT_add failed");
     }
 }
@@ -647,7 +666,7 @@ void utils::P256Point::save(ostream &stream) const
                      POINT_CONVERSION_COMPRESSED,
                      buf.data(),
                      buf.size(),
-                     nullptr)) {
+                     get_bn_ctx())) {
             stream.exceptions(old_ex_mask);
             throw runtime_error("Call to EC_POINT_point2oct failed");
         }
@@ -673,7 +692,7 @@ void utils::P256Point::load(istream &stream)
                      reinterpret_cast<EC_POINT *>(pt_),
                      buf.data(),
                      buf.size(),
-                     nullptr)) {
+                     get_bn_ctx())) {
             stream.exceptions(old_ex_mask);
             throw logic_error("Call to EC_POINT_oct2point failed");
         }
@@ -694,7 +713,7 @@ void utils::P256Point::save(point_save_span_type out) const
         POINT_CONVERSION_COMPRESSED,
         reinterpret_cast<unsigned char *>(out.data()),
         out.size(),
-        nullptr);
+        get_bn_ctx());
 
     if (ret == 0) {
         throw runtime_error("Call to EC_POINT_point2oct failed");
@@ -708,7 +727,7 @@ void utils::P256Point::load(point_save_span_const_type in)
                  reinterpret_cast<EC_POINT *>(pt_),
                  reinterpret_cast<const unsigned char *>(in.data()),
                  in.size(),
-                 nullptr)) {
+                 get_bn_ctx())) {
         throw runtime_error("Call to EC_POINT_oct2point failed");
     }
 }
@@ -729,6 +748,28 @@ namespace {
             reinterpret_cast<digit_t *>(value.data()), reinterpret_cast<digit_t *>(value.data()));
     }
 
+    void hash_to_field(
+        const hash_type &data, utils::FourQPoint::encode_to_curve_salt_type salt, f2elm_t r)
+    {
+        constexpr size_t data_start = salt.size();
+        constexpr size_t buf_size = data_start + utils::FourQPoint::hash_size;
+
+        array<byte, buf_size> buf{};
+        copy_n(salt.data(), salt.size(), buf.data());
+        copy_n(data.begin(), utils::FourQPoint::hash_size, buf.begin() + data_start);
+
+        // Hash everything into an f2elm_t struct
+        utils::compute_hash(
+            buf,
+            "fourq_constructor_hash",
+            gsl::span<byte, sizeof(f2elm_t)>{ reinterpret_cast<byte *>(r), sizeof(f2elm_t) });
+
+        // Reduce r; note that this does not produce a perfectly uniform distribution modulo
+        // 2^127-1, but it is good enough.
+        mod1271(r[0]);
+        mod1271(r[1]);
+    }
+
     digit_t is_nonzero_scalar(utils::FourQPoint::scalar_type &value)
     {
         const digit_t *value_ptr = reinterpret_cast<digit_t *>(value.data());
@@ -746,26 +787,9 @@ namespace {
 
 utils::FourQPoint::FourQPoint(const hash_type &data, encode_to_curve_salt_type salt)
 {
-    constexpr size_t data_start = salt.size();
-    constexpr size_t buf_size = data_start + hash_size;
-
-    array<byte, buf_size> buf{};
-    copy_n(salt.data(), salt.size(), buf.data());
-    copy_n(data.begin(), hash_size, buf.begin() + data_start);
-
-    // Hash everything into an f2elm_t struct
-    f2elm_t r;
-    compute_hash(
-        buf,
-        "fourq_constructor_hash",
-        gsl::span<byte, sizeof(r)>{ reinterpret_cast<byte *>(r), sizeof(r) });
-
-    // Reduce r; note that this does not produce a perfectly uniform distribution modulo
-    // 2^127-1, but it is good enough.
-    mod1271(r[0]);
-    mod1271(r[1]);
-
     // Create an elliptic curve point
+    f2elm_t r;
+    hash_to_field(data, salt, r);
     HashToCurve(r, pt_);
 }
 
@@ -812,6 +836,26 @@ utils::FourQPoint utils::FourQPoint::MakeGeneratorMultiple(const scalar_type &sc
     return result;
 }
 
+vector<utils::FourQPoint> utils::FourQPoint::MakeHashToCurveBatch(
+    gsl::span<const hash_type> data, encode_to_curve_salt_type salt)
+{
+    vector<digit_t> r_data(data.size() * 2 * NWORDS_FIELD);
+    f2elm_t *r = reinterpret_cast<f2elm_t *>(r_data.data());
+    for (size_t i = 0; i < data.size(); i++) {
+        hash_to_field(data[i], salt, r[i]);
+    }
+
+    vector<point_affine> pts(data.size());
+    HashToCurveBatch(r, pts.data(), static_cast<unsigned int>(data.size()));
+
+    vector<FourQPoint> result(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        result[i].pt_[0] = pts[i];
+    }
+
+    return result;
+}
+
 void utils::FourQPoint::InvertScalar(const scalar_type &in, scalar_type &out)
 {
     to_Montgomery(
@@ -882,6 +926,39 @@ bool utils::FourQPoint::scalar_multiply(const scalar_type &scalar, bool clear_co
         clear_cofactor);
 }
 
+bool utils::FourQPoint::ScalarMultiplyBatch(
+    gsl::span<FourQPoint> points, gsl::span<const scalar_type> scalars, bool clear_cofactor)
+{
+    if (points.size() != scalars.size()) {
+        throw invalid_argument("Number of points and scalars must match");
+    }
+
+    vector<point_affine> pts(points.size());
+    vector<digit_t> ks(scalars.size() * NWORDS_ORDER);
+    for (size_t i = 0; i < points.size(); i++) {
+        pts[i] = points[i].pt_[0];
+        copy_n(
+            scalars[i].data(), order_size, reinterpret_cast<byte *>(ks.data() + i * NWORDS_ORDER));
+    }
+
+    // The ecc_mul_batch function returns false when any input point is not a valid curve point
+    bool valid = ecc_mul_batch(
+        pts.data(), ks.data(), pts.data(), static_cast<unsigned int>(pts.size()), clear_cofactor);
+
+    // The scalars may be secret, so the copies are wiped like the scalars themselves
+    clear_words(
+        ks.data(), static_cast<unsigned int>(ks.size() * sizeof(digit_t) / sizeof(unsigned int)));
+    if (!valid) {
+        return false;
+    }
+
+    for (size_t i = 0; i < points.size(); i++) {
+        points[i].pt_[0] = pts[i];
+    }
+
+    return true;
+}
+
 bool utils::FourQPoint::double_scalar_multiply(
     const scalar_type &scalar1, const scalar_type &scalar2)
 {
@@ -942,6 +1019,11 @@ utils::FourQPoint::scalar_type::scalar_type(scalar_span_const_type in) : scalar_
     load(in);
 }
 
+utils::FourQPoint::scalar_type::~scalar_type()
+{
+    clear_words(data(), static_cast<unsigned int>(size() / sizeof(unsigned int)));
+}
+
 bool utils::FourQPoint::scalar_type::is_zero() const
 {
     return *this == scalar_type{};
@@ -7,6 +7,7 @@
 #include <array>
 #include <cstddef>
 #include <iostream>
+#include <vector>
 
 // OZKS
 #include "oZKS/config.h"
@@ -31,57 +32,25 @@ namespace ozks {
             using point_save_span_const_type = gsl::span<const std::byte, save_size>;
             using encode_to_curve_salt_type = point_save_span_const_type;
 
-            class scalar_type {
+            // Scalars are stored as little-endian bytes and converted to BIGNUMs from a
+            // thread-local BN_CTX when needed, so creating and copying them does not allocate
+            class scalar_type : public std::array<std::byte, order_size> {
             public:
                 scalar_type();
 
                 ~scalar_type();
 
-                scalar_type(void *scalar_ptr);
-
                 scalar_type(scalar_span_const_type in);
 
-                scalar_type &operator=(const scalar_type &assign);
-
-                scalar_type(const scalar_type &assign) : scalar_type()
-                {
-                    operator=(assign);
-                }
-
-                scalar_type &operator=(scalar_type &&source) noexcept;
-
-                scalar_type(scalar_type &&source) noexcept
-                {
-                    operator=(std::move(source));
-                }
-
-                bool operator==(const scalar_type &other) const;
-
-                bool operator!=(const scalar_type &other) const
-                {
-                    return !operator==(other);
-                }
+                scalar_type(const scalar_type &copy) = default;
 
-                void *ptr() noexcept
-                {
-                    return scalar_;
-                }
-
-                const void *ptr() const noexcept
-                {
-                    return scalar_;
-                }
+                scalar_type &operator=(const scalar_type &assign) = default;
 
                 static constexpr std::size_t Size() noexcept
                 {
                     return order_size;
                 }
 
-                constexpr std::size_t size() noexcept
-                {
-                    return Size();
-                }
-
                 void set_zero();
 
                 template <typename T>
@@ -92,11 +61,6 @@ namespace ozks {
                 void load(scalar_span_const_type in);
 
                 void save(scalar_span_type out) const;
-
-            private:
-                void clean_up();
-
-                void *scalar_ = nullptr;
             };
 
             // Output hash size is 32 bytes
@@ -141,6 +105,11 @@ namespace ozks {
 
             static P256Point MakeGeneratorMultiple(const scalar_type &scalar);
 
+            // Hashes each input to an elliptic curve point. The result is the same as constructing
+            // the points one at a time, but work is shared across the batch where possible.
+            static std::vector<P256Point> MakeHashToCurveBatch(
+                gsl::span<const hash_type> data, encode_to_curve_salt_type salt);
+
             static void InvertScalar(const scalar_type &in, scalar_type &out);
 
             static void MultiplyScalar(
@@ -157,6 +126,13 @@ namespace ozks {
 
             bool scalar_multiply(const scalar_type &scalar, bool clear_cofactor);
 
+            // Multiplies each point by the corresponding scalar; returns false if any of the
+            // points is not a valid curve point
+            static bool ScalarMultiplyBatch(
+                gsl::span<P256Point> points,
+                gsl::span<const scalar_type> scalars,
+                bool clear_cofactor);
+
             // Computes scalar1*this+scalar2*generator; does not clear cofactor
             bool double_scalar_multiply(const scalar_type &scalar1, const scalar_type &scalar2);
 
@@ -202,8 +178,14 @@ namespace ozks {
             public:
                 scalar_type() = default;
 
+                ~scalar_type();
+
                 scalar_type(scalar_span_const_type in);
 
+                scalar_type(const scalar_type &copy) = default;
+
+                scalar_type &operator=(const scalar_type &assign) = default;
+
                 bool is_zero() const;
 
                 void load(scalar_span_const_type in);
@@ -243,6 +225,11 @@ namespace ozks {
 
             static FourQPoint MakeGeneratorMultiple(const scalar_type &scalar);
 
+            // Hashes each input to an elliptic curve point. The result is the same as constructing
+            // the points one at a time, but work is shared across the batch where possible.
+            static std::vector<FourQPoint> MakeHashToCurveBatch(
+                gsl::span<const hash_type> data, encode_to_curve_salt_type salt);
+
             static void InvertScalar(const scalar_type &in, scalar_type &out);
 
             static void MultiplyScalar(
@@ -259,6 +246,13 @@ namespace ozks {
 
             bool scalar_multiply(const scalar_type &scalar, bool clear_cofactor);
 
+            // Multiplies each point by the corresponding scalar; returns false if any of the
+            // points is not a valid curve point
+            static bool ScalarMultiplyBatch(
+                gsl::span<FourQPoint> points,
+                gsl::span<const scalar_type> scalars,
+                bool clear_cofactor);
+
             // Computes scalar1*this+scalar2*generator; does not clear cofactor
             bool double_scalar_multiply(const scalar_type &scalar1, const scalar_type &scalar2);
 
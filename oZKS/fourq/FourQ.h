@@ -116,6 +116,10 @@ typedef int64_t sdigit_t; // Signed 64-bit digit
 #define ASM_SUPPORT
 #endif
 
+#if defined(_DISPATCH_) // Runtime selection of the GF(p^2) arithmetic implementation
+#define RUNTIME_DISPATCH
+#endif
+
 #if defined(_GENERIC_) // Selection of generic, portable implementation
 #define GENERIC_IMPLEMENTATION
 #endif
@@ -138,6 +142,12 @@ typedef int64_t sdigit_t; // Signed 64-bit digit
 #error-- "Unsupported configuration"
 #endif
 
+#if defined(RUNTIME_DISPATCH) && \
+    (defined(ASM_SUPPORT) || (SIMD_SUPPORT != NO_SIMD_SUPPORT) || (TARGET != TARGET_AMD64) || \
+     (OS_TARGET != OS_LINUX))
+#error-- "Unsupported configuration"
+#endif
+
 // Definition of complementary cryptographic functions
 
 #define RandomBytesFunction random_bytes
@@ -184,6 +194,15 @@ typedef enum {
 
 #define ECCRYPTO_STATUS_TYPE_SIZE (ECCRYPTO_ERROR_END_OF_LIST)
 
+// Implementations of the GF(p^2) arithmetic that can be selected at runtime
+
+typedef enum {
+    FOURQ_IMPL_GENERIC,   // 0x00, portable C
+    FOURQ_IMPL_ASM,       // 0x01, x64 assembly
+    FOURQ_IMPL_AVX2,      // 0x02, x64 assembly using BMI2, ADX and AVX2
+    FOURQ_IMPL_AVX512IFMA // 0x03, as above, plus 8-way batched arithmetic using AVX-512 IFMA
+} FOURQ_IMPL;
+
 // Error message definitions
 
 #define ECCRYPTO_MSG_ERROR "ECCRYPTO_ERROR"
@@ -35,6 +35,25 @@ bool ecc_mul_fixed(digit_t *k, point_t Q);
 // Double scalar multiplication R = k*G + l*Q, where G is the generator
 bool ecc_mul_double(digit_t *k, point_t Q, digit_t *l, point_t R);
 
+// Batched variable-base scalar multiplication Q[i] = k[i]*P[i] for i = 0..n-1, where k holds n
+// consecutive scalars of NWORDS_ORDER digits each. Returns false if any P[i] is invalid.
+bool ecc_mul_batch(
+    point_affine *P, digit_t *k, point_affine *Q, unsigned int n, bool clear_cofactor);
+
+#if defined(RUNTIME_DISPATCH)
+/************* Runtime selection of the GF(p^2) arithmetic implementation **************/
+
+// Fastest implementation supported by the executing CPU
+FOURQ_IMPL fourq_best_impl(void);
+
+// Implementation currently in use
+FOURQ_IMPL fourq_current_impl(void);
+
+// Switch to the given implementation; returns false if the executing CPU does not support it.
+// Not thread-safe: must not be called while other threads use the library.
+bool fourq_select_impl(FOURQ_IMPL impl);
+#endif
+
 /************* Public API for arithmetic functions modulo the curve order **************/
 
 // Converting to Montgomery representation
@@ -143,6 +162,11 @@ ECCRYPTO_STATUS SecretAgreement(
 // Output: point in affine coordinates with co-factor cleared
 ECCRYPTO_STATUS HashToCurve(f2elm_t r, point_t P);
 
+// Hash n GF(p^2) elements to curve points, sharing work across the batch
+// Input: n GF(p^2) elements
+// Output: n points in affine coordinates with co-factor cleared, identical to those of HashToCurve
+ECCRYPTO_STATUS HashToCurveBatch(f2elm_t *r, point_affine *P, unsigned int n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -335,11 +335,39 @@ void fp2sqr1271_a(f2elm_t a, f2elm_t c);
 // Quadratic extension field inversion, af = a^-1 = a^(p-2) in GF((2^127-1)^2)
 void fp2inv1271(f2elm_t a);
 
+#if defined(RUNTIME_DISPATCH)
+// Variants of the assembly functions above that require BMI2, ADX and AVX2
+void fp2addsub1271_AVX2_a(f2elm_t a, f2elm_t b, f2elm_t c);
+void fp2mul1271_AVX2_a(f2elm_t a, f2elm_t b, f2elm_t c);
+void fp2sqr1271_AVX2_a(f2elm_t a, f2elm_t c);
+
+// 8-way variants of the multiplication and squaring using AVX-512 IFMA
+void fp2mul1271_x8_IFMA(felm_t **a, felm_t **b, felm_t **c);
+void fp2sqr1271_x8_IFMA(felm_t **a, felm_t **c);
+
+// Runtime-selected GF(p^2) functions; NULL selects the portable C implementation
+extern void (*fp2addsub1271_impl)(f2elm_t a, f2elm_t b, f2elm_t c);
+extern void (*fp2mul1271_impl)(f2elm_t a, f2elm_t b, f2elm_t c);
+extern void (*fp2sqr1271_impl)(f2elm_t a, f2elm_t c);
+extern void (*fp2mul1271_x8_impl)(felm_t **a, felm_t **b, felm_t **c);
+extern void (*fp2sqr1271_x8_impl)(felm_t **a, felm_t **c);
+#endif
+
+// Batched quadratic extension field multiplication, *c[i] = *a[i] * *b[i] for i = 0..n-1.
+// The outputs may alias the inputs a[i] but not b[i].
+void fp2mul1271_batch(felm_t **a, felm_t **b, felm_t **c, unsigned int n);
+
+// Batched quadratic extension field squaring, *c[i] = *a[i]^2 for i = 0..n-1
+void fp2sqr1271_batch(felm_t **a, felm_t **c, unsigned int n);
+
 /************ Curve and recoding functions *************/
 
 // Normalize projective twisted Edwards point Q = (X,Y,Z) -> P = (x,y)
 void eccnorm(point_extproj_t P, point_t Q);
 
+// Batched normalization Q[i] = (X/Z,Y/Z) of n <= ECC_BATCH_WIDTH points sharing one inversion
+void eccnorm_batch(point_extproj *P, point_affine *Q, unsigned int n);
+
 // Conversion from representation (X,Y,Z,Ta,Tb) to (X+Y,Y-X,2Z,2dT), where T = Ta*Tb
 void R1_to_R2(point_extproj_t P, point_extproj_precomp_t Q);
 
@@ -358,6 +386,15 @@ void eccadd_ni(point_extproj_precomp_t Q, point_extproj_t P);
 void eccadd(point_extproj_precomp_t Q, point_extproj_t P);
 void eccadd_core(point_extproj_precomp_t P, point_extproj_precomp_t Q, point_extproj_t R);
 
+// Maximum number of points processed in lockstep by the batched point operations
+#define ECC_BATCH_WIDTH 8
+
+// Batched point doubling P[i] = 2P[i] for n <= ECC_BATCH_WIDTH points
+void eccdouble_batch(point_extproj *P, unsigned int n);
+
+// Batched complete point addition P[i] = P[i]+Q[i] for n <= ECC_BATCH_WIDTH points
+void eccadd_batch(point_extproj_precomp *Q, point_extproj *P, unsigned int n);
+
 // Psi mapping of a point, P = psi(P)
 void ecc_psi(point_extproj_t P);
 
@@ -379,6 +416,9 @@ void conversion_to_odd(digit_t *k, digit_t *k_odd);
 // Co-factor clearing
 void cofactor_clearing(point_extproj_t P);
 
+// Batched co-factor clearing for n <= ECC_BATCH_WIDTH points
+void cofactor_clearing_batch(point_extproj *P, unsigned int n);
+
 // Precomputation function
 void ecc_precomp(point_extproj_t P, point_extproj_precomp_t *T);
 
@@ -394,6 +434,20 @@ void table_lookup_1x8_a(
     point_extproj_precomp_t P,
     unsigned int *digit,
     unsigned int *sign_mask);
+#if defined(RUNTIME_DISPATCH)
+void table_lookup_1x8_AVX2_a(
+    point_extproj_precomp_t *table,
+    point_extproj_precomp_t P,
+    unsigned int *digit,
+    unsigned int *sign_mask);
+
+// Runtime-selected table lookup; NULL selects the portable C implementation
+extern void (*table_lookup_1x8_impl)(
+    point_extproj_precomp_t *table,
+    point_extproj_precomp_t P,
+    unsigned int *digit,
+    unsigned int *sign_mask);
+#endif
 
 // Modular correction of input coordinates and conversion to representation (X,Y,Z,Ta,Tb)
 void point_setup(point_t P, point_extproj_t Q);
@@ -0,0 +1,138 @@
+/***********************************************************************************
+ * FourQlib: a high-performance crypto library based on the elliptic curve FourQ
+ *
+ *    Copyright (c) Microsoft Corporation. All rights reserved.
+ *
+ * Abstract: runtime selection of the GF(p^2) arithmetic implementation on x64
+ ************************************************************************************/
+
+#include "oZKS/fourq/FourQ_internal.h"
+
+#if defined(RUNTIME_DISPATCH)
+#include <cpuid.h>
+#include <stdlib.h>
+#include <string.h>
+
+void (*fp2addsub1271_impl)(f2elm_t a, f2elm_t b, f2elm_t c) = NULL;
+void (*fp2mul1271_impl)(f2elm_t a, f2elm_t b, f2elm_t c) = NULL;
+void (*fp2sqr1271_impl)(f2elm_t a, f2elm_t c) = NULL;
+void (*fp2mul1271_x8_impl)(felm_t **a, felm_t **b, felm_t **c) = NULL;
+void (*fp2sqr1271_x8_impl)(felm_t **a, felm_t **c) = NULL;
+void (*table_lookup_1x8_impl)(
+    point_extproj_precomp_t *table,
+    point_extproj_precomp_t P,
+    unsigned int *digit,
+    unsigned int *sign_mask) = NULL;
+
+static FOURQ_IMPL current_impl = FOURQ_IMPL_GENERIC;
+
+static bool os_saves_state(uint32_t mask)
+{ // Check that the OS preserves the register state selected by mask across context switches.
+  // Bits 1-2 of XCR0 cover the XMM/YMM registers, bits 5-7 the opmask and ZMM registers.
+    uint32_t xcr0_lo, xcr0_hi;
+
+    __asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    return (xcr0_lo & mask) == mask;
+}
+
+FOURQ_IMPL fourq_best_impl(void)
+{ // Fastest implementation supported by the executing CPU.
+  // The plain assembly only uses baseline x64 instructions; the AVX2 variant additionally uses
+  // MULX (BMI2), ADCX/ADOX (ADX) and 256-bit integer vector instructions for the table lookup.
+  // The batched arithmetic additionally needs AVX-512F and AVX-512 IFMA.
+    unsigned int eax, ebx, ecx, edx;
+    bool osxsave, avx2, bmi2, adx, avx512f, avx512ifma;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return FOURQ_IMPL_ASM;
+    }
+    osxsave = (ecx & bit_OSXSAVE) != 0;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return FOURQ_IMPL_ASM;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    avx2 = (ebx & bit_AVX2) != 0;
+    bmi2 = (ebx & bit_BMI2) != 0;
+    adx = (ebx & bit_ADX) != 0;
+    avx512f = (ebx & bit_AVX512F) != 0;
+    avx512ifma = (ebx & bit_AVX512IFMA) != 0;
+
+    if (!osxsave || !avx2 || !bmi2 || !adx || !os_saves_state(0x6)) {
+        return FOURQ_IMPL_ASM;
+    }
+    if (avx512f && avx512ifma && os_saves_state(0xE6)) {
+        return FOURQ_IMPL_AVX512IFMA;
+    }
+    return FOURQ_IMPL_AVX2;
+}
+
+FOURQ_IMPL fourq_current_impl(void)
+{ // Implementation currently in use
+    return current_impl;
+}
+
+bool fourq_select_impl(FOURQ_IMPL impl)
+{ // Switch to the given implementation if the executing CPU supports it
+    if (impl > fourq_best_impl()) {
+        return false;
+    }
+
+    fp2mul1271_x8_impl = NULL;
+    fp2sqr1271_x8_impl = NULL;
+
+    switch (impl) {
+    case FOURQ_IMPL_AVX512IFMA:
+        fp2mul1271_x8_impl = fp2mul1271_x8_IFMA;
+        fp2sqr1271_x8_impl = fp2sqr1271_x8_IFMA;
+        // Fall through
+    case FOURQ_IMPL_AVX2:
+        fp2addsub1271_impl = fp2addsub1271_AVX2_a;
+        fp2mul1271_impl = fp2mul1271_AVX2_a;
+        fp2sqr1271_impl = fp2sqr1271_AVX2_a;
+        table_lookup_1x8_impl = table_lookup_1x8_AVX2_a;
+        break;
+    case FOURQ_IMPL_ASM:
+        fp2addsub1271_impl = fp2addsub1271_a;
+        fp2mul1271_impl = fp2mul1271_a;
+        fp2sqr1271_impl = fp2sqr1271_a;
+        table_lookup_1x8_impl = NULL;
+        break;
+    case FOURQ_IMPL_GENERIC:
+        fp2addsub1271_impl = NULL;
+        fp2mul1271_impl = NULL;
+        fp2sqr1271_impl = NULL;
+        table_lookup_1x8_impl = NULL;
+        break;
+    default:
+        return false;
+    }
+
+    current_impl = impl;
+    return true;
+}
+
+__attribute__((constructor)) static void fourq_init_impl(void)
+{ // Select the implementation once at load time. The environment variable OZKS_FOURQ_IMPL
+  // (one of "generic", "asm", "avx2" or "avx512ifma") can be used to force a slower
+  // implementation.
+    const char *forced = getenv("OZKS_FOURQ_IMPL");
+
+    if (forced != NULL) {
+        if (strcmp(forced, "generic") == 0 && fourq_select_impl(FOURQ_IMPL_GENERIC)) {
+            return;
+        }
+        if (strcmp(forced, "asm") == 0 && fourq_select_impl(FOURQ_IMPL_ASM)) {
+            return;
+        }
+        if (strcmp(forced, "avx2") == 0 && fourq_select_impl(FOURQ_IMPL_AVX2)) {
+            return;
+        }
+        if (strcmp(forced, "avx512ifma") == 0 && fourq_select_impl(FOURQ_IMPL_AVX512IFMA)) {
+            return;
+        }
+    }
+
+    fourq_select_impl(fourq_best_impl());
+}
+#endif
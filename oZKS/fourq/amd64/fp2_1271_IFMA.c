@@ -0,0 +1,182 @@
+/***********************************************************************************
+ * FourQlib: a high-performance crypto library based on the elliptic curve FourQ
+ *
+ *    Copyright (c) Microsoft Corporation. All rights reserved.
+ *
+ * Abstract: 8-way arithmetic over GF(p^2) using AVX-512 IFMA
+ *
+ * Each 512-bit register holds one 52-bit limb of eight independent field elements, so a
+ * field element a < 2^127 is represented by three registers a = a0 + a1*2^52 + a2*2^104,
+ * where a2 < 2^24. Products are accumulated column-wise with VPMADD52LUQ/VPMADD52HUQ and
+ * reduced using 2^127 = 1 mod p, where p = 2^127-1.
+ ************************************************************************************/
+
+#include "oZKS/fourq/FourQ_internal.h"
+
+#if defined(RUNTIME_DISPATCH)
+#include <immintrin.h>
+
+#define IFMA_TARGET __attribute__((target("avx512f,avx512ifma")))
+
+typedef struct {
+    __m512i l[3];
+} felm_x8_t; // Eight field elements in radix 2^52
+
+static const uint64_t mask52 = 0xFFFFFFFFFFFFF;
+static const uint64_t mask23 = 0x7FFFFF;
+
+static IFMA_TARGET __inline __m512i load_pointers(felm_t **a)
+{ // Load eight pointers into a vector of gather indices
+    return _mm512_loadu_si512((const void *)a);
+}
+
+static IFMA_TARGET __inline void load_x8(felm_t **a, unsigned int k, felm_x8_t *r)
+{ // Gather the k-th coefficient of eight GF(p^2) elements and convert to radix 2^52
+    __m512i ptrs = load_pointers(a);
+    __m512i w0 = _mm512_i64gather_epi64(ptrs, (const void *)(k * sizeof(felm_t)), 1);
+    __m512i w1 = _mm512_i64gather_epi64(ptrs, (const void *)(k * sizeof(felm_t) + 8), 1);
+    __m512i m52 = _mm512_set1_epi64((long long)mask52);
+
+    r->l[0] = _mm512_and_si512(w0, m52);
+    r->l[1] = _mm512_and_si512(
+        _mm512_or_si512(_mm512_srli_epi64(w0, 52), _mm512_slli_epi64(w1, 12)), m52);
+    r->l[2] = _mm512_srli_epi64(w1, 40);
+}
+
+static IFMA_TARGET __inline void store_x8(felm_t **c, unsigned int k, const felm_x8_t *r)
+{ // Convert from radix 2^52 and scatter into the k-th coefficient of eight GF(p^2) elements
+    __m512i ptrs = load_pointers(c);
+    __m512i w0 = _mm512_or_si512(r->l[0], _mm512_slli_epi64(r->l[1], 52));
+    __m512i w1 = _mm512_or_si512(_mm512_srli_epi64(r->l[1], 12), _mm512_slli_epi64(r->l[2], 40));
+
+    _mm512_i64scatter_epi64((void *)(k * sizeof(felm_t)), ptrs, w0, 1);
+    _mm512_i64scatter_epi64((void *)(k * sizeof(felm_t) + 8), ptrs, w1, 1);
+}
+
+static IFMA_TARGET __inline void neg_x8(const felm_x8_t *a, felm_x8_t *r)
+{ // r = p - a, computed limb-wise without borrows since a < 2^127
+    r->l[0] = _mm512_sub_epi64(_mm512_set1_epi64((long long)mask52), a->l[0]);
+    r->l[1] = _mm512_sub_epi64(_mm512_set1_epi64((long long)mask52), a->l[1]);
+    r->l[2] = _mm512_sub_epi64(_mm512_set1_epi64((long long)mask23), a->l[2]);
+}
+
+static IFMA_TARGET __inline void mul_acc_x8(const felm_x8_t *a, const felm_x8_t *b, __m512i *t)
+{ // Accumulate the schoolbook product a*b into the five columns t[0..4] (weights 2^(52*i)).
+  // The high half of a2*b2 is always zero since a2, b2 < 2^24.
+    t[0] = _mm512_madd52lo_epu64(t[0], a->l[0], b->l[0]);
+
+    t[1] = _mm512_madd52lo_epu64(t[1], a->l[0], b->l[1]);
+    t[1] = _mm512_madd52lo_epu64(t[1], a->l[1], b->l[0]);
+    t[1] = _mm512_madd52hi_epu64(t[1], a->l[0], b->l[0]);
+
+    t[2] = _mm512_madd52lo_epu64(t[2], a->l[0], b->l[2]);
+    t[2] = _mm512_madd52lo_epu64(t[2], a->l[1], b->l[1]);
+    t[2] = _mm512_madd52lo_epu64(t[2], a->l[2], b->l[0]);
+    t[2] = _mm512_madd52hi_epu64(t[2], a->l[0], b->l[1]);
+    t[2] = _mm512_madd52hi_epu64(t[2], a->l[1], b->l[0]);
+
+    t[3] = _mm512_madd52lo_epu64(t[3], a->l[1], b->l[2]);
+    t[3] = _mm512_madd52lo_epu64(t[3], a->l[2], b->l[1]);
+    t[3] = _mm512_madd52hi_epu64(t[3], a->l[0], b->l[2]);
+    t[3] = _mm512_madd52hi_epu64(t[3], a->l[1], b->l[1]);
+    t[3] = _mm512_madd52hi_epu64(t[3], a->l[2], b->l[0]);
+
+    t[4] = _mm512_madd52lo_epu64(t[4], a->l[2], b->l[2]);
+    t[4] = _mm512_madd52hi_epu64(t[4], a->l[1], b->l[2]);
+    t[4] = _mm512_madd52hi_epu64(t[4], a->l[2], b->l[1]);
+}
+
+static IFMA_TARGET __inline void carry_x8(felm_x8_t *r)
+{ // Propagate carries so that r0, r1 < 2^52
+    __m512i m52 = _mm512_set1_epi64((long long)mask52);
+
+    r->l[1] = _mm512_add_epi64(r->l[1], _mm512_srli_epi64(r->l[0], 52));
+    r->l[0] = _mm512_and_si512(r->l[0], m52);
+    r->l[2] = _mm512_add_epi64(r->l[2], _mm512_srli_epi64(r->l[1], 52));
+    r->l[1] = _mm512_and_si512(r->l[1], m52);
+}
+
+static IFMA_TARGET __inline void fold_x8(felm_x8_t *r)
+{ // r = (r mod 2^127) + floor(r/2^127), followed by carry propagation
+    __m512i m23 = _mm512_set1_epi64((long long)mask23);
+
+    r->l[0] = _mm512_add_epi64(r->l[0], _mm512_srli_epi64(r->l[2], 23));
+    r->l[2] = _mm512_and_si512(r->l[2], m23);
+    carry_x8(r);
+}
+
+static IFMA_TARGET __inline void reduce_x8(const __m512i *t, felm_x8_t *r)
+{ // Reduce the column sums t[0..4] modulo 2^127-1. Using 2^156 = 2^29 and 2^208 = 2^81 (mod p):
+  // r = t0 + t1*2^52 + (t2 mod 2^23)*2^104 + floor(t2/2^23) + t3*2^29 + t4*2^81.
+  // The output is in [0, 2^127-1].
+    __m512i m23 = _mm512_set1_epi64((long long)mask23);
+
+    r->l[0] = _mm512_add_epi64(t[0], _mm512_srli_epi64(t[2], 23));
+    r->l[0] = _mm512_add_epi64(r->l[0], _mm512_slli_epi64(_mm512_and_si512(t[3], m23), 29));
+    r->l[1] = _mm512_add_epi64(t[1], _mm512_srli_epi64(t[3], 23));
+    r->l[1] = _mm512_add_epi64(r->l[1], _mm512_slli_epi64(_mm512_and_si512(t[4], m23), 29));
+    r->l[2] = _mm512_add_epi64(_mm512_and_si512(t[2], m23), _mm512_srli_epi64(t[4], 23));
+
+    carry_x8(r);
+    fold_x8(r);
+    fold_x8(r);
+}
+
+static IFMA_TARGET __inline void zero_columns(__m512i *t)
+{
+    t[0] = t[1] = t[2] = t[3] = t[4] = _mm512_setzero_si512();
+}
+
+IFMA_TARGET void fp2mul1271_x8_IFMA(felm_t **a, felm_t **b, felm_t **c)
+{ // 8-way GF(p^2) multiplication, c[i] = a[i]*b[i] in GF((2^127-1)^2) for i = 0..7
+  // Inputs must be in [0, 2^127-1]. The outputs may alias the inputs.
+  //   c0 = a0*b0 + a1*(p-b1), c1 = a0*b1 + a1*b0
+    felm_x8_t a0, a1, b0, b1, nb1, r;
+    __m512i t0[5], t1[5];
+
+    load_x8(a, 0, &a0);
+    load_x8(a, 1, &a1);
+    load_x8(b, 0, &b0);
+    load_x8(b, 1, &b1);
+    neg_x8(&b1, &nb1);
+
+    zero_columns(t0);
+    mul_acc_x8(&a0, &b0, t0);
+    mul_acc_x8(&a1, &nb1, t0);
+    zero_columns(t1);
+    mul_acc_x8(&a0, &b1, t1);
+    mul_acc_x8(&a1, &b0, t1);
+
+    reduce_x8(t0, &r);
+    store_x8(c, 0, &r);
+    reduce_x8(t1, &r);
+    store_x8(c, 1, &r);
+}
+
+IFMA_TARGET void fp2sqr1271_x8_IFMA(felm_t **a, felm_t **c)
+{ // 8-way GF(p^2) squaring, c[i] = a[i]^2 in GF((2^127-1)^2) for i = 0..7
+  // Inputs must be in [0, 2^127-1]. The outputs may alias the inputs.
+  //   c0 = a0^2 + a1*(p-a1), c1 = 2*a0*a1
+    felm_x8_t a0, a1, na1, r;
+    __m512i t0[5], t1[5];
+    unsigned int i;
+
+    load_x8(a, 0, &a0);
+    load_x8(a, 1, &a1);
+    neg_x8(&a1, &na1);
+
+    zero_columns(t0);
+    mul_acc_x8(&a0, &a0, t0);
+    mul_acc_x8(&a1, &na1, t0);
+    zero_columns(t1);
+    mul_acc_x8(&a0, &a1, t1);
+    for (i = 0; i < 5; i++) {
+        t1[i] = _mm512_add_epi64(t1[i], t1[i]);
+    }
+
+    reduce_x8(t0, &r);
+    store_x8(c, 0, &r);
+    reduce_x8(t1, &r);
+    store_x8(c, 1, &r);
+}
+#endif
@@ -485,6 +485,66 @@ bool ecc_mul(point_t P, digit_t *k, point_t Q, bool clear_cofactor)
     return true;
 }
 
+bool ecc_mul_batch(
+    point_affine *P, digit_t *k, point_affine *Q, unsigned int n, bool clear_cofactor)
+{ // Batched variable-base scalar multiplication Q[i] = k[i]*P[i] for i = 0..n-1
+  // Inputs: n scalars in [0, 2^256-1] stored consecutively in "k" (NWORDS_ORDER digits each),
+  //         points P[i] = (x,y) in affine coordinates,
+  //         clear_cofactor = 1 (TRUE) or 0 (FALSE) whether cofactor clearing is required or not,
+  //         respectively.
+  // Output: Q[i] = k[i]*P[i] in affine coordinates (x,y).
+  // Up to ECC_BATCH_WIDTH multiplications run in lockstep: the per-point setup and table lookups
+  // are as in ecc_mul(), while the doublings and additions of the main loop are batched.
+  // Returns false if any of the points fails validation.
+    point_extproj R[ECC_BATCH_WIDTH];
+    point_extproj_precomp S[ECC_BATCH_WIDTH];
+    point_extproj_precomp_t Table[ECC_BATCH_WIDTH][8];
+    uint64_t scalars[NWORDS64_ORDER];
+    unsigned int digits[ECC_BATCH_WIDTH][65], sign_masks[ECC_BATCH_WIDTH][65];
+    unsigned int base, m, j;
+    int i;
+
+    for (base = 0; base < n; base += m) {
+        m = (n - base < ECC_BATCH_WIDTH) ? n - base : ECC_BATCH_WIDTH;
+
+        for (j = 0; j < m; j++) {
+            point_setup(&P[base + j], &R[j]);
+            if (ecc_point_validate(&R[j]) == false) {
+                return false;
+            }
+        }
+
+        if (clear_cofactor == true) {
+            cofactor_clearing_batch(R, m);
+        }
+
+        for (j = 0; j < m; j++) {
+            decompose((uint64_t *)(k + (base + j) * NWORDS_ORDER), scalars);
+            recode(scalars, digits[j], sign_masks[j]);
+            ecc_precomp(&R[j], Table[j]);
+            table_lookup_1x8(Table[j], &S[j], digits[j][64], sign_masks[j][64]);
+            R2_to_R4(&S[j], &R[j]);
+        }
+
+        for (i = 63; i >= 0; i--) {
+            for (j = 0; j < m; j++) {
+                table_lookup_1x8(Table[j], &S[j], digits[j][i], sign_masks[j][i]);
+            }
+            eccdouble_batch(R, m);
+            eccadd_batch(S, R, m);
+        }
+
+        eccnorm_batch(R, &Q[base], m);
+    }
+
+#ifdef TEMP_ZEROING
+    clear_words((void *)digits, sizeof(digits) / sizeof(unsigned int));
+    clear_words((void *)sign_masks, sizeof(sign_masks) / sizeof(unsigned int));
+    clear_words((void *)S, sizeof(S) / sizeof(unsigned int));
+#endif
+    return true;
+}
+
 void cofactor_clearing(point_extproj_t P)
 { // Co-factor clearing
   // Input: P = (X1,Y1,Z1,Ta,Tb), where T1 = Ta*Tb, corresponding to (X1:Y1:Z1:T1) in extended
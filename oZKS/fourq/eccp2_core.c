@@ -49,6 +49,12 @@ void fp2sqr1271(f2elm_t a, f2elm_t c)
 #ifdef ASM_SUPPORT
     fp2sqr1271_a(a, c);
 #else
+#if defined(RUNTIME_DISPATCH)
+    if (fp2sqr1271_impl != NULL) {
+        fp2sqr1271_impl(a, c);
+        return;
+    }
+#endif
     felm_t t1, t2, t3;
 
     fpadd1271(a[0], a[1], t1); // t1 = a0+a1
@@ -70,6 +76,12 @@ void fp2mul1271(f2elm_t a, f2elm_t b, f2elm_t c)
 #if defined(ASM_SUPPORT)
     fp2mul1271_a(a, b, c);
 #else
+#if defined(RUNTIME_DISPATCH)
+    if (fp2mul1271_impl != NULL) {
+        fp2mul1271_impl(a, b, c);
+        return;
+    }
+#endif
     felm_t t1, t2, t3, t4;
 
     fpmul1271(a[0], b[0], t1); // t1 = a0*b0
@@ -107,6 +119,12 @@ static void fp2addsub1271(f2elm_t a, f2elm_t b, f2elm_t c)
 #ifdef ASM_SUPPORT
     fp2addsub1271_a(a, b, c);
 #else
+#if defined(RUNTIME_DISPATCH)
+    if (fp2addsub1271_impl != NULL) {
+        fp2addsub1271_impl(a, b, c);
+        return;
+    }
+#endif
     fp2add1271(a, a, a);
     fp2sub1271(a, b, c);
 #endif
@@ -128,6 +146,38 @@ void fp2inv1271(f2elm_t a)
 #endif
 }
 
+void fp2mul1271_batch(felm_t **a, felm_t **b, felm_t **c, unsigned int n)
+{ // Batched GF(p^2) multiplication, *c[i] = *a[i] * *b[i] for i = 0..n-1
+    unsigned int i = 0;
+
+#if defined(RUNTIME_DISPATCH)
+    if (fp2mul1271_x8_impl != NULL) {
+        for (; i + 8 <= n; i += 8) {
+            fp2mul1271_x8_impl(a + i, b + i, c + i);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        fp2mul1271(a[i], b[i], c[i]);
+    }
+}
+
+void fp2sqr1271_batch(felm_t **a, felm_t **c, unsigned int n)
+{ // Batched GF(p^2) squaring, *c[i] = *a[i]^2 for i = 0..n-1
+    unsigned int i = 0;
+
+#if defined(RUNTIME_DISPATCH)
+    if (fp2sqr1271_x8_impl != NULL) {
+        for (; i + 8 <= n; i += 8) {
+            fp2sqr1271_x8_impl(a + i, c + i);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        fp2sqr1271(a[i], c[i]);
+    }
+}
+
 void clear_words(void *mem, unsigned int nwords)
 { // Clear integer-size digits from memory. "nwords" indicates the number of integer digits to be
   // zeroed. This function uses the volatile type qualifier to inform the compiler not to optimize
@@ -168,6 +218,52 @@ void eccnorm(point_extproj_t P, point_t Q)
     mod1271(Q->y[1]);
 }
 
+void eccnorm_batch(point_extproj *P, point_affine *Q, unsigned int n)
+{ // Normalize n <= ECC_BATCH_WIDTH projective points (X1:Y1:Z1), including full reduction; see
+  // eccnorm(). A single GF(p^2) inversion is shared by all points using Montgomery's trick.
+  // Input: P[i] = (X1:Y1:Z1) in twisted Edwards coordinates, with Z1 != 0
+  // Output: Q[i] = (X1/Z1,Y1/Z1). The Z-coordinates of P are overwritten.
+    f2elm_t prefix[ECC_BATCH_WIDTH], inv, t;
+    felm_t *a[2 * ECC_BATCH_WIDTH], *b[2 * ECC_BATCH_WIDTH], *c[2 * ECC_BATCH_WIDTH];
+    unsigned int i;
+
+    if (n == 0) {
+        return;
+    }
+
+    fp2copy1271(P[0].z, prefix[0]); // prefix[i] = Z_0*...*Z_i
+    for (i = 1; i < n; i++) {
+        fp2mul1271(prefix[i - 1], P[i].z, prefix[i]);
+    }
+
+    fp2copy1271(prefix[n - 1], inv); // inv = (Z_0*...*Z_{n-1})^-1
+    fp2inv1271(inv);
+
+    for (i = n - 1; i > 0; i--) {
+        fp2mul1271(inv, prefix[i - 1], t); // t = Z_i^-1
+        fp2mul1271(inv, P[i].z, inv);      // inv = (Z_0*...*Z_{i-1})^-1
+        fp2copy1271(t, P[i].z);
+    }
+    fp2copy1271(inv, P[0].z);
+
+    for (i = 0; i < n; i++) {
+        a[i] = P[i].x; // X1 = X1/Z1
+        b[i] = P[i].z;
+        c[i] = Q[i].x;
+        a[n + i] = P[i].y; // Y1 = Y1/Z1
+        b[n + i] = P[i].z;
+        c[n + i] = Q[i].y;
+    }
+    fp2mul1271_batch(a, b, c, 2 * n);
+
+    for (i = 0; i < n; i++) {
+        mod1271(Q[i].x[0]);
+        mod1271(Q[i].x[1]);
+        mod1271(Q[i].y[0]);
+        mod1271(Q[i].y[1]);
+    }
+}
+
 void R1_to_R2(point_extproj_t P, point_extproj_precomp_t Q)
 { // Conversion from representation (X,Y,Z,Ta,Tb) to (X+Y,Y-X,2Z,2dT), where T = Ta*Tb
   // Input:  P = (X1,Y1,Z1,Ta,Tb), where T1 = Ta*Tb, corresponding to (X1:Y1:Z1:T1) in extended
@@ -275,6 +371,130 @@ void eccadd(point_extproj_precomp_t Q, point_extproj_t P)
 #endif
 }
 
+void eccdouble_batch(point_extproj *P, unsigned int n)
+{ // Batched point doubling P[i] = 2P[i] for n <= ECC_BATCH_WIDTH points; see eccdouble().
+  // The independent multiplications of all points are grouped so that they can be vectorized.
+    f2elm_t t1[ECC_BATCH_WIDTH], t2[ECC_BATCH_WIDTH];
+    felm_t *a[3 * ECC_BATCH_WIDTH], *b[3 * ECC_BATCH_WIDTH], *c[3 * ECC_BATCH_WIDTH];
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        a[i] = P[i].x; // t1 = X1^2
+        c[i] = t1[i];
+        a[n + i] = P[i].y; // t2 = Y1^2
+        c[n + i] = t2[i];
+    }
+    fp2sqr1271_batch(a, c, 2 * n);
+
+    for (i = 0; i < n; i++) {
+        fp2add1271(P[i].x, P[i].y, P[i].x); // t3 = X1+Y1
+        fp2add1271(t1[i], t2[i], P[i].tb);  // Tbfinal = X1^2+Y1^2
+        fp2sub1271(t2[i], t1[i], t1[i]);    // t1 = Y1^2-X1^2
+        a[i] = P[i].x;                      // Ta = (X1+Y1)^2
+        c[i] = P[i].ta;
+        a[n + i] = P[i].z; // t2 = Z1^2
+        c[n + i] = t2[i];
+    }
+    fp2sqr1271_batch(a, c, 2 * n);
+
+    for (i = 0; i < n; i++) {
+        fp2sub1271(P[i].ta, P[i].tb, P[i].ta); // Tafinal = 2X1*Y1 = (X1+Y1)^2-(X1^2+Y1^2)
+        fp2addsub1271(t2[i], t1[i], t2[i]);    // t2 = 2Z1^2-(Y1^2-X1^2)
+        a[i] = t1[i];                          // Yfinal = (X1^2+Y1^2)(Y1^2-X1^2)
+        b[i] = P[i].tb;
+        c[i] = P[i].y;
+        a[n + i] = t2[i]; // Xfinal = 2X1*Y1*[2Z1^2-(Y1^2-X1^2)]
+        b[n + i] = P[i].ta;
+        c[n + i] = P[i].x;
+        a[2 * n + i] = t1[i]; // Zfinal = (Y1^2-X1^2)[2Z1^2-(Y1^2-X1^2)]
+        b[2 * n + i] = t2[i];
+        c[2 * n + i] = P[i].z;
+    }
+    fp2mul1271_batch(a, b, c, 3 * n);
+#ifdef TEMP_ZEROING
+    clear_words((void *)t1, sizeof(t1) / sizeof(unsigned int));
+    clear_words((void *)t2, sizeof(t2) / sizeof(unsigned int));
+#endif
+}
+
+void eccadd_batch(point_extproj_precomp *Q, point_extproj *P, unsigned int n)
+{ // Batched complete point addition P[i] = P[i]+Q[i] for n <= ECC_BATCH_WIDTH points; see eccadd()
+  // and eccadd_core().
+    point_extproj_precomp R[ECC_BATCH_WIDTH];
+    f2elm_t t1[ECC_BATCH_WIDTH], t2[ECC_BATCH_WIDTH];
+    felm_t *a[4 * ECC_BATCH_WIDTH], *b[4 * ECC_BATCH_WIDTH], *c[4 * ECC_BATCH_WIDTH];
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        fp2add1271(P[i].x, P[i].y, R[i].xy); // R = (X1+Y1,Y1-X1,Z1,T1)
+        fp2sub1271(P[i].y, P[i].x, R[i].yx);
+        fp2copy1271(P[i].z, R[i].z2);
+        a[i] = P[i].ta;
+        b[i] = P[i].tb;
+        c[i] = R[i].t2;
+    }
+    fp2mul1271_batch(a, b, c, n);
+
+    for (i = 0; i < n; i++) {
+        a[i] = Q[i].t2; // Z = 2dT1*T2
+        b[i] = R[i].t2;
+        c[i] = P[i].z;
+        a[n + i] = Q[i].z2; // t1 = 2Z1*Z2
+        b[n + i] = R[i].z2;
+        c[n + i] = t1[i];
+        a[2 * n + i] = Q[i].xy; // X = (X1+Y1)(X2+Y2)
+        b[2 * n + i] = R[i].xy;
+        c[2 * n + i] = P[i].x;
+        a[3 * n + i] = Q[i].yx; // Y = (Y1-X1)(Y2-X2)
+        b[3 * n + i] = R[i].yx;
+        c[3 * n + i] = P[i].y;
+    }
+    fp2mul1271_batch(a, b, c, 4 * n);
+
+    for (i = 0; i < n; i++) {
+        fp2sub1271(t1[i], P[i].z, t2[i]);     // t2 = theta
+        fp2add1271(t1[i], P[i].z, t1[i]);     // t1 = alpha
+        fp2sub1271(P[i].x, P[i].y, P[i].tb); // Tbfinal = beta
+        fp2add1271(P[i].x, P[i].y, P[i].ta); // Tafinal = omega
+        a[i] = P[i].tb;                      // Xfinal = beta*theta
+        b[i] = t2[i];
+        c[i] = P[i].x;
+        a[n + i] = t1[i]; // Zfinal = theta*alpha
+        b[n + i] = t2[i];
+        c[n + i] = P[i].z;
+        a[2 * n + i] = P[i].ta; // Yfinal = alpha*omega
+        b[2 * n + i] = t1[i];
+        c[2 * n + i] = P[i].y;
+    }
+    fp2mul1271_batch(a, b, c, 3 * n);
+#ifdef TEMP_ZEROING
+    clear_words((void *)R, sizeof(R) / sizeof(unsigned int));
+    clear_words((void *)t1, sizeof(t1) / sizeof(unsigned int));
+    clear_words((void *)t2, sizeof(t2) / sizeof(unsigned int));
+#endif
+}
+
+void cofactor_clearing_batch(point_extproj *P, unsigned int n)
+{ // Batched co-factor clearing P[i] = 392*P[i] for n <= ECC_BATCH_WIDTH points; see
+  // cofactor_clearing()
+    point_extproj_precomp Q[ECC_BATCH_WIDTH];
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        R1_to_R2(&P[i], &Q[i]); // Converting from (X,Y,Z,Ta,Tb) to (X+Y,Y-X,2Z,2dT)
+    }
+    eccdouble_batch(P, n);
+    eccadd_batch(Q, P, n);
+    eccdouble_batch(P, n);
+    eccdouble_batch(P, n);
+    eccdouble_batch(P, n);
+    eccdouble_batch(P, n);
+    eccadd_batch(Q, P, n);
+    eccdouble_batch(P, n);
+    eccdouble_batch(P, n);
+    eccdouble_batch(P, n);
+}
+
 void point_setup(point_t P, point_extproj_t Q)
 { // Point conversion to representation (X,Y,Z,Ta,Tb)
   // Input: P = (x,y) in affine coordinates
@@ -165,4 +165,21 @@ bool ecc_mul(point_t P, digit_t *k, point_t Q, bool clear_cofactor)
     return true;
 }
 
+bool ecc_mul_batch(
+    point_affine *P, digit_t *k, point_affine *Q, unsigned int n, bool clear_cofactor)
+{ // Batched variable-base scalar multiplication Q[i] = k[i]*P[i] for i = 0..n-1
+  // Inputs: n scalars stored consecutively in "k" (NWORDS_ORDER digits each), points P[i] = (x,y)
+  //         in affine coordinates, and whether cofactor clearing is required.
+  // Output: Q[i] = k[i]*P[i] in affine coordinates (x,y).
+  // Without endomorphisms the multiplications are simply performed one after another.
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        if (ecc_mul(&P[i], k + i * NWORDS_ORDER, &Q[i], clear_cofactor) == false) {
+            return false;
+        }
+    }
+    return true;
+}
+
 #endif
@@ -27,8 +27,8 @@ static void fpselect(digit_t *a, digit_t *b, digit_t *c, digit_t selector)
         c[i] = (selector & (a[i] ^ b[i])) ^ a[i];
 }
 
-ECCRYPTO_STATUS HashToCurve(f2elm_t r, point_t out)
-{
+static void MapToCurve(f2elm_t r, point_t out)
+{ // Map r to a curve point; the output still needs to have its cofactor cleared
     digit_t *r0 = (digit_t *)r[0], *r1 = (digit_t *)r[1];
     felm_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16;
     felm_t one = { 0 };
@@ -223,6 +223,11 @@ ECCRYPTO_STATUS HashToCurve(f2elm_t r, point_t out)
     fpmul1271(t13, t9, t13);
     fpmul1271(t15, t13, x0);
     fpmul1271(t16, t13, x1);
+}
+
+ECCRYPTO_STATUS HashToCurve(f2elm_t r, point_t out)
+{
+    MapToCurve(r, out);
 
     // Clear cofactor
     point_extproj_t P;
@@ -232,3 +237,24 @@ ECCRYPTO_STATUS HashToCurve(f2elm_t r, point_t out)
 
     return ECCRYPTO_SUCCESS;
 }
+
+ECCRYPTO_STATUS HashToCurveBatch(f2elm_t *r, point_affine *out, unsigned int n)
+{ // Batched HashToCurve for n inputs. The outputs are identical to those of HashToCurve, but the
+  // cofactor clearing is vectorized across points and the final normalization shares a single
+  // field inversion per ECC_BATCH_WIDTH points.
+    point_extproj P[ECC_BATCH_WIDTH];
+    unsigned int base, m, j;
+
+    for (base = 0; base < n; base += m) {
+        m = (n - base < ECC_BATCH_WIDTH) ? n - base : ECC_BATCH_WIDTH;
+
+        for (j = 0; j < m; j++) {
+            MapToCurve(r[base + j], &out[base + j]);
+            point_setup(&out[base + j], &P[j]);
+        }
+        cofactor_clearing_batch(P, m);
+        eccnorm_batch(P, &out[base], m);
+    }
+
+    return ECCRYPTO_SUCCESS;
+}
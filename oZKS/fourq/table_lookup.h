@@ -127,6 +127,13 @@ void table_lookup_1x8(
     unsigned int i, j;
     digit_t mask;
 
+#if defined(RUNTIME_DISPATCH)
+    if (table_lookup_1x8_impl != NULL) {
+        table_lookup_1x8_impl(table, P, &digit, &sign_mask);
+        return;
+    }
+#endif
+
     ecccopy_precomp(table[0], point); // point = table[0]
 
     for (i = 1; i < 8; i++) {
@@ -0,0 +1,171 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// OZKS
+#include "oZKS/key_filter.h"
+#include "oZKS/key_filter_generated.h"
+#include "oZKS/utilities.h"
+#include "oZKS/version.h"
+
+using namespace std;
+using namespace ozks;
+
+KeyFilter::KeyFilter(size_t expected_key_count, size_t bits_per_key)
+{
+    if (0 == bits_per_key) {
+        throw invalid_argument("bits_per_key must be positive");
+    }
+
+    constexpr size_t block_bits = block_words * 64;
+    size_t bit_count = std::max<size_t>(expected_key_count, 1) * bits_per_key;
+    size_t block_count = (bit_count + block_bits - 1) / block_bits;
+    blocks_.assign(block_count * block_words, 0);
+
+    // The number of bits per key hash that minimizes the false positive rate is bits_per_key * ln 2
+    hash_count_ = static_cast<size_t>(std::lround(static_cast<double>(bits_per_key) * 0.693));
+    hash_count_ = std::clamp<size_t>(hash_count_, 1, max_hash_count);
+}
+
+void KeyFilter::add(const hash_type &key_hash)
+{
+    size_t block;
+    uint32_t first;
+    uint32_t step;
+    get_positions(key_hash, block, first, step);
+
+    for (size_t idx = 0; idx < hash_count_; idx++) {
+        uint32_t bit = (first + static_cast<uint32_t>(idx) * step) % (block_words * 64);
+        blocks_[block + bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+    key_count_++;
+}
+
+bool KeyFilter::might_contain(const hash_type &key_hash) const
+{
+    size_t block;
+    uint32_t first;
+    uint32_t step;
+    get_positions(key_hash, block, first, step);
+
+    for (size_t idx = 0; idx < hash_count_; idx++) {
+        uint32_t bit = (first + static_cast<uint32_t>(idx) * step) % (block_words * 64);
+        if (0 == (blocks_[block + bit / 64] & (uint64_t(1) << (bit % 64)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void KeyFilter::clear()
+{
+    std::fill(blocks_.begin(), blocks_.end(), 0);
+    key_count_ = 0;
+}
+
+void KeyFilter::get_positions(
+    const hash_type &key_hash, size_t &block, uint32_t &first, uint32_t &step) const
+{
+    // Key hashes are uniformly distributed, so their bytes can be used directly
+    uint64_t block_hash;
+    utils::copy_bytes(key_hash.data(), sizeof(block_hash), &block_hash);
+    utils::copy_bytes(key_hash.data() + sizeof(block_hash), sizeof(first), &first);
+    utils::copy_bytes(
+        key_hash.data() + sizeof(block_hash) + sizeof(first), sizeof(step), &step);
+
+    block = static_cast<size_t>(block_hash % (blocks_.size() / block_words)) * block_words;
+
+    // An odd step visits distinct bits within the block
+    step |= 1;
+}
+
+size_t KeyFilter::save(SerializationWriter &writer) const
+{
+    flatbuffers::FlatBufferBuilder fbs_builder;
+
+    auto blocks_data = fbs_builder.CreateVector(blocks_.data(), blocks_.size());
+
+    fbs::KeyFilterBuilder key_filter_builder(fbs_builder);
+    key_filter_builder.add_version(ozks_serialization_version);
+    key_filter_builder.add_hash_count(static_cast<uint32_t>(hash_count_));
+    key_filter_builder.add_key_count(key_count_);
+    key_filter_builder.add_blocks(blocks_data);
+
+    auto fbs_key_filter = key_filter_builder.Finish();
+    fbs_builder.FinishSizePrefixed(fbs_key_filter);
+
+    writer.write(fbs_builder.GetBufferPointer(), fbs_builder.GetSize());
+
+    return fbs_builder.GetSize();
+}
+
+size_t KeyFilter::save(ostream &stream) const
+{
+    StreamSerializationWriter writer(&stream);
+    return save(writer);
+}
+
+template <typename T>
+size_t KeyFilter::save(vector<T> &vec) const
+{
+    VectorSerializationWriter writer(&vec);
+    return save(writer);
+}
+
+pair<KeyFilter, size_t> KeyFilter::Load(SerializationReader &reader)
+{
+    vector<unsigned char> in_data(utils::read_from_serialization_reader(reader));
+
+    auto verifier =
+        flatbuffers::Verifier(reinterpret_cast<uint8_t *>(in_data.data()), in_data.size());
+    bool safe = fbs::VerifySizePrefixedKeyFilterBuffer(verifier);
+
+    if (!safe) {
+        throw runtime_error("Failed to load KeyFilter: invalid buffer");
+    }
+
+    auto fbs_key_filter = fbs::GetSizePrefixedKeyFilter(in_data.data());
+    if (!same_serialization_version(fbs_key_filter->version())) {
+        throw runtime_error("Failed to load KeyFilter: unsupported version");
+    }
+
+    size_t word_count = fbs_key_filter->blocks()->size();
+    if (0 == word_count || 0 != word_count % block_words) {
+        throw runtime_error("Failed to load KeyFilter: invalid block count");
+    }
+    if (0 == fbs_key_filter->hash_count() || fbs_key_filter->hash_count() > max_hash_count) {
+        throw runtime_error("Failed to load KeyFilter: invalid hash count");
+    }
+
+    KeyFilter key_filter;
+    key_filter.blocks_.assign(
+        fbs_key_filter->blocks()->begin(), fbs_key_filter->blocks()->end());
+    key_filter.hash_count_ = fbs_key_filter->hash_count();
+    key_filter.key_count_ = static_cast<size_t>(fbs_key_filter->key_count());
+
+    return { key_filter, in_data.size() };
+}
+
+pair<KeyFilter, size_t> KeyFilter::Load(istream &stream)
+{
+    StreamSerializationReader reader(&stream);
+    return Load(reader);
+}
+
+template <typename T>
+pair<KeyFilter, size_t> KeyFilter::Load(const vector<T> &vec, size_t position)
+{
+    VectorSerializationReader reader(&vec, position);
+    return Load(reader);
+}
+
+// Explicit specializations
+template size_t KeyFilter::save(vector<uint8_t> &vec) const;
+template size_t KeyFilter::save(vector<byte> &vec) const;
+template pair<KeyFilter, size_t> KeyFilter::Load(const vector<uint8_t> &vec, size_t position);
+template pair<KeyFilter, size_t> KeyFilter::Load(const vector<byte> &vec, size_t position);
@@ -0,0 +1,133 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+// STD
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+// OZKS
+#include "oZKS/defines.h"
+#include "oZKS/serialization_helpers.h"
+
+namespace ozks {
+    /**
+    An approximate membership filter over key hashes. The filter never reports a key hash that
+    was added as missing, but it reports a key hash that was not added as present with a small
+    probability, so a negative answer is definite and a positive answer has to be checked against
+    storage.
+
+    The filter is a blocked Bloom filter: all bits of a key hash are set in a single 512-bit
+    block, so a lookup touches a single cache line. The filter does not grow; when more keys than
+    expected are added the false positive rate goes up. Adding key hashes is not thread-safe, but
+    the filter can be queried from multiple threads concurrently.
+    */
+    class KeyFilter {
+    public:
+        // Number of bits set aside for every expected key unless told otherwise, which gives a
+        // false positive rate of about one percent
+        static constexpr std::size_t default_bits_per_key = 10;
+
+        /**
+        Construct a filter that holds the given number of key hashes with the given number of
+        bits per key hash
+        */
+        KeyFilter(
+            std::size_t expected_key_count, std::size_t bits_per_key = default_bits_per_key);
+
+        /**
+        Add a key hash to the filter
+        */
+        void add(const hash_type &key_hash);
+
+        /**
+        Whether the given key hash might have been added to the filter. When this returns false
+        the key hash was definitely not added.
+        */
+        bool might_contain(const hash_type &key_hash) const;
+
+        /**
+        Remove all key hashes from the filter
+        */
+        void clear();
+
+        /**
+        Get the number of key hashes that have been added to the filter
+        */
+        std::size_t key_count() const
+        {
+            return key_count_;
+        }
+
+        /**
+        Get the number of bits set for every key hash
+        */
+        std::size_t hash_count() const
+        {
+            return hash_count_;
+        }
+
+        /**
+        Get the number of bytes used by the bits of the filter
+        */
+        std::size_t size_bytes() const
+        {
+            return blocks_.size() * sizeof(std::uint64_t);
+        }
+
+        /**
+        Save the filter to a stream
+        */
+        std::size_t save(std::ostream &stream) const;
+
+        /**
+        Save the filter to a byte vector
+        */
+        template <typename T>
+        std::size_t save(std::vector<T> &vec) const;
+
+        /**
+        Load a filter from a stream
+        */
+        static std::pair<KeyFilter, std::size_t> Load(std::istream &stream);
+
+        /**
+        Load a filter from a byte vector
+        */
+        template <typename T>
+        static std::pair<KeyFilter, std::size_t> Load(
+            const std::vector<T> &vec, std::size_t position = 0);
+
+    private:
+        // Number of 64-bit words in a block
+        static constexpr std::size_t block_words = 8;
+
+        static constexpr std::size_t max_hash_count = 16;
+
+        KeyFilter() = default;
+
+        std::size_t save(SerializationWriter &writer) const;
+
+        static std::pair<KeyFilter, std::size_t> Load(SerializationReader &reader);
+
+        /**
+        Get the index of the first word of the block for the given key hash, and the two values
+        the bit positions within the block are derived from
+        */
+        void get_positions(
+            const hash_type &key_hash,
+            std::size_t &block,
+            std::uint32_t &first,
+            std::uint32_t &step) const;
+
+        std::vector<std::uint64_t> blocks_;
+
+        std::size_t hash_count_ = 0;
+
+        std::size_t key_count_ = 0;
+    };
+} // namespace ozks
@@ -15,11 +15,12 @@ OZKSConfig::OZKSConfig(
     shared_ptr<storage::Storage> storage,
     const gsl::span<const byte> vrf_seed,
     size_t vrf_cache_size,
-    size_t thread_count)
+    size_t thread_count,
+    shared_ptr<ThreadPool> thread_pool)
     : commitment_type_(commitment_type), label_type_(label_type), trie_type_(trie_type),
       storage_(storage), vrf_seed_(vrf_seed.size()),
       vrf_cache_size_(label_type == LabelType::VRFLabels ? vrf_cache_size : 0),
-      thread_count_(thread_count)
+      thread_count_(thread_count), thread_pool_(thread_pool)
 {
     // Storage is mandatory
     if (storage_ == nullptr) {
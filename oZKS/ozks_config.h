@@ -6,6 +6,7 @@
 // STD
 #include <cstddef>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 // GSL
@@ -15,6 +16,7 @@
 #include "oZKS/defines.h"
 #include "oZKS/serialization_helpers.h"
 #include "oZKS/storage/storage.h"
+#include "oZKS/thread_pool.h"
 
 namespace ozks {
     class OZKSConfig {
@@ -29,7 +31,8 @@ namespace ozks {
             std::shared_ptr<storage::Storage> storage,
             const gsl::span<const std::byte> vrf_seed = gsl::span<std::byte>(nullptr, nullptr),
             std::size_t vrf_cache_size = 0,
-            std::size_t thread_count = 0);
+            std::size_t thread_count = 0,
+            std::shared_ptr<ThreadPool> thread_pool = nullptr);
 
         /**
         Construct an instance of OZKSConfig
@@ -87,6 +90,27 @@ namespace ozks {
             return thread_count_;
         }
 
+        /**
+        Get the thread pool that parallel work is submitted to. If no thread pool was given when
+        constructing this instance, the process-wide ThreadPool::Shared() pool is used. The thread
+        pool is not saved.
+        */
+        std::shared_ptr<ThreadPool> thread_pool() const
+        {
+            if (nullptr != thread_pool_) {
+                return thread_pool_;
+            }
+            return ThreadPool::Shared();
+        }
+
+        /**
+        Set the thread pool that parallel work is submitted to
+        */
+        void set_thread_pool(std::shared_ptr<ThreadPool> thread_pool)
+        {
+            thread_pool_ = thread_pool;
+        }
+
         /**
         Get the size of the VRF cache.
         */
@@ -119,6 +143,7 @@ namespace ozks {
         std::vector<std::byte> vrf_seed_;
         std::size_t vrf_cache_size_;
         std::size_t thread_count_;
+        std::shared_ptr<ThreadPool> thread_pool_;
 
         /**
         Save the current OZKSConfig object to the given serialization writer
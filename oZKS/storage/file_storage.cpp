@@ -0,0 +1,983 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// OZKS
+#include "oZKS/compressed_trie.h"
+#include "oZKS/ct_node_stored.h"
+#include "oZKS/storage/file_storage.h"
+#include "oZKS/storage/log_file_helpers.h"
+
+using namespace std;
+using namespace ozks;
+using namespace ozks::storage;
+
+namespace {
+    constexpr char segment_file_prefix[] = "segment-";
+
+    constexpr char segment_file_suffix[] = ".log";
+
+    constexpr uint32_t batch_magic = 0x424B5A4F;
+
+    // A batch starts with the magic number, the record count, the payload size and the checksum
+    // of the payload
+    constexpr size_t batch_header_size = 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+    // A record starts with the record type, the trie ID, the sequence number, the key size and
+    // the value size, followed by the key and the value
+    constexpr size_t record_header_size =
+        sizeof(uint8_t) + sizeof(trie_id_type) + sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+    // A record read from a segment file; the value is referenced by its offset in the file
+    struct ParsedRecord {
+        uint8_t type;
+
+        trie_id_type trie_id;
+
+        uint64_t sequence;
+
+        vector<byte> key;
+
+        uint64_t value_offset;
+
+        uint32_t value_size;
+
+        uint32_t record_size;
+    };
+
+    string segment_path(const string &directory, uint64_t segment_id)
+    {
+        char id[17];
+        snprintf(id, sizeof(id), "%016llx", static_cast<unsigned long long>(segment_id));
+        filesystem::path path(directory);
+        path /= string(segment_file_prefix) + id + segment_file_suffix;
+        return path.string();
+    }
+
+    optional<uint64_t> parse_segment_id(const string &file_name)
+    {
+        size_t prefix_size = sizeof(segment_file_prefix) - 1;
+        size_t suffix_size = sizeof(segment_file_suffix) - 1;
+        if (file_name.size() != prefix_size + 16 + suffix_size ||
+            file_name.compare(0, prefix_size, segment_file_prefix) != 0 ||
+            file_name.compare(prefix_size + 16, suffix_size, segment_file_suffix) != 0) {
+            return nullopt;
+        }
+
+        uint64_t segment_id = 0;
+        for (size_t idx = prefix_size; idx < prefix_size + 16; idx++) {
+            char c = file_name[idx];
+            uint64_t digit;
+            if (c >= '0' && c <= '9') {
+                digit = static_cast<uint64_t>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                digit = static_cast<uint64_t>(c - 'a' + 10);
+            } else {
+                return nullopt;
+            }
+            segment_id = (segment_id << 4) | digit;
+        }
+
+        return segment_id;
+    }
+
+    vector<byte> read_file(const string &path)
+    {
+        ifstream in(path, ios::binary | ios::ate);
+        if (!in) {
+            throw runtime_error("Failed to open storage segment " + path);
+        }
+
+        vector<byte> data(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        in.read(reinterpret_cast<char *>(data.data()), static_cast<streamsize>(data.size()));
+        if (!in) {
+            throw runtime_error("Failed to read storage segment " + path);
+        }
+
+        return data;
+    }
+
+    /**
+    Parses the batches in the given segment data, stopping at the first batch that is incomplete
+    or does not match its checksum. Returns the size of the valid part of the data.
+    */
+    size_t parse_segment(const vector<byte> &data, vector<ParsedRecord> &records)
+    {
+        size_t position = 0;
+        while (data.size() - position >= batch_header_size) {
+            uint32_t magic = read_value<uint32_t>(data, position);
+            uint32_t record_count = read_value<uint32_t>(data, position + sizeof(uint32_t));
+            uint64_t payload_size = read_value<uint64_t>(data, position + 2 * sizeof(uint32_t));
+            uint64_t batch_checksum =
+                read_value<uint64_t>(data, position + 2 * sizeof(uint32_t) + sizeof(uint64_t));
+            size_t payload = position + batch_header_size;
+            if (magic != batch_magic || payload_size > data.size() - payload ||
+                batch_checksum != checksum(data.data() + payload, payload_size)) {
+                break;
+            }
+
+            // Parse the records of the batch; they must fill the payload exactly
+            vector<ParsedRecord> batch_records;
+            size_t record = payload;
+            size_t end = payload + payload_size;
+            bool valid = true;
+            for (uint32_t idx = 0; idx < record_count; idx++) {
+                if (end - record < record_header_size) {
+                    valid = false;
+                    break;
+                }
+
+                ParsedRecord parsed;
+                size_t field = record;
+                parsed.type = read_value<uint8_t>(data, field);
+                field += sizeof(uint8_t);
+                parsed.trie_id = read_value<trie_id_type>(data, field);
+                field += sizeof(trie_id_type);
+                parsed.sequence = read_value<uint64_t>(data, field);
+                field += sizeof(uint64_t);
+                uint32_t key_size = read_value<uint32_t>(data, field);
+                field += sizeof(uint32_t);
+                parsed.value_size = read_value<uint32_t>(data, field);
+                field += sizeof(uint32_t);
+                if (static_cast<uint64_t>(key_size) + parsed.value_size > end - field) {
+                    valid = false;
+                    break;
+                }
+
+                parsed.key.assign(data.begin() + field, data.begin() + field + key_size);
+                parsed.value_offset = field + key_size;
+                parsed.record_size =
+                    static_cast<uint32_t>(record_header_size + key_size + parsed.value_size);
+                record += parsed.record_size;
+                batch_records.push_back(std::move(parsed));
+            }
+            if (!valid || record != end) {
+                break;
+            }
+
+            move(batch_records.begin(), batch_records.end(), back_inserter(records));
+            position = end;
+        }
+
+        return position;
+    }
+
+    // Seek with a 64-bit offset; long is only 32 bits on Windows
+    int seek_file(FILE *file, uint64_t offset)
+    {
+#if defined(_WIN32)
+        return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET);
+#else
+        return fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+    }
+
+    void sync_directory([[maybe_unused]] const string &directory)
+    {
+#if !defined(_WIN32)
+        // Make sure a newly created segment file is found after a crash; failure is harmless
+        int fd = open(directory.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+#endif
+    }
+
+    vector<byte> label_key(const PartialLabel &label)
+    {
+        vector<byte> key(PartialLabel::SaveSize);
+        label.save(gsl::span<byte, PartialLabel::SaveSize>(key.data(), PartialLabel::SaveSize));
+        return key;
+    }
+
+    PartialLabel key_label(const vector<byte> &key)
+    {
+        if (key.size() != PartialLabel::SaveSize) {
+            throw runtime_error("Invalid node key in storage segment");
+        }
+
+        PartialLabel label;
+        label.load(gsl::span<const byte, PartialLabel::SaveSize>(key.data(), key.size()));
+        return label;
+    }
+
+    vector<byte> store_element_value(const store_value_type &value)
+    {
+        vector<byte> result;
+        result.reserve(value.payload.size() + value.randomness.size());
+        result.insert(result.end(), value.payload.begin(), value.payload.end());
+        result.insert(result.end(), value.randomness.begin(), value.randomness.end());
+        return result;
+    }
+
+    store_value_type load_store_element_value(const vector<byte> &value)
+    {
+        if (value.size() < randomness_size) {
+            throw runtime_error("Invalid store element in storage segment");
+        }
+
+        store_value_type result;
+        size_t payload_size = value.size() - randomness_size;
+        result.payload.assign(value.begin(), value.begin() + payload_size);
+        copy(value.begin() + payload_size, value.end(), result.randomness.begin());
+        return result;
+    }
+} // namespace
+
+struct FileStorage::Segment {
+    Segment(uint64_t segment_id, string segment_path)
+        : id(segment_id), path(std::move(segment_path))
+    {}
+
+    ~Segment()
+    {
+        if (nullptr != writer) {
+            fclose(writer);
+        }
+        if (nullptr != reader) {
+            fclose(reader);
+        }
+        if (removed) {
+            error_code ec;
+            filesystem::remove(path, ec);
+        }
+    }
+
+    uint64_t id;
+
+    string path;
+
+    // Only open for the active segment
+    FILE *writer = nullptr;
+
+    mutex read_mtx;
+
+    FILE *reader = nullptr;
+
+    // Size and live bytes are protected by the index mutex
+    uint64_t size = 0;
+
+    uint64_t live_bytes = 0;
+
+    // The file is removed when the last reference to a compacted segment is released
+    atomic_bool removed = false;
+};
+
+FileStorage::FileStorage(const string &directory, size_t segment_size, bool sync)
+    : directory_(directory), segment_size_(segment_size), sync_(sync)
+{
+    if (directory_.empty()) {
+        throw invalid_argument("directory cannot be empty");
+    }
+    if (segment_size_ == 0) {
+        throw invalid_argument("segment_size cannot be zero");
+    }
+
+    recover();
+    compaction_thread_ = thread(&FileStorage::run_compaction, this);
+}
+
+FileStorage::~FileStorage()
+{
+    {
+        lock_guard<mutex> lock(compaction_request_mtx_);
+        stop_compaction_ = true;
+    }
+    compaction_cv_.notify_one();
+    if (compaction_thread_.joinable()) {
+        compaction_thread_.join();
+    }
+
+    try {
+        lock_guard<mutex> lock(write_mtx_);
+        if (nullptr != active_segment_ && nullptr != active_segment_->writer) {
+            sync_file(active_segment_->writer, sync_, "storage segment");
+        }
+    } catch (...) {
+    }
+}
+
+void FileStorage::recover()
+{
+    filesystem::create_directories(directory_);
+
+    vector<uint64_t> segment_ids;
+    for (const auto &entry : filesystem::directory_iterator(directory_)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+
+        auto segment_id = parse_segment_id(entry.path().filename().string());
+        if (segment_id) {
+            segment_ids.push_back(*segment_id);
+        }
+    }
+    sort(segment_ids.begin(), segment_ids.end());
+
+    // Replay the segments from oldest to newest
+    for (size_t idx = 0; idx < segment_ids.size(); idx++) {
+        auto segment =
+            make_shared<Segment>(segment_ids[idx], segment_path(directory_, segment_ids[idx]));
+        segments_[segment->id] = segment;
+        recover_segment(*segment, idx + 1 == segment_ids.size());
+    }
+
+    // Keep appending to the newest segment unless it is full
+    if (segment_ids.empty()) {
+        open_segment(1);
+        sync_directory(directory_);
+    } else if (segments_.rbegin()->second->size >= segment_size_) {
+        open_segment(segment_ids.back() + 1);
+        sync_directory(directory_);
+    } else {
+        open_segment(segment_ids.back());
+    }
+}
+
+size_t FileStorage::recover_segment(Segment &segment, bool last)
+{
+    vector<byte> data = read_file(segment.path);
+    vector<ParsedRecord> records;
+    size_t valid_size = parse_segment(data, records);
+    if (valid_size != data.size()) {
+        // Only the newest segment can end with an incomplete batch
+        if (!last) {
+            throw runtime_error("Storage segment is corrupted: " + segment.path);
+        }
+        filesystem::resize_file(segment.path, valid_size);
+    }
+    segment.size = valid_size;
+
+    for (auto &parsed : records) {
+        Record record{
+            static_cast<RecordType>(parsed.type), parsed.trie_id, parsed.sequence, parsed.key, {}
+        };
+        Location location{
+            segment.id, parsed.value_offset, parsed.value_size, parsed.record_size, parsed.sequence
+        };
+        apply(record, location, nullptr, true);
+        last_sequence_ = max(last_sequence_, parsed.sequence);
+    }
+
+    return records.size();
+}
+
+void FileStorage::open_segment(uint64_t segment_id)
+{
+    shared_ptr<Segment> segment;
+    {
+        shared_lock<shared_mutex> lock(index_mtx_);
+        auto existing = segments_.find(segment_id);
+        if (existing != segments_.end()) {
+            segment = existing->second;
+        }
+    }
+    if (nullptr == segment) {
+        segment = make_shared<Segment>(segment_id, segment_path(directory_, segment_id));
+    }
+
+    segment->writer = fopen(segment->path.c_str(), "ab");
+    if (nullptr == segment->writer) {
+        throw runtime_error("Failed to open storage segment " + segment->path);
+    }
+
+    unique_lock<shared_mutex> lock(index_mtx_);
+    segments_[segment_id] = segment;
+    active_segment_ = segment;
+}
+
+vector<FileStorage::Location> FileStorage::append(
+    vector<Record> &records, const vector<Location> *expected)
+{
+    lock_guard<mutex> write_lock(write_mtx_);
+    if (write_failed_) {
+        throw runtime_error("Storage cannot be written after a failed write: " + directory_);
+    }
+
+    // New records share the next sequence number; records moved by compaction keep their own
+    if (nullptr == expected) {
+        uint64_t sequence = ++last_sequence_;
+        for (auto &record : records) {
+            record.sequence = sequence;
+        }
+    }
+
+    // Build the whole batch in memory so that it is written with a single call
+    vector<byte> batch(batch_header_size);
+    vector<pair<uint64_t, uint32_t>> value_offsets;
+    value_offsets.reserve(records.size());
+    for (const auto &record : records) {
+        size_t start = batch.size();
+        append_value(batch, static_cast<uint8_t>(record.type));
+        append_value(batch, record.trie_id);
+        append_value(batch, record.sequence);
+        append_value(batch, static_cast<uint32_t>(record.key.size()));
+        append_value(batch, static_cast<uint32_t>(record.value.size()));
+        batch.insert(batch.end(), record.key.begin(), record.key.end());
+        value_offsets.emplace_back(batch.size(), static_cast<uint32_t>(0));
+        batch.insert(batch.end(), record.value.begin(), record.value.end());
+        value_offsets.back().second = static_cast<uint32_t>(batch.size() - start);
+    }
+
+    uint64_t payload_size = batch.size() - batch_header_size;
+    write_value(batch, 0, batch_magic);
+    write_value(batch, sizeof(uint32_t), static_cast<uint32_t>(records.size()));
+    write_value(batch, 2 * sizeof(uint32_t), payload_size);
+    write_value(
+        batch,
+        2 * sizeof(uint32_t) + sizeof(uint64_t),
+        checksum(batch.data() + batch_header_size, payload_size));
+
+    // Start a new segment if the batch does not fit in the active one
+    bool sealed = false;
+    if (active_segment_->size > 0 && active_segment_->size + batch.size() > segment_size_) {
+        sync_file(active_segment_->writer, sync_, "storage segment");
+        fclose(active_segment_->writer);
+        active_segment_->writer = nullptr;
+        try {
+            open_segment(active_segment_->id + 1);
+        } catch (...) {
+            write_failed_ = true;
+            throw;
+        }
+        sync_directory(directory_);
+        sealed = true;
+    }
+
+    shared_ptr<Segment> segment = active_segment_;
+    uint64_t batch_offset = segment->size;
+    bool written = fwrite(batch.data(), 1, batch.size(), segment->writer) == batch.size();
+    try {
+        if (!written) {
+            throw runtime_error("Failed to write storage segment " + segment->path);
+        }
+        sync_file(segment->writer, sync_, "storage segment");
+    } catch (...) {
+        // Drop whatever part of the batch reached the file, so that later batches are not
+        // appended after an incomplete one
+        fclose(segment->writer);
+        error_code ec;
+        filesystem::resize_file(segment->path, batch_offset, ec);
+        segment->writer = fopen(segment->path.c_str(), "ab");
+        if (nullptr == segment->writer) {
+            write_failed_ = true;
+        }
+        throw;
+    }
+
+    vector<Location> locations(records.size());
+    {
+        unique_lock<shared_mutex> lock(index_mtx_);
+        segment->size += batch.size();
+        for (size_t idx = 0; idx < records.size(); idx++) {
+            uint32_t record_size = value_offsets[idx].second;
+            uint64_t value_offset = batch_offset + value_offsets[idx].first;
+            uint32_t value_size = static_cast<uint32_t>(records[idx].value.size());
+            uint64_t sequence = records[idx].sequence;
+            locations[idx] = { segment->id, value_offset, value_size, record_size, sequence };
+            apply(
+                records[idx],
+                locations[idx],
+                nullptr == expected ? nullptr : &(*expected)[idx],
+                false);
+        }
+    }
+
+    if (sealed) {
+        request_compaction();
+    }
+
+    return locations;
+}
+
+void FileStorage::apply(
+    const Record &record, const Location &location, const Location *expected, bool recovering)
+{
+    auto &segment = segments_.at(location.segment_id);
+
+    if (record.type == RecordType::DeleteTrie) {
+        // Drop everything of the trie that is older than the deletion. The deletion record
+        // itself stays live so that the dropped records are not resurrected on recovery.
+        segment->live_bytes += location.record_size;
+        uint64_t &tombstone = tombstones_[record.trie_id];
+        tombstone = max(tombstone, location.sequence);
+
+        auto trie_index = index_.find(record.trie_id);
+        if (trie_index == index_.end()) {
+            return;
+        }
+
+        auto &entries = trie_index->second;
+        if (entries.trie && entries.trie->sequence <= tombstone) {
+            release(*entries.trie);
+            entries.trie.reset();
+        }
+        for (auto it = entries.nodes.begin(); it != entries.nodes.end();) {
+            if (it->second.sequence <= tombstone) {
+                release(it->second);
+                it = entries.nodes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (auto it = entries.store_elements.begin(); it != entries.store_elements.end();) {
+            if (it->second.sequence <= tombstone) {
+                release(it->second);
+                it = entries.store_elements.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (!entries.trie && entries.nodes.empty() && entries.store_elements.empty()) {
+            index_.erase(trie_index);
+        }
+
+        return;
+    }
+
+    auto tombstone = tombstones_.find(record.trie_id);
+    if (tombstone != tombstones_.end() && location.sequence <= tombstone->second) {
+        return;
+    }
+
+    Location *current = find(record.trie_id, record.type, record.key);
+    if (nullptr != expected) {
+        // A record moved by compaction only replaces the record it was copied from
+        if (nullptr == current || current->segment_id != expected->segment_id ||
+            current->offset != expected->offset) {
+            return;
+        }
+    } else if (recovering && nullptr != current && current->sequence > location.sequence) {
+        // Compaction moves old records to newer segments, so recovery may see them late
+        return;
+    }
+
+    if (nullptr != current) {
+        release(*current);
+        *current = location;
+    } else {
+        auto &entries = index_[record.trie_id];
+        switch (record.type) {
+        case RecordType::Node:
+            entries.nodes.emplace(key_label(record.key), location);
+            break;
+        case RecordType::Trie:
+            entries.trie = location;
+            break;
+        case RecordType::StoreElement:
+            entries.store_elements.emplace(record.key, location);
+            break;
+        default:
+            throw runtime_error("Invalid record type in storage segment");
+        }
+    }
+    segment->live_bytes += location.record_size;
+}
+
+void FileStorage::release(const Location &location)
+{
+    auto segment = segments_.find(location.segment_id);
+    if (segment != segments_.end()) {
+        segment->second->live_bytes -= location.record_size;
+    }
+}
+
+FileStorage::Location *FileStorage::find(
+    trie_id_type trie_id, RecordType type, const vector<byte> &key)
+{
+    auto trie_index = index_.find(trie_id);
+    if (trie_index == index_.end()) {
+        return nullptr;
+    }
+
+    auto &entries = trie_index->second;
+    switch (type) {
+    case RecordType::Node: {
+        auto node = entries.nodes.find(key_label(key));
+        return node == entries.nodes.end() ? nullptr : &node->second;
+    }
+    case RecordType::Trie:
+        return entries.trie ? &*entries.trie : nullptr;
+    case RecordType::StoreElement: {
+        auto store_element = entries.store_elements.find(key);
+        return store_element == entries.store_elements.end() ? nullptr : &store_element->second;
+    }
+    default:
+        return nullptr;
+    }
+}
+
+bool FileStorage::read(
+    trie_id_type trie_id, RecordType type, const vector<byte> &key, vector<byte> &value)
+{
+    Location location;
+    shared_ptr<Segment> segment;
+    {
+        shared_lock<shared_mutex> lock(index_mtx_);
+        Location *current = find(trie_id, type, key);
+        if (nullptr == current) {
+            return false;
+        }
+
+        location = *current;
+        segment = segments_.at(location.segment_id);
+    }
+
+    // The segment stays readable while we hold a reference, even if it is compacted meanwhile
+    lock_guard<mutex> lock(segment->read_mtx);
+    if (nullptr == segment->reader) {
+        segment->reader = fopen(segment->path.c_str(), "rb");
+        if (nullptr == segment->reader) {
+            throw runtime_error("Failed to open storage segment " + segment->path);
+        }
+    }
+
+    value.resize(location.size);
+    if (seek_file(segment->reader, location.offset) != 0 ||
+        fread(value.data(), 1, value.size(), segment->reader) != value.size()) {
+        throw runtime_error("Failed to read storage segment " + segment->path);
+    }
+
+    return true;
+}
+
+bool FileStorage::load_ctnode(
+    trie_id_type trie_id, const PartialLabel &node_id, shared_ptr<Storage>, CTNodeStored &node)
+{
+    vector<byte> value;
+    if (!read(trie_id, RecordType::Node, label_key(node_id), value)) {
+        return false;
+    }
+
+    // Nodes written before the compact format was introduced are still read
+    if (CTNodeStored::IsCompact(value)) {
+        CTNodeStored::LoadCompact(value, node);
+    } else {
+        node = get<0>(CTNodeStored::Load(value, nullptr));
+    }
+    return true;
+}
+
+void FileStorage::save_ctnode(trie_id_type trie_id, const CTNodeStored &node)
+{
+    vector<Record> records(1);
+    records[0] = { RecordType::Node, trie_id, 0, label_key(node.label()), {} };
+    records[0].value.resize(node.compact_save_size());
+    node.save_compact(records[0].value);
+    append(records);
+}
+
+bool FileStorage::load_compressed_trie(trie_id_type trie_id, CompressedTrie &trie)
+{
+    vector<byte> value;
+    if (!read(trie_id, RecordType::Trie, {}, value)) {
+        return false;
+    }
+
+    trie = *CompressedTrie::Load(value, nullptr).first;
+    return true;
+}
+
+void FileStorage::save_compressed_trie(const CompressedTrie &trie)
+{
+    vector<Record> records(1);
+    records[0] = { RecordType::Trie, trie.id(), 0, {}, {} };
+    trie.save(records[0].value);
+    append(records);
+}
+
+bool FileStorage::load_store_element(
+    trie_id_type trie_id, const vector<byte> &key, store_value_type &value)
+{
+    vector<byte> stored_value;
+    if (!read(trie_id, RecordType::StoreElement, key, stored_value)) {
+        return false;
+    }
+
+    value = load_store_element_value(stored_value);
+    return true;
+}
+
+void FileStorage::save_store_element(
+    trie_id_type trie_id, const vector<byte> &key, const store_value_type &value)
+{
+    vector<Record> records(1);
+    records[0] = { RecordType::StoreElement, trie_id, 0, key, store_element_value(value) };
+    append(records);
+}
+
+void FileStorage::save_store_elements(
+    trie_id_type trie_id, const vector<pair<vector<byte>, store_value_type>> &store_elements)
+{
+    if (store_elements.empty()) {
+        return;
+    }
+
+    vector<Record> records;
+    records.reserve(store_elements.size());
+    for (const auto &store_element : store_elements) {
+        records.push_back(
+            { RecordType::StoreElement,
+              trie_id,
+              0,
+              store_element.first,
+              store_element_value(store_element.second) });
+    }
+    append(records);
+}
+
+void FileStorage::flush(trie_id_type)
+{
+    // Nothing to do because every batch is synced when it is written
+}
+
+void FileStorage::flush(
+    trie_id_type trie_id,
+    const vector<CTNodeStored> &nodes,
+    const vector<CompressedTrie> &tries,
+    const vector<pair<vector<byte>, store_value_type>> &store_elements)
+{
+    vector<Record> records;
+    records.reserve(nodes.size() + tries.size() + store_elements.size());
+    for (const auto &store_element : store_elements) {
+        records.push_back(
+            { RecordType::StoreElement,
+              trie_id,
+              0,
+              store_element.first,
+              store_element_value(store_element.second) });
+    }
+    for (const auto &node : nodes) {
+        records.push_back({ RecordType::Node, trie_id, 0, label_key(node.label()), {} });
+        records.back().value.resize(node.compact_save_size());
+        node.save_compact(records.back().value);
+    }
+    for (const auto &trie : tries) {
+        records.push_back({ RecordType::Trie, trie.id(), 0, {}, {} });
+        trie.save(records.back().value);
+    }
+
+    if (!records.empty()) {
+        append(records);
+    }
+}
+
+void FileStorage::add_ctnode(trie_id_type, const CTNodeStored &)
+{
+    throw runtime_error("Does not make sense for this Storage implementation");
+}
+
+void FileStorage::add_compressed_trie(const CompressedTrie &)
+{
+    throw runtime_error("Does not make sense for this Storage implementation");
+}
+
+void FileStorage::add_store_element(trie_id_type, const vector<byte> &, const store_value_type &)
+{
+    throw runtime_error("Does not make sense for this Storage implementation");
+}
+
+size_t FileStorage::get_compressed_trie_epoch(trie_id_type trie_id)
+{
+    size_t result = 0;
+    CompressedTrie trie;
+
+    if (load_compressed_trie(trie_id, trie)) {
+        result = trie.epoch();
+    }
+
+    return result;
+}
+
+void FileStorage::load_updated_elements(size_t, trie_id_type, shared_ptr<Storage>)
+{
+    // Nothing to do for this implementation
+}
+
+void FileStorage::delete_ozks(trie_id_type trie_id)
+{
+    vector<Record> records(1);
+    records[0] = { RecordType::DeleteTrie, trie_id, 0, {}, {} };
+    append(records);
+    request_compaction();
+}
+
+size_t FileStorage::compact()
+{
+    lock_guard<mutex> lock(compaction_mtx_);
+
+    vector<shared_ptr<Segment>> candidates;
+    {
+        shared_lock<shared_mutex> index_lock(index_mtx_);
+        double threshold = compaction_threshold_;
+        for (const auto &segment : segments_) {
+            if (segment.second == active_segment_) {
+                continue;
+            }
+            if (static_cast<double>(segment.second->live_bytes) <
+                threshold * static_cast<double>(segment.second->size)) {
+                candidates.push_back(segment.second);
+            }
+        }
+    }
+
+    size_t result = 0;
+    for (auto &segment : candidates) {
+        if (compact_segment(std::move(segment))) {
+            result++;
+        }
+    }
+
+    return result;
+}
+
+bool FileStorage::compact_segment(shared_ptr<Segment> segment)
+{
+    // The segment is sealed, so its contents no longer change
+    vector<byte> data = read_file(segment->path);
+    vector<ParsedRecord> parsed_records;
+    parse_segment(data, parsed_records);
+
+    // Collect the records that are still referenced by the index, and all deletions
+    vector<Record> records;
+    vector<Location> expected;
+    size_t batch_size = 0;
+    auto move_records = [&]() {
+        if (!records.empty()) {
+            append(records, &expected);
+            records.clear();
+            expected.clear();
+            batch_size = 0;
+        }
+    };
+
+    for (auto &parsed : parsed_records) {
+        RecordType type = static_cast<RecordType>(parsed.type);
+        Location location{
+            segment->id, parsed.value_offset, parsed.value_size, parsed.record_size, parsed.sequence
+        };
+        if (type != RecordType::DeleteTrie) {
+            shared_lock<shared_mutex> lock(index_mtx_);
+            Location *current = find(parsed.trie_id, type, parsed.key);
+            if (nullptr == current || current->segment_id != segment->id ||
+                current->offset != location.offset) {
+                continue;
+            }
+        }
+
+        auto value_begin = data.begin() + static_cast<ptrdiff_t>(parsed.value_offset);
+        records.push_back(
+            { type,
+              parsed.trie_id,
+              parsed.sequence,
+              std::move(parsed.key),
+              vector<byte>(value_begin, value_begin + parsed.value_size) });
+        expected.push_back(location);
+
+        // Keep the moved batches within the segment size
+        batch_size += parsed.record_size;
+        if (batch_size >= segment_size_ / 2) {
+            move_records();
+        }
+    }
+    move_records();
+
+    {
+        unique_lock<shared_mutex> lock(index_mtx_);
+        segments_.erase(segment->id);
+    }
+    segment->removed = true;
+
+    return true;
+}
+
+void FileStorage::request_compaction()
+{
+    {
+        lock_guard<mutex> lock(compaction_request_mtx_);
+        compaction_requested_ = true;
+    }
+    compaction_cv_.notify_one();
+}
+
+void FileStorage::run_compaction()
+{
+    while (true) {
+        {
+            unique_lock<mutex> lock(compaction_request_mtx_);
+            compaction_cv_.wait(
+                lock, [this]() { return compaction_requested_ || stop_compaction_; });
+            if (stop_compaction_) {
+                return;
+            }
+            compaction_requested_ = false;
+        }
+
+        try {
+            compact();
+        } catch (...) {
+            // Compaction is retried the next time it is requested
+        }
+    }
+}
+
+void FileStorage::set_compaction_threshold(double compaction_threshold)
+{
+    if (compaction_threshold < 0.0 || compaction_threshold > 1.0) {
+        throw invalid_argument("compaction_threshold must be between 0 and 1");
+    }
+
+    unique_lock<shared_mutex> lock(index_mtx_);
+    compaction_threshold_ = compaction_threshold;
+}
+
+double FileStorage::compaction_threshold() const
+{
+    shared_lock<shared_mutex> lock(index_mtx_);
+    return compaction_threshold_;
+}
+
+size_t FileStorage::segment_count() const
+{
+    shared_lock<shared_mutex> lock(index_mtx_);
+    return segments_.size();
+}
+
+size_t FileStorage::byte_count() const
+{
+    shared_lock<shared_mutex> lock(index_mtx_);
+    size_t result = 0;
+    for (const auto &segment : segments_) {
+        result += static_cast<size_t>(segment.second->size);
+    }
+
+    return result;
+}
+
+size_t FileStorage::live_byte_count() const
+{
+    shared_lock<shared_mutex> lock(index_mtx_);
+    size_t result = 0;
+    for (const auto &segment : segments_) {
+        result += static_cast<size_t>(segment.second->live_bytes);
+    }
+
+    return result;
+}
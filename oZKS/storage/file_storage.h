@@ -0,0 +1,322 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+// STD
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// OZKS
+#include "oZKS/storage/batch_storage.h"
+#include "oZKS/utilities.h"
+
+namespace ozks {
+    namespace storage {
+        /**
+        Durable storage that keeps nodes, tries and store elements in append-only segment files in
+        a local directory. Every flush is written to the active segment as a single checksummed
+        batch and synced to disk before it returns, so a batch is either recovered completely
+        after a crash or not at all. An in-memory index maps every trie, node label and store
+        element key to the location of its latest record; it is rebuilt from the segments when
+        the storage is opened.
+
+        When the active segment exceeds the segment size a new segment is started. Sealed
+        segments in which most records have been superseded or deleted are compacted on a
+        background thread: their live records are appended to the active segment and the
+        segment file is removed. All operations are thread-safe.
+        */
+        class FileStorage : public BatchStorage {
+        public:
+            // Default size after which a new segment file is started
+            static constexpr std::size_t default_segment_size = std::size_t(64) << 20;
+
+            // Default fraction of live data below which a sealed segment is compacted
+            static constexpr double default_compaction_threshold = 0.5;
+
+            /**
+            Opens the storage in the given directory, creating the directory if it does not exist,
+            and rebuilds the index from the segment files found there. An incomplete batch at the
+            end of the newest segment is discarded. If sync is false, batches are handed to the
+            operating system but not synced to disk, which is faster but does not survive a power
+            loss.
+            */
+            FileStorage(
+                const std::string &directory,
+                std::size_t segment_size = default_segment_size,
+                bool sync = true);
+
+            virtual ~FileStorage();
+
+            /**
+            Get a node from storage
+            */
+            bool load_ctnode(
+                trie_id_type trie_id,
+                const PartialLabel &node_id,
+                std::shared_ptr<Storage> storage,
+                CTNodeStored &node) override;
+
+            /**
+            Save a node to storage
+            */
+            void save_ctnode(trie_id_type trie_id, const CTNodeStored &node) override;
+
+            /**
+            Get a compressed trie from storage
+            */
+            bool load_compressed_trie(trie_id_type trie_id, CompressedTrie &trie) override;
+
+            /**
+            Save a compressed trie to storage
+            */
+            void save_compressed_trie(const CompressedTrie &trie) override;
+
+            /**
+            Get a store element from storage
+            */
+            bool load_store_element(
+                trie_id_type trie_id,
+                const std::vector<std::byte> &key,
+                store_value_type &value) override;
+
+            /**
+            Save a store element to storage
+            */
+            void save_store_element(
+                trie_id_type trie_id,
+                const std::vector<std::byte> &key,
+                const store_value_type &value) override;
+
+            /**
+            Save a batch of store elements to storage
+            */
+            void save_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::pair<std::vector<std::byte>, store_value_type>>
+                    &store_elements) override;
+
+            /**
+            Flush changes if appropriate
+            */
+            void flush(trie_id_type trie_id) override;
+
+            /**
+            Flush given sets of nodes, tries and store elements as a single batch
+            */
+            void flush(
+                trie_id_type trie_id,
+                const std::vector<CTNodeStored> &nodes,
+                const std::vector<CompressedTrie> &tries,
+                const std::vector<std::pair<std::vector<std::byte>, store_value_type>>
+                    &store_elements) override;
+
+            /**
+            Add an existing node to the current storage.
+            */
+            void add_ctnode(trie_id_type trie_id, const CTNodeStored &node) override;
+
+            /**
+            Add an existing compresssed trie to the current storage.
+            */
+            void add_compressed_trie(const CompressedTrie &trie) override;
+
+            /**
+            Add an existing store element to the current storage
+            */
+            void add_store_element(
+                trie_id_type trie_id,
+                const std::vector<std::byte> &key,
+                const store_value_type &value) override;
+
+            /**
+            Get the latest epoch for the given compressed trie
+            */
+            std::size_t get_compressed_trie_epoch(trie_id_type trie_id) override;
+
+            /**
+            Load updated elements for the given epoch
+            */
+            void load_updated_elements(
+                std::size_t epoch, trie_id_type trie_id, std::shared_ptr<Storage> storage) override;
+
+            /**
+            Delete nodes for the given trie from storage, as well as the trie itself and related
+            ozks instance.
+            */
+            void delete_ozks(trie_id_type trie_id) override;
+
+            /**
+            Compact all sealed segments whose fraction of live data is below the compaction
+            threshold, and return the number of segments that were removed. This is also done
+            automatically on a background thread whenever a segment is sealed or a trie is
+            deleted.
+            */
+            std::size_t compact();
+
+            /**
+            Set the fraction of live data below which a sealed segment is compacted
+            */
+            void set_compaction_threshold(double compaction_threshold);
+
+            /**
+            Get the fraction of live data below which a sealed segment is compacted
+            */
+            double compaction_threshold() const;
+
+            /**
+            Get the directory holding the segment files
+            */
+            const std::string &directory() const
+            {
+                return directory_;
+            }
+
+            /**
+            Get the number of segment files
+            */
+            std::size_t segment_count() const;
+
+            /**
+            Get the total size of the segment files in bytes
+            */
+            std::size_t byte_count() const;
+
+            /**
+            Get the size of the records that are still referenced by the index in bytes
+            */
+            std::size_t live_byte_count() const;
+
+        private:
+            enum class RecordType : std::uint8_t {
+                Node = 1,
+                Trie = 2,
+                StoreElement = 3,
+                DeleteTrie = 4
+            };
+
+            // A record to be appended to the log
+            struct Record {
+                RecordType type;
+
+                trie_id_type trie_id;
+
+                std::uint64_t sequence;
+
+                std::vector<std::byte> key;
+
+                std::vector<std::byte> value;
+            };
+
+            // Location of the latest record for a trie, node or store element
+            struct Location {
+                std::uint64_t segment_id;
+
+                std::uint64_t offset;
+
+                std::uint32_t size;
+
+                std::uint32_t record_size;
+
+                std::uint64_t sequence;
+            };
+
+            // Locations of the latest records of a single trie
+            struct TrieIndex {
+                std::optional<Location> trie;
+
+                std::unordered_map<PartialLabel, Location> nodes;
+
+                std::unordered_map<std::vector<std::byte>, Location, utils::byte_vector_hash>
+                    store_elements;
+            };
+
+            struct Segment;
+
+            void recover();
+
+            std::size_t recover_segment(Segment &segment, bool last);
+
+            void open_segment(std::uint64_t segment_id);
+
+            std::vector<Location> append(
+                std::vector<Record> &records, const std::vector<Location> *expected = nullptr);
+
+            void apply(
+                const Record &record,
+                const Location &location,
+                const Location *expected,
+                bool recovering);
+
+            void release(const Location &location);
+
+            Location *find(
+                trie_id_type trie_id, RecordType type, const std::vector<std::byte> &key);
+
+            bool read(
+                trie_id_type trie_id,
+                RecordType type,
+                const std::vector<std::byte> &key,
+                std::vector<std::byte> &value);
+
+            bool compact_segment(std::shared_ptr<Segment> segment);
+
+            void request_compaction();
+
+            void run_compaction();
+
+            std::string directory_;
+
+            std::size_t segment_size_;
+
+            bool sync_;
+
+            double compaction_threshold_ = default_compaction_threshold;
+
+            // Protects the index, the tombstones, the segment map and the compaction threshold
+            mutable std::shared_mutex index_mtx_;
+
+            std::unordered_map<trie_id_type, TrieIndex> index_;
+
+            // Sequence number of the latest deletion of each deleted trie
+            std::unordered_map<trie_id_type, std::uint64_t> tombstones_;
+
+            std::map<std::uint64_t, std::shared_ptr<Segment>> segments_;
+
+            // Serializes appends to the active segment
+            std::mutex write_mtx_;
+
+            std::shared_ptr<Segment> active_segment_;
+
+            std::uint64_t last_sequence_ = 0;
+
+            // Set when the active segment could not be reopened after a failed write; all later
+            // writes are rejected, since the file may no longer end at a batch boundary
+            bool write_failed_ = false;
+
+            // Only one compaction runs at a time
+            std::mutex compaction_mtx_;
+
+            std::mutex compaction_request_mtx_;
+
+            std::condition_variable compaction_cv_;
+
+            bool compaction_requested_ = false;
+
+            bool stop_compaction_ = false;
+
+            std::thread compaction_thread_;
+        };
+    } // namespace storage
+} // namespace ozks
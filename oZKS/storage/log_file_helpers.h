@@ -0,0 +1,91 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+// STD
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace ozks {
+    namespace storage {
+        /**
+        Append the bytes of a value to a buffer
+        */
+        template <typename T>
+        void append_value(std::vector<std::byte> &buffer, T value)
+        {
+            const std::byte *bytes = reinterpret_cast<const std::byte *>(&value);
+            buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+        }
+
+        /**
+        Overwrite the bytes at the given position of a buffer with a value
+        */
+        template <typename T>
+        void write_value(std::vector<std::byte> &buffer, std::size_t position, T value)
+        {
+            std::memcpy(buffer.data() + position, &value, sizeof(T));
+        }
+
+        /**
+        Read a value from the given position of a buffer
+        */
+        template <typename T>
+        T read_value(const std::vector<std::byte> &buffer, std::size_t position)
+        {
+            T value;
+            std::memcpy(&value, buffer.data() + position, sizeof(T));
+            return value;
+        }
+
+        /**
+        Compute the checksum of a log record
+        */
+        inline std::uint64_t checksum(const std::byte *data, std::size_t size)
+        {
+            // 64-bit FNV-1a; this only needs to detect torn and corrupted writes
+            std::uint64_t result = 0xCBF29CE484222325ULL;
+            for (std::size_t idx = 0; idx < size; idx++) {
+                result ^= static_cast<std::uint64_t>(data[idx]);
+                result *= 0x100000001B3ULL;
+            }
+
+            return result;
+        }
+
+        /**
+        Flush a log file and, if requested, sync it to disk. The file name is used in the error
+        message when either fails.
+        */
+        inline void sync_file(std::FILE *file, bool sync, const std::string &file_name)
+        {
+            if (std::fflush(file) != 0) {
+                throw std::runtime_error("Failed to write " + file_name);
+            }
+            if (!sync) {
+                return;
+            }
+
+#if defined(_WIN32)
+            int result = _commit(_fileno(file));
+#else
+            int result = fsync(fileno(file));
+#endif
+            if (result != 0) {
+                throw std::runtime_error("Failed to sync " + file_name);
+            }
+        }
+    } // namespace storage
+} // namespace ozks
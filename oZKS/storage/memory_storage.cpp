@@ -10,7 +10,8 @@ using namespace std;
 using namespace ozks;
 using namespace ozks::storage;
 
-MemoryStorage::MemoryStorage()
+MemoryStorage::MemoryStorage(size_t shard_count)
+    : shard_count_(shard_count), tries_(shard_count)
 {}
 
 MemoryStorage::~MemoryStorage()
@@ -22,58 +23,80 @@ bool MemoryStorage::load_ctnode(
     shared_ptr<Storage> /* unused */,
     CTNodeStored &node)
 {
-    StorageNodeKey node_key{ trie_id, node_id };
-    auto node_it = nodes_.find(node_key);
-    if (node_it == nodes_.end()) {
+    auto partition = partitions_.get(trie_id);
+    if (nullptr == partition)
         return false;
-    }
 
-    node = node_it->second;
-    return true;
+    return partition->nodes.get(node_id, node);
 }
 
 void MemoryStorage::save_ctnode(trie_id_type trie_id, const CTNodeStored &node)
 {
-    StorageNodeKey key(trie_id, node.label());
-    nodes_[key] = node;
+    partitions_.get_or_create(trie_id, shard_count_)->nodes.set(node.label(), node);
 }
 
 bool MemoryStorage::load_compressed_trie(trie_id_type trie_id, CompressedTrie &trie)
 {
     StorageTrieKey trie_key{ trie_id };
-    auto trie_it = tries_.find(trie_key);
-    if (trie_it == tries_.end()) {
-        return false;
-    }
-
-    trie = trie_it->second;
-    return true;
+    return tries_.get(trie_key, trie);
 }
 
 void MemoryStorage::save_compressed_trie(const CompressedTrie &trie)
 {
     StorageTrieKey key(trie.id());
-    tries_[key] = trie;
+    tries_.set(key, trie);
 }
 
 bool MemoryStorage::load_store_element(
     trie_id_type trie_id, const vector<byte> &key, store_value_type &value)
 {
-    StorageStoreElementKey se_key(trie_id, key);
-    auto se_it = store_.find(se_key);
-    if (se_it == store_.end()) {
+    auto partition = partitions_.get(trie_id);
+    if (nullptr == partition)
         return false;
-    }
 
-    value = se_it->second;
-    return true;
+    return partition->store.get(key, value);
 }
 
 void MemoryStorage::save_store_element(
     trie_id_type trie_id, const vector<byte> &key, const store_value_type &value)
 {
-    StorageStoreElementKey se_key(trie_id, key);
-    store_[se_key] = value;
+    partitions_.get_or_create(trie_id, shard_count_)->store.set(key, value);
+}
+
+size_t MemoryStorage::load_store_elements(
+    trie_id_type trie_id,
+    const vector<vector<byte>> &keys,
+    vector<optional<store_value_type>> &values)
+{
+    size_t found = 0;
+    values.assign(keys.size(), nullopt);
+    auto partition = partitions_.get(trie_id);
+    if (nullptr == partition) {
+        return found;
+    }
+
+    for (size_t idx = 0; idx < keys.size(); idx++) {
+        store_value_type value;
+        if (partition->store.get(keys[idx], value)) {
+            values[idx] = std::move(value);
+            found++;
+        }
+    }
+
+    return found;
+}
+
+void MemoryStorage::save_store_elements(
+    trie_id_type trie_id, const vector<pair<vector<byte>, store_value_type>> &store_elements)
+{
+    if (store_elements.empty()) {
+        return;
+    }
+
+    auto partition = partitions_.get_or_create(trie_id, shard_count_);
+    for (const auto &store_element : store_elements) {
+        partition->store.set(store_element.first, store_element.second);
+    }
 }
 
 void MemoryStorage::flush(trie_id_type)
@@ -115,20 +138,9 @@ void MemoryStorage::load_updated_elements(std::size_t, trie_id_type, shared_ptr<
 
 void MemoryStorage::delete_ozks(trie_id_type trie_id)
 {
-    {
-        // Find nodes to delete
-        vector<StorageNodeKey> nodes_to_delete;
-        for (const auto &node : nodes_) {
-            if (node.first.trie_id() == trie_id) {
-                nodes_to_delete.push_back(node.first);
-            }
-        }
-
-        // Do the deletion
-        for (const auto &node : nodes_to_delete) {
-            nodes_.erase(node);
-        }
-    }
+    // The nodes and store elements of the trie are destroyed when the partition is released,
+    // without holding any lock needed by operations on other tries
+    auto partition = partitions_.erase(trie_id);
 
     // There should be a single compressed trie with the id
     StorageTrieKey trie_key(trie_id);
@@ -137,19 +149,36 @@ void MemoryStorage::delete_ozks(trie_id_type trie_id)
     //// There should be a single OZKS instance with the id
     // StorageOZKSKey ozks_key(trie_id);
     // ozks_.erase(ozks_key);
+}
 
-    {
-        // Find store elements to delete
-        vector<StorageStoreElementKey> store_elems_to_delete;
-        for (const auto &se : store_) {
-            if (se.first.trie_id() == trie_id) {
-                store_elems_to_delete.push_back(se.first);
-            }
-        }
+size_t MemoryStorage::node_count() const
+{
+    size_t result = 0;
+    partitions_.for_each([&result](trie_id_type, const TriePartition &partition) {
+        result += partition.nodes.size();
+    });
 
-        // Do the deletion
-        for (const auto &se : store_elems_to_delete) {
-            store_.erase(se);
-        }
-    }
+    return result;
+}
+
+size_t MemoryStorage::node_count(trie_id_type trie_id) const
+{
+    auto partition = partitions_.get(trie_id);
+    return nullptr == partition ? 0 : partition->nodes.size();
+}
+
+size_t MemoryStorage::store_element_count() const
+{
+    size_t result = 0;
+    partitions_.for_each([&result](trie_id_type, const TriePartition &partition) {
+        result += partition.store.size();
+    });
+
+    return result;
+}
+
+size_t MemoryStorage::store_element_count(trie_id_type trie_id) const
+{
+    auto partition = partitions_.get(trie_id);
+    return nullptr == partition ? 0 : partition->store.size();
 }
@@ -4,7 +4,7 @@
 #pragma once
 
 // STD
-#include <unordered_map>
+#include <cstddef>
 #include <vector>
 
 // OZKS
@@ -16,9 +16,19 @@
 
 namespace ozks {
     namespace storage {
+        /**
+        Storage that keeps everything in memory. All operations are thread-safe: the nodes, tries
+        and store elements are kept in sharded maps, so parallel insertion threads and querier
+        threads can share a single instance without external locking. Nodes and store elements
+        are partitioned by trie, so deleting or counting the elements of one trie does not touch
+        the elements of any other trie.
+        */
         class MemoryStorage : public Storage {
         public:
-            MemoryStorage();
+            // Default number of shards of the node and store element maps of each trie
+            static constexpr std::size_t default_shard_count = 16;
+
+            explicit MemoryStorage(std::size_t shard_count = default_shard_count);
             virtual ~MemoryStorage();
 
             /**
@@ -61,6 +71,22 @@ namespace ozks {
                 const std::vector<std::byte> &key,
                 const store_value_type &value) override;
 
+            /**
+            Get a batch of store elements from storage
+            */
+            std::size_t load_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::vector<std::byte>> &keys,
+                std::vector<std::optional<store_value_type>> &values) override;
+
+            /**
+            Save a batch of store elements to storage
+            */
+            void save_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::pair<std::vector<std::byte>, store_value_type>>
+                    &store_elements) override;
+
             /**
             Flush changes if appropriate
             */
@@ -104,18 +130,22 @@ namespace ozks {
             /**
             Get the count of nodes contained in storage
             */
-            std::size_t node_count() const
-            {
-                return nodes_.size();
-            }
+            std::size_t node_count() const;
+
+            /**
+            Get the count of nodes of the given trie contained in storage
+            */
+            std::size_t node_count(trie_id_type trie_id) const;
 
             /**
             Get the count of store elements contained in storage
             */
-            std::size_t store_element_count() const
-            {
-                return store_.size();
-            }
+            std::size_t store_element_count() const;
+
+            /**
+            Get the count of store elements of the given trie contained in storage
+            */
+            std::size_t store_element_count(trie_id_type trie_id) const;
 
             /**
             Get the count of compressed tries contained in storage
@@ -134,15 +164,22 @@ namespace ozks {
             //}
 
         private:
-            std::unordered_map<StorageNodeKey, ozks::CTNodeStored, StorageNodeKeyHasher> nodes_;
-            std::unordered_map<StorageTrieKey, ozks::CompressedTrie, StorageTrieKeyHasher> tries_;
+            // Nodes and store elements of a single trie
+            struct TriePartition {
+                explicit TriePartition(std::size_t shard_count)
+                    : nodes(shard_count), store(shard_count)
+                {}
+
+                ShardedMap<PartialLabel, ozks::CTNodeStored, std::hash<PartialLabel>> nodes;
+                ShardedMap<std::vector<std::byte>, ozks::store_value_type, utils::byte_vector_hash>
+                    store;
+            };
+
+            std::size_t shard_count_;
+            TriePartitionMap<TriePartition> partitions_;
+            ShardedMap<StorageTrieKey, ozks::CompressedTrie, StorageTrieKeyHasher> tries_;
             //            std::unordered_map<StorageOZKSKey, ozks::OZKS, StorageOZKSKeyHasher>
             //            ozks_;
-            std::unordered_map<
-                StorageStoreElementKey,
-                ozks::store_value_type,
-                StorageStoreElementKeyHasher>
-                store_;
         };
     } // namespace storage
 } // namespace ozks
@@ -2,6 +2,8 @@
 // Licensed under the MIT license.
 
 // STD
+#include <algorithm>
+#include <utility>
 
 // OZKS
 #include "oZKS/compressed_trie.h"
@@ -14,7 +16,18 @@ using namespace ozks;
 using namespace ozks::storage;
 
 MemoryStorageBatchInserter::~MemoryStorageBatchInserter()
-{}
+{
+    // Pending asynchronous flushes are still written before the writer stops
+    {
+        lock_guard<mutex> lock(flush_mtx_);
+        stop_flush_ = true;
+    }
+    flush_cv_.notify_all();
+
+    if (flush_thread_.joinable()) {
+        flush_thread_.join();
+    }
+}
 
 bool MemoryStorageBatchInserter::load_ctnode(
     trie_id_type trie_id,
@@ -26,24 +39,96 @@ bool MemoryStorageBatchInserter::load_ctnode(
         throw runtime_error("storage is not initialized");
 
     // First, check unsaved nodes
-    StorageNodeKey key(trie_id, node_id);
-    auto unsaved_node = unsaved_nodes_.find(key);
-    if (unsaved_node != unsaved_nodes_.end()) {
-        node = unsaved_node->second;
-        return true;
+    auto unsaved = unsaved_elements_.find(trie_id);
+    if (unsaved != unsaved_elements_.end()) {
+        auto unsaved_node = unsaved->second.nodes.find(node_id);
+        if (unsaved_node != unsaved->second.nodes.end()) {
+            node = unsaved_node->second;
+            return true;
+        }
     }
 
-    // Second, check backing storage
+    // Second, check nodes that are being flushed
+    for (const auto &frozen : frozen_elements(trie_id)) {
+        auto frozen_node = frozen->elements.nodes.find(node_id);
+        if (frozen_node != frozen->elements.nodes.end()) {
+            node = frozen_node->second;
+            return true;
+        }
+    }
+
+    // Third, check backing storage
     return storage_->load_ctnode(trie_id, node_id, storage, node);
 }
 
+size_t MemoryStorageBatchInserter::load_ctnodes(
+    trie_id_type trie_id,
+    gsl::span<const PartialLabel> node_ids,
+    shared_ptr<Storage> storage,
+    vector<optional<CTNodeStored>> &nodes)
+{
+    if (nullptr == storage_)
+        throw runtime_error("storage is not initialized");
+
+    // First, check unsaved nodes, then nodes that are being flushed
+    auto unsaved = unsaved_elements_.find(trie_id);
+    auto frozen = frozen_elements(trie_id);
+    if (unsaved == unsaved_elements_.end() && frozen.empty()) {
+        return storage_->load_ctnodes(trie_id, node_ids, storage, nodes);
+    }
+
+    vector<const unordered_map<PartialLabel, CTNodeStored> *> buffers;
+    if (unsaved != unsaved_elements_.end()) {
+        buffers.push_back(&unsaved->second.nodes);
+    }
+    for (const auto &frozen_buffer : frozen) {
+        buffers.push_back(&frozen_buffer->elements.nodes);
+    }
+
+    size_t found = 0;
+    vector<size_t> missing;
+    nodes.assign(node_ids.size(), nullopt);
+    for (size_t idx = 0; idx < node_ids.size(); idx++) {
+        for (const auto *buffer : buffers) {
+            auto node = buffer->find(node_ids[idx]);
+            if (node != buffer->end()) {
+                nodes[idx] = node->second;
+                found++;
+                break;
+            }
+        }
+
+        if (!nodes[idx]) {
+            missing.push_back(idx);
+        }
+    }
+
+    if (missing.empty()) {
+        return found;
+    }
+
+    // Last, check backing storage for the rest in a single batch
+    vector<PartialLabel> missing_ids;
+    missing_ids.reserve(missing.size());
+    for (size_t idx : missing) {
+        missing_ids.push_back(node_ids[idx]);
+    }
+
+    vector<optional<CTNodeStored>> missing_nodes;
+    found += storage_->load_ctnodes(trie_id, missing_ids, storage, missing_nodes);
+    for (size_t idx = 0; idx < missing.size(); idx++) {
+        nodes[missing[idx]] = std::move(missing_nodes[idx]);
+    }
+
+    return found;
+}
+
 void MemoryStorageBatchInserter::save_ctnode(trie_id_type trie_id, const CTNodeStored &node)
 {
     if (nullptr == storage_)
         throw runtime_error("storage is not initialized");
 
-    StorageNodeKey key(trie_id, node.label());
-    unsaved_nodes_[key] = node;
+    unsaved_elements_[trie_id].nodes[node.label()] = node;
 }
 
 bool MemoryStorageBatchInserter::load_compressed_trie(trie_id_type trie_id, CompressedTrie &trie)
@@ -59,7 +144,15 @@ bool MemoryStorageBatchInserter::load_compressed_trie(trie_id_type trie_id, Comp
         return true;
     }
 
-    // Second, check backing storage
+    // Second, check tries that are being flushed
+    for (const auto &frozen : frozen_elements(trie_id)) {
+        if (frozen->trie) {
+            trie = *frozen->trie;
+            return true;
+        }
+    }
+
+    // Third, check backing storage
     return storage_->load_compressed_trie(trie_id, trie);
 }
 
@@ -79,14 +172,25 @@ bool MemoryStorageBatchInserter::load_store_element(
         throw runtime_error("storage is not initialized");
 
     // First, check unsaved store elements
-    StorageStoreElementKey sekey(trie_id, key);
-    auto unsaved_store_element = unsaved_store_elements_.find(sekey);
-    if (unsaved_store_element != unsaved_store_elements_.end()) {
-        value = unsaved_store_element->second;
-        return true;
+    auto unsaved = unsaved_elements_.find(trie_id);
+    if (unsaved != unsaved_elements_.end()) {
+        auto unsaved_store_element = unsaved->second.store_elements.find(key);
+        if (unsaved_store_element != unsaved->second.store_elements.end()) {
+            value = unsaved_store_element->second;
+            return true;
+        }
+    }
+
+    // Second, check store elements that are being flushed
+    for (const auto &frozen : frozen_elements(trie_id)) {
+        auto frozen_store_element = frozen->elements.store_elements.find(key);
+        if (frozen_store_element != frozen->elements.store_elements.end()) {
+            value = frozen_store_element->second;
+            return true;
+        }
     }
 
-    // Second, check backing storage
+    // Third, check backing storage
     return storage_->load_store_element(trie_id, key, value);
 }
 
@@ -96,8 +200,82 @@ void MemoryStorageBatchInserter::save_store_element(
     if (nullptr == storage_)
         throw runtime_error("storage is not initialized");
 
-    StorageStoreElementKey sekey(trie_id, key);
-    unsaved_store_elements_[sekey] = value;
+    unsaved_elements_[trie_id].store_elements[key] = value;
+}
+
+size_t MemoryStorageBatchInserter::load_store_elements(
+    trie_id_type trie_id,
+    const vector<vector<byte>> &keys,
+    vector<optional<store_value_type>> &values)
+{
+    if (nullptr == storage_)
+        throw runtime_error("storage is not initialized");
+
+    // First, check unsaved store elements, then store elements that are being flushed
+    auto unsaved = unsaved_elements_.find(trie_id);
+    auto frozen = frozen_elements(trie_id);
+    if (unsaved == unsaved_elements_.end() && frozen.empty()) {
+        return storage_->load_store_elements(trie_id, keys, values);
+    }
+
+    vector<const unordered_map<vector<byte>, store_value_type, utils::byte_vector_hash> *>
+        buffers;
+    if (unsaved != unsaved_elements_.end()) {
+        buffers.push_back(&unsaved->second.store_elements);
+    }
+    for (const auto &frozen_buffer : frozen) {
+        buffers.push_back(&frozen_buffer->elements.store_elements);
+    }
+
+    size_t found = 0;
+    vector<size_t> missing;
+    values.assign(keys.size(), nullopt);
+    for (size_t idx = 0; idx < keys.size(); idx++) {
+        for (const auto *buffer : buffers) {
+            auto store_element = buffer->find(keys[idx]);
+            if (store_element != buffer->end()) {
+                values[idx] = store_element->second;
+                found++;
+                break;
+            }
+        }
+
+        if (!values[idx]) {
+            missing.push_back(idx);
+        }
+    }
+
+    if (missing.empty()) {
+        return found;
+    }
+
+    // Last, check backing storage for the rest in a single batch
+    vector<vector<byte>> missing_keys;
+    missing_keys.reserve(missing.size());
+    for (size_t idx : missing) {
+        missing_keys.push_back(keys[idx]);
+    }
+
+    vector<optional<store_value_type>> missing_values;
+    found += storage_->load_store_elements(trie_id, missing_keys, missing_values);
+    for (size_t idx = 0; idx < missing.size(); idx++) {
+        values[missing[idx]] = std::move(missing_values[idx]);
+    }
+
+    return found;
+}
+
+void MemoryStorageBatchInserter::save_store_elements(
+    trie_id_type trie_id, const vector<pair<vector<byte>, store_value_type>> &store_elements)
+{
+    if (nullptr == storage_)
+        throw runtime_error("storage is not initialized");
+
+    auto &unsaved_store_elements = unsaved_elements_[trie_id].store_elements;
+    unsaved_store_elements.reserve(unsaved_store_elements.size() + store_elements.size());
+    for (const auto &store_element : store_elements) {
+        unsaved_store_elements[store_element.first] = store_element.second;
+    }
 }
 
 void MemoryStorageBatchInserter::flush(trie_id_type trie_id)
@@ -105,32 +283,185 @@ void MemoryStorageBatchInserter::flush(trie_id_type trie_id)
     if (nullptr == storage_)
         throw runtime_error("storage is not initialized");
 
+    if (async_flush_) {
+        // Report an earlier failure before handing over more elements
+        {
+            lock_guard<mutex> lock(flush_mtx_);
+            if (nullptr != flush_error_) {
+                exception_ptr error = flush_error_;
+                flush_error_ = nullptr;
+                rethrow_exception(error);
+            }
+        }
+
+        flush_async(trie_id);
+        return;
+    }
+
+    // Earlier asynchronous flushes need to reach the backing storage first
+    wait_for_flush();
+
+    auto frozen = freeze(trie_id);
+    write(*frozen, /* move_elements */ true);
+}
+
+future<void> MemoryStorageBatchInserter::flush_async(trie_id_type trie_id)
+{
+    if (nullptr == storage_)
+        throw runtime_error("storage is not initialized");
+
+    auto frozen = freeze(trie_id);
+    future<void> result = frozen->done.get_future();
+
+    {
+        lock_guard<mutex> lock(flush_mtx_);
+        if (!flush_thread_.joinable()) {
+            flush_thread_ = thread(&MemoryStorageBatchInserter::run_flush, this);
+        }
+        frozen_elements_.push_back(std::move(frozen));
+    }
+    flush_cv_.notify_all();
+
+    return result;
+}
+
+void MemoryStorageBatchInserter::wait_for_flush()
+{
+    unique_lock<mutex> lock(flush_mtx_);
+    flush_cv_.wait(lock, [this]() { return frozen_elements_.empty(); });
+
+    if (nullptr != flush_error_) {
+        exception_ptr error = flush_error_;
+        flush_error_ = nullptr;
+        rethrow_exception(error);
+    }
+}
+
+size_t MemoryStorageBatchInserter::pending_flush_count() const
+{
+    lock_guard<mutex> lock(flush_mtx_);
+    return frozen_elements_.size();
+}
+
+shared_ptr<MemoryStorageBatchInserter::FrozenElements> MemoryStorageBatchInserter::freeze(
+    trie_id_type trie_id)
+{
+    // Only the unsaved elements of the given trie are flushed
+    auto frozen = make_shared<FrozenElements>();
+    frozen->trie_id = trie_id;
+
+    auto unsaved = unsaved_elements_.find(trie_id);
+    if (unsaved != unsaved_elements_.end()) {
+        frozen->elements = std::move(unsaved->second);
+        unsaved_elements_.erase(unsaved);
+    }
+
+    StorageTrieKey trie_key(trie_id);
+    auto unsaved_trie = unsaved_tries_.find(trie_key);
+    if (unsaved_trie != unsaved_tries_.end()) {
+        frozen->trie = std::move(unsaved_trie->second);
+        unsaved_tries_.erase(unsaved_trie);
+    }
+
+    return frozen;
+}
+
+void MemoryStorageBatchInserter::write(FrozenElements &frozen, bool move_elements)
+{
+    // Elements that are being flushed asynchronously may be read concurrently, so they can only
+    // be copied
     vector<CTNodeStored> nodes;
     vector<CompressedTrie> tries;
     vector<pair<vector<byte>, store_value_type>> store_elements;
 
-    nodes.reserve(unsaved_nodes_.size());
-    tries.reserve(unsaved_tries_.size());
-    store_elements.reserve(unsaved_store_elements_.size());
+    nodes.reserve(frozen.elements.nodes.size());
+    for (auto &node_pair : frozen.elements.nodes) {
+        if (move_elements) {
+            nodes.emplace_back(std::move(node_pair.second));
+        } else {
+            nodes.emplace_back(node_pair.second);
+        }
+    }
 
-    for (auto &node_pair : unsaved_nodes_) {
-        nodes.emplace_back(std::move(node_pair.second));
+    store_elements.reserve(frozen.elements.store_elements.size());
+    for (auto &store_element_pair : frozen.elements.store_elements) {
+        if (move_elements) {
+            store_elements.emplace_back(
+                store_element_pair.first, std::move(store_element_pair.second));
+        } else {
+            store_elements.emplace_back(store_element_pair.first, store_element_pair.second);
+        }
     }
-    unsaved_nodes_.clear();
 
-    for (auto &trie_pair : unsaved_tries_) {
-        tries.emplace_back(std::move(trie_pair.second));
+    if (frozen.trie) {
+        if (move_elements) {
+            tries.emplace_back(std::move(*frozen.trie));
+        } else {
+            tries.emplace_back(*frozen.trie);
+        }
     }
-    unsaved_tries_.clear();
 
-    for (auto store_element_pair : unsaved_store_elements_) {
-        pair<vector<byte>, store_value_type> se(
-            store_element_pair.first.key(), store_element_pair.second);
-        store_elements.emplace_back(std::move(se));
+    storage_->flush(frozen.trie_id, nodes, tries, store_elements);
+}
+
+void MemoryStorageBatchInserter::run_flush()
+{
+    unique_lock<mutex> lock(flush_mtx_);
+    while (true) {
+        flush_cv_.wait(lock, [this]() { return stop_flush_ || !frozen_elements_.empty(); });
+        if (frozen_elements_.empty()) {
+            return;
+        }
+
+        // The frozen elements stay visible to loads until the backing storage has them
+        auto frozen = frozen_elements_.front();
+        lock.unlock();
+
+        exception_ptr error;
+        try {
+            write(*frozen, /* move_elements */ false);
+        } catch (...) {
+            error = current_exception();
+        }
+
+        lock.lock();
+        frozen_elements_.pop_front();
+        if (nullptr != error) {
+            if (nullptr == flush_error_) {
+                flush_error_ = error;
+            }
+            frozen->done.set_exception(error);
+        } else {
+            frozen->done.set_value();
+        }
+        flush_cv_.notify_all();
     }
-    unsaved_store_elements_.clear();
+}
 
-    storage_->flush(trie_id, nodes, tries, store_elements);
+vector<shared_ptr<MemoryStorageBatchInserter::FrozenElements>> MemoryStorageBatchInserter::
+    frozen_elements(trie_id_type trie_id) const
+{
+    vector<shared_ptr<FrozenElements>> result;
+
+    lock_guard<mutex> lock(flush_mtx_);
+    for (auto it = frozen_elements_.rbegin(); it != frozen_elements_.rend(); it++) {
+        if ((*it)->trie_id == trie_id) {
+            result.push_back(*it);
+        }
+    }
+
+    return result;
+}
+
+void MemoryStorageBatchInserter::wait_for_frozen_elements(trie_id_type trie_id)
+{
+    unique_lock<mutex> lock(flush_mtx_);
+    flush_cv_.wait(lock, [this, trie_id]() {
+        return none_of(
+            frozen_elements_.begin(), frozen_elements_.end(), [trie_id](const auto &frozen) {
+                return frozen->trie_id == trie_id;
+            });
+    });
 }
 
 void MemoryStorageBatchInserter::add_ctnode(trie_id_type, const CTNodeStored &)
@@ -160,6 +491,14 @@ size_t MemoryStorageBatchInserter::get_compressed_trie_epoch(trie_id_type trie_i
         auto unsaved_trie = unsaved_tries_.find(key);
         if (unsaved_trie != unsaved_tries_.end()) {
             trie = unsaved_trie->second;
+        } else {
+            // Finally, try in tries that are being flushed
+            for (const auto &frozen : frozen_elements(trie_id)) {
+                if (frozen->trie) {
+                    trie = *frozen->trie;
+                    break;
+                }
+            }
         }
     }
 
@@ -176,44 +515,23 @@ void MemoryStorageBatchInserter::load_updated_elements(
         // If this is the top storage, however, we don't want the callback.
         storage = nullptr;
     }
+
+    // The updated elements may still be being flushed
+    wait_for_frozen_elements(trie_id);
     storage_->load_updated_elements(epoch, trie_id, storage);
 }
 
 void MemoryStorageBatchInserter::delete_ozks(trie_id_type trie_id)
 {
-    {
-        // Find nodes to delete
-        vector<StorageNodeKey> nodes_to_delete;
-        for (const auto &node : unsaved_nodes_) {
-            if (node.first.trie_id() == trie_id) {
-                nodes_to_delete.push_back(node.first);
-            }
-        }
-
-        // Do the deletion
-        for (const auto &node : nodes_to_delete) {
-            unsaved_nodes_.erase(node);
-        }
-    }
+    // Unsaved nodes and store elements of the trie are in a single partition
+    unsaved_elements_.erase(trie_id);
 
     // There should be a single trie with the trie_id
     StorageTrieKey trie_key(trie_id);
     unsaved_tries_.erase(trie_key);
 
-    {
-        // Find storage elements to delete
-        vector<StorageStoreElementKey> store_elems_to_delete;
-        for (const auto &se : unsaved_store_elements_) {
-            if (se.first.trie_id() == trie_id) {
-                store_elems_to_delete.push_back(se.first);
-            }
-        }
-
-        // Do the deletion
-        for (const auto &se : store_elems_to_delete) {
-            unsaved_store_elements_.erase(se);
-        }
-    }
+    // Elements of the trie that are being flushed must not reappear after the deletion
+    wait_for_frozen_elements(trie_id);
 
     // Perform same operation on backing storage
     storage_->delete_ozks(trie_id);
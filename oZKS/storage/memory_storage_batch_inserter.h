@@ -4,19 +4,42 @@
 #pragma once
 
 // STD
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 // OZKS
+#include "oZKS/compressed_trie.h"
+#include "oZKS/ct_node_stored.h"
 #include "oZKS/storage/batch_storage.h"
 #include "oZKS/storage/memory_storage_helpers.h"
 
 namespace ozks {
     namespace storage {
+        /**
+        Storage that keeps saved elements in memory until they are flushed to a BatchStorage in a
+        single batch. Unsaved elements are partitioned by trie, and flushing or deleting a trie
+        only touches the unsaved elements of that trie.
+
+        A flush can also be done asynchronously: the unsaved elements of the trie are frozen and
+        handed to a background writer, and new elements are saved to a fresh buffer while the
+        frozen one is written. Loads keep finding the frozen elements until the backing storage
+        has them. Frozen buffers are written in the order they were flushed, so the backing
+        storage must be thread-safe. With async_flush set, flush(trie_id) is asynchronous too,
+        which lets the next epoch start while the previous one is being persisted.
+        */
         class MemoryStorageBatchInserter : public Storage {
         public:
-            MemoryStorageBatchInserter(std::shared_ptr<BatchStorage> backing_storage)
-                : storage_(backing_storage)
+            MemoryStorageBatchInserter(
+                std::shared_ptr<BatchStorage> backing_storage, bool async_flush = false)
+                : storage_(backing_storage), async_flush_(async_flush)
             {}
 
             virtual ~MemoryStorageBatchInserter();
@@ -30,6 +53,16 @@ namespace ozks {
                 std::shared_ptr<Storage> storage,
                 CTNodeStored &node) override;
 
+            /**
+            Get a batch of nodes from storage. Nodes that are neither unsaved nor being flushed
+            are loaded from backing storage in a single batch.
+            */
+            std::size_t load_ctnodes(
+                trie_id_type trie_id,
+                gsl::span<const PartialLabel> node_ids,
+                std::shared_ptr<Storage> storage,
+                std::vector<std::optional<CTNodeStored>> &nodes) override;
+
             /**
             Save a node to storage
             */
@@ -62,10 +95,53 @@ namespace ozks {
                 const store_value_type &value) override;
 
             /**
-            Flush changes if appropriate
+            Get a batch of store elements from storage
+            */
+            std::size_t load_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::vector<std::byte>> &keys,
+                std::vector<std::optional<store_value_type>> &values) override;
+
+            /**
+            Save a batch of store elements to storage
+            */
+            void save_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::pair<std::vector<std::byte>, store_value_type>>
+                    &store_elements) override;
+
+            /**
+            Flush changes if appropriate. If async flushing is enabled this only hands the unsaved
+            elements to the background writer, and rethrows the error of any earlier
+            asynchronous flush that failed.
             */
             void flush(trie_id_type trie_id) override;
 
+            /**
+            Hand the unsaved elements of the given trie to the background writer and return a
+            future that becomes ready once they have been flushed to the backing storage
+            */
+            std::future<void> flush_async(trie_id_type trie_id);
+
+            /**
+            Wait until all asynchronous flushes have been written to the backing storage, and
+            rethrow the error of any asynchronous flush that failed
+            */
+            void wait_for_flush();
+
+            /**
+            Whether flush(trie_id) is asynchronous
+            */
+            bool async_flush() const
+            {
+                return async_flush_;
+            }
+
+            /**
+            Get the number of asynchronous flushes that have not been written yet
+            */
+            std::size_t pending_flush_count() const;
+
             /**
             Add an existing node to the current storage.
             */
@@ -102,15 +178,59 @@ namespace ozks {
             void delete_ozks(trie_id_type trie_id) override;
 
         private:
+            // Unsaved nodes and store elements of a single trie
+            struct UnsavedElements {
+                std::unordered_map<PartialLabel, CTNodeStored> nodes;
+                std::unordered_map<
+                    std::vector<std::byte>,
+                    store_value_type,
+                    utils::byte_vector_hash>
+                    store_elements;
+            };
+
+            // Unsaved elements of a single trie that are being written by the background writer
+            struct FrozenElements {
+                trie_id_type trie_id;
+
+                UnsavedElements elements;
+
+                std::optional<CompressedTrie> trie;
+
+                std::promise<void> done;
+            };
+
+            std::shared_ptr<FrozenElements> freeze(trie_id_type trie_id);
+
+            void write(FrozenElements &frozen, bool move_elements);
+
+            void run_flush();
+
+            // Frozen elements of the given trie, newest first
+            std::vector<std::shared_ptr<FrozenElements>> frozen_elements(
+                trie_id_type trie_id) const;
+
+            void wait_for_frozen_elements(trie_id_type trie_id);
+
             std::shared_ptr<BatchStorage> storage_;
 
-            std::unordered_map<StorageNodeKey, CTNodeStored, StorageNodeKeyHasher> unsaved_nodes_;
+            bool async_flush_;
+
+            std::unordered_map<trie_id_type, UnsavedElements> unsaved_elements_;
             std::unordered_map<StorageTrieKey, CompressedTrie, StorageTrieKeyHasher> unsaved_tries_;
-            std::unordered_map<
-                StorageStoreElementKey,
-                store_value_type,
-                StorageStoreElementKeyHasher>
-                unsaved_store_elements_;
+
+            // Protects the frozen elements, the flush error and the background writer state
+            mutable std::mutex flush_mtx_;
+
+            std::condition_variable flush_cv_;
+
+            // Frozen elements in flush order; the front one is being written
+            std::deque<std::shared_ptr<FrozenElements>> frozen_elements_;
+
+            std::exception_ptr flush_error_;
+
+            bool stop_flush_ = false;
+
+            std::thread flush_thread_;
         };
     } // namespace storage
 } // namespace ozks
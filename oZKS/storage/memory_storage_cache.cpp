@@ -2,6 +2,10 @@
 // Licensed under the MIT license.
 
 // STD
+#include <mutex>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
 
 // OZKS
 #include "oZKS/storage/batch_storage.h"
@@ -20,40 +24,126 @@ bool MemoryStorageCache::load_ctnode(
     shared_ptr<Storage> storage,
     CTNodeStored &node)
 {
-    StorageNodeKey key(trie_id, node_id);
-    auto cached_node = node_cache_.get(key);
-    if (cached_node.isNull()) {
-        if (!storage_->load_ctnode(trie_id, node_id, storage, node))
+    uint64_t trie_generation = generation(trie_id);
+    auto cached_node = get_cached_node(trie_id, node_id, trie_generation);
+    if (nullptr != cached_node) {
+        node = *cached_node;
+        return true;
+    }
+
+    if (prefetch_enabled()) {
+        vector<optional<CTNodeStored>> nodes;
+        if (0 == load_missing_ctnodes(trie_id, trie_generation, { node_id }, storage, nodes))
             return false;
 
-        node_cache_.add(key, node);
+        node = std::move(*nodes[0]);
         return true;
     }
 
-    node = *(cached_node.get());
+    if (!storage_->load_ctnode(trie_id, node_id, storage, node))
+        return false;
+
+    cache_node(trie_id, trie_generation, node, nullptr);
     return true;
 }
 
+size_t MemoryStorageCache::load_ctnodes(
+    trie_id_type trie_id,
+    gsl::span<const PartialLabel> node_ids,
+    shared_ptr<Storage> storage,
+    vector<optional<CTNodeStored>> &nodes)
+{
+    // First, check the cache
+    size_t found = 0;
+    vector<size_t> missing;
+    nodes.assign(node_ids.size(), nullopt);
+    uint64_t trie_generation = generation(trie_id);
+    for (size_t idx = 0; idx < node_ids.size(); idx++) {
+        auto cached_node = get_cached_node(trie_id, node_ids[idx], trie_generation);
+        if (nullptr == cached_node) {
+            missing.push_back(idx);
+        } else {
+            nodes[idx] = *cached_node;
+            found++;
+        }
+    }
+
+    if (missing.empty()) {
+        return found;
+    }
+
+    // Load the rest from backing storage in a single batch
+    vector<PartialLabel> missing_ids;
+    missing_ids.reserve(missing.size());
+    for (size_t idx : missing) {
+        missing_ids.push_back(node_ids[idx]);
+    }
+
+    vector<optional<CTNodeStored>> missing_nodes;
+    found += load_missing_ctnodes(trie_id, trie_generation, missing_ids, storage, missing_nodes);
+    for (size_t idx = 0; idx < missing.size(); idx++) {
+        nodes[missing[idx]] = std::move(missing_nodes[idx]);
+    }
+
+    return found;
+}
+
+size_t MemoryStorageCache::load_path(
+    trie_id_type trie_id,
+    const PartialLabel &label,
+    shared_ptr<Storage> storage,
+    vector<CTNodeStored> &nodes)
+{
+    // Walk the path in the cache first
+    nodes.clear();
+    bool cached = true;
+    uint64_t trie_generation = generation(trie_id);
+    auto load_cached_nodes = [&](gsl::span<const PartialLabel> node_ids,
+                                 vector<optional<CTNodeStored>> &loaded) {
+        loaded.assign(node_ids.size(), nullopt);
+        for (size_t idx = 0; cached && idx < node_ids.size(); idx++) {
+            auto cached_node = get_cached_node(trie_id, node_ids[idx], trie_generation);
+            cached = nullptr != cached_node;
+            if (cached) {
+                loaded[idx] = *cached_node;
+            }
+        }
+    };
+
+    if (LoadPath(label, load_cached_nodes, nodes) && cached) {
+        return nodes.size();
+    }
+
+    // Some node was missing, load the whole path from backing storage
+    storage_->load_path(trie_id, label, storage, nodes);
+    for (const auto &node : nodes) {
+        cache_node(trie_id, trie_generation, node, nullptr);
+    }
+
+    return nodes.size();
+}
+
 void MemoryStorageCache::save_ctnode(trie_id_type trie_id, const CTNodeStored &node)
 {
-    StorageNodeKey key(trie_id, node.label());
+    uint64_t trie_generation = generation(trie_id);
     storage_->save_ctnode(trie_id, node);
-    node_cache_.update(key, node);
+    store_node(trie_id, trie_generation, node);
 }
 
 bool MemoryStorageCache::load_compressed_trie(trie_id_type trie_id, CompressedTrie &trie)
 {
     StorageTrieKey key(trie_id);
-    auto cached_trie = trie_cache_.get(key);
-    if (cached_trie.isNull()) {
+    uint64_t trie_generation = generation(trie_id);
+    auto cached_trie = get_cached<CompressedTrie>(key, trie_generation);
+    if (nullptr == cached_trie) {
         if (!storage_->load_compressed_trie(trie_id, trie))
             return false;
 
-        trie_cache_.add(key, trie);
+        put_cached(key, trie_generation, trie, TrieCharge(trie));
         return true;
     }
 
-    trie = *(cached_trie.get());
+    trie = *cached_trie;
     return true;
 }
 
@@ -61,23 +151,24 @@ void MemoryStorageCache::save_compressed_trie(const CompressedTrie &trie)
 {
     StorageTrieKey key(trie.id());
     storage_->save_compressed_trie(trie);
-    trie_cache_.update(key, trie);
+    put_cached(key, generation(trie.id()), trie, TrieCharge(trie));
 }
 
 bool MemoryStorageCache::load_store_element(
     trie_id_type trie_id, const vector<byte> &se_key, store_value_type &value)
 {
     StorageStoreElementKey key(trie_id, se_key);
-    auto cached_store_element = store_element_cache_.get(key);
-    if (cached_store_element.isNull()) {
+    uint64_t trie_generation = generation(trie_id);
+    auto cached_store_element = get_cached<store_value_type>(key, trie_generation);
+    if (nullptr == cached_store_element) {
         if (!storage_->load_store_element(trie_id, se_key, value))
             return false;
 
-        store_element_cache_.add(key, value);
+        put_cached(key, trie_generation, value, StoreElementCharge(se_key, value));
         return true;
     }
 
-    value = *(cached_store_element.get());
+    value = *cached_store_element;
     return true;
 }
 
@@ -86,7 +177,71 @@ void MemoryStorageCache::save_store_element(
 {
     StorageStoreElementKey key(trie_id, se_key);
     storage_->save_store_element(trie_id, se_key, value);
-    store_element_cache_.update(key, value);
+    put_cached(key, generation(trie_id), value, StoreElementCharge(se_key, value));
+}
+
+size_t MemoryStorageCache::load_store_elements(
+    trie_id_type trie_id,
+    const vector<vector<byte>> &keys,
+    vector<optional<store_value_type>> &values)
+{
+    // First, check the cache
+    size_t found = 0;
+    vector<size_t> missing;
+    values.assign(keys.size(), nullopt);
+    uint64_t trie_generation = generation(trie_id);
+    for (size_t idx = 0; idx < keys.size(); idx++) {
+        StorageStoreElementKey key(trie_id, keys[idx]);
+        auto cached_store_element = get_cached<store_value_type>(key, trie_generation);
+        if (nullptr == cached_store_element) {
+            missing.push_back(idx);
+        } else {
+            values[idx] = *cached_store_element;
+            found++;
+        }
+    }
+
+    if (missing.empty()) {
+        return found;
+    }
+
+    // Load the rest from backing storage in a single batch
+    vector<vector<byte>> missing_keys;
+    missing_keys.reserve(missing.size());
+    for (size_t idx : missing) {
+        missing_keys.push_back(keys[idx]);
+    }
+
+    vector<optional<store_value_type>> missing_values;
+    found += storage_->load_store_elements(trie_id, missing_keys, missing_values);
+    for (size_t idx = 0; idx < missing.size(); idx++) {
+        if (missing_values[idx].has_value()) {
+            StorageStoreElementKey key(trie_id, missing_keys[idx]);
+            put_cached(
+                key,
+                trie_generation,
+                *missing_values[idx],
+                StoreElementCharge(missing_keys[idx], *missing_values[idx]));
+            values[missing[idx]] = std::move(missing_values[idx]);
+        }
+    }
+
+    return found;
+}
+
+void MemoryStorageCache::save_store_elements(
+    trie_id_type trie_id, const vector<pair<vector<byte>, store_value_type>> &store_elements)
+{
+    storage_->save_store_elements(trie_id, store_elements);
+    uint64_t trie_generation = generation(trie_id);
+    for (const auto &store_element : store_elements) {
+        StorageStoreElementKey key(trie_id, store_element.first);
+        put_cached(
+            key,
+            trie_generation,
+            store_element.second,
+            StoreElementCharge(store_element.first, store_element.second));
+    }
 }
 
 void MemoryStorageCache::flush(trie_id_type trie_id)
@@ -96,21 +251,20 @@ void MemoryStorageCache::flush(trie_id_type trie_id)
 
 void MemoryStorageCache::add_ctnode(trie_id_type trie_id, const CTNodeStored &node)
 {
-    StorageNodeKey key(trie_id, node.label());
-    node_cache_.update(key, node);
+    store_node(trie_id, generation(trie_id), node);
 }
 
 void MemoryStorageCache::add_compressed_trie(const CompressedTrie &trie)
 {
     StorageTrieKey key(trie.id());
-    trie_cache_.update(key, trie);
+    put_cached(key, generation(trie.id()), trie, TrieCharge(trie));
 }
 
 void MemoryStorageCache::add_store_element(
     trie_id_type trie_id, const vector<byte> &se_key, const store_value_type &value)
 {
     StorageStoreElementKey key(trie_id, se_key);
-    store_element_cache_.update(key, value);
+    put_cached(key, generation(trie_id), value, StoreElementCharge(se_key, value));
 }
 
 size_t MemoryStorageCache::get_compressed_trie_epoch(trie_id_type trie_id)
@@ -120,9 +274,9 @@ size_t MemoryStorageCache::get_compressed_trie_epoch(trie_id_type trie_id)
     // Look first in backing storage
     if (!storage_->load_compressed_trie(trie_id, trie)) {
         // Not in backing storage, try the cache
-        StorageTrieKey key(trie_id);
-        auto cached_trie = trie_cache_.get(key);
-        if (!cached_trie.isNull()) {
+        auto cached_trie =
+            get_cached<CompressedTrie>(StorageTrieKey(trie_id), generation(trie_id));
+        if (nullptr != cached_trie) {
             trie = *cached_trie;
         }
     }
@@ -139,40 +293,370 @@ void MemoryStorageCache::load_updated_elements(
 void MemoryStorageCache::delete_ozks(trie_id_type trie_id)
 {
     {
-        // Look for nodes to delete
-        vector<StorageNodeKey> nodes_to_delete;
-        node_cache_.forEach([&](const StorageNodeKey &key, const CTNode &) {
-            if (key.trie_id() == trie_id) {
-                nodes_to_delete.push_back(key);
+        // Cached nodes and store elements of the trie become stale when the trie moves to a new
+        // generation; they are evicted from the cache over time
+        unique_lock<shared_mutex> lock(generations_mtx_);
+        generations_[trie_id] = ++last_generation_;
+    }
+
+    // Pinned nodes are released right away, as they are never evicted
+    auto pinned = pinned_.erase(trie_id);
+    if (nullptr != pinned) {
+        release_pinned(*pinned);
+    }
+
+    // There should be a single compressed trie with the id
+    cache_.remove(StorageTrieKey(trie_id));
+
+    // Do the same in backing storage
+    storage_->delete_ozks(trie_id);
+}
+
+uint64_t MemoryStorageCache::generation(trie_id_type trie_id) const
+{
+    shared_lock<shared_mutex> lock(generations_mtx_);
+    auto it = generations_.find(trie_id);
+    return it == generations_.end() ? 0 : it->second;
+}
+
+size_t MemoryStorageCache::pinned_node_count() const
+{
+    size_t count = 0;
+    pinned_.for_each([&count](trie_id_type, const PinnedTrie &pinned) {
+        shared_lock<shared_mutex> lock(pinned.mtx);
+        for (const auto &entry : pinned.nodes) {
+            if (nullptr != entry.second.node) {
+                count++;
             }
-        });
+        }
+    });
 
-        // Do the deletion
-        for (const auto &node : nodes_to_delete) {
-            node_cache_.remove(node);
+    return count;
+}
+
+shared_ptr<const CTNodeStored> MemoryStorageCache::get_cached_node(
+    trie_id_type trie_id, const PartialLabel &node_id, uint64_t trie_generation)
+{
+    if (!pin_enabled()) {
+        return get_cached<CTNodeStored>(StorageNodeKey(trie_id, node_id), trie_generation);
+    }
+
+    bool in_pinned_levels = false;
+    auto pinned_node = get_pinned_node(trie_id, node_id, trie_generation, in_pinned_levels);
+    if (nullptr != pinned_node) {
+        return pinned_node;
+    }
+
+    // A node that was cached before its parent was pinned is pinned on its first hit
+    auto cached_node =
+        get_cached<CTNodeStored>(StorageNodeKey(trie_id, node_id), trie_generation);
+    if (nullptr != cached_node && in_pinned_levels) {
+        pin_node(trie_id, trie_generation, *cached_node);
+    }
+
+    return cached_node;
+}
+
+shared_ptr<const CTNodeStored> MemoryStorageCache::get_pinned_node(
+    trie_id_type trie_id,
+    const PartialLabel &node_id,
+    uint64_t trie_generation,
+    bool &in_pinned_levels) const
+{
+    in_pinned_levels = node_id.empty();
+    auto pinned = pinned_.get(trie_id);
+    if (nullptr == pinned || pinned->generation != trie_generation) {
+        return nullptr;
+    }
+
+    shared_lock<shared_mutex> lock(pinned->mtx);
+    auto it = pinned->nodes.find(node_id);
+    if (it == pinned->nodes.end()) {
+        return nullptr;
+    }
+
+    in_pinned_levels = true;
+    return it->second.node;
+}
+
+bool MemoryStorageCache::pin_node(
+    trie_id_type trie_id, uint64_t trie_generation, const CTNodeStored &node)
+{
+    if (!pin_enabled()) {
+        return false;
+    }
+
+    auto pinned = pinned_.get_or_create(trie_id, trie_generation);
+    if (pinned->generation < trie_generation) {
+        // The partition was created by a writer that raced with the deletion of the trie
+        auto stale = pinned_.erase(trie_id);
+        if (nullptr != stale) {
+            release_pinned(*stale);
         }
+        pinned = pinned_.get_or_create(trie_id, trie_generation);
+    }
+    if (pinned->generation != trie_generation) {
+        return false;
     }
 
-    // There should be a single compressed trie with the id
-    StorageTrieKey trie_key(trie_id);
-    trie_cache_.remove(trie_key);
+    unique_lock<shared_mutex> lock(pinned->mtx);
+    if (pinned->released) {
+        return false;
+    }
 
-    {
-        // Look for store elements to delete
-        vector<StorageStoreElementKey> store_elems_to_delete;
-        store_element_cache_.forEach(
-            [&](const StorageStoreElementKey &key, const store_value_type &) {
-                if (key.trie_id() == trie_id) {
-                    store_elems_to_delete.push_back(key);
+    // The depth of a node is known once its parent is pinned; the root is always at depth zero
+    auto it = pinned->nodes.find(node.label());
+    if (it == pinned->nodes.end()) {
+        if (!node.label().empty()) {
+            return false;
+        }
+        it = pinned->nodes.emplace(node.label(), PinnedNode{}).first;
+    }
+
+    if (nullptr == it->second.node) {
+        if (!reserve_pinned_bytes(pinned_node_charge)) {
+            return false;
+        }
+        pinned->size_bytes += pinned_node_charge;
+    }
+
+    // Saving a pinned node replaces it in place
+    size_t depth = it->second.depth;
+    it->second.node = make_shared<const CTNodeStored>(node);
+    for (const auto *child_label : { &node.left_label(), &node.right_label() }) {
+        if (!child_label->empty()) {
+            set_pinned_depth(trie_id, *pinned, *child_label, depth + 1);
+        }
+    }
+
+    return true;
+}
+
+void MemoryStorageCache::set_pinned_depth(
+    trie_id_type trie_id, PinnedTrie &pinned, const PartialLabel &node_id, size_t depth)
+{
+    auto it = pinned.nodes.find(node_id);
+    if (depth < pin_policy_.depth) {
+        if (it != pinned.nodes.end() && it->second.depth == depth) {
+            return;
+        }
+
+        PinnedNode &entry = pinned.nodes[node_id];
+        entry.depth = depth;
+        if (nullptr != entry.node) {
+            auto node = entry.node;
+            for (const auto *child_label : { &node->left_label(), &node->right_label() }) {
+                if (!child_label->empty()) {
+                    set_pinned_depth(trie_id, pinned, *child_label, depth + 1);
                 }
-            });
+            }
+        }
+        return;
+    }
+
+    // A node above this one was split, which pushed this node below the pinned levels
+    if (it == pinned.nodes.end()) {
+        return;
+    }
+
+    auto node = std::move(it->second.node);
+    pinned.nodes.erase(it);
+    if (nullptr == node) {
+        return;
+    }
 
-        // Do the deletion
-        for (const auto &se : store_elems_to_delete) {
-            store_element_cache_.remove(se);
+    pinned.size_bytes -= pinned_node_charge;
+    pinned_bytes_ -= pinned_node_charge;
+    put_cached(StorageNodeKey(trie_id, node_id), pinned.generation, *node);
+    for (const auto *child_label : { &node->left_label(), &node->right_label() }) {
+        if (!child_label->empty()) {
+            set_pinned_depth(trie_id, pinned, *child_label, depth + 1);
         }
     }
+}
 
-    // Do the same in backing storage
-    storage_->delete_ozks(trie_id);
+void MemoryStorageCache::release_pinned(PinnedTrie &pinned)
+{
+    unique_lock<shared_mutex> lock(pinned.mtx);
+    pinned.released = true;
+    pinned.nodes.clear();
+    pinned_bytes_ -= pinned.size_bytes;
+    pinned.size_bytes = 0;
+}
+
+bool MemoryStorageCache::reserve_pinned_bytes(size_t bytes)
+{
+    size_t current = pinned_bytes_.load();
+    do {
+        if (0 != pin_policy_.max_bytes && current + bytes > pin_policy_.max_bytes) {
+            return false;
+        }
+    } while (!pinned_bytes_.compare_exchange_weak(current, current + bytes));
+
+    return true;
+}
+
+void MemoryStorageCache::store_node(
+    trie_id_type trie_id, uint64_t trie_generation, const CTNodeStored &node)
+{
+    if (!pin_node(trie_id, trie_generation, node)) {
+        put_cached(StorageNodeKey(trie_id, node.label()), trie_generation, node);
+    }
+    remember_siblings(trie_id, trie_generation, node);
+}
+
+void MemoryStorageCache::cache_node(
+    trie_id_type trie_id,
+    uint64_t trie_generation,
+    const CTNodeStored &node,
+    shared_ptr<Storage> storage)
+{
+    store_node(trie_id, trie_generation, node);
+
+    // Prefetched nodes are also offered to the storage of the caller
+    if (nullptr != storage && this != storage.get()) {
+        storage->add_ctnode(trie_id, node);
+    }
+}
+
+void MemoryStorageCache::remember_siblings(
+    trie_id_type trie_id, uint64_t trie_generation, const CTNodeStored &node)
+{
+    if (!prefetch_policy_.path_siblings || node.left_label().empty() ||
+        node.right_label().empty()) {
+        return;
+    }
+
+    put_cached(
+        SiblingKey{ StorageNodeKey(trie_id, node.left_label()) },
+        trie_generation,
+        node.right_label());
+    put_cached(
+        SiblingKey{ StorageNodeKey(trie_id, node.right_label()) },
+        trie_generation,
+        node.left_label());
+}
+
+size_t MemoryStorageCache::load_missing_ctnodes(
+    trie_id_type trie_id,
+    uint64_t trie_generation,
+    const vector<PartialLabel> &node_ids,
+    shared_ptr<Storage> storage,
+    vector<optional<CTNodeStored>> &nodes)
+{
+    // Siblings that are not cached yet go in the same batch as the requested nodes
+    vector<PartialLabel> batch_ids = node_ids;
+    if (prefetch_policy_.path_siblings) {
+        unordered_set<PartialLabel> requested(node_ids.begin(), node_ids.end());
+        for (const auto &node_id : node_ids) {
+            auto sibling = get_cached<PartialLabel>(
+                SiblingKey{ StorageNodeKey(trie_id, node_id) }, trie_generation);
+            if (nullptr == sibling || requested.count(*sibling) > 0 ||
+                nullptr != get_cached_node(trie_id, *sibling, trie_generation)) {
+                continue;
+            }
+
+            requested.insert(*sibling);
+            batch_ids.push_back(*sibling);
+        }
+    }
+
+    vector<optional<CTNodeStored>> batch_nodes;
+    storage_->load_ctnodes(trie_id, batch_ids, storage, batch_nodes);
+
+    size_t found = 0;
+    vector<CTNodeStored> loaded;
+    nodes.assign(node_ids.size(), nullopt);
+    for (size_t idx = 0; idx < batch_ids.size(); idx++) {
+        if (!batch_nodes[idx].has_value()) {
+            continue;
+        }
+
+        bool requested = idx < node_ids.size();
+        cache_node(trie_id, trie_generation, *batch_nodes[idx], requested ? nullptr : storage);
+        if (requested) {
+            loaded.push_back(*batch_nodes[idx]);
+            nodes[idx] = std::move(batch_nodes[idx]);
+            found++;
+        }
+    }
+
+    prefetch_descendants(trie_id, trie_generation, std::move(loaded), storage);
+    return found;
+}
+
+void MemoryStorageCache::prefetch_descendants(
+    trie_id_type trie_id,
+    uint64_t trie_generation,
+    vector<CTNodeStored> level,
+    shared_ptr<Storage> storage)
+{
+    for (size_t depth = 0; depth < prefetch_policy_.descendant_depth && !level.empty(); depth++) {
+        // Children that are already cached are not loaded again, but their own children might
+        // still need to be prefetched
+        vector<CTNodeStored> next_level;
+        vector<PartialLabel> missing_ids;
+        for (const auto &node : level) {
+            for (const auto *child_label : { &node.left_label(), &node.right_label() }) {
+                if (child_label->empty()) {
+                    continue;
+                }
+
+                auto child = get_cached_node(trie_id, *child_label, trie_generation);
+                if (nullptr != child) {
+                    next_level.push_back(*child);
+                } else {
+                    missing_ids.push_back(*child_label);
+                }
+            }
+        }
+
+        if (!missing_ids.empty()) {
+            vector<optional<CTNodeStored>> missing_nodes;
+            storage_->load_ctnodes(trie_id, missing_ids, storage, missing_nodes);
+            for (auto &child : missing_nodes) {
+                if (child.has_value()) {
+                    cache_node(trie_id, trie_generation, *child, storage);
+                    next_level.push_back(std::move(*child));
+                }
+            }
+        }
+
+        level = std::move(next_level);
+    }
+}
+
+size_t MemoryStorageCache::TrieCharge(const CompressedTrie &trie)
+{
+    // The entry holds the trie itself and keeps its root node alive; the other nodes are cached
+    // as separate entries
+    vector<byte> saved_trie;
+    return trie.save(saved_trie) + sizeof(CTNodeStored);
+}
+
+size_t MemoryStorageCache::StoreElementCharge(
+    const vector<byte> &key, const store_value_type &value)
+{
+    return key.size() + value.payload.size();
+}
+
+size_t MemoryStorageCache::CacheKeyHasher::operator()(const cache_key_type &key) const
+{
+    size_t hash = visit(
+        [](const auto &k) -> size_t {
+            using key_type = decay_t<decltype(k)>;
+            if constexpr (is_same_v<key_type, StorageNodeKey>) {
+                return StorageNodeKeyHasher()(k);
+            } else if constexpr (is_same_v<key_type, StorageTrieKey>) {
+                return StorageTrieKeyHasher()(k);
+            } else if constexpr (is_same_v<key_type, StorageStoreElementKey>) {
+                return StorageStoreElementKeyHasher()(k);
+            } else {
+                return StorageNodeKeyHasher()(k.node_key);
+            }
+        },
+        key);
+
+    // Keys of different kinds with the same hash end up in different buckets
+    return hash ^ (key.index() * 0x9E3779B97F4A7C15ULL);
 }
@@ -4,11 +4,17 @@
 #pragma once
 
 // STD
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
-
-// Poco
-#include "Poco/LRUCache.h"
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
 
 // OZKS
 #include "oZKS/compressed_trie.h"
@@ -19,12 +25,88 @@
 
 namespace ozks {
     namespace storage {
+        /**
+        Nodes that MemoryStorageCache loads ahead of time when a node is not in the cache. All
+        nodes prefetched for a miss at the same depth below the missed node are loaded from
+        backing storage in a single batch.
+        */
+        struct PrefetchPolicy {
+            /**
+            Number of levels below a missed node whose nodes are prefetched. A lookup that misses
+            a node goes on to load its children, and one of them is on the path of the lookup.
+            */
+            std::size_t descendant_depth = 0;
+
+            /**
+            Whether a missed node is loaded in the same batch as its sibling. A lookup loads both
+            children of every node on its path, so the sibling of a missed node is needed next.
+            */
+            bool path_siblings = false;
+        };
+
+        /**
+        Nodes that MemoryStorageCache keeps resident outside of its ShardedCache. Pinned nodes are
+        never evicted, and saving a pinned node replaces it in place.
+        */
+        struct PinPolicy {
+            /**
+            Nodes whose depth is smaller than this are pinned; the root is at depth zero. Every
+            lookup in a trie starts with the nodes at the top levels.
+            */
+            std::size_t depth = 0;
+
+            /**
+            Maximum number of bytes used by the pinned nodes of all tries, or zero for no limit.
+            Nodes that do not fit are cached as usual.
+            */
+            std::size_t max_bytes = 0;
+        };
+
+        /**
+        Memory budget of a MemoryStorageCache in bytes. The budget has its own type because the
+        cache used to be sized by a number of elements, and such a count passed as a number of
+        bytes would give a cache that holds almost nothing.
+        */
+        struct CacheBytes {
+            explicit constexpr CacheBytes(std::size_t bytes) : value(bytes)
+            {}
+
+            std::size_t value;
+        };
+
+        /**
+        Storage that caches the elements of a backing storage. Nodes, tries and store elements
+        share a single ShardedCache with a memory budget in bytes, so the memory used by the cache
+        does not depend on the mix of elements it holds. Cached elements are shared and immutable;
+        a hit copies the element straight out of the cache without taking a global lock.
+
+        Deleting a trie does not scan the cache: every cached element is tagged with the
+        generation of its trie at the time it was cached, deleting a trie moves the trie to a new
+        generation, and elements from an older generation are treated as cache misses until they
+        are evicted.
+
+        A prefetch policy can be given to load the nodes that are likely to be needed after a
+        missed node together with it, which reduces the number of sequential requests to backing
+        storage when a lookup walks a cold part of a trie. A pin policy keeps the top levels of
+        every trie resident, so a burst of reads from cold parts of a trie cannot evict the nodes
+        that every lookup goes through.
+        */
         class MemoryStorageCache : public Storage {
         public:
+            /**
+            Construct a cache that holds up to the given number of bytes of elements of the given
+            backing storage
+            */
             MemoryStorageCache(
-                std::shared_ptr<ozks::storage::Storage> backing_storage, std::size_t cache_size)
-                : storage_(backing_storage), node_cache_(cache_size), trie_cache_(cache_size),
-                  store_element_cache_(cache_size)
+                std::shared_ptr<ozks::storage::Storage> backing_storage,
+                CacheBytes cache_bytes,
+                PrefetchPolicy prefetch_policy = {},
+                PinPolicy pin_policy = {})
+                : storage_(backing_storage),
+                  cache_(
+                      cache_bytes.value,
+                      std::min(max_shard_count, cache_bytes.value / min_shard_bytes)),
+                  prefetch_policy_(prefetch_policy), pin_policy_(pin_policy)
             {}
 
             virtual ~MemoryStorageCache();
@@ -38,6 +120,26 @@ namespace ozks {
                 std::shared_ptr<Storage> storage,
                 CTNodeStored &node) override;
 
+            /**
+            Get a batch of nodes from storage. Nodes that are not in the cache are loaded from
+            backing storage in a single batch.
+            */
+            std::size_t load_ctnodes(
+                trie_id_type trie_id,
+                gsl::span<const PartialLabel> node_ids,
+                std::shared_ptr<Storage> storage,
+                std::vector<std::optional<CTNodeStored>> &nodes) override;
+
+            /**
+            Get the nodes needed to look up the given label. If any of them is not in the cache,
+            the path is loaded from backing storage with a single call to load_path.
+            */
+            std::size_t load_path(
+                trie_id_type trie_id,
+                const PartialLabel &label,
+                std::shared_ptr<Storage> storage,
+                std::vector<CTNodeStored> &nodes) override;
+
             /**
             Save a node to storage
             */
@@ -69,6 +171,22 @@ namespace ozks {
                 const std::vector<std::byte> &key,
                 const store_value_type &value) override;
 
+            /**
+            Get a batch of store elements from storage
+            */
+            std::size_t load_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::vector<std::byte>> &keys,
+                std::vector<std::optional<store_value_type>> &values) override;
+
+            /**
+            Save a batch of store elements to storage
+            */
+            void save_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::pair<std::vector<std::byte>, store_value_type>>
+                    &store_elements) override;
+
             /**
             Flush changes if appropriate
             */
@@ -109,11 +227,303 @@ namespace ozks {
             */
             void delete_ozks(trie_id_type trie_id) override;
 
+            /**
+            Get the prefetch policy of this cache
+            */
+            const PrefetchPolicy &prefetch_policy() const
+            {
+                return prefetch_policy_;
+            }
+
+            /**
+            Get the pin policy of this cache
+            */
+            const PinPolicy &pin_policy() const
+            {
+                return pin_policy_;
+            }
+
+            /**
+            Get the number of pinned nodes of all tries
+            */
+            std::size_t pinned_node_count() const;
+
+            /**
+            Get the number of bytes used by the pinned nodes of all tries
+            */
+            std::size_t pinned_size_bytes() const
+            {
+                return pinned_bytes_.load();
+            }
+
+            /**
+            Get the number of bytes used by the elements in the cache, not counting pinned nodes
+            */
+            std::size_t size_bytes() const
+            {
+                return cache_.size_bytes();
+            }
+
+            /**
+            Get the memory budget of the cache in bytes
+            */
+            std::size_t capacity_bytes() const
+            {
+                return cache_.capacity_bytes();
+            }
+
+            /**
+            Get the number of elements that were evicted to stay within the memory budget
+            */
+            std::size_t eviction_count() const
+            {
+                return cache_.eviction_count();
+            }
+
+            /**
+            Get the number of bytes a cached trie node counts against the memory budget
+            */
+            static constexpr std::size_t NodeCharge()
+            {
+                return decltype(cache_)::EntryCharge(sizeof(cache_value_type));
+            }
+
         private:
+            // Each shard gets at least this many bytes, so small caches are not fragmented
+            static constexpr std::size_t min_shard_bytes = std::size_t(256) * 1024;
+
+            static constexpr std::size_t max_shard_count = 16;
+
+            template <typename T>
+            struct CacheEntry {
+                std::uint64_t generation;
+                T value;
+            };
+
+            // Key of the sibling of a node, kept apart from the key of the node itself
+            struct SiblingKey {
+                StorageNodeKey node_key;
+
+                bool operator==(const SiblingKey &other) const
+                {
+                    return node_key == other.node_key;
+                }
+            };
+
+            // A node in the pinned levels of a trie. The node is null while only its depth is
+            // known, which happens when its parent is pinned before the node itself is cached.
+            struct PinnedNode {
+                std::size_t depth = 0;
+                std::shared_ptr<const CTNodeStored> node;
+            };
+
+            // Pinned levels of a single trie generation
+            struct PinnedTrie {
+                explicit PinnedTrie(std::uint64_t trie_generation) : generation(trie_generation)
+                {}
+
+                const std::uint64_t generation;
+                mutable std::shared_mutex mtx;
+                std::unordered_map<PartialLabel, PinnedNode> nodes;
+                std::size_t size_bytes = 0;
+
+                // Set when the trie is deleted; nothing is pinned in a released partition
+                bool released = false;
+            };
+
+            // Approximate number of bytes a pinned node uses, including its map entry
+            static constexpr std::size_t pinned_node_charge =
+                sizeof(CTNodeStored) + sizeof(PartialLabel) + sizeof(PinnedNode) +
+                4 * sizeof(void *);
+
+            using cache_key_type =
+                std::variant<StorageNodeKey, StorageTrieKey, StorageStoreElementKey, SiblingKey>;
+
+            using cache_value_type = std::variant<
+                CacheEntry<CTNodeStored>,
+                CacheEntry<CompressedTrie>,
+                CacheEntry<store_value_type>,
+                CacheEntry<PartialLabel>>;
+
+            struct CacheKeyHasher {
+                std::size_t operator()(const cache_key_type &key) const;
+            };
+
+            /**
+            Get the number of bytes a compressed trie uses outside of its cache entry
+            */
+            static std::size_t TrieCharge(const CompressedTrie &trie);
+
+            /**
+            Get the number of bytes a store element uses outside of its cache entry
+            */
+            static std::size_t StoreElementCharge(
+                const std::vector<std::byte> &key, const store_value_type &value);
+
+            /**
+            Get an element from the cache if it is there and belongs to the given generation. The
+            result shares ownership of the cached entry, so nothing is copied.
+            */
+            template <typename T>
+            std::shared_ptr<const T> get_cached(
+                const cache_key_type &key, std::uint64_t trie_generation) const
+            {
+                auto cached = cache_.get(key);
+                const CacheEntry<T> *entry =
+                    nullptr == cached ? nullptr : std::get_if<CacheEntry<T>>(cached.get());
+                if (nullptr == entry || entry->generation != trie_generation) {
+                    return nullptr;
+                }
+
+                return std::shared_ptr<const T>(cached, &entry->value);
+            }
+
+            /**
+            Add an element to the cache. The extra charge is the number of bytes the element
+            uses outside of the entry itself.
+            */
+            template <typename T>
+            void put_cached(
+                const cache_key_type &key,
+                std::uint64_t trie_generation,
+                T value,
+                std::size_t extra_charge = 0)
+            {
+                cache_.put(
+                    key,
+                    std::make_shared<const cache_value_type>(
+                        CacheEntry<T>{ trie_generation, std::move(value) }),
+                    sizeof(cache_value_type) + extra_charge);
+            }
+
+            /**
+            Get the current generation of the given trie
+            */
+            std::uint64_t generation(trie_id_type trie_id) const;
+
+            /**
+            Whether prefetching is enabled
+            */
+            bool prefetch_enabled() const
+            {
+                return prefetch_policy_.path_siblings || 0 != prefetch_policy_.descendant_depth;
+            }
+
+            /**
+            Whether pinning is enabled
+            */
+            bool pin_enabled() const
+            {
+                return 0 != pin_policy_.depth;
+            }
+
+            /**
+            Get a node from the cache if it is there and belongs to the given generation. A node in
+            the pinned levels that is found in the ShardedCache is pinned.
+            */
+            std::shared_ptr<const CTNodeStored> get_cached_node(
+                trie_id_type trie_id, const PartialLabel &node_id, std::uint64_t trie_generation);
+
+            /**
+            Get a pinned node if it is there and belongs to the given generation. The flag tells
+            whether the node is in the pinned levels, even if it is not pinned yet.
+            */
+            std::shared_ptr<const CTNodeStored> get_pinned_node(
+                trie_id_type trie_id,
+                const PartialLabel &node_id,
+                std::uint64_t trie_generation,
+                bool &in_pinned_levels) const;
+
+            /**
+            Pin the given node if it is in the pinned levels of its trie, replacing the pinned
+            node with the same label. Returns whether the node was pinned.
+            */
+            bool pin_node(
+                trie_id_type trie_id, std::uint64_t trie_generation, const CTNodeStored &node);
+
+            /**
+            Record the depth of the node with the given label and of its pinned descendants. Nodes
+            that end up below the pinned levels are moved to the ShardedCache. The lock of the
+            partition must be held.
+            */
+            void set_pinned_depth(
+                trie_id_type trie_id,
+                PinnedTrie &pinned,
+                const PartialLabel &node_id,
+                std::size_t depth);
+
+            /**
+            Release the nodes of the given partition and mark it as released
+            */
+            void release_pinned(PinnedTrie &pinned);
+
+            /**
+            Reserve the given number of bytes for pinned nodes, if the pin policy allows it
+            */
+            bool reserve_pinned_bytes(std::size_t bytes);
+
+            /**
+            Pin the given node, or add it to the ShardedCache if it is not in the pinned levels
+            */
+            void store_node(
+                trie_id_type trie_id, std::uint64_t trie_generation, const CTNodeStored &node);
+
+            /**
+            Add a node loaded from backing storage to the cache
+            */
+            void cache_node(
+                trie_id_type trie_id,
+                std::uint64_t trie_generation,
+                const CTNodeStored &node,
+                std::shared_ptr<Storage> storage);
+
+            /**
+            Remember the children of the given node as siblings of each other
+            */
+            void remember_siblings(
+                trie_id_type trie_id, std::uint64_t trie_generation, const CTNodeStored &node);
+
+            /**
+            Load the given missed nodes from backing storage in a single batch, together with the
+            siblings the prefetch policy asks for, and prefetch their descendants. Returns the
+            number of given nodes that were found.
+            */
+            std::size_t load_missing_ctnodes(
+                trie_id_type trie_id,
+                std::uint64_t trie_generation,
+                const std::vector<PartialLabel> &node_ids,
+                std::shared_ptr<Storage> storage,
+                std::vector<std::optional<CTNodeStored>> &nodes);
+
+            /**
+            Prefetch the descendants of the given nodes as configured by the prefetch policy,
+            one level at a time
+            */
+            void prefetch_descendants(
+                trie_id_type trie_id,
+                std::uint64_t trie_generation,
+                std::vector<CTNodeStored> level,
+                std::shared_ptr<Storage> storage);
+
             std::shared_ptr<ozks::storage::Storage> storage_;
-            Poco::LRUCache<StorageNodeKey, CTNodeStored> node_cache_;
-            Poco::LRUCache<StorageTrieKey, CompressedTrie> trie_cache_;
-            Poco::LRUCache<StorageStoreElementKey, store_value_type> store_element_cache_;
+
+            // Holds nodes, tries, store elements and, to prefetch path siblings, the sibling of
+            // every cached node that has one
+            ShardedCache<cache_key_type, cache_value_type, CacheKeyHasher> cache_;
+
+            PrefetchPolicy prefetch_policy_;
+
+            PinPolicy pin_policy_;
+
+            // Nodes at the top levels of every trie, which are never evicted
+            TriePartitionMap<PinnedTrie> pinned_;
+
+            std::atomic<std::size_t> pinned_bytes_{ 0 };
+
+            // Tries that have never been deleted are in generation zero
+            mutable std::shared_mutex generations_mtx_;
+            std::unordered_map<trie_id_type, std::uint64_t> generations_;
+            std::uint64_t last_generation_ = 0;
         };
     } // namespace storage
 } // namespace ozks
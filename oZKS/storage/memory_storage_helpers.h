@@ -4,6 +4,18 @@
 #pragma once
 
 // STD
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 // OZKS
@@ -124,5 +136,551 @@ namespace ozks {
                 return hasher(key.key());
             }
         };
+
+        /**
+        A thread-safe hash map split into shards that are locked independently. Lookups take a
+        shared lock on a single shard, so concurrent readers never block each other, and writers
+        only block the operations on the same shard.
+        */
+        template <typename Key, typename Value, typename Hasher>
+        class ShardedMap {
+        public:
+            /**
+            Construct a map with the given number of shards, rounded up to a power of two
+            */
+            explicit ShardedMap(std::size_t shard_count) : shard_bits_(0)
+            {
+                while ((std::size_t(1) << shard_bits_) < shard_count) {
+                    shard_bits_++;
+                }
+                shards_ = std::make_unique<Shard[]>(this->shard_count());
+            }
+
+            /**
+            Get the value for the given key, if present
+            */
+            bool get(const Key &key, Value &value) const
+            {
+                const Shard &shard = get_shard(key);
+                std::shared_lock<std::shared_mutex> lock(shard.mtx);
+                auto it = shard.map.find(key);
+                if (it == shard.map.end()) {
+                    return false;
+                }
+
+                value = it->second;
+                return true;
+            }
+
+            /**
+            Insert or replace the value for the given key
+            */
+            void set(const Key &key, const Value &value)
+            {
+                Shard &shard = get_shard(key);
+                std::unique_lock<std::shared_mutex> lock(shard.mtx);
+                shard.map[key] = value;
+            }
+
+            /**
+            Remove the given key
+            */
+            bool erase(const Key &key)
+            {
+                Shard &shard = get_shard(key);
+                std::unique_lock<std::shared_mutex> lock(shard.mtx);
+                return shard.map.erase(key) != 0;
+            }
+
+            /**
+            Remove all keys for which the given predicate returns true. Each shard is locked
+            separately, so this is not atomic with respect to concurrent insertions.
+            */
+            template <typename Pred>
+            void erase_if(Pred pred)
+            {
+                for (std::size_t idx = 0; idx < shard_count(); idx++) {
+                    Shard &shard = shards_[idx];
+                    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+                    for (auto it = shard.map.begin(); it != shard.map.end();) {
+                        if (pred(it->first)) {
+                            it = shard.map.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
+                }
+            }
+
+            /**
+            Get the number of elements in the map
+            */
+            std::size_t size() const
+            {
+                std::size_t result = 0;
+                for (std::size_t idx = 0; idx < shard_count(); idx++) {
+                    std::shared_lock<std::shared_mutex> lock(shards_[idx].mtx);
+                    result += shards_[idx].map.size();
+                }
+
+                return result;
+            }
+
+            /**
+            Get the number of shards
+            */
+            std::size_t shard_count() const
+            {
+                return std::size_t(1) << shard_bits_;
+            }
+
+        private:
+            struct Shard {
+                mutable std::shared_mutex mtx;
+                std::unordered_map<Key, Value, Hasher> map;
+            };
+
+            const Shard &get_shard(const Key &key) const
+            {
+                if (shard_bits_ == 0) {
+                    return shards_[0];
+                }
+
+                // The top bits of a multiplicative hash select the shard, so that the shard does
+                // not correlate with the bucket the key falls into within the shard
+                std::uint64_t hash = static_cast<std::uint64_t>(Hasher()(key));
+                hash *= 0x9E3779B97F4A7C15ULL;
+                return shards_[static_cast<std::size_t>(hash >> (64 - shard_bits_))];
+            }
+
+            Shard &get_shard(const Key &key)
+            {
+                return const_cast<Shard &>(std::as_const(*this).get_shard(key));
+            }
+
+            std::unique_ptr<Shard[]> shards_;
+            unsigned shard_bits_;
+        };
+
+        /**
+        A thread-safe map from trie identifiers to per-trie partitions. Each partition holds the
+        data of a single trie, so operations that concern a single trie, such as deleting it or
+        counting its elements, cost time proportional to the size of that trie only. Partitions
+        are reference counted: a partition that is removed from the map remains valid for the
+        threads that are still using it, and is destroyed when the last of them releases it.
+        */
+        template <typename Partition>
+        class TriePartitionMap {
+        public:
+            /**
+            Get the partition for the given trie, or nullptr if the trie has no partition
+            */
+            std::shared_ptr<Partition> get(trie_id_type trie_id) const
+            {
+                std::shared_lock<std::shared_mutex> lock(mtx_);
+                auto it = partitions_.find(trie_id);
+                if (it == partitions_.end()) {
+                    return nullptr;
+                }
+
+                return it->second;
+            }
+
+            /**
+            Get the partition for the given trie, constructing it with the given arguments if the
+            trie has no partition yet
+            */
+            template <typename... Args>
+            std::shared_ptr<Partition> get_or_create(trie_id_type trie_id, Args &&... args)
+            {
+                auto partition = get(trie_id);
+                if (nullptr != partition) {
+                    return partition;
+                }
+
+                std::unique_lock<std::shared_mutex> lock(mtx_);
+                auto &result = partitions_[trie_id];
+                if (nullptr == result) {
+                    result = std::make_shared<Partition>(std::forward<Args>(args)...);
+                }
+
+                return result;
+            }
+
+            /**
+            Remove the partition for the given trie from the map and return it. The partition is
+            destroyed when the returned pointer is released, outside of the lock of the map.
+            */
+            std::shared_ptr<Partition> erase(trie_id_type trie_id)
+            {
+                std::shared_ptr<Partition> result;
+                std::unique_lock<std::shared_mutex> lock(mtx_);
+                auto it = partitions_.find(trie_id);
+                if (it != partitions_.end()) {
+                    result = std::move(it->second);
+                    partitions_.erase(it);
+                }
+
+                return result;
+            }
+
+            /**
+            Call the given function with the identifier and the partition of every trie. The
+            function is called without holding the lock of the map.
+            */
+            template <typename F>
+            void for_each(F f) const
+            {
+                std::vector<std::pair<trie_id_type, std::shared_ptr<Partition>>> partitions;
+                {
+                    std::shared_lock<std::shared_mutex> lock(mtx_);
+                    partitions.assign(partitions_.begin(), partitions_.end());
+                }
+
+                for (const auto &partition : partitions) {
+                    f(partition.first, *partition.second);
+                }
+            }
+
+            /**
+            Get the number of partitions in the map
+            */
+            std::size_t size() const
+            {
+                std::shared_lock<std::shared_mutex> lock(mtx_);
+                return partitions_.size();
+            }
+
+        private:
+            mutable std::shared_mutex mtx_;
+            std::unordered_map<trie_id_type, std::shared_ptr<Partition>> partitions_;
+        };
+
+        /**
+        A thread-safe cache with a memory budget in bytes, split into shards that are locked
+        independently. Every entry is charged the size given when it is inserted plus the
+        bookkeeping of the cache, and each shard evicts entries once it holds more than its share
+        of the budget.
+
+        Shards evict with S3-FIFO. New entries go to a small FIFO queue that gets a tenth of the
+        budget of the shard. An entry that is hit again while in the small queue moves to the main
+        queue when it reaches the end of the small queue; the others are evicted right away, and
+        their keys are remembered in a ghost queue so that they go to the main queue if they are
+        inserted again soon. The main queue gives entries that were hit another round before
+        evicting them. A scan over entries that are used only once therefore goes through the
+        small queue without pushing frequently used entries out of the main queue.
+
+        Values are shared and immutable: a hit returns a pointer to the cached value under a
+        shared lock of its shard without copying the value, and the value stays valid after it is
+        evicted.
+        */
+        template <typename Key, typename Value, typename Hasher>
+        class ShardedCache {
+        public:
+            using value_ptr = std::shared_ptr<const Value>;
+
+            /**
+            Construct a cache with the given budget in bytes and number of shards, rounded up to
+            a power of two. Each shard gets an equal part of the budget.
+            */
+            ShardedCache(std::size_t capacity_bytes, std::size_t shard_count)
+                : capacity_bytes_(capacity_bytes), shard_bits_(0)
+            {
+                while ((std::size_t(1) << shard_bits_) < shard_count) {
+                    shard_bits_++;
+                }
+                shards_ = std::make_unique<Shard[]>(this->shard_count());
+                shard_capacity_ = capacity_bytes_ >> shard_bits_;
+                small_capacity_ = shard_capacity_ / 10;
+            }
+
+            /**
+            Get the value for the given key, or nullptr if it is not in the cache
+            */
+            value_ptr get(const Key &key) const
+            {
+                const Shard &shard = get_shard(Hasher()(key));
+                std::shared_lock<std::shared_mutex> lock(shard.mtx);
+                auto it = shard.index.find(key);
+                if (it == shard.index.end()) {
+                    return nullptr;
+                }
+
+                // Frequencies saturate at a small value, so an entry that was hit a lot does not
+                // stay in the main queue for long after it stops being used
+                const Entry &entry = *it->second;
+                std::uint8_t freq = entry.freq.load(std::memory_order_relaxed);
+                if (freq < max_freq) {
+                    entry.freq.store(freq + 1, std::memory_order_relaxed);
+                }
+
+                return entry.value;
+            }
+
+            /**
+            Get the number of bytes an entry counts against the budget when its value uses the
+            given number of bytes
+            */
+            static constexpr std::size_t EntryCharge(std::size_t charge)
+            {
+                return charge + entry_overhead;
+            }
+
+            /**
+            Insert or replace the value for the given key. The charge is the number of bytes the
+            value uses; values that do not fit in a shard are not cached.
+            */
+            void put(const Key &key, value_ptr value, std::size_t charge)
+            {
+                std::size_t hash = Hasher()(key);
+                Shard &shard = get_shard(hash);
+                std::unique_lock<std::shared_mutex> lock(shard.mtx);
+
+                charge = EntryCharge(charge);
+                auto it = shard.index.find(key);
+                if (it != shard.index.end()) {
+                    Entry &entry = *it->second;
+                    std::size_t &queue_bytes = entry.in_main ? shard.main_bytes : shard.small_bytes;
+                    queue_bytes = queue_bytes - entry.charge + charge;
+                    entry.value = std::move(value);
+                    entry.charge = charge;
+                } else {
+                    if (charge > shard_capacity_) {
+                        return;
+                    }
+
+                    bool in_main = shard.in_ghost(hash);
+                    auto &queue = in_main ? shard.main : shard.small;
+                    queue.emplace_back(key, std::move(value), charge, in_main);
+                    shard.index.emplace(key, std::prev(queue.end()));
+                    (in_main ? shard.main_bytes : shard.small_bytes) += charge;
+                }
+
+                evict(shard);
+            }
+
+            /**
+            Remove the given key
+            */
+            bool remove(const Key &key)
+            {
+                Shard &shard = get_shard(Hasher()(key));
+                std::unique_lock<std::shared_mutex> lock(shard.mtx);
+                auto it = shard.index.find(key);
+                if (it == shard.index.end()) {
+                    return false;
+                }
+
+                auto entry = it->second;
+                shard.index.erase(it);
+                if (entry->in_main) {
+                    shard.main_bytes -= entry->charge;
+                    shard.main.erase(entry);
+                } else {
+                    shard.small_bytes -= entry->charge;
+                    shard.small.erase(entry);
+                }
+
+                return true;
+            }
+
+            /**
+            Remove all entries
+            */
+            void clear()
+            {
+                for (std::size_t idx = 0; idx < shard_count(); idx++) {
+                    Shard &shard = shards_[idx];
+                    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+                    shard.index.clear();
+                    shard.small.clear();
+                    shard.main.clear();
+                    shard.ghost.clear();
+                    shard.ghost_counts.clear();
+                    shard.small_bytes = 0;
+                    shard.main_bytes = 0;
+                }
+            }
+
+            /**
+            Get the number of entries in the cache
+            */
+            std::size_t size() const
+            {
+                std::size_t result = 0;
+                for (std::size_t idx = 0; idx < shard_count(); idx++) {
+                    std::shared_lock<std::shared_mutex> lock(shards_[idx].mtx);
+                    result += shards_[idx].index.size();
+                }
+
+                return result;
+            }
+
+            /**
+            Get the number of bytes charged for the entries in the cache
+            */
+            std::size_t size_bytes() const
+            {
+                std::size_t result = 0;
+                for (std::size_t idx = 0; idx < shard_count(); idx++) {
+                    std::shared_lock<std::shared_mutex> lock(shards_[idx].mtx);
+                    result += shards_[idx].small_bytes + shards_[idx].main_bytes;
+                }
+
+                return result;
+            }
+
+            /**
+            Get the budget of the cache in bytes
+            */
+            std::size_t capacity_bytes() const
+            {
+                return capacity_bytes_;
+            }
+
+            /**
+            Get the number of entries that were evicted to stay within the budget
+            */
+            std::size_t eviction_count() const
+            {
+                return eviction_count_.load(std::memory_order_relaxed);
+            }
+
+            /**
+            Get the number of shards
+            */
+            std::size_t shard_count() const
+            {
+                return std::size_t(1) << shard_bits_;
+            }
+
+        private:
+            static constexpr std::uint8_t max_freq = 3;
+
+            struct Entry {
+                Entry(const Key &k, value_ptr v, std::size_t c, bool m)
+                    : key(k), value(std::move(v)), charge(c), in_main(m)
+                {}
+
+                Key key;
+                value_ptr value;
+                std::size_t charge;
+                mutable std::atomic<std::uint8_t> freq{ 0 };
+                bool in_main;
+            };
+
+            using queue_type = std::list<Entry>;
+
+            // Approximate memory used by the cache itself for every entry: the queue node and the
+            // index node with its copy of the key
+            static constexpr std::size_t entry_overhead =
+                sizeof(Entry) + sizeof(Key) + 4 * sizeof(void *);
+
+            struct Shard {
+                mutable std::shared_mutex mtx;
+                std::unordered_map<Key, typename queue_type::iterator, Hasher> index;
+                queue_type small;
+                queue_type main;
+                std::size_t small_bytes = 0;
+                std::size_t main_bytes = 0;
+
+                // Hashes of keys recently evicted from the small queue
+                std::deque<std::size_t> ghost;
+                std::unordered_map<std::size_t, std::size_t> ghost_counts;
+
+                void add_ghost(std::size_t hash)
+                {
+                    ghost.push_back(hash);
+                    ghost_counts[hash]++;
+
+                    // Remember about as many evicted keys as there are entries in the cache
+                    while (ghost.size() > std::max<std::size_t>(index.size(), 1)) {
+                        auto count = ghost_counts.find(ghost.front());
+                        if (0 == --count->second) {
+                            ghost_counts.erase(count);
+                        }
+                        ghost.pop_front();
+                    }
+                }
+
+                bool in_ghost(std::size_t hash) const
+                {
+                    // A hash stays in the ghost queue until it reaches the front
+                    return ghost_counts.count(hash) > 0;
+                }
+            };
+
+            void evict(Shard &shard) const
+            {
+                while (shard.small_bytes + shard.main_bytes > shard_capacity_) {
+                    if (!shard.small.empty() &&
+                        (shard.small_bytes > small_capacity_ || shard.main.empty())) {
+                        evict_small(shard);
+                    } else {
+                        evict_main(shard);
+                    }
+                }
+            }
+
+            void evict_small(Shard &shard) const
+            {
+                auto entry = shard.small.begin();
+                shard.small_bytes -= entry->charge;
+                if (entry->freq.load(std::memory_order_relaxed) > 0) {
+                    // Hit while in the small queue, keep it in the main queue
+                    entry->freq.store(0, std::memory_order_relaxed);
+                    entry->in_main = true;
+                    shard.main_bytes += entry->charge;
+                    shard.main.splice(shard.main.end(), shard.small, entry);
+                    return;
+                }
+
+                shard.add_ghost(Hasher()(entry->key));
+                shard.index.erase(entry->key);
+                shard.small.erase(entry);
+                eviction_count_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void evict_main(Shard &shard) const
+            {
+                auto entry = shard.main.begin();
+                std::uint8_t freq = entry->freq.load(std::memory_order_relaxed);
+                if (freq > 0) {
+                    // Hit since it was last at the front, give it another round
+                    entry->freq.store(freq - 1, std::memory_order_relaxed);
+                    shard.main.splice(shard.main.end(), shard.main, entry);
+                    return;
+                }
+
+                shard.main_bytes -= entry->charge;
+                shard.index.erase(entry->key);
+                shard.main.erase(entry);
+                eviction_count_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            const Shard &get_shard(std::size_t hash) const
+            {
+                if (shard_bits_ == 0) {
+                    return shards_[0];
+                }
+
+                // Same shard selection as ShardedMap
+                std::uint64_t shard_hash = static_cast<std::uint64_t>(hash);
+                shard_hash *= 0x9E3779B97F4A7C15ULL;
+                return shards_[static_cast<std::size_t>(shard_hash >> (64 - shard_bits_))];
+            }
+
+            Shard &get_shard(std::size_t hash)
+            {
+                return const_cast<Shard &>(std::as_const(*this).get_shard(hash));
+            }
+
+            std::size_t capacity_bytes_;
+            std::size_t shard_capacity_;
+            std::size_t small_capacity_;
+            std::unique_ptr<Shard[]> shards_;
+            unsigned shard_bits_;
+            mutable std::atomic<std::size_t> eviction_count_{ 0 };
+        };
     } // namespace storage
 } // namespace ozks
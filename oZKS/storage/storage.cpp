@@ -0,0 +1,103 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+
+// OZKS
+#include "oZKS/ct_node_stored.h"
+#include "oZKS/partial_label.h"
+#include "oZKS/storage/storage.h"
+
+using namespace std;
+using namespace ozks;
+using namespace ozks::storage;
+
+size_t Storage::load_ctnodes(
+    trie_id_type trie_id,
+    gsl::span<const PartialLabel> node_ids,
+    shared_ptr<Storage> storage,
+    vector<optional<CTNodeStored>> &nodes)
+{
+    size_t found = 0;
+    nodes.assign(node_ids.size(), nullopt);
+    for (size_t idx = 0; idx < node_ids.size(); idx++) {
+        CTNodeStored node;
+        if (load_ctnode(trie_id, node_ids[idx], storage, node)) {
+            nodes[idx] = std::move(node);
+            found++;
+        }
+    }
+
+    return found;
+}
+
+size_t Storage::load_path(
+    trie_id_type trie_id,
+    const PartialLabel &label,
+    shared_ptr<Storage> storage,
+    vector<CTNodeStored> &nodes)
+{
+    nodes.clear();
+    LoadPath(
+        label,
+        [this, trie_id, &storage](
+            gsl::span<const PartialLabel> node_ids, vector<optional<CTNodeStored>> &loaded) {
+            load_ctnodes(trie_id, node_ids, storage, loaded);
+        },
+        nodes);
+
+    return nodes.size();
+}
+
+bool Storage::LoadPath(
+    const PartialLabel &label, const node_loader_type &load_nodes, vector<CTNodeStored> &nodes)
+{
+    vector<optional<CTNodeStored>> loaded;
+    PartialLabel root_label;
+    load_nodes(gsl::span<const PartialLabel>(&root_label, 1), loaded);
+    if (loaded.empty() || !loaded[0]) {
+        return false;
+    }
+    nodes.push_back(std::move(*loaded[0]));
+
+    // Follow the same route as a lookup: stop at the label, at a leaf, or when there is no child
+    // in the direction of the label
+    size_t current = 0;
+    while (nodes[current].label() != label && !nodes[current].is_leaf()) {
+        uint32_t common_count = PartialLabel::CommonPrefixCount(label, nodes[current].label());
+        bool next_bit = label[common_count];
+
+        vector<PartialLabel> children;
+        if (!nodes[current].left_label().empty()) {
+            children.push_back(nodes[current].left_label());
+        }
+        if (!nodes[current].right_label().empty()) {
+            children.push_back(nodes[current].right_label());
+        }
+        const PartialLabel &next_label =
+            next_bit ? nodes[current].right_label() : nodes[current].left_label();
+
+        load_nodes(children, loaded);
+        if (loaded.size() != children.size()) {
+            return false;
+        }
+
+        optional<size_t> next;
+        for (size_t idx = 0; idx < children.size(); idx++) {
+            if (!loaded[idx]) {
+                return false;
+            }
+            if (children[idx] == next_label) {
+                next = nodes.size();
+            }
+            nodes.push_back(std::move(*loaded[idx]));
+        }
+
+        if (!next) {
+            break;
+        }
+        current = *next;
+    }
+
+    return true;
+}
@@ -4,12 +4,20 @@
 #pragma once
 
 // STD
+#include <cstddef>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 // OZKS
 #include "oZKS/defines.h"
 
+// GSL
+#include "gsl/span"
+
 namespace ozks {
     class CTNodeStored;
     class CompressedTrie;
@@ -33,6 +41,30 @@ namespace ozks {
                 std::shared_ptr<Storage> storage,
                 CTNodeStored &node) = 0;
 
+            /**
+            Get a batch of nodes from storage. On return nodes has the same size as node_ids; a node
+            is empty if the corresponding label was not found. Returns the number of nodes that
+            were found. The default implementation loads the nodes one at a time.
+            */
+            virtual std::size_t load_ctnodes(
+                trie_id_type trie_id,
+                gsl::span<const PartialLabel> node_ids,
+                std::shared_ptr<Storage> storage,
+                std::vector<std::optional<CTNodeStored>> &nodes);
+
+            /**
+            Get the nodes needed to look up the given label: the root, every node on the path from
+            the root towards the label, and the children of those nodes. Implementations backed by
+            a remote store can override this to fetch the whole path in a single round trip. The
+            default implementation walks the path from the root and loads the children of each
+            node with a single call to load_ctnodes. Returns the number of nodes loaded.
+            */
+            virtual std::size_t load_path(
+                trie_id_type trie_id,
+                const PartialLabel &label,
+                std::shared_ptr<Storage> storage,
+                std::vector<CTNodeStored> &nodes);
+
             /**
             Save a node to storage
             */
@@ -64,6 +96,43 @@ namespace ozks {
                 const std::vector<std::byte> &key,
                 const store_value_type &value) = 0;
 
+            /**
+            Get a batch of store elements from storage. On return values has the same size as keys;
+            an element is empty if the corresponding key was not found. Returns the number of keys
+            that were found. The default implementation loads the elements one at a time.
+            */
+            virtual std::size_t load_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::vector<std::byte>> &keys,
+                std::vector<std::optional<store_value_type>> &values)
+            {
+                std::size_t found = 0;
+                values.assign(keys.size(), std::nullopt);
+                for (std::size_t idx = 0; idx < keys.size(); idx++) {
+                    store_value_type value;
+                    if (load_store_element(trie_id, keys[idx], value)) {
+                        values[idx] = std::move(value);
+                        found++;
+                    }
+                }
+
+                return found;
+            }
+
+            /**
+            Save a batch of store elements to storage. The default implementation saves the
+            elements one at a time.
+            */
+            virtual void save_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::pair<std::vector<std::byte>, store_value_type>>
+                    &store_elements)
+            {
+                for (const auto &store_element : store_elements) {
+                    save_store_element(trie_id, store_element.first, store_element.second);
+                }
+            }
+
             /**
             Flush changes if appropriate
             */
@@ -103,6 +172,25 @@ namespace ozks {
             OZKS instance. Some storage implementation might not support this operation.
             */
             virtual void delete_ozks(trie_id_type trie_id) = 0;
+
+        protected:
+            /**
+            Loads nodes into the given vector, which has the same size as the given labels on
+            return
+            */
+            using node_loader_type = std::function<void(
+                gsl::span<const PartialLabel>, std::vector<std::optional<CTNodeStored>> &)>;
+
+            /**
+            Walk the path of the given label from the root, adding the root, the nodes on the path
+            and their children to nodes. The root is loaded with one call to load_nodes, and the
+            children of every node on the path with one more call. Returns false if a node that
+            should exist could not be loaded.
+            */
+            static bool LoadPath(
+                const PartialLabel &label,
+                const node_loader_type &load_nodes,
+                std::vector<CTNodeStored> &nodes);
         };
     } // namespace storage
 } // namespace ozks
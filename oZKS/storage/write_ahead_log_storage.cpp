@@ -0,0 +1,621 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+// OZKS
+#include "oZKS/storage/log_file_helpers.h"
+#include "oZKS/storage/write_ahead_log_storage.h"
+
+using namespace std;
+using namespace ozks;
+using namespace ozks::storage;
+
+namespace {
+    constexpr uint32_t record_magic = 0x4C415A4F;
+
+    // A record starts with the magic number, the entry count, the payload size and the checksum
+    // of the payload
+    constexpr size_t record_header_size = 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+    // The payload starts with the trie ID and the record type, followed by the entries
+    constexpr size_t payload_header_size = sizeof(trie_id_type) + sizeof(uint8_t);
+
+    // An entry starts with the entry type, the key size and the value size, followed by the key
+    // and the value
+    constexpr size_t entry_header_size = sizeof(uint8_t) + 2 * sizeof(uint32_t);
+
+    enum class RecordType : uint8_t { Flush = 1, DeleteTrie = 2 };
+
+    enum class EntryType : uint8_t { Node = 1, Trie = 2, StoreElement = 3 };
+
+    /**
+    Builds a log record for the given trie; the entries are added with append_entry
+    */
+    vector<byte> begin_record(trie_id_type trie_id, RecordType type)
+    {
+        vector<byte> record(record_header_size);
+        append_value(record, trie_id);
+        append_value(record, static_cast<uint8_t>(type));
+        return record;
+    }
+
+    /**
+    Appends an entry whose value is written by the given function
+    */
+    template <typename WriteValue>
+    void append_entry(
+        vector<byte> &record, EntryType type, const vector<byte> &key, WriteValue write_entry_value)
+    {
+        size_t entry = record.size();
+        append_value(record, static_cast<uint8_t>(type));
+        append_value(record, static_cast<uint32_t>(key.size()));
+        append_value(record, uint32_t(0));
+        record.insert(record.end(), key.begin(), key.end());
+
+        size_t value = record.size();
+        write_entry_value(record);
+        write_value(
+            record,
+            entry + sizeof(uint8_t) + sizeof(uint32_t),
+            static_cast<uint32_t>(record.size() - value));
+    }
+
+    void end_record(vector<byte> &record, uint32_t entry_count)
+    {
+        size_t payload_size = record.size() - record_header_size;
+        write_value(record, 0, record_magic);
+        write_value(record, sizeof(uint32_t), entry_count);
+        write_value(record, 2 * sizeof(uint32_t), static_cast<uint64_t>(payload_size));
+        write_value(
+            record,
+            2 * sizeof(uint32_t) + sizeof(uint64_t),
+            checksum(record.data() + record_header_size, payload_size));
+    }
+
+    vector<byte> read_file(const string &path)
+    {
+        ifstream in(path, ios::binary | ios::ate);
+        if (!in) {
+            return {};
+        }
+
+        vector<byte> data(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        in.read(reinterpret_cast<char *>(data.data()), static_cast<streamsize>(data.size()));
+        if (!in) {
+            throw runtime_error("Failed to read write-ahead log " + path);
+        }
+
+        return data;
+    }
+} // namespace
+
+WriteAheadLogStorage::WriteAheadLogStorage(
+    shared_ptr<Storage> storage, const string &log_path, bool sync)
+    : storage_(storage), log_path_(log_path), sync_(sync)
+{
+    if (nullptr == storage_) {
+        throw invalid_argument("storage is null");
+    }
+
+    replay();
+
+    log_file_ = fopen(log_path_.c_str(), "ab");
+    if (nullptr == log_file_) {
+        throw runtime_error("Failed to open write-ahead log " + log_path_);
+    }
+}
+
+WriteAheadLogStorage::~WriteAheadLogStorage()
+{
+    if (nullptr != log_file_) {
+        fclose(log_file_);
+    }
+}
+
+void WriteAheadLogStorage::replay()
+{
+    vector<byte> data = read_file(log_path_);
+
+    // Apply records until the first one that is incomplete or does not match its checksum
+    size_t position = 0;
+    while (data.size() - position >= record_header_size) {
+        uint32_t magic = read_value<uint32_t>(data, position);
+        uint32_t entry_count = read_value<uint32_t>(data, position + sizeof(uint32_t));
+        uint64_t payload_size = read_value<uint64_t>(data, position + 2 * sizeof(uint32_t));
+        uint64_t record_checksum =
+            read_value<uint64_t>(data, position + 2 * sizeof(uint32_t) + sizeof(uint64_t));
+        size_t payload = position + record_header_size;
+        if (magic != record_magic || payload_size > data.size() - payload ||
+            payload_size < payload_header_size ||
+            record_checksum != checksum(data.data() + payload, payload_size)) {
+            break;
+        }
+
+        // A record that matches its checksum was written by this class, so its entries must be
+        // well-formed
+        trie_id_type trie_id = read_value<trie_id_type>(data, payload);
+        auto type = static_cast<RecordType>(read_value<uint8_t>(data, payload + sizeof(trie_id)));
+        size_t end = payload + payload_size;
+
+        vector<CTNodeStored> nodes;
+        vector<CompressedTrie> tries;
+        vector<pair<vector<byte>, store_value_type>> store_elements;
+        size_t entry = payload + payload_header_size;
+        for (uint32_t idx = 0; idx < entry_count; idx++) {
+            if (end - entry < entry_header_size) {
+                throw runtime_error("Invalid entry in write-ahead log");
+            }
+
+            auto entry_type = static_cast<EntryType>(read_value<uint8_t>(data, entry));
+            uint32_t key_size = read_value<uint32_t>(data, entry + sizeof(uint8_t));
+            uint32_t value_size =
+                read_value<uint32_t>(data, entry + sizeof(uint8_t) + sizeof(uint32_t));
+            size_t key = entry + entry_header_size;
+            if (static_cast<uint64_t>(key_size) + value_size > end - key) {
+                throw runtime_error("Invalid entry in write-ahead log");
+            }
+
+            vector<byte> value(
+                data.begin() + key + key_size, data.begin() + key + key_size + value_size);
+            switch (entry_type) {
+            case EntryType::Node:
+                if (CTNodeStored::IsCompact(value)) {
+                    CTNodeStored::LoadCompact(value, nodes.emplace_back());
+                } else {
+                    nodes.push_back(get<0>(CTNodeStored::Load(value, nullptr)));
+                }
+                break;
+            case EntryType::Trie:
+                tries.push_back(*CompressedTrie::Load(value, nullptr).first);
+                break;
+            case EntryType::StoreElement: {
+                if (value_size < randomness_size) {
+                    throw runtime_error("Invalid store element in write-ahead log");
+                }
+                store_value_type store_value;
+                size_t payload_value_size = value_size - randomness_size;
+                store_value.payload.assign(value.begin(), value.begin() + payload_value_size);
+                copy(
+                    value.begin() + payload_value_size,
+                    value.end(),
+                    store_value.randomness.begin());
+                store_elements.emplace_back(
+                    vector<byte>(data.begin() + key, data.begin() + key + key_size),
+                    std::move(store_value));
+                break;
+            }
+            default:
+                throw runtime_error("Invalid entry type in write-ahead log");
+            }
+
+            entry = key + key_size + value_size;
+        }
+        if (entry != end) {
+            throw runtime_error("Invalid record in write-ahead log");
+        }
+
+        if (type == RecordType::DeleteTrie) {
+            storage_->delete_ozks(trie_id);
+        } else {
+            apply(trie_id, nodes, tries, store_elements);
+        }
+        position = end;
+    }
+
+    // Discard an incomplete record so that new records are appended after the valid ones
+    log_size_ = position;
+    if (position != data.size()) {
+        filesystem::resize_file(log_path_, position);
+    }
+}
+
+uint64_t WriteAheadLogStorage::commit(trie_id_type trie_id, const vector<byte> &record)
+{
+    unique_lock<mutex> lock(log_mtx_);
+    if (nullptr != log_error_) {
+        rethrow_exception(log_error_);
+    }
+
+    log_buffer_.insert(log_buffer_.end(), record.begin(), record.end());
+    if (nullptr == pending_group_) {
+        pending_group_ = make_shared<CommitGroup>();
+    }
+    shared_ptr<CommitGroup> group = pending_group_;
+    group->record_count++;
+    uint64_t sequence = trie_sequences_[trie_id].committed++;
+
+    // The first waiting flush writes and syncs the records of all flushes that are waiting
+    while (!group->done) {
+        if (syncing_) {
+            log_cv_.wait(lock);
+            continue;
+        }
+
+        syncing_ = true;
+        vector<byte> buffer;
+        swap(buffer, log_buffer_);
+        shared_ptr<CommitGroup> writing_group;
+        swap(writing_group, pending_group_);
+        size_t log_size = log_size_;
+        exception_ptr error = log_error_;
+        lock.unlock();
+
+        bool restored = true;
+        if (nullptr == error) {
+            try {
+                if (fwrite(buffer.data(), 1, buffer.size(), log_file_) != buffer.size()) {
+                    throw runtime_error("Failed to write write-ahead log");
+                }
+                sync_file(log_file_, sync_, "write-ahead log");
+            } catch (...) {
+                error = current_exception();
+                restored = restore_log(log_size);
+            }
+        }
+
+        lock.lock();
+        syncing_ = false;
+        writing_group->done = true;
+        writing_group->error = error;
+        if (nullptr == error) {
+            log_size_ += buffer.size();
+            sync_count_++;
+            unapplied_count_ += writing_group->record_count;
+        } else if (!restored) {
+            log_error_ = error;
+        }
+        log_cv_.notify_all();
+    }
+
+    if (nullptr != group->error) {
+        // The record is not in the log, but later records of the trie must not wait for it
+        TrieSequence &trie_sequence = trie_sequences_[trie_id];
+        log_cv_.wait(lock, [&]() { return trie_sequence.applied == sequence; });
+        trie_sequence.applied++;
+        log_cv_.notify_all();
+        rethrow_exception(group->error);
+    }
+
+    return sequence;
+}
+
+void WriteAheadLogStorage::apply_in_order(
+    trie_id_type trie_id, uint64_t sequence, const function<void()> &apply)
+{
+    unique_lock<mutex> lock(log_mtx_);
+    TrieSequence &trie_sequence = trie_sequences_[trie_id];
+    log_cv_.wait(lock, [&]() { return trie_sequence.applied == sequence; });
+    lock.unlock();
+
+    exception_ptr error;
+    try {
+        apply();
+    } catch (...) {
+        error = current_exception();
+    }
+
+    lock.lock();
+    trie_sequence.applied++;
+    unapplied_count_--;
+    log_cv_.notify_all();
+    lock.unlock();
+
+    if (nullptr != error) {
+        rethrow_exception(error);
+    }
+}
+
+bool WriteAheadLogStorage::restore_log(size_t size)
+{
+    // Drop whatever part of the failed records reached the log, so that later records are not
+    // appended after an incomplete one
+    fclose(log_file_);
+    error_code ec;
+    filesystem::resize_file(log_path_, size, ec);
+    log_file_ = fopen(log_path_.c_str(), "ab");
+    return !ec && nullptr != log_file_;
+}
+
+void WriteAheadLogStorage::apply(
+    trie_id_type trie_id,
+    const vector<CTNodeStored> &nodes,
+    const vector<CompressedTrie> &tries,
+    const vector<pair<vector<byte>, store_value_type>> &store_elements)
+{
+    auto batch_storage = dynamic_pointer_cast<BatchStorage>(storage_);
+    if (nullptr != batch_storage) {
+        batch_storage->flush(trie_id, nodes, tries, store_elements);
+        return;
+    }
+
+    for (const auto &node : nodes) {
+        storage_->save_ctnode(trie_id, node);
+    }
+    for (const auto &trie : tries) {
+        storage_->save_compressed_trie(trie);
+    }
+    if (!store_elements.empty()) {
+        storage_->save_store_elements(trie_id, store_elements);
+    }
+    storage_->flush(trie_id);
+}
+
+bool WriteAheadLogStorage::load_ctnode(
+    trie_id_type trie_id,
+    const PartialLabel &node_id,
+    shared_ptr<Storage> storage,
+    CTNodeStored &node)
+{
+    // First, check unsaved nodes
+    {
+        lock_guard<mutex> lock(unsaved_mtx_);
+        auto unsaved = unsaved_elements_.find(trie_id);
+        if (unsaved != unsaved_elements_.end()) {
+            auto unsaved_node = unsaved->second.nodes.find(node_id);
+            if (unsaved_node != unsaved->second.nodes.end()) {
+                node = unsaved_node->second;
+                return true;
+            }
+        }
+    }
+
+    // Second, check wrapped storage
+    return storage_->load_ctnode(trie_id, node_id, storage, node);
+}
+
+void WriteAheadLogStorage::save_ctnode(trie_id_type trie_id, const CTNodeStored &node)
+{
+    lock_guard<mutex> lock(unsaved_mtx_);
+    unsaved_elements_[trie_id].nodes[node.label()] = node;
+}
+
+bool WriteAheadLogStorage::load_compressed_trie(trie_id_type trie_id, CompressedTrie &trie)
+{
+    // First, check unsaved tries
+    {
+        lock_guard<mutex> lock(unsaved_mtx_);
+        auto unsaved = unsaved_elements_.find(trie_id);
+        if (unsaved != unsaved_elements_.end() && unsaved->second.trie) {
+            trie = *unsaved->second.trie;
+            return true;
+        }
+    }
+
+    // Second, check wrapped storage
+    return storage_->load_compressed_trie(trie_id, trie);
+}
+
+void WriteAheadLogStorage::save_compressed_trie(const CompressedTrie &trie)
+{
+    lock_guard<mutex> lock(unsaved_mtx_);
+    unsaved_elements_[trie.id()].trie = trie;
+}
+
+bool WriteAheadLogStorage::load_store_element(
+    trie_id_type trie_id, const vector<byte> &key, store_value_type &value)
+{
+    // First, check unsaved store elements
+    {
+        lock_guard<mutex> lock(unsaved_mtx_);
+        auto unsaved = unsaved_elements_.find(trie_id);
+        if (unsaved != unsaved_elements_.end()) {
+            auto unsaved_store_element = unsaved->second.store_elements.find(key);
+            if (unsaved_store_element != unsaved->second.store_elements.end()) {
+                value = unsaved_store_element->second;
+                return true;
+            }
+        }
+    }
+
+    // Second, check wrapped storage
+    return storage_->load_store_element(trie_id, key, value);
+}
+
+void WriteAheadLogStorage::save_store_element(
+    trie_id_type trie_id, const vector<byte> &key, const store_value_type &value)
+{
+    lock_guard<mutex> lock(unsaved_mtx_);
+    unsaved_elements_[trie_id].store_elements[key] = value;
+}
+
+void WriteAheadLogStorage::save_store_elements(
+    trie_id_type trie_id, const vector<pair<vector<byte>, store_value_type>> &store_elements)
+{
+    lock_guard<mutex> lock(unsaved_mtx_);
+    auto &unsaved_store_elements = unsaved_elements_[trie_id].store_elements;
+    unsaved_store_elements.reserve(unsaved_store_elements.size() + store_elements.size());
+    for (const auto &store_element : store_elements) {
+        unsaved_store_elements[store_element.first] = store_element.second;
+    }
+}
+
+void WriteAheadLogStorage::flush(trie_id_type trie_id)
+{
+    // Only the unsaved elements of the given trie are flushed
+    UnsavedElements unsaved;
+    {
+        lock_guard<mutex> lock(unsaved_mtx_);
+        auto unsaved_it = unsaved_elements_.find(trie_id);
+        if (unsaved_it != unsaved_elements_.end()) {
+            unsaved = std::move(unsaved_it->second);
+            unsaved_elements_.erase(unsaved_it);
+        }
+    }
+
+    vector<CTNodeStored> nodes;
+    vector<CompressedTrie> tries;
+    vector<pair<vector<byte>, store_value_type>> store_elements;
+
+    nodes.reserve(unsaved.nodes.size());
+    for (auto &node_pair : unsaved.nodes) {
+        nodes.emplace_back(std::move(node_pair.second));
+    }
+    if (unsaved.trie) {
+        tries.emplace_back(std::move(*unsaved.trie));
+    }
+    store_elements.reserve(unsaved.store_elements.size());
+    for (auto &store_element_pair : unsaved.store_elements) {
+        store_elements.emplace_back(store_element_pair.first, std::move(store_element_pair.second));
+    }
+
+    try {
+        flush(trie_id, nodes, tries, store_elements);
+    } catch (...) {
+        // Keep the elements so that the flush can be retried; elements that were saved again
+        // in the meantime are newer and take precedence
+        lock_guard<mutex> lock(unsaved_mtx_);
+        auto &current = unsaved_elements_[trie_id];
+        for (auto &node : nodes) {
+            PartialLabel label = node.label();
+            current.nodes.try_emplace(label, std::move(node));
+        }
+        if (!current.trie && !tries.empty()) {
+            current.trie = std::move(tries.front());
+        }
+        for (auto &store_element : store_elements) {
+            current.store_elements.try_emplace(
+                std::move(store_element.first), std::move(store_element.second));
+        }
+        throw;
+    }
+}
+
+void WriteAheadLogStorage::flush(
+    trie_id_type trie_id,
+    const vector<CTNodeStored> &nodes,
+    const vector<CompressedTrie> &tries,
+    const vector<pair<vector<byte>, store_value_type>> &store_elements)
+{
+    size_t entry_count = nodes.size() + tries.size() + store_elements.size();
+    if (0 != entry_count) {
+        vector<byte> record = begin_record(trie_id, RecordType::Flush);
+        for (const auto &node : nodes) {
+            append_entry(record, EntryType::Node, {}, [&node](vector<byte> &buffer) {
+                size_t offset = buffer.size();
+                buffer.resize(offset + node.compact_save_size());
+                node.save_compact(gsl::span<byte>(buffer).subspan(offset));
+            });
+        }
+        for (const auto &trie : tries) {
+            append_entry(record, EntryType::Trie, {}, [&trie](vector<byte> &buffer) {
+                trie.save(buffer);
+            });
+        }
+        for (const auto &store_element : store_elements) {
+            const store_value_type &value = store_element.second;
+            append_entry(
+                record,
+                EntryType::StoreElement,
+                store_element.first,
+                [&value](vector<byte> &buffer) {
+                    buffer.insert(buffer.end(), value.payload.begin(), value.payload.end());
+                    buffer.insert(buffer.end(), value.randomness.begin(), value.randomness.end());
+                });
+        }
+        end_record(record, static_cast<uint32_t>(entry_count));
+
+        // Only apply the elements once the whole record is on disk
+        uint64_t sequence = commit(trie_id, record);
+        apply_in_order(trie_id, sequence, [&]() { apply(trie_id, nodes, tries, store_elements); });
+        return;
+    }
+
+    apply(trie_id, nodes, tries, store_elements);
+}
+
+void WriteAheadLogStorage::add_ctnode(trie_id_type, const CTNodeStored &)
+{
+    throw runtime_error("Does not make sense for this Storage implementation");
+}
+
+void WriteAheadLogStorage::add_compressed_trie(const CompressedTrie &)
+{
+    throw runtime_error("Does not make sense for this Storage implementation");
+}
+
+void WriteAheadLogStorage::add_store_element(
+    trie_id_type, const vector<byte> &, const store_value_type &)
+{
+    throw runtime_error("Does not make sense for this Storage implementation");
+}
+
+size_t WriteAheadLogStorage::get_compressed_trie_epoch(trie_id_type trie_id)
+{
+    CompressedTrie trie;
+
+    // Look first in wrapped storage
+    if (!storage_->load_compressed_trie(trie_id, trie)) {
+        // Not in wrapped storage, try in unsaved tries
+        lock_guard<mutex> lock(unsaved_mtx_);
+        auto unsaved = unsaved_elements_.find(trie_id);
+        if (unsaved != unsaved_elements_.end() && unsaved->second.trie) {
+            trie = *unsaved->second.trie;
+        }
+    }
+
+    return trie.epoch();
+}
+
+void WriteAheadLogStorage::load_updated_elements(
+    size_t epoch, trie_id_type trie_id, shared_ptr<Storage> storage)
+{
+    // As with the batch inserter, the callback goes to the caller unless this is the top storage
+    if (storage.get() == this) {
+        storage = nullptr;
+    }
+    storage_->load_updated_elements(epoch, trie_id, storage);
+}
+
+void WriteAheadLogStorage::delete_ozks(trie_id_type trie_id)
+{
+    {
+        lock_guard<mutex> lock(unsaved_mtx_);
+        unsaved_elements_.erase(trie_id);
+    }
+
+    vector<byte> record = begin_record(trie_id, RecordType::DeleteTrie);
+    end_record(record, 0);
+    uint64_t sequence = commit(trie_id, record);
+
+    // Perform same operation on wrapped storage
+    apply_in_order(trie_id, sequence, [&]() { storage_->delete_ozks(trie_id); });
+}
+
+void WriteAheadLogStorage::checkpoint()
+{
+    unique_lock<mutex> lock(log_mtx_);
+    log_cv_.wait(lock, [this]() { return !syncing_ && 0 == unapplied_count_; });
+    if (nullptr != log_error_) {
+        rethrow_exception(log_error_);
+    }
+
+    // Every record in the log has been applied. Records that are waiting for a group commit
+    // stay in the buffer and are written to the truncated log.
+    fclose(log_file_);
+    log_file_ = fopen(log_path_.c_str(), "wb");
+    if (nullptr == log_file_) {
+        log_error_ = make_exception_ptr(
+            runtime_error("Failed to truncate write-ahead log " + log_path_));
+        rethrow_exception(log_error_);
+    }
+    log_size_ = 0;
+    sync_file(log_file_, sync_, "write-ahead log");
+}
+
+size_t WriteAheadLogStorage::log_size() const
+{
+    lock_guard<mutex> lock(log_mtx_);
+    return log_size_;
+}
+
+uint64_t WriteAheadLogStorage::sync_count() const
+{
+    lock_guard<mutex> lock(log_mtx_);
+    return sync_count_;
+}
@@ -0,0 +1,284 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+// STD
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// OZKS
+#include "oZKS/compressed_trie.h"
+#include "oZKS/ct_node_stored.h"
+#include "oZKS/storage/batch_storage.h"
+#include "oZKS/utilities.h"
+
+namespace ozks {
+    namespace storage {
+        /**
+        Storage that makes every flush of a trie atomic and durable by writing it to a
+        write-ahead log before it is applied to a wrapped storage. Saved nodes, tries and store
+        elements are kept in memory until the trie is flushed; the flush then appends them to the
+        log as a single checksummed record and only applies them to the wrapped storage once the
+        record is on disk. When the storage is opened, the records in the log are applied to the
+        wrapped storage again, so an epoch whose flush was interrupted by a crash is either
+        applied completely or, if its record was not completely written, not at all.
+
+        Concurrent flushes are group committed: records that are appended while the log is being
+        synced are written and synced together by the next flush, so the number of syncs does not
+        grow with the number of nodes or concurrent flushes. The records of a trie are applied to
+        the wrapped storage in the order in which they were written to the log. If flushes happen
+        concurrently with other operations, the wrapped storage must be thread-safe. When a record
+        cannot be written, the log is truncated to the last complete record and the unsaved
+        elements are kept, so the flush can be retried.
+
+        The log grows until it is checkpointed. Call checkpoint once the wrapped storage has
+        durably stored everything that was flushed so far; a log that is never checkpointed can
+        be used to rebuild a non-durable wrapped storage, such as a MemoryStorage, from scratch.
+        */
+        class WriteAheadLogStorage : public BatchStorage {
+        public:
+            /**
+            Opens the log at the given path, creating it if it does not exist, and applies the
+            records found in it to the wrapped storage. An incomplete record at the end of the log
+            is discarded. If sync is false, records are handed to the operating system but not
+            synced to disk, which is faster but does not survive a power loss.
+            */
+            WriteAheadLogStorage(
+                std::shared_ptr<Storage> storage, const std::string &log_path, bool sync = true);
+
+            virtual ~WriteAheadLogStorage();
+
+            /**
+            Get a node from storage
+            */
+            bool load_ctnode(
+                trie_id_type trie_id,
+                const PartialLabel &node_id,
+                std::shared_ptr<Storage> storage,
+                CTNodeStored &node) override;
+
+            /**
+            Save a node to storage
+            */
+            void save_ctnode(trie_id_type trie_id, const CTNodeStored &node) override;
+
+            /**
+            Get a compressed trie from storage
+            */
+            bool load_compressed_trie(trie_id_type trie_id, CompressedTrie &trie) override;
+
+            /**
+            Save a compressed trie to storage
+            */
+            void save_compressed_trie(const CompressedTrie &trie) override;
+
+            /**
+            Get a store element from storage
+            */
+            bool load_store_element(
+                trie_id_type trie_id,
+                const std::vector<std::byte> &key,
+                store_value_type &value) override;
+
+            /**
+            Save a store element to storage
+            */
+            void save_store_element(
+                trie_id_type trie_id,
+                const std::vector<std::byte> &key,
+                const store_value_type &value) override;
+
+            /**
+            Save a batch of store elements to storage
+            */
+            void save_store_elements(
+                trie_id_type trie_id,
+                const std::vector<std::pair<std::vector<std::byte>, store_value_type>>
+                    &store_elements) override;
+
+            /**
+            Write the unsaved elements of the given trie to the log as a single record and apply
+            them to the wrapped storage
+            */
+            void flush(trie_id_type trie_id) override;
+
+            /**
+            Write the given sets of nodes, tries and store elements to the log as a single record
+            and apply them to the wrapped storage
+            */
+            void flush(
+                trie_id_type trie_id,
+                const std::vector<CTNodeStored> &nodes,
+                const std::vector<CompressedTrie> &tries,
+                const std::vector<std::pair<std::vector<std::byte>, store_value_type>>
+                    &store_elements) override;
+
+            /**
+            Add an existing node to the current storage.
+            */
+            void add_ctnode(trie_id_type trie_id, const CTNodeStored &node) override;
+
+            /**
+            Add an existing compresssed trie to the current storage.
+            */
+            void add_compressed_trie(const CompressedTrie &trie) override;
+
+            /**
+            Add an existing store element to the current storage
+            */
+            void add_store_element(
+                trie_id_type trie_id,
+                const std::vector<std::byte> &key,
+                const store_value_type &value) override;
+
+            /**
+            Get the latest epoch for the given compressed trie
+            */
+            std::size_t get_compressed_trie_epoch(trie_id_type trie_id) override;
+
+            /**
+            Load updated elements for the given epoch
+            */
+            void load_updated_elements(
+                std::size_t epoch, trie_id_type trie_id, std::shared_ptr<Storage> storage) override;
+
+            /**
+            Delete nodes for the given trie from storage, as well as the trie itself and related
+            ozks instance. The deletion is logged so that replaying the log does not bring the
+            trie back.
+            */
+            void delete_ozks(trie_id_type trie_id) override;
+
+            /**
+            Discard all records in the log. Waits until every record that is in the log has been
+            applied to the wrapped storage. Must only be called once the wrapped storage has
+            durably stored everything that was flushed so far.
+            */
+            void checkpoint();
+
+            /**
+            Get the path of the log file
+            */
+            const std::string &log_path() const
+            {
+                return log_path_;
+            }
+
+            /**
+            Get the size of the log in bytes
+            */
+            std::size_t log_size() const;
+
+            /**
+            Get the number of times the log was synced to disk
+            */
+            std::uint64_t sync_count() const;
+
+        private:
+            // Unsaved nodes, trie and store elements of a single trie
+            struct UnsavedElements {
+                std::unordered_map<PartialLabel, CTNodeStored> nodes;
+
+                std::optional<CompressedTrie> trie;
+
+                std::unordered_map<
+                    std::vector<std::byte>,
+                    store_value_type,
+                    utils::byte_vector_hash>
+                    store_elements;
+            };
+
+            // Flushes whose records are written and synced together
+            struct CommitGroup {
+                std::size_t record_count = 0;
+
+                bool done = false;
+
+                std::exception_ptr error;
+            };
+
+            // Position of a trie's records in the log, so that they are applied in log order
+            struct TrieSequence {
+                std::uint64_t committed = 0;
+
+                std::uint64_t applied = 0;
+            };
+
+            void replay();
+
+            /**
+            Append a record of the given trie to the log and wait until it is on disk. Returns the
+            position of the record among the records of the trie.
+            */
+            std::uint64_t commit(trie_id_type trie_id, const std::vector<std::byte> &record);
+
+            /**
+            Wait until all earlier records of the trie have been applied, then apply this one
+            */
+            void apply_in_order(
+                trie_id_type trie_id, std::uint64_t sequence, const std::function<void()> &apply);
+
+            /**
+            Truncate the log to the given size after a failed write and reopen it
+            */
+            bool restore_log(std::size_t size);
+
+            void apply(
+                trie_id_type trie_id,
+                const std::vector<CTNodeStored> &nodes,
+                const std::vector<CompressedTrie> &tries,
+                const std::vector<std::pair<std::vector<std::byte>, store_value_type>>
+                    &store_elements);
+
+            std::shared_ptr<Storage> storage_;
+
+            std::string log_path_;
+
+            bool sync_;
+
+            // Protects the unsaved elements
+            mutable std::mutex unsaved_mtx_;
+
+            std::unordered_map<trie_id_type, UnsavedElements> unsaved_elements_;
+
+            // Protects the log file, the group commit state and the trie sequences
+            mutable std::mutex log_mtx_;
+
+            std::condition_variable log_cv_;
+
+            FILE *log_file_ = nullptr;
+
+            std::size_t log_size_ = 0;
+
+            // Records waiting for the next group commit
+            std::vector<std::byte> log_buffer_;
+
+            std::shared_ptr<CommitGroup> pending_group_;
+
+            bool syncing_ = false;
+
+            std::uint64_t sync_count_ = 0;
+
+            std::unordered_map<trie_id_type, TrieSequence> trie_sequences_;
+
+            // Number of records that are in the log but have not been applied yet
+            std::size_t unapplied_count_ = 0;
+
+            // Set when the log could not be restored after a failed write; the log cannot be used
+            // after that
+            std::exception_ptr log_error_;
+        };
+    } // namespace storage
+} // namespace ozks
@@ -27,79 +27,353 @@
 
 // STD
 #include <algorithm>
+#include <array>
 #include <atomic>
-#include <cassert>
 #include <condition_variable>
-#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
+#include <optional>
 #include <stdexcept>
+#include <string>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
 #define ozks_result_of_type typename std::invoke_result<F, Args...>::type
 
 namespace ozks {
+    namespace detail {
+        // A type-erased callable that is invoked once. Callables of up to inline_size bytes are
+        // stored in the task itself, larger ones on the heap.
+        class Task {
+        public:
+            static constexpr std::size_t inline_size = 64;
+
+            template <class F>
+            explicit Task(F &&f)
+            {
+                using fn_type = std::decay_t<F>;
+                if constexpr (
+                    sizeof(fn_type) <= inline_size &&
+                    alignof(fn_type) <= alignof(std::max_align_t)) {
+                    new (storage_) fn_type(std::forward<F>(f));
+                    invoke_ = [](void *p) { (*static_cast<fn_type *>(p))(); };
+                    destroy_ = [](void *p) { static_cast<fn_type *>(p)->~fn_type(); };
+                } else {
+                    new (storage_) fn_type *(new fn_type(std::forward<F>(f)));
+                    invoke_ = [](void *p) { (**static_cast<fn_type **>(p))(); };
+                    destroy_ = [](void *p) { delete *static_cast<fn_type **>(p); };
+                }
+            }
+
+            Task(const Task &) = delete;
+
+            Task &operator=(const Task &) = delete;
+
+            ~Task()
+            {
+                destroy_(storage_);
+            }
+
+            void operator()()
+            {
+                invoke_(storage_);
+            }
+
+        private:
+            alignas(std::max_align_t) unsigned char storage_[inline_size];
+            void (*invoke_)(void *);
+            void (*destroy_)(void *);
+        };
+
+        // Lock-free work-stealing deque (Chase and Lev; memory orderings follow Le et al.,
+        // "Correct and Efficient Work-Stealing for Weak Memory Models"). Only the owning worker
+        // may push and pop; any thread may steal.
+        class WorkDeque {
+        public:
+            WorkDeque() : top_(0), bottom_(0)
+            {
+                arrays_.push_back(std::make_unique<Array>(initial_capacity));
+                array_.store(arrays_.back().get(), std::memory_order_relaxed);
+            }
+
+            WorkDeque(const WorkDeque &) = delete;
+
+            WorkDeque &operator=(const WorkDeque &) = delete;
+
+            void push(Task *task)
+            {
+                std::int64_t b = bottom_.load(std::memory_order_relaxed);
+                std::int64_t t = top_.load(std::memory_order_acquire);
+                Array *a = array_.load(std::memory_order_relaxed);
+                if (b - t > a->capacity - 1) {
+                    a = grow(a, t, b);
+                }
+                a->put(b, task);
+                bottom_.store(b + 1, std::memory_order_release);
+            }
+
+            Task *pop()
+            {
+                std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+                Array *a = array_.load(std::memory_order_relaxed);
+                bottom_.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::int64_t t = top_.load(std::memory_order_relaxed);
+
+                if (t > b) {
+                    // Empty
+                    bottom_.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+
+                Task *task = a->get(b);
+                if (t == b) {
+                    // Last element; race against thieves
+                    if (!top_.compare_exchange_strong(
+                            t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                        task = nullptr;
+                    }
+                    bottom_.store(b + 1, std::memory_order_relaxed);
+                }
+                return task;
+            }
+
+            Task *steal()
+            {
+                std::int64_t t = top_.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::int64_t b = bottom_.load(std::memory_order_acquire);
+                if (t >= b) {
+                    return nullptr;
+                }
+
+                Array *a = array_.load(std::memory_order_acquire);
+                Task *task = a->get(t);
+                if (!top_.compare_exchange_strong(
+                        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    return nullptr;
+                }
+                return task;
+            }
+
+            bool empty() const
+            {
+                return bottom_.load(std::memory_order_acquire) <=
+                       top_.load(std::memory_order_acquire);
+            }
+
+        private:
+            static constexpr std::int64_t initial_capacity = 64;
+
+            struct Array {
+                explicit Array(std::int64_t cap)
+                    : capacity(cap), slots(new std::atomic<Task *>[static_cast<std::size_t>(cap)])
+                {}
+
+                Task *get(std::int64_t idx) const
+                {
+                    return slots[static_cast<std::size_t>(idx & (capacity - 1))].load(
+                        std::memory_order_relaxed);
+                }
+
+                void put(std::int64_t idx, Task *task)
+                {
+                    slots[static_cast<std::size_t>(idx & (capacity - 1))].store(
+                        task, std::memory_order_relaxed);
+                }
+
+                const std::int64_t capacity;
+                std::unique_ptr<std::atomic<Task *>[]> slots;
+            };
+
+            Array *grow(Array *a, std::int64_t t, std::int64_t b)
+            {
+                arrays_.push_back(std::make_unique<Array>(a->capacity * 2));
+                Array *new_array = arrays_.back().get();
+                for (std::int64_t idx = t; idx < b; idx++) {
+                    new_array->put(idx, a->get(idx));
+                }
+                array_.store(new_array, std::memory_order_release);
+                return new_array;
+            }
+
+            alignas(64) std::atomic<std::int64_t> top_;
+            alignas(64) std::atomic<std::int64_t> bottom_;
+            std::atomic<Array *> array_;
+
+            // Arrays replaced when growing are kept alive, since thieves may still read them
+            std::vector<std::unique_ptr<Array>> arrays_;
+        };
+
+        // Identifies the pool and worker slot of the current thread, if it is a worker
+        struct worker_context {
+            const void *pool = nullptr;
+            std::size_t index = 0;
+        };
+
+        inline worker_context &current_worker()
+        {
+            static thread_local worker_context context;
+            return context;
+        }
+
+        // Shared state of a parallel_for call
+        struct loop_state {
+            std::size_t chunk_count = 0;
+            std::atomic<std::size_t> next_chunk{ 0 };
+            std::atomic<std::size_t> done_chunks{ 0 };
+            void (*run_chunk)(const void *fn, std::size_t chunk) = nullptr;
+            const void *fn = nullptr;
+            std::atomic<bool> failed{ false };
+            std::exception_ptr error;
+            std::mutex mtx;
+            std::condition_variable done;
+        };
+
+        inline void run_loop(loop_state &state)
+        {
+            for (;;) {
+                std::size_t chunk = state.next_chunk.fetch_add(1, std::memory_order_relaxed);
+                if (chunk >= state.chunk_count) {
+                    return;
+                }
+
+                // After a failure the remaining chunks are skipped, but still counted as done
+                if (!state.failed.load(std::memory_order_relaxed)) {
+                    try {
+                        state.run_chunk(state.fn, chunk);
+                    } catch (...) {
+                        if (!state.failed.exchange(true)) {
+                            state.error = std::current_exception();
+                        }
+                    }
+                }
+
+                std::size_t done_chunks =
+                    state.done_chunks.fetch_add(1, std::memory_order_acq_rel) + 1;
+                if (done_chunks == state.chunk_count) {
+                    std::unique_lock<std::mutex> lock(state.mtx);
+                    state.done.notify_all();
+                }
+            }
+        }
+    } // namespace detail
+
+    /**
+    A work-stealing thread pool. Every worker has its own lock-free deque; tasks enqueued from a
+    worker go to the worker's deque, tasks enqueued from other threads go to a shared queue, and
+    idle workers steal from the other workers. Besides enqueue, which returns a future, the pool
+    provides a chunked parallel_for and parallel_reduce with much lower per-chunk overhead.
+    */
     class ThreadPool {
     public:
+        // maximum number of worker threads
+        static constexpr std::size_t max_pool_size = 256;
+
         explicit ThreadPool(
             std::size_t threads = (std::max)(2u, std::thread::hardware_concurrency()));
+        // worker threads are named "<name>-<worker number>" where supported
+        ThreadPool(std::size_t threads, std::string name);
         template <class F, class... Args>
         auto enqueue(F &&f, Args &&... args) -> std::future<ozks_result_of_type>;
+        // calls f(chunk_begin, chunk_end) for consecutive chunks of at most grain indices
+        // covering [begin, end), and returns when all chunks are done. The calling thread
+        // processes chunks too. If f throws, the remaining chunks are skipped and the first
+        // exception is rethrown.
+        template <class F>
+        void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F &&f);
+        // combines map(chunk_begin, chunk_end) over chunks of [begin, end) as in parallel_for,
+        // starting from identity and in chunk order, using reduce(T, T)
+        template <class T, class Map, class Reduce>
+        T parallel_reduce(
+            std::size_t begin,
+            std::size_t end,
+            std::size_t grain,
+            T identity,
+            Map &&map,
+            Reduce &&reduce);
         void wait_until_empty();
         void wait_until_nothing_in_flight();
+        // limit on the number of tasks queued by threads that are not workers of this pool;
+        // enqueue blocks while the limit is reached
         void set_queue_size_limit(std::size_t limit);
         void set_pool_size(std::size_t limit);
+        std::size_t pool_size_limit();
         ~ThreadPool();
 
+        // process-wide pool shared by everything that is not given a pool of its own;
+        // created on first use
+        static std::shared_ptr<ThreadPool> Shared();
+        // set the size and thread name of the shared pool; if the shared pool already exists it
+        // is resized, but its threads keep their names
+        static void ConfigureShared(std::size_t threads, std::string name = "ozks");
+
     private:
         void emplace_back_worker(std::size_t worker_number);
-        void set_queue_size_limit_no_lock(std::size_t limit);
-
-        // need to keep track of threads so we can join them
-        std::vector<std::thread> workers;
+        void worker_loop(std::size_t worker_number);
+        void push_task(detail::Task *task);
+        detail::Task *find_task(std::size_t start);
+        void run_task(detail::Task *task);
+        void task_taken();
+        void wake_one();
+
+        // per-worker deques; created on demand and never destroyed before the pool
+        std::array<std::atomic<detail::WorkDeque *>, max_pool_size> deques;
+        std::atomic<std::size_t> deque_count{ 0 };
+        // worker threads and whether each has exited after the pool was downsized
+        std::array<std::thread, max_pool_size> workers;
+        std::array<bool, max_pool_size> exited{};
         // target pool size
-        std::size_t pool_size;
-        // the task queue
-        std::queue<std::function<void()> > tasks;
+        std::atomic<std::size_t> pool_size;
+        // worker thread name prefix
+        std::string name;
+        // tasks enqueued by threads that are not workers of this pool
+        std::deque<detail::Task *> tasks;
         // queue length limit
         std::size_t max_queue_size = 100000;
         // stop signal
-        bool stop = false;
+        std::atomic<bool> stop{ false };
 
         // synchronization
         std::mutex queue_mutex;
         std::condition_variable condition_producers;
-        std::condition_variable condition_consumers;
-
-        std::mutex in_flight_mutex;
-        std::condition_variable in_flight_condition;
-        std::atomic<std::size_t> in_flight;
 
-        struct handle_in_flight_decrement {
-            ThreadPool &tp;
-
-            handle_in_flight_decrement(ThreadPool &tp_) : tp(tp_)
-            {}
+        std::mutex sleep_mutex;
+        std::condition_variable condition_consumers;
+        std::atomic<std::size_t> sleeping{ 0 };
 
-            ~handle_in_flight_decrement()
-            {
-                std::size_t prev = std::atomic_fetch_sub_explicit(
-                    &tp.in_flight, std::size_t(1), std::memory_order_acq_rel);
-                if (prev == 1) {
-                    std::unique_lock<std::mutex> guard(tp.in_flight_mutex);
-                    tp.in_flight_condition.notify_all();
-                }
-            }
-        };
+        // number of queued tasks and number of queued or running tasks
+        std::atomic<std::size_t> queued{ 0 };
+        std::atomic<std::size_t> in_flight{ 0 };
+        std::mutex idle_mutex;
+        std::condition_variable idle_condition;
     };
 
-    // the constructor just launches some amount of workers
-    inline ThreadPool::ThreadPool(std::size_t threads) : pool_size(threads), in_flight(0)
+    inline ThreadPool::ThreadPool(std::size_t threads) : ThreadPool(threads, std::string())
+    {}
+
+    inline ThreadPool::ThreadPool(std::size_t threads, std::string name)
+        : pool_size((std::min)(threads, max_pool_size)), name(std::move(name))
     {
-        for (std::size_t i = 0; i != threads; ++i)
+        for (auto &deque : deques) {
+            deque.store(nullptr, std::memory_order_relaxed);
+        }
+
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        for (std::size_t i = 0; i != pool_size; ++i)
             emplace_back_worker(i);
     }
 
@@ -109,140 +383,369 @@ namespace ozks {
     {
         using return_type = ozks_result_of_type;
 
-        auto task = std::make_shared<std::packaged_task<return_type()> >(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        std::promise<return_type> promise;
+        std::future<return_type> res = promise.get_future();
+
+        push_task(new detail::Task([promise = std::move(promise),
+                                    f = std::forward<F>(f),
+                                    args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            try {
+                if constexpr (std::is_void_v<return_type>) {
+                    std::apply(f, std::move(args));
+                    promise.set_value();
+                } else {
+                    promise.set_value(std::apply(f, std::move(args)));
+                }
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }));
 
-        std::future<return_type> res = task->get_future();
+        return res;
+    }
 
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        if (tasks.size() >= max_queue_size) {
-            std::size_t new_queue_size = max_queue_size * 2;
-            set_queue_size_limit_no_lock(new_queue_size);
+    template <class F>
+    void ThreadPool::parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F &&f)
+    {
+        if (begin >= end) {
+            return;
+        }
 
-            // wait for the queue to empty or be stopped
-            condition_producers.wait(
-                lock, [this] { return tasks.size() < max_queue_size || stop; });
+        grain = (std::max)(grain, std::size_t(1));
+        std::size_t chunk_count = (end - begin + grain - 1) / grain;
+        auto run_chunk = [&f, begin, end, grain](std::size_t chunk) {
+            std::size_t chunk_begin = begin + chunk * grain;
+            f(chunk_begin, (std::min)(chunk_begin + grain, end));
+        };
+
+        if (chunk_count == 1) {
+            run_chunk(0);
+            return;
         }
 
-        // don't allow enqueueing after stopping the pool
-        if (stop)
-            throw std::runtime_error("enqueue on stopped ThreadPool");
+        // Helper tasks share the loop state, which outlives this call in case a helper only
+        // starts after all chunks are done
+        auto state = std::make_shared<detail::loop_state>();
+        state->chunk_count = chunk_count;
+        state->fn = &run_chunk;
+        state->run_chunk = [](const void *fn, std::size_t chunk) {
+            (*static_cast<const decltype(run_chunk) *>(fn))(chunk);
+        };
 
-        tasks.emplace([task]() { (*task)(); });
-        std::atomic_fetch_add_explicit(&in_flight, std::size_t(1), std::memory_order_relaxed);
-        condition_consumers.notify_one();
+        std::size_t helper_count =
+            (std::min)(chunk_count - 1, pool_size.load(std::memory_order_relaxed));
+        for (std::size_t i = 0; i < helper_count; i++) {
+            push_task(new detail::Task([state]() { detail::run_loop(*state); }));
+        }
 
-        return res;
+        detail::run_loop(*state);
+
+        {
+            std::unique_lock<std::mutex> lock(state->mtx);
+            state->done.wait(lock, [&state, chunk_count] {
+                return state->done_chunks.load(std::memory_order_acquire) == chunk_count;
+            });
+        }
+
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
     }
 
-    // the destructor joins all threads
+    template <class T, class Map, class Reduce>
+    T ThreadPool::parallel_reduce(
+        std::size_t begin,
+        std::size_t end,
+        std::size_t grain,
+        T identity,
+        Map &&map,
+        Reduce &&reduce)
+    {
+        if (begin >= end) {
+            return identity;
+        }
+
+        grain = (std::max)(grain, std::size_t(1));
+        std::size_t chunk_count = (end - begin + grain - 1) / grain;
+        std::vector<std::optional<T>> partials(chunk_count);
+        parallel_for(0, chunk_count, 1, [&](std::size_t chunk_begin, std::size_t chunk_end) {
+            for (std::size_t chunk = chunk_begin; chunk < chunk_end; chunk++) {
+                std::size_t map_begin = begin + chunk * grain;
+                partials[chunk].emplace(map(map_begin, (std::min)(map_begin + grain, end)));
+            }
+        });
+
+        T result = std::move(identity);
+        for (auto &partial : partials) {
+            result = reduce(std::move(result), std::move(*partial));
+        }
+        return result;
+    }
+
+    // the destructor runs all remaining tasks and joins all threads
     inline ThreadPool::~ThreadPool()
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop = true;
-        condition_consumers.notify_all();
-        condition_producers.notify_all();
-        pool_size = 0;
-        condition_consumers.wait(lock, [this] { return this->workers.empty(); });
-        assert(in_flight == 0);
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            stop = true;
+            condition_producers.notify_all();
+        }
+        {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            condition_consumers.notify_all();
+        }
+
+        for (auto &worker : workers) {
+            if (worker.joinable())
+                worker.join();
+        }
+
+        // Only left over if the pool has no threads; the futures report a broken promise
+        for (auto task : tasks)
+            delete task;
+        for (auto &deque : deques)
+            delete deque.load(std::memory_order_relaxed);
     }
 
     inline void ThreadPool::wait_until_empty()
     {
-        std::unique_lock<std::mutex> lock(this->queue_mutex);
-        this->condition_producers.wait(lock, [this] { return this->tasks.empty(); });
+        std::unique_lock<std::mutex> lock(this->idle_mutex);
+        this->idle_condition.wait(lock, [this] { return this->queued == 0; });
     }
 
     inline void ThreadPool::wait_until_nothing_in_flight()
     {
-        std::unique_lock<std::mutex> lock(this->in_flight_mutex);
-        this->in_flight_condition.wait(lock, [this] { return this->in_flight == 0; });
+        std::unique_lock<std::mutex> lock(this->idle_mutex);
+        this->idle_condition.wait(lock, [this] { return this->in_flight == 0; });
     }
 
     inline void ThreadPool::set_queue_size_limit(std::size_t limit)
     {
         std::unique_lock<std::mutex> lock(this->queue_mutex);
-        set_queue_size_limit_no_lock(limit);
+        max_queue_size = (std::max)(limit, std::size_t(1));
+        condition_producers.notify_all();
     }
 
     inline void ThreadPool::set_pool_size(std::size_t limit)
     {
-        if (limit < 1)
-            limit = 1;
+        limit = (std::min)((std::max)(limit, std::size_t(1)), max_pool_size);
 
         std::unique_lock<std::mutex> lock(this->queue_mutex);
 
         if (stop)
             return;
 
+        std::size_t const old_size = pool_size;
         pool_size = limit;
-        std::size_t const old_size = this->workers.size();
-        if (pool_size > old_size) {
-            // create new worker threads
-            for (std::size_t i = old_size; i != pool_size; ++i)
-                emplace_back_worker(i);
-        } else if (pool_size < old_size)
-            // notify all worker threads to start downsizing
-            this->condition_consumers.notify_all();
+        for (std::size_t i = old_size; i < limit; ++i) {
+            // a worker that has not noticed the earlier downsizing simply keeps running
+            if (workers[i].joinable() && !exited[i])
+                continue;
+            if (workers[i].joinable())
+                workers[i].join();
+            emplace_back_worker(i);
+        }
+
+        if (limit < old_size) {
+            // wake up the workers that need to exit
+            std::unique_lock<std::mutex> sleep_lock(sleep_mutex);
+            condition_consumers.notify_all();
+        }
+    }
+
+    inline std::size_t ThreadPool::pool_size_limit()
+    {
+        return pool_size;
+    }
+
+    namespace detail {
+        struct shared_pool_state {
+            std::mutex mtx;
+            std::shared_ptr<ThreadPool> pool;
+            std::size_t threads = (std::max)(2u, std::thread::hardware_concurrency());
+            std::string name = "ozks";
+        };
+
+        inline shared_pool_state &get_shared_pool_state()
+        {
+            static shared_pool_state state;
+            return state;
+        }
+    } // namespace detail
+
+    inline std::shared_ptr<ThreadPool> ThreadPool::Shared()
+    {
+        detail::shared_pool_state &state = detail::get_shared_pool_state();
+        std::unique_lock<std::mutex> lock(state.mtx);
+        if (!state.pool) {
+            state.pool = std::make_shared<ThreadPool>(state.threads, state.name);
+        }
+        return state.pool;
     }
 
+    inline void ThreadPool::ConfigureShared(std::size_t threads, std::string name)
+    {
+        detail::shared_pool_state &state = detail::get_shared_pool_state();
+        std::unique_lock<std::mutex> lock(state.mtx);
+        state.threads = (std::max)(threads, std::size_t(1));
+        state.name = std::move(name);
+        if (state.pool) {
+            state.pool->set_pool_size(state.threads);
+        }
+    }
+
+    // must be called with queue_mutex held
     inline void ThreadPool::emplace_back_worker(std::size_t worker_number)
     {
-        workers.emplace_back([this, worker_number] {
-            for (;;) {
-                std::function<void()> task;
-                bool notify;
+        if (nullptr == deques[worker_number].load(std::memory_order_relaxed)) {
+            deques[worker_number].store(new detail::WorkDeque(), std::memory_order_release);
+            if (deque_count.load(std::memory_order_relaxed) < worker_number + 1)
+                deque_count.store(worker_number + 1, std::memory_order_release);
+        }
 
-                {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition_consumers.wait(lock, [this, worker_number] {
-                        return this->stop || !this->tasks.empty() || pool_size < worker_number + 1;
-                    });
-
-                    // deal with downsizing of thread pool or shutdown
-                    if ((this->stop && this->tasks.empty()) ||
-                        (!this->stop && pool_size < worker_number + 1)) {
-                        std::thread &last_thread = this->workers.back();
-                        std::thread::id this_id = std::this_thread::get_id();
-                        if (this_id == last_thread.get_id()) {
-                            // highest number thread exits, resizes the workers
-                            // vector, and notifies others
-                            last_thread.detach();
-                            this->workers.pop_back();
-                            this->condition_consumers.notify_all();
-                            return;
-                        } else
-                            continue;
-                    } else if (!this->tasks.empty()) {
-                        task = std::move(this->tasks.front());
-                        this->tasks.pop();
-                        notify = this->tasks.size() + 1 == max_queue_size || this->tasks.empty();
-                    } else
-                        continue;
+        exited[worker_number] = false;
+        workers[worker_number] = std::thread([this, worker_number] { worker_loop(worker_number); });
+    }
+
+    inline void ThreadPool::worker_loop(std::size_t worker_number)
+    {
+#ifdef __linux__
+        if (!name.empty()) {
+            // Linux limits thread names to 15 characters
+            std::string thread_name = name + "-" + std::to_string(worker_number);
+            pthread_setname_np(pthread_self(), thread_name.substr(0, 15).c_str());
+        }
+#endif
+        detail::current_worker() = { this, worker_number };
+        detail::WorkDeque &own_deque = *deques[worker_number].load(std::memory_order_acquire);
+
+        for (;;) {
+            if (pool_size.load(std::memory_order_acquire) < worker_number + 1) {
+                // deal with downsizing of thread pool: hand the tasks in this worker's deque to
+                // the remaining workers and exit
+                std::unique_lock<std::mutex> lock(this->queue_mutex);
+                if (!stop && pool_size < worker_number + 1) {
+                    while (detail::Task *task = own_deque.pop())
+                        tasks.push_back(task);
+                    exited[worker_number] = true;
+                    lock.unlock();
+
+                    std::unique_lock<std::mutex> sleep_lock(sleep_mutex);
+                    condition_consumers.notify_all();
+                    break;
                 }
+            }
 
-                handle_in_flight_decrement guard(*this);
+            detail::Task *task = own_deque.pop();
+            if (nullptr == task) {
+                task = find_task(worker_number + 1);
+            }
+            if (nullptr != task) {
+                task_taken();
+                run_task(task);
+                continue;
+            }
 
-                if (notify) {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    condition_producers.notify_all();
-                }
+            // deal with shutdown: exit once there is nothing left to run
+            if (stop && queued == 0) {
+                break;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            sleeping.fetch_add(1);
+            condition_consumers.wait(lock, [this, worker_number] {
+                return this->queued > 0 || this->stop || pool_size < worker_number + 1;
+            });
+            sleeping.fetch_sub(1);
+        }
+
+        detail::current_worker() = {};
+    }
+
+    inline void ThreadPool::push_task(detail::Task *task)
+    {
+        std::atomic_fetch_add_explicit(&in_flight, std::size_t(1), std::memory_order_relaxed);
+
+        detail::worker_context &context = detail::current_worker();
+        if (context.pool == this) {
+            // enqueued from one of our workers: no locking needed
+            queued.fetch_add(1);
+            deques[context.index].load(std::memory_order_relaxed)->push(task);
+        } else {
+            std::unique_lock<std::mutex> lock(queue_mutex);
 
-                task();
+            // wait for the queue to have room or the pool to be stopped
+            condition_producers.wait(
+                lock, [this] { return tasks.size() < max_queue_size || stop; });
+
+            // don't allow enqueueing after stopping the pool
+            if (stop) {
+                lock.unlock();
+                delete task;
+                std::atomic_fetch_sub_explicit(
+                    &in_flight, std::size_t(1), std::memory_order_relaxed);
+                throw std::runtime_error("enqueue on stopped ThreadPool");
             }
-        });
+
+            queued.fetch_add(1);
+            tasks.push_back(task);
+        }
+
+        wake_one();
     }
 
-    inline void ThreadPool::set_queue_size_limit_no_lock(std::size_t limit)
+    inline detail::Task *ThreadPool::find_task(std::size_t start)
     {
-        if (stop) {
-            return;
+        // steal from the other workers first, which needs no locking
+        std::size_t count = deque_count.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; i++) {
+            detail::WorkDeque *deque =
+                deques[(start + i) % count].load(std::memory_order_acquire);
+            if (nullptr != deque) {
+                if (detail::Task *task = deque->steal())
+                    return task;
+            }
         }
 
-        std::size_t old_limit = max_queue_size;
-        max_queue_size = (std::max)(limit, std::size_t(1));
-        if (old_limit < max_queue_size) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (tasks.empty())
+            return nullptr;
+
+        detail::Task *task = tasks.front();
+        tasks.pop_front();
+        if (tasks.size() + 1 == max_queue_size)
             condition_producers.notify_all();
+        return task;
+    }
+
+    inline void ThreadPool::run_task(detail::Task *task)
+    {
+        (*task)();
+        delete task;
+
+        std::size_t prev =
+            std::atomic_fetch_sub_explicit(&in_flight, std::size_t(1), std::memory_order_acq_rel);
+        if (prev == 1) {
+            std::unique_lock<std::mutex> guard(idle_mutex);
+            idle_condition.notify_all();
+        }
+    }
+
+    inline void ThreadPool::task_taken()
+    {
+        if (queued.fetch_sub(1) == 1) {
+            std::unique_lock<std::mutex> guard(idle_mutex);
+            idle_condition.notify_all();
+        }
+    }
+
+    inline void ThreadPool::wake_one()
+    {
+        // sleeping is incremented under sleep_mutex before the wait predicate reads queued, so
+        // either the sleeper sees the new task or we see the sleeper
+        if (sleeping.load() > 0) {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            condition_consumers.notify_one();
         }
     }
 } // namespace ozks
@@ -0,0 +1,374 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// OZKS
+#include "oZKS/compressed_trie.h"
+#include "oZKS/ct_node.h"
+#include "oZKS/trie_image.h"
+
+using namespace std;
+using namespace ozks;
+
+namespace {
+    constexpr uint32_t image_magic = 0x49545A4F; // "OZTI"
+
+    constexpr uint32_t image_version = 1;
+
+    // Marks a missing child
+    constexpr uint32_t no_node = numeric_limits<uint32_t>::max();
+
+    // Header: magic, version, trie id, epoch, node count and commitment
+    constexpr size_t magic_offset = 0;
+    constexpr size_t version_offset = magic_offset + sizeof(uint32_t);
+    constexpr size_t id_offset = version_offset + sizeof(uint32_t);
+    constexpr size_t epoch_offset = id_offset + sizeof(uint64_t);
+    constexpr size_t node_count_offset = epoch_offset + sizeof(uint64_t);
+    constexpr size_t commitment_offset = node_count_offset + sizeof(uint64_t);
+    constexpr size_t header_size = commitment_offset + hash_size;
+
+    // Node record: label, left child index, right child index and hash
+    constexpr size_t label_offset = 0;
+    constexpr size_t left_offset = label_offset + PartialLabel::SaveSize;
+    constexpr size_t right_offset = left_offset + sizeof(uint32_t);
+    constexpr size_t hash_offset = right_offset + sizeof(uint32_t);
+    constexpr size_t record_size = hash_offset + hash_size;
+
+    template <typename T>
+    void write_value(byte *dest, const T &value)
+    {
+        memcpy(dest, &value, sizeof(T));
+    }
+
+    template <typename T>
+    T read_value(const byte *src)
+    {
+        T value;
+        memcpy(&value, src, sizeof(T));
+        return value;
+    }
+
+    bool sync_file(FILE *file)
+    {
+#if defined(_WIN32)
+        return 0 == _commit(_fileno(file));
+#else
+        return 0 == fsync(fileno(file));
+#endif
+    }
+
+    void sync_parent_directory([[maybe_unused]] const string &path)
+    {
+#if !defined(_WIN32)
+        // Make the rename durable; failure only means the old image may be found after a crash
+        filesystem::path directory = filesystem::path(path).parent_path();
+        int fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+#endif
+    }
+} // namespace
+
+struct TrieImage::Mapping {
+    const byte *data = nullptr;
+
+    size_t size = 0;
+
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+
+    HANDLE mapping = nullptr;
+
+    Mapping(const string &path)
+    {
+        file = CreateFileA(
+            path.c_str(),
+            GENERIC_READ,
+            FILE_SHARE_READ,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            nullptr);
+        if (INVALID_HANDLE_VALUE == file) {
+            throw runtime_error("Failed to open trie image file");
+        }
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size)) {
+            CloseHandle(file);
+            throw runtime_error("Failed to get size of trie image file");
+        }
+        size = static_cast<size_t>(file_size.QuadPart);
+        if (0 == size) {
+            CloseHandle(file);
+            throw runtime_error("Trie image file is empty");
+        }
+
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (nullptr == mapping) {
+            CloseHandle(file);
+            throw runtime_error("Failed to map trie image file");
+        }
+
+        data = static_cast<const byte *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (nullptr == data) {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            throw runtime_error("Failed to map trie image file");
+        }
+    }
+
+    ~Mapping()
+    {
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+        CloseHandle(file);
+    }
+#else
+    Mapping(const string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Failed to open trie image file");
+        }
+
+        struct stat file_stat;
+        if (0 != fstat(fd, &file_stat)) {
+            close(fd);
+            throw runtime_error("Failed to get size of trie image file");
+        }
+        size = static_cast<size_t>(file_stat.st_size);
+        if (0 == size) {
+            close(fd);
+            throw runtime_error("Trie image file is empty");
+        }
+
+        // The mapping stays valid after the file descriptor is closed
+        void *address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (MAP_FAILED == address) {
+            throw runtime_error("Failed to map trie image file");
+        }
+        data = static_cast<const byte *>(address);
+    }
+
+    ~Mapping()
+    {
+        munmap(const_cast<byte *>(data), size);
+    }
+#endif
+
+    Mapping(const Mapping &) = delete;
+
+    Mapping &operator=(const Mapping &) = delete;
+};
+
+TrieImage::TrieImage(const string &path) : path_(path), mapping_(make_unique<Mapping>(path))
+{
+    const byte *header = mapping_->data;
+    if (mapping_->size < header_size || image_magic != read_value<uint32_t>(header)) {
+        throw runtime_error("File is not a trie image");
+    }
+    if (image_version != read_value<uint32_t>(header + version_offset)) {
+        throw runtime_error("Unsupported trie image version");
+    }
+
+    id_ = read_value<uint64_t>(header + id_offset);
+    epoch_ = static_cast<size_t>(read_value<uint64_t>(header + epoch_offset));
+    node_count_ = static_cast<size_t>(read_value<uint64_t>(header + node_count_offset));
+    memcpy(commitment_.data(), header + commitment_offset, hash_size);
+
+    if (0 == node_count_ || node_count_ > no_node ||
+        mapping_->size != header_size + node_count_ * record_size) {
+        throw runtime_error("Trie image file is corrupted");
+    }
+
+    records_ = header + header_size;
+}
+
+TrieImage::~TrieImage()
+{}
+
+void TrieImage::Export(const CompressedTrie &trie, const string &path)
+{
+    trie.root_->init(&trie);
+
+    // Assign record indices in depth-first order, filling in the child indices of the parent
+    // once a child gets its index
+    vector<byte> records;
+    vector<pair<shared_ptr<const CTNode>, size_t>> pending;
+    pending.emplace_back(trie.root_, 0);
+    while (!pending.empty()) {
+        auto [node, child_offset] = move(pending.back());
+        pending.pop_back();
+
+        size_t index = records.size() / record_size;
+        if (index >= no_node) {
+            throw runtime_error("Trie has too many nodes for a trie image");
+        }
+        if (0 != index) {
+            write_value(records.data() + child_offset, static_cast<uint32_t>(index));
+        }
+
+        size_t offset = records.size();
+        records.resize(offset + record_size);
+        byte *record = records.data() + offset;
+        node->label().save(gsl::span<byte, PartialLabel::SaveSize>(
+            record + label_offset, PartialLabel::SaveSize));
+        write_value(record + left_offset, no_node);
+        write_value(record + right_offset, no_node);
+        hash_type hash = node->hash();
+        memcpy(record + hash_offset, hash.data(), hash_size);
+
+        // Right is pushed first so the left subtree directly follows its parent
+        auto right_node = node->right();
+        if (nullptr != right_node) {
+            pending.emplace_back(right_node, offset + right_offset);
+        }
+        auto left_node = node->left();
+        if (nullptr != left_node) {
+            pending.emplace_back(left_node, offset + left_offset);
+        }
+    }
+
+    byte header[header_size];
+    write_value(header + magic_offset, image_magic);
+    write_value(header + version_offset, image_version);
+    write_value(header + id_offset, static_cast<uint64_t>(trie.id()));
+    write_value(header + epoch_offset, static_cast<uint64_t>(trie.epoch()));
+    write_value(header + node_count_offset, static_cast<uint64_t>(records.size() / record_size));
+    commitment_type commitment = trie.get_commitment();
+    memcpy(header + commitment_offset, commitment.data(), hash_size);
+
+    // The contents must be on disk before the rename makes them visible under the final path,
+    // otherwise a crash can leave an empty or partial image behind
+    string temp_path = path + ".tmp";
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if (nullptr == file) {
+        throw runtime_error("Failed to create trie image file");
+    }
+    bool written = fwrite(header, 1, header_size, file) == header_size &&
+                   fwrite(records.data(), 1, records.size(), file) == records.size() &&
+                   0 == fflush(file) && sync_file(file);
+    if (0 != fclose(file) || !written) {
+        error_code ec;
+        filesystem::remove(temp_path, ec);
+        throw runtime_error("Failed to write trie image file");
+    }
+
+    filesystem::rename(temp_path, path);
+    sync_parent_directory(path);
+}
+
+bool TrieImage::lookup(const PartialLabel &label, lookup_path_type &path) const
+{
+    path.clear();
+
+    // Same walk as CTNode::lookup, with the lookup path collected in reverse order
+    vector<uint32_t> lookup_path;
+    PartialLabel current_label;
+    uint32_t current = 0;
+    bool sibling_is_left = false;
+    bool found = false;
+
+    while (true) {
+        load_node(current, current_label);
+        if (current_label == label) {
+            // This node is the result
+            lookup_path.push_back(current);
+            found = true;
+            break;
+        }
+
+        uint32_t left;
+        uint32_t right;
+        load_children(current, left, right);
+        if (no_node == left && no_node == right) {
+            // Not found. Need to include non-existence proof in result.
+            if (sibling_is_left) {
+                lookup_path.push_back(current);
+            } else {
+                // When sibling is right we need to insert at n-1
+                auto position = lookup_path.begin();
+                if (lookup_path.size() > 0) {
+                    position = lookup_path.end() - 1;
+                }
+
+                lookup_path.insert(position, current);
+            }
+            break;
+        }
+
+        uint32_t common_count = PartialLabel::CommonPrefixCount(label, current_label);
+        bool next_bit = label[common_count];
+
+        uint32_t next = next_bit ? right : left;
+        uint32_t sibling = next_bit ? left : right;
+        sibling_is_left = next_bit;
+
+        if (no_node != sibling) {
+            // Add sibling to the path
+            lookup_path.push_back(sibling);
+        }
+
+        if (no_node == next) {
+            break;
+        }
+        current = next;
+    }
+
+    path.reserve(lookup_path.size());
+    for (auto it = lookup_path.rbegin(); it != lookup_path.rend(); it++) {
+        PartialLabel node_label;
+        load_node(*it, node_label);
+        path.push_back({ node_label, load_hash(*it) });
+    }
+
+    return found;
+}
+
+void TrieImage::load_node(uint32_t index, PartialLabel &label) const
+{
+    if (index >= node_count_) {
+        throw runtime_error("Trie image file is corrupted");
+    }
+
+    const byte *record = records_ + index * record_size;
+    label.load(gsl::span<const byte, PartialLabel::SaveSize>(
+        record + label_offset, PartialLabel::SaveSize));
+}
+
+void TrieImage::load_children(uint32_t index, uint32_t &left, uint32_t &right) const
+{
+    const byte *record = records_ + index * record_size;
+    left = read_value<uint32_t>(record + left_offset);
+    right = read_value<uint32_t>(record + right_offset);
+}
+
+hash_type TrieImage::load_hash(uint32_t index) const
+{
+    hash_type hash;
+    memcpy(hash.data(), records_ + index * record_size + hash_offset, hash_size);
+    return hash;
+}
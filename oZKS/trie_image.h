@@ -0,0 +1,119 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+// STD
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// OZKS
+#include "oZKS/defines.h"
+#include "oZKS/partial_label.h"
+
+namespace ozks {
+    class CompressedTrie;
+
+    /**
+    A read-only image of a compressed trie at a given epoch. The image is a single immutable file
+    made of a fixed-size header followed by one fixed-size record per node, holding the node label,
+    hash and the record indices of its children. Nodes are stored in depth-first order starting
+    with the root, so the nodes of a lookup path tend to share pages.
+
+    Opening an image maps the file into memory; lookups walk the records in place without loading
+    or deserializing nodes, and processes that open the same image share its pages. All lookups
+    are thread-safe.
+    */
+    class TrieImage {
+    public:
+        /**
+        Opens the image in the given file. Throws if the file is not a valid trie image.
+        */
+        TrieImage(const std::string &path);
+
+        TrieImage(const TrieImage &) = delete;
+
+        TrieImage &operator=(const TrieImage &) = delete;
+
+        ~TrieImage();
+
+        /**
+        Writes an image of the given compressed trie at its current epoch to the given file. The
+        image is first written to a temporary file that is then renamed, so an existing image at
+        the same path is replaced atomically.
+        */
+        static void Export(const CompressedTrie &trie, const std::string &path);
+
+        /**
+        Returns whether the given label exists in the trie. If it does, gets the path of the label,
+        including its sibling node (if any). The path is identical to the one returned by
+        CompressedTrie::lookup.
+        */
+        bool lookup(const PartialLabel &label, lookup_path_type &path) const;
+
+        /**
+        Get the id of the trie the image was exported from
+        */
+        trie_id_type id() const
+        {
+            return id_;
+        }
+
+        /**
+        Get the epoch the image was exported at
+        */
+        std::size_t epoch() const
+        {
+            return epoch_;
+        }
+
+        /**
+        Get the commitment (root hash) of the trie at the exported epoch
+        */
+        const commitment_type &get_commitment() const
+        {
+            return commitment_;
+        }
+
+        /**
+        Get the number of nodes in the image
+        */
+        std::size_t node_count() const
+        {
+            return node_count_;
+        }
+
+        /**
+        Get the path of the image file
+        */
+        const std::string &path() const
+        {
+            return path_;
+        }
+
+    private:
+        struct Mapping;
+
+        void load_node(std::uint32_t index, PartialLabel &label) const;
+
+        void load_children(std::uint32_t index, std::uint32_t &left, std::uint32_t &right) const;
+
+        hash_type load_hash(std::uint32_t index) const;
+
+        std::string path_;
+
+        std::unique_ptr<Mapping> mapping_;
+
+        const std::byte *records_ = nullptr;
+
+        trie_id_type id_ = 0;
+
+        std::size_t epoch_ = 0;
+
+        commitment_type commitment_ = {};
+
+        std::size_t node_count_ = 0;
+    };
+} // namespace ozks
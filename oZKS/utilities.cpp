@@ -183,6 +183,24 @@ hash_type utils::get_node_label(
     return key_hash;
 }
 
+vector<hash_type> utils::get_node_labels(
+    gsl::span<const key_type> keys, const VRFSecretKey &vrf_sk, LabelType label_type)
+{
+    // In any case, first hash the keys with utils::compute_key_hash
+    vector<hash_type> key_hashes;
+    key_hashes.reserve(keys.size());
+    for (const auto &key : keys) {
+        key_hashes.push_back(utils::compute_key_hash(key));
+    }
+
+    if (label_type == LabelType::VRFLabels) {
+        // If this OZKS uses VRFs, replace the key hashes with the VRF values (hashes)
+        return vrf_sk.get_vrf_values(key_hashes);
+    }
+
+    return key_hashes;
+}
+
 void utils::copy_bytes(const void *src, size_t count, void *dst)
 {
     if (!count) {
@@ -133,6 +133,13 @@ namespace ozks {
         hash_type get_node_label(
             const key_type &key, const VRFSecretKey &vrf_sk, LabelType label_type);
 
+        /**
+        Computes the labels for a batch of keys. The result is the same as calling get_node_label
+        for each key, but when VRFs are used the VRF values are computed as a single batch.
+        */
+        std::vector<hash_type> get_node_labels(
+            gsl::span<const key_type> keys, const VRFSecretKey &vrf_sk, LabelType label_type);
+
         /**
         Hasher for a byte vector.
         Needed to be able to use a byte vector as the key to a map.
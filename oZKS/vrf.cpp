@@ -7,6 +7,7 @@
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 // OZKS
 #include "oZKS/utilities.h"
@@ -113,6 +114,37 @@ namespace {
 
         return nonce_s;
     }
+
+    VRFProof make_proof(
+        const utils::ECPoint &pk,
+        const utils::ECPoint &h2c_data,
+        const utils::ECPoint &sk_times_h2c_data,
+        const utils::ECPoint::scalar_type &nonce,
+        const utils::ECPoint &nonce_times_h2c_data,
+        const utils::ECPoint::scalar_type &key_scalar)
+    {
+        utils::ECPoint nonce_times_generator = utils::ECPoint::MakeGeneratorMultiple(nonce);
+
+        // Compute c as the hash of all of the above curve points and reduce modulo order
+        decltype(VRFProof::c) c = make_challenge(
+            pk, h2c_data, sk_times_h2c_data, nonce_times_generator, nonce_times_h2c_data);
+
+        // Next compute s=c*key-nonce mod order
+        utils::ECPoint::scalar_type temp;
+        utils::ECPoint::MultiplyScalar(utils::ECPoint::scalar_type(c), key_scalar, temp);
+        utils::ECPoint::SubtractScalar(nonce, temp, temp);
+
+        // Save temp as s
+        decltype(VRFProof::s) s{};
+        temp.save(s);
+
+        // Finally save sk_times_h2c_data to gamma
+        decltype(VRFProof::gamma) gamma{};
+        sk_times_h2c_data.save(gamma);
+
+        // Return the proof struct
+        return { gamma, c, s };
+    }
 } // namespace
 
 bool VRFProof::is_valid() const noexcept
@@ -218,30 +250,12 @@ VRFProof VRFSecretKey::get_vrf_proof(const hash_type &data) const
     sk_times_h2c_data.scalar_multiply(key_scalar_, false);
 
     utils::ECPoint::scalar_type nonce = make_nonce(h2c_data, key_scalar_);
-    utils::ECPoint nonce_times_generator = utils::ECPoint::MakeGeneratorMultiple(nonce);
 
     utils::ECPoint nonce_times_h2c_data(h2c_data);
     nonce_times_h2c_data.scalar_multiply(nonce, false);
 
-    // Compute c as the hash of all of the above curve points and reduce modulo order
-    decltype(VRFProof::c) c = make_challenge(
-        pk_.key_point_, h2c_data, sk_times_h2c_data, nonce_times_generator, nonce_times_h2c_data);
-
-    // Next compute s=c*key-nonce mod order
-    utils::ECPoint::scalar_type temp;
-    utils::ECPoint::MultiplyScalar(utils::ECPoint::scalar_type(c), key_scalar_, temp);
-    utils::ECPoint::SubtractScalar(nonce, temp, temp);
-
-    // Save temp as s
-    decltype(VRFProof::s) s{};
-    temp.save(s);
-
-    // Finally save sk_times_h2c_data to gamma
-    decltype(VRFProof::gamma) gamma{};
-    sk_times_h2c_data.save(gamma);
-
-    // Return the proof struct
-    return { gamma, c, s };
+    return make_proof(
+        pk_.key_point_, h2c_data, sk_times_h2c_data, nonce, nonce_times_h2c_data, key_scalar_);
 }
 
 VRFProof VRFSecretKey::get_vrf_proof(const key_type &data) const
@@ -269,6 +283,63 @@ hash_type VRFSecretKey::get_vrf_value(const key_type &data) const
     return get_vrf_value(data_hash);
 }
 
+vector<VRFProof> VRFSecretKey::get_vrf_proofs(gsl::span<const hash_type> data) const
+{
+    throw_if_uninitialized();
+
+    // Same steps as in get_vrf_proof, but with batched hash-to-curve and scalar multiplications
+    vector<utils::ECPoint> h2c_data =
+        utils::ECPoint::MakeHashToCurveBatch(data, h2c_salt_); // cofactor cleared
+
+    vector<utils::ECPoint> sk_times_h2c_data(h2c_data);
+    vector<utils::ECPoint::scalar_type> key_scalars(data.size(), key_scalar_);
+    utils::ECPoint::ScalarMultiplyBatch(sk_times_h2c_data, key_scalars, false);
+
+    vector<utils::ECPoint::scalar_type> nonces;
+    nonces.reserve(data.size());
+    for (const auto &pt : h2c_data) {
+        nonces.push_back(make_nonce(pt, key_scalar_));
+    }
+
+    vector<utils::ECPoint> nonce_times_h2c_data(h2c_data);
+    utils::ECPoint::ScalarMultiplyBatch(nonce_times_h2c_data, nonces, false);
+
+    vector<VRFProof> result;
+    result.reserve(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        result.push_back(make_proof(
+            pk_.key_point_,
+            h2c_data[i],
+            sk_times_h2c_data[i],
+            nonces[i],
+            nonce_times_h2c_data[i],
+            key_scalar_));
+    }
+
+    return result;
+}
+
+vector<hash_type> VRFSecretKey::get_vrf_values(gsl::span<const hash_type> data) const
+{
+    throw_if_uninitialized();
+
+    vector<utils::ECPoint> sk_times_h2c_data =
+        utils::ECPoint::MakeHashToCurveBatch(data, h2c_salt_);
+    vector<utils::ECPoint::scalar_type> key_scalars(data.size(), key_scalar_);
+    utils::ECPoint::ScalarMultiplyBatch(sk_times_h2c_data, key_scalars, false);
+
+    // We write each VRF value in a VRFProof struct, then extract the hash
+    vector<hash_type> result;
+    result.reserve(data.size());
+    for (const auto &pt : sk_times_h2c_data) {
+        VRFProof vrf_proof;
+        pt.save(vrf_proof.gamma);
+        result.push_back(vrf_proof.compute_vrf_value());
+    }
+
+    return result;
+}
+
 void VRFSecretKey::save(gsl::span<byte, save_size> out) const
 {
     key_scalar_.save(out);
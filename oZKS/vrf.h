@@ -145,6 +145,20 @@ namespace ozks {
         */
         hash_type get_vrf_value(const key_type &data) const;
 
+        /**
+        Computes VRF proofs for a batch of inputs. The result is the same as calling
+        get_vrf_proof for each input, but the hash-to-curve and scalar multiplications
+        are performed as a batch.
+        */
+        std::vector<VRFProof> get_vrf_proofs(gsl::span<const hash_type> data) const;
+
+        /**
+        Returns the VRF values (hashes) for a batch of inputs. The result is the same as
+        calling get_vrf_value for each input, but the hash-to-curve and scalar multiplications
+        are performed as a batch.
+        */
+        std::vector<hash_type> get_vrf_values(gsl::span<const hash_type> data) const;
+
         /**
         The byte-size of a buffer needed to save the VRFSecretKey object.
         */
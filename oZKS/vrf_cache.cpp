@@ -2,6 +2,20 @@
 // Licensed under the MIT license.
 
 // STD
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 // OZKS
 #include "oZKS/vrf_cache.h"
@@ -9,43 +23,635 @@
 using namespace std;
 using namespace ozks;
 
-VRFCache::VRFCache(size_t vrf_cache_size) : cache_size_(vrf_cache_size)
+namespace {
+    constexpr char backing_file_magic[] = { 'O', 'Z', 'K', 'S', 'V', 'R', 'F', 'C' };
+
+    constexpr uint32_t backing_file_version = 1;
+
+    // Each record holds the key hash followed by the proof
+    constexpr size_t record_size =
+        hash_size + sizeof(VRFProof::gamma) + sizeof(VRFProof::c) + sizeof(VRFProof::s);
+
+    using record_type = array<byte, record_size>;
+
+    record_type make_record(const hash_type &key_hash, const VRFProof &vrf_proof)
+    {
+        record_type record;
+        auto it = copy(key_hash.begin(), key_hash.end(), record.begin());
+        it = copy(vrf_proof.gamma.begin(), vrf_proof.gamma.end(), it);
+        it = copy(vrf_proof.c.begin(), vrf_proof.c.end(), it);
+        copy(vrf_proof.s.begin(), vrf_proof.s.end(), it);
+        return record;
+    }
+
+    void read_record(const record_type &record, hash_type &key_hash, VRFProof &vrf_proof)
+    {
+        auto it = record.begin();
+        copy_n(it, key_hash.size(), key_hash.begin());
+        it += key_hash.size();
+        copy_n(it, vrf_proof.gamma.size(), vrf_proof.gamma.begin());
+        it += vrf_proof.gamma.size();
+        copy_n(it, vrf_proof.c.size(), vrf_proof.c.begin());
+        it += vrf_proof.c.size();
+        copy_n(it, vrf_proof.s.size(), vrf_proof.s.begin());
+    }
+
+    vector<byte> make_header(gsl::span<const byte> key_id)
+    {
+        uint32_t key_id_size = static_cast<uint32_t>(key_id.size());
+        vector<byte> header(sizeof(backing_file_magic) + 2 * sizeof(uint32_t) + key_id.size());
+
+        auto it = header.begin();
+        it = copy_n(
+            reinterpret_cast<const byte *>(backing_file_magic), sizeof(backing_file_magic), it);
+        it = copy_n(reinterpret_cast<const byte *>(&backing_file_version), sizeof(uint32_t), it);
+        it = copy_n(reinterpret_cast<const byte *>(&key_id_size), sizeof(uint32_t), it);
+        copy(key_id.begin(), key_id.end(), it);
+        return header;
+    }
+
+    // Number of proofs computed together by the prewarm thread
+    constexpr size_t prewarm_batch_size = 32;
+
+    void lower_thread_priority()
+    {
+#ifdef __linux__
+        // On Linux the nice value is per thread; failure is harmless
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+    }
+
+    void write_bytes(ofstream &stream, const byte *data, size_t size)
+    {
+        stream.write(reinterpret_cast<const char *>(data), static_cast<streamsize>(size));
+        if (!stream) {
+            throw runtime_error("Failed to write to VRF cache file");
+        }
+    }
+} // namespace
+
+struct VRFCache::BackingFile {
+    string path;
+
+    vector<byte> key_id;
+
+    vector<byte> header;
+
+    mutex mtx;
+
+    ofstream out;
+
+    // The loader may be waited for from several threads at once
+    mutex loader_mtx;
+
+    thread loader;
+
+    atomic_bool loaded = false;
+
+    atomic_bool stop_loading = false;
+
+    // Set when writing fails; the file is not written to after that
+    atomic_bool failed = false;
+
+    void join_loader()
+    {
+        lock_guard<mutex> lock(loader_mtx);
+        if (loader.joinable()) {
+            loader.join();
+        }
+    }
+};
+
+struct VRFCache::Prewarmer {
+    struct Job {
+        VRFSecretKey vrf_sk;
+
+        vector<hash_type> key_hashes;
+    };
+
+    mutable mutex mtx;
+
+    condition_variable work_cv;
+
+    condition_variable idle_cv;
+
+    deque<Job> jobs;
+
+    size_t pending = 0;
+
+    bool busy = false;
+
+    bool stop = false;
+
+    thread worker;
+};
+
+size_t VRFCache::hash_type_hash::operator()(const hash_type &hash) const noexcept
+{
+    // The key hashes are uniformly random, so any part of them is a good hash
+    size_t result;
+    memcpy(&result, hash.data() + sizeof(size_t), sizeof(size_t));
+    return result;
+}
+
+VRFCache::VRFCache(size_t vrf_cache_size, size_t shard_count) : cache_size_(vrf_cache_size)
 {
-    if (cache_size_) {
-        cache_ = make_unique<Poco::LRUCache<hash_type, VRFProof>>(cache_size_);
+    if (!shard_count) {
+        shard_count = default_shard_count;
     }
+    shard_count = max<size_t>(1, min(shard_count, cache_size_));
+
+    // Distribute the capacity as evenly as possible between the shards
+    shards_.reserve(shard_count);
+    for (size_t i = 0; i < shard_count; i++) {
+        auto shard = make_unique<Shard>();
+        shard->max_size = cache_size_ / shard_count + (i < cache_size_ % shard_count ? 1 : 0);
+        shards_.push_back(std::move(shard));
+    }
+}
+
+VRFCache::~VRFCache()
+{
+    try {
+        stop_prewarm();
+        close_backing_file();
+    } catch (...) {
+    }
+}
+
+VRFCache VRFCache::WithByteCapacity(size_t byte_capacity, size_t shard_count)
+{
+    return VRFCache(byte_capacity / entry_byte_size, shard_count);
 }
 
 VRFCache &VRFCache::operator=(const VRFCache &other)
 {
-    // Just copy the cache size; not the contents
-    VRFCache new_cache(other.cache_size_);
-    swap(cache_, new_cache.cache_);
+    // Just copy the cache size and shard count; not the contents. The background load must not
+    // write into the shards we are about to replace.
+    stop_prewarm();
+    close_backing_file();
+    VRFCache new_cache(other.cache_size_, other.shard_count());
+    swap(shards_, new_cache.shards_);
     swap(cache_size_, new_cache.cache_size_);
+    prewarm_budget_ = other.prewarm_budget_;
 
     return *this;
 }
 
+auto VRFCache::get_shard(const hash_type &key_hash) const -> Shard &
+{
+    // Use different bytes of the key hash than the hash table inside the shard
+    uint64_t shard_selector;
+    memcpy(&shard_selector, key_hash.data(), sizeof(uint64_t));
+    return *shards_[shard_selector % shards_.size()];
+}
+
+bool VRFCache::contains(const hash_type &key_hash) const
+{
+    Shard &shard = get_shard(key_hash);
+    lock_guard<mutex> lock(shard.mtx);
+    return shard.index.find(key_hash) != shard.index.end();
+}
+
+bool VRFCache::add_to_shard(const hash_type &key_hash, const VRFProof &vrf_proof, bool replace)
+{
+    Shard &shard = get_shard(key_hash);
+    if (!shard.max_size) {
+        return false;
+    }
+
+    lock_guard<mutex> lock(shard.mtx);
+    auto it = shard.index.find(key_hash);
+    if (it != shard.index.end()) {
+        if (replace) {
+            it->second->second = vrf_proof;
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        }
+        return false;
+    }
+
+    shard.lru.emplace_front(key_hash, vrf_proof);
+    shard.index.emplace(key_hash, shard.lru.begin());
+
+    if (shard.lru.size() > shard.max_size) {
+        shard.index.erase(shard.lru.back().first);
+        shard.lru.pop_back();
+        shard.evictions++;
+    }
+
+    return true;
+}
+
 void VRFCache::add(const hash_type &key_hash, const VRFProof &vrf_proof)
 {
-    if (cache_) {
-        cache_->add(key_hash, vrf_proof);
+    // Only proofs that were not cached yet are persisted. The shard lock is released before the
+    // file lock is taken, as compact_backing_file takes the locks in the opposite order.
+    if (!add_to_shard(key_hash, vrf_proof, /* replace */ true)) {
+        return;
+    }
+
+    shared_ptr<BackingFile> backing_file = get_backing_file();
+    if (!backing_file || backing_file->failed) {
+        return;
+    }
+
+    record_type record = make_record(key_hash, vrf_proof);
+    lock_guard<mutex> lock(backing_file->mtx);
+    if (backing_file->failed) {
+        return;
+    }
+
+    // The proof is cached either way; a failure only means it is not persisted
+    try {
+        write_bytes(backing_file->out, record.data(), record.size());
+    } catch (const runtime_error &) {
+        disable_backing_file(*backing_file);
     }
 }
 
 optional<VRFProof> VRFCache::get(const hash_type &key_hash)
 {
-    optional<VRFProof> ret = nullopt;
-    if (cache_) {
-        auto cache_value = cache_->get(key_hash);
-        if (!cache_value.isNull()) {
-            ret = optional<VRFProof>{ *cache_value };
-            cache_hits_++;
-            return ret;
+    Shard &shard = get_shard(key_hash);
+
+    // Even if there is no cache (size == 0) we count the miss
+    if (shard.max_size) {
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.index.find(key_hash);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            shard.hits++;
+            return it->second->second;
         }
     }
 
-    // Even if there is no cache (size == 0) we count the miss
-    cache_misses_++;
-    return ret;
+    shard.misses++;
+    return nullopt;
+}
+
+size_t VRFCache::size() const
+{
+    size_t result = 0;
+    for (const auto &shard : shards_) {
+        lock_guard<mutex> lock(shard->mtx);
+        result += shard->lru.size();
+    }
+
+    return result;
+}
+
+vector<VRFCache::ShardStats> VRFCache::shard_stats() const
+{
+    vector<ShardStats> result;
+    result.reserve(shards_.size());
+    for (const auto &shard : shards_) {
+        lock_guard<mutex> lock(shard->mtx);
+        result.push_back(
+            { shard->lru.size(),
+              shard->max_size,
+              shard->hits.load(),
+              shard->misses.load(),
+              shard->evictions.load() });
+    }
+
+    return result;
+}
+
+void VRFCache::clear_contents()
+{
+    // Remove the backing file as well so that the proofs do not come back on the next start
+    string path;
+    vector<byte> key_id;
+    if (shared_ptr<BackingFile> backing_file = get_backing_file()) {
+        path = backing_file->path;
+        key_id = backing_file->key_id;
+        close_backing_file();
+    }
+
+    for (auto &shard : shards_) {
+        lock_guard<mutex> lock(shard->mtx);
+        shard->index.clear();
+        shard->lru.clear();
+    }
+
+    if (!path.empty()) {
+        filesystem::remove(path);
+        open_backing_file(path, key_id);
+    }
+}
+
+void VRFCache::clear_stats() noexcept
+{
+    for (auto &shard : shards_) {
+        shard->hits = 0;
+        shard->misses = 0;
+        shard->evictions = 0;
+    }
+}
+
+uint64_t VRFCache::cache_hits() const noexcept
+{
+    uint64_t result = 0;
+    for (const auto &shard : shards_) {
+        result += shard->hits;
+    }
+
+    return result;
+}
+
+uint64_t VRFCache::cache_misses() const noexcept
+{
+    uint64_t result = 0;
+    for (const auto &shard : shards_) {
+        result += shard->misses;
+    }
+
+    return result;
+}
+
+void VRFCache::open_backing_file(const string &path, gsl::span<const byte> key_id)
+{
+    close_backing_file();
+
+    auto backing_file = make_shared<BackingFile>();
+    backing_file->path = path;
+    backing_file->key_id.assign(key_id.begin(), key_id.end());
+    backing_file->header = make_header(key_id);
+    const vector<byte> &header = backing_file->header;
+
+    // Check whether an existing file was written for the same key
+    bool reuse = false;
+    size_t record_count = 0;
+    {
+        ifstream in(path, ios::binary);
+        if (in) {
+            vector<byte> file_header(header.size());
+            in.read(reinterpret_cast<char *>(file_header.data()), file_header.size());
+            reuse = in && file_header == header;
+        }
+    }
+
+    if (reuse) {
+        // Drop a partially written record at the end of the file
+        uintmax_t file_size = filesystem::file_size(path);
+        record_count = static_cast<size_t>((file_size - header.size()) / record_size);
+        filesystem::resize_file(path, header.size() + record_count * record_size);
+    } else {
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out) {
+            throw runtime_error("Failed to create VRF cache file");
+        }
+        write_bytes(out, header.data(), header.size());
+    }
+
+    backing_file->out.open(path, ios::binary | ios::app);
+    if (!backing_file->out) {
+        throw runtime_error("Failed to open VRF cache file");
+    }
+
+    if (record_count) {
+        backing_file->loader =
+            thread(&VRFCache::load_backing_file, this, ref(*backing_file), record_count);
+    } else {
+        backing_file->loaded = true;
+    }
+    atomic_store(&backing_file_, std::move(backing_file));
+}
+
+shared_ptr<VRFCache::BackingFile> VRFCache::get_backing_file() const noexcept
+{
+    return atomic_load(&backing_file_);
+}
+
+void VRFCache::disable_backing_file(BackingFile &backing_file) noexcept
+{
+    // Called with the file lock held
+    backing_file.failed = true;
+    backing_file_failures_++;
+}
+
+void VRFCache::load_backing_file(BackingFile &backing_file, size_t record_count)
+{
+    ifstream in(backing_file.path, ios::binary);
+    in.seekg(static_cast<streamoff>(backing_file.header.size()));
+
+    // Records later in the file are more recent, so loading in order leaves them in front of the
+    // LRU order. Proofs added to the cache in the meantime take precedence.
+    record_type record;
+    hash_type key_hash;
+    VRFProof vrf_proof;
+    for (size_t i = 0; i < record_count && !backing_file.stop_loading; i++) {
+        if (!in.read(reinterpret_cast<char *>(record.data()), record.size())) {
+            break;
+        }
+        read_record(record, key_hash, vrf_proof);
+        add_to_shard(key_hash, vrf_proof, /* replace */ false);
+    }
+
+    backing_file.loaded = true;
+}
+
+void VRFCache::flush_backing_file()
+{
+    shared_ptr<BackingFile> backing_file = get_backing_file();
+    if (!backing_file) {
+        return;
+    }
+
+    lock_guard<mutex> lock(backing_file->mtx);
+    if (!backing_file->failed && !backing_file->out.flush()) {
+        disable_backing_file(*backing_file);
+    }
+}
+
+void VRFCache::compact_backing_file()
+{
+    shared_ptr<BackingFile> backing_file = get_backing_file();
+    if (!backing_file || backing_file->failed) {
+        return;
+    }
+
+    // Wait for the background load so that the file is not read while being replaced
+    backing_file->join_loader();
+
+    lock_guard<mutex> lock(backing_file->mtx);
+    backing_file->out.close();
+
+    string temp_path = backing_file->path + ".tmp";
+    try {
+        ofstream out(temp_path, ios::binary | ios::trunc);
+        write_bytes(out, backing_file->header.data(), backing_file->header.size());
+
+        // Write the least recently used proofs first so that the order is preserved on load
+        for (const auto &shard : shards_) {
+            lock_guard<mutex> shard_lock(shard->mtx);
+            for (auto it = shard->lru.rbegin(); it != shard->lru.rend(); it++) {
+                record_type record = make_record(it->first, it->second);
+                write_bytes(out, record.data(), record.size());
+            }
+        }
+
+        out.close();
+        if (!out) {
+            throw runtime_error("Failed to write to VRF cache file");
+        }
+        filesystem::rename(temp_path, backing_file->path);
+    } catch (...) {
+        // The original file is still intact, so keep appending to it
+        error_code ec;
+        filesystem::remove(temp_path, ec);
+        backing_file->out.open(backing_file->path, ios::binary | ios::app);
+        if (!backing_file->out) {
+            disable_backing_file(*backing_file);
+        }
+        throw;
+    }
+
+    backing_file->out.open(backing_file->path, ios::binary | ios::app);
+    if (!backing_file->out) {
+        disable_backing_file(*backing_file);
+        throw runtime_error("Failed to open VRF cache file");
+    }
+}
+
+void VRFCache::close_backing_file()
+{
+    // Concurrent calls to add may still hold the file; it is closed when the last one is done
+    shared_ptr<BackingFile> backing_file =
+        atomic_exchange(&backing_file_, shared_ptr<BackingFile>());
+    if (!backing_file) {
+        return;
+    }
+
+    backing_file->stop_loading = true;
+    backing_file->join_loader();
+
+    lock_guard<mutex> lock(backing_file->mtx);
+    backing_file->out.flush();
+}
+
+void VRFCache::wait_for_backing_file_load()
+{
+    if (shared_ptr<BackingFile> backing_file = get_backing_file()) {
+        backing_file->join_loader();
+    }
+}
+
+bool VRFCache::has_backing_file() const noexcept
+{
+    shared_ptr<BackingFile> backing_file = get_backing_file();
+    return backing_file && !backing_file->failed;
+}
+
+bool VRFCache::backing_file_loaded() const noexcept
+{
+    shared_ptr<BackingFile> backing_file = get_backing_file();
+    return backing_file && backing_file->loaded;
+}
+
+void VRFCache::prewarm(const VRFSecretKey &vrf_sk, gsl::span<const hash_type> key_hashes)
+{
+    if (!prewarm_budget_ || !cache_size_ || key_hashes.empty()) {
+        return;
+    }
+
+    if (!prewarmer_) {
+        prewarmer_ = make_unique<Prewarmer>();
+        prewarmer_->worker = thread(&VRFCache::run_prewarm, this);
+    }
+
+    lock_guard<mutex> lock(prewarmer_->mtx);
+    size_t available = prewarm_budget_ - min(prewarm_budget_, prewarmer_->pending);
+    size_t count = min(key_hashes.size(), available);
+    if (!count) {
+        return;
+    }
+
+    prewarmer_->jobs.push_back(
+        { vrf_sk, vector<hash_type>(key_hashes.begin(), key_hashes.begin() + count) });
+    prewarmer_->pending += count;
+    prewarmer_->work_cv.notify_one();
+}
+
+void VRFCache::run_prewarm()
+{
+    lower_thread_priority();
+
+    Prewarmer &pw = *prewarmer_;
+    while (true) {
+        Prewarmer::Job job;
+        {
+            unique_lock<mutex> lock(pw.mtx);
+            pw.busy = false;
+            pw.idle_cv.notify_all();
+            pw.work_cv.wait(lock, [&pw]() { return pw.stop || !pw.jobs.empty(); });
+            if (pw.stop) {
+                return;
+            }
+            job = std::move(pw.jobs.front());
+            pw.jobs.pop_front();
+            pw.busy = true;
+        }
+
+        // Compute the proofs in small batches so that stop_prewarm does not need to wait long
+        for (size_t begin = 0; begin < job.key_hashes.size(); begin += prewarm_batch_size) {
+            size_t end = min(begin + prewarm_batch_size, job.key_hashes.size());
+            vector<hash_type> missing;
+            copy_if(
+                job.key_hashes.begin() + begin,
+                job.key_hashes.begin() + end,
+                back_inserter(missing),
+                [this](const hash_type &key_hash) { return !contains(key_hash); });
+
+            // Prewarming is best effort; a failure only means the proofs are computed later
+            try {
+                vector<VRFProof> proofs = job.vrf_sk.get_vrf_proofs(missing);
+                for (size_t i = 0; i < missing.size(); i++) {
+                    add(missing[i], proofs[i]);
+                }
+            } catch (...) {
+            }
+
+            lock_guard<mutex> lock(pw.mtx);
+            pw.pending -= end - begin;
+            if (pw.stop) {
+                return;
+            }
+        }
+    }
+}
+
+size_t VRFCache::prewarm_pending() const
+{
+    if (!prewarmer_) {
+        return 0;
+    }
+
+    lock_guard<mutex> lock(prewarmer_->mtx);
+    return prewarmer_->pending;
+}
+
+void VRFCache::wait_for_prewarm()
+{
+    if (!prewarmer_) {
+        return;
+    }
+
+    unique_lock<mutex> lock(prewarmer_->mtx);
+    prewarmer_->idle_cv.wait(
+        lock, [this]() { return prewarmer_->jobs.empty() && !prewarmer_->busy; });
+}
+
+void VRFCache::stop_prewarm()
+{
+    if (!prewarmer_) {
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(prewarmer_->mtx);
+        prewarmer_->stop = true;
+    }
+    prewarmer_->work_cv.notify_all();
+    prewarmer_->worker.join();
+    prewarmer_.reset();
 }
@@ -5,8 +5,16 @@
 
 // STD
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 // OZKS
 #include "oZKS/defines.h"
@@ -15,18 +23,53 @@
 // GSL
 #include "gsl/span"
 
-// Poco
-#include "Poco/LRUCache.h"
-
 namespace ozks {
+    /**
+    A thread-safe LRU cache for VRF proofs. The cache is split into shards selected by the key
+    hash; each shard has its own lock and its own LRU order, so concurrent lookups for different
+    keys rarely contend.
+    */
     class VRFCache {
     public:
-        VRFCache(std::size_t vrf_cache_size);
+        // Statistics for a single shard
+        struct ShardStats {
+            std::size_t size;
+
+            std::size_t max_size;
+
+            std::uint64_t hits;
+
+            std::uint64_t misses;
+
+            std::uint64_t evictions;
+        };
+
+        // Default number of shards; smaller caches use fewer shards so that each holds at least
+        // one element
+        static constexpr std::size_t default_shard_count = 16;
+
+        // Approximate number of bytes used by a single cached element, including the list and
+        // hash table bookkeeping
+        static constexpr std::size_t entry_byte_size =
+            sizeof(std::pair<hash_type, VRFProof>) + 6 * sizeof(void *) + sizeof(hash_type);
 
+        VRFCache(std::size_t vrf_cache_size, std::size_t shard_count = 0);
+
+        ~VRFCache();
+
+        // Copies only the cache size, shard count, and prewarm budget. Any backing file of this
+        // cache is closed and any pending prewarming is stopped.
         VRFCache &operator=(const VRFCache &other);
 
-        VRFCache(const VRFCache &other) : VRFCache(other.size())
-        {}
+        VRFCache(const VRFCache &other) : VRFCache(other.max_size(), other.shard_count())
+        {
+            prewarm_budget_ = other.prewarm_budget_;
+        }
+
+        /**
+        Creates a cache that holds as many elements as fit in the given number of bytes.
+        */
+        static VRFCache WithByteCapacity(std::size_t byte_capacity, std::size_t shard_count = 0);
 
         void add(const hash_type &key_hash, const VRFProof &vrf_proof);
 
@@ -39,47 +82,176 @@ namespace ozks {
         }
 
         // Return the number of currently cached elements
-        std::size_t size() const
+        std::size_t size() const;
+
+        // Return the approximate maximum memory use of the cached elements in bytes
+        std::size_t max_byte_size() const noexcept
+        {
+            return cache_size_ * entry_byte_size;
+        }
+
+        // Return the approximate current memory use of the cached elements in bytes
+        std::size_t byte_size() const
         {
-            return cache_ ? cache_->size() : 0;
+            return size() * entry_byte_size;
         }
 
+        // Return the number of shards
+        std::size_t shard_count() const noexcept
+        {
+            return shards_.size();
+        }
+
+        // Return statistics for each shard
+        std::vector<ShardStats> shard_stats() const;
+
         void clear()
         {
             clear_contents();
             clear_stats();
         }
 
-        void clear_contents()
-        {
-            if (cache_) {
-                cache_->clear();
-            }
-        }
+        void clear_contents();
+
+        void clear_stats() noexcept;
+
+        std::uint64_t cache_hits() const noexcept;
+
+        std::uint64_t cache_misses() const noexcept;
+
+        /**
+        Attaches an append-only file to the cache. Proofs already in the file are loaded into the
+        cache on a background thread, and every proof subsequently added to the cache is appended
+        to the file. The key_id identifies the VRF key the proofs belong to (e.g., the saved VRF
+        public key); if the file was written for a different key_id, its contents are discarded.
+        Appended proofs are buffered; call flush_backing_file to make sure they reach the file.
+        If writing to the file fails, the file is disabled and the cache continues without it.
+        This function must not be called concurrently with other operations on the cache.
+        */
+        void open_backing_file(const std::string &path, gsl::span<const std::byte> key_id);
+
+        /**
+        Writes any buffered proofs to the backing file.
+        */
+        void flush_backing_file();
+
+        /**
+        Rewrites the backing file so that it contains only the currently cached proofs. Over time
+        the file accumulates proofs that have been evicted from the cache.
+        */
+        void compact_backing_file();
 
-        void clear_stats() noexcept
+        /**
+        Detaches the backing file, stopping the background load if it is still running.
+        */
+        void close_backing_file();
+
+        // Return whether a backing file is attached and has not been disabled by a write failure
+        bool has_backing_file() const noexcept;
+
+        // Return the number of times writing to a backing file failed
+        std::uint64_t backing_file_failures() const noexcept
         {
-            cache_hits_ = 0;
-            cache_misses_ = 0;
+            return backing_file_failures_;
         }
 
-        std::uint64_t cache_hits() const noexcept
+        // Return whether the background load of the backing file has finished
+        bool backing_file_loaded() const noexcept;
+
+        /**
+        Waits until the background load of the backing file has finished.
+        */
+        void wait_for_backing_file_load();
+
+        /**
+        Sets the maximum number of key hashes that can be waiting for prewarming at any time.
+        The default is zero, which disables prewarming.
+        */
+        void set_prewarm_budget(std::size_t prewarm_budget) noexcept
         {
-            return cache_hits_;
+            prewarm_budget_ = prewarm_budget;
         }
 
-        std::uint64_t cache_misses() const noexcept
+        // Return the maximum number of key hashes that can be waiting for prewarming
+        std::size_t prewarm_budget() const noexcept
         {
-            return cache_misses_;
+            return prewarm_budget_;
         }
 
+        /**
+        Computes VRF proofs for the given key hashes on a low-priority background thread and adds
+        them to the cache, so that the first query for a newly inserted key does not need to
+        compute the proof. Key hashes that do not fit in the prewarm budget are ignored, as are
+        key hashes that are already cached.
+        */
+        void prewarm(const VRFSecretKey &vrf_sk, gsl::span<const hash_type> key_hashes);
+
+        // Return the number of key hashes waiting for prewarming
+        std::size_t prewarm_pending() const;
+
+        /**
+        Waits until all pending prewarming has been done.
+        */
+        void wait_for_prewarm();
+
+        /**
+        Discards all pending prewarming and stops the background thread.
+        */
+        void stop_prewarm();
+
     private:
-        std::unique_ptr<Poco::LRUCache<hash_type, VRFProof>> cache_{ nullptr };
+        struct hash_type_hash {
+            std::size_t operator()(const hash_type &hash) const noexcept;
+        };
+
+        struct Shard {
+            using lru_list_type = std::list<std::pair<hash_type, VRFProof>>;
+
+            mutable std::mutex mtx;
+
+            lru_list_type lru;
+
+            std::unordered_map<hash_type, lru_list_type::iterator, hash_type_hash> index;
+
+            std::size_t max_size = 0;
+
+            std::atomic_uint64_t hits = 0;
+
+            std::atomic_uint64_t misses = 0;
+
+            std::atomic_uint64_t evictions = 0;
+        };
+
+        struct BackingFile;
+
+        struct Prewarmer;
+
+        Shard &get_shard(const hash_type &key_hash) const;
+
+        bool contains(const hash_type &key_hash) const;
+
+        void run_prewarm();
+
+        bool add_to_shard(const hash_type &key_hash, const VRFProof &vrf_proof, bool replace);
+
+        std::shared_ptr<BackingFile> get_backing_file() const noexcept;
+
+        void disable_backing_file(BackingFile &backing_file) noexcept;
+
+        void load_backing_file(BackingFile &backing_file, std::size_t record_count);
+
+        std::vector<std::unique_ptr<Shard>> shards_;
 
         std::size_t cache_size_;
 
-        std::atomic_uint64_t cache_hits_ = 0;
+        // Accessed only through the atomic shared_ptr functions, as add reads it concurrently
+        // with close_backing_file and compact_backing_file
+        std::shared_ptr<BackingFile> backing_file_;
+
+        std::atomic_uint64_t backing_file_failures_ = 0;
+
+        std::size_t prewarm_budget_ = 0;
 
-        std::atomic_uint64_t cache_misses_ = 0;
+        std::unique_ptr<Prewarmer> prewarmer_;
     };
 } // namespace ozks
@@ -1,8 +1,14 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the MIT license.
 
+// STD
+#include <atomic>
+#include <optional>
+#include <vector>
+
 // OZKS
 #include "oZKS/compressed_trie.h"
+#include "oZKS/ct_node_stored.h"
 #include "oZKS/query_result.h"
 #include "oZKS/storage/batch_storage.h"
 #include "oZKS/storage/memory_storage.h"
@@ -202,6 +208,46 @@ namespace {
         unordered_map<size_t, vector<CTNodeStored>> updated_nodes_;
         unordered_map<size_t, vector<CompressedTrie>> updated_tries_;
     };
+
+    /**
+    A memory storage that counts the batched node loads it receives
+    */
+    class PathCountingStorage : public storage::MemoryStorage {
+    public:
+        size_t load_ctnodes(
+            trie_id_type trie_id,
+            gsl::span<const PartialLabel> node_ids,
+            shared_ptr<Storage> storage,
+            vector<optional<CTNodeStored>> &nodes) override
+        {
+            load_ctnodes_count_++;
+            return MemoryStorage::load_ctnodes(trie_id, node_ids, storage, nodes);
+        }
+
+        size_t load_path(
+            trie_id_type trie_id,
+            const PartialLabel &label,
+            shared_ptr<Storage> storage,
+            vector<CTNodeStored> &nodes) override
+        {
+            load_path_count_++;
+            return MemoryStorage::load_path(trie_id, label, storage, nodes);
+        }
+
+        size_t load_ctnodes_count() const
+        {
+            return load_ctnodes_count_;
+        }
+
+        size_t load_path_count() const
+        {
+            return load_path_count_;
+        }
+
+    private:
+        atomic<size_t> load_ctnodes_count_ = 0;
+        atomic<size_t> load_path_count_ = 0;
+    };
 } // namespace
 
 void DoInsertTest(CompressedTrie &trie)
@@ -1040,6 +1086,281 @@ TEST(CompressedTrieTests, LinkedLookupTest)
     DoLookupTest(trie);
 }
 
+TEST(CompressedTrieTests, StoredCachedLookupTest)
+{
+    // The cache only holds a few nodes, so the lookups also go through evicted nodes
+    auto storage = make_shared<MemoryStorageCache>(
+        make_shared<storage::MemoryStorage>(),
+        CacheBytes(4 * MemoryStorageCache::NodeCharge()));
+    CompressedTrie trie(storage, TrieType::Stored);
+    DoLookupTest(trie);
+    EXPECT_LT(0, storage->eviction_count());
+}
+
+TEST(CompressedTrieTests, StoredPrefetchLookupTest)
+{
+    auto storage = make_shared<MemoryStorageCache>(
+        make_shared<storage::MemoryStorage>(),
+        CacheBytes(4 * MemoryStorageCache::NodeCharge()),
+        PrefetchPolicy{ 2, true });
+    CompressedTrie trie(storage, TrieType::Stored);
+    DoLookupTest(trie);
+    EXPECT_LT(0, storage->eviction_count());
+}
+
+TEST(CompressedTrieTests, PrefetchDescendantsTest)
+{
+    auto backing_storage = make_shared<PathCountingStorage>();
+    CompressedTrie trie(backing_storage, TrieType::Stored);
+    partial_label_hash_batch_type label_payload_batch;
+    for (size_t i = 0; i < 50; i++) {
+        hash_type label_bytes{};
+        get_random_bytes(label_bytes.data(), label_bytes.size());
+        label_payload_batch.emplace_back(label_bytes, make_bytes<hash_type>(i, i + 1));
+    }
+    append_proof_batch_type append_proofs;
+    trie.insert(label_payload_batch, append_proofs);
+
+    auto storage = make_shared<MemoryStorageCache>(
+        backing_storage,
+        CacheBytes(1000 * MemoryStorageCache::NodeCharge()),
+        PrefetchPolicy{ /* descendant_depth */ 2, false });
+
+    // Missing the root loads it, then its children and then its grandchildren in one batch each
+    CTNodeStored root;
+    size_t load_ctnodes_count = backing_storage->load_ctnodes_count();
+    ASSERT_TRUE(storage->load_ctnode(trie.id(), {}, storage, root));
+    EXPECT_EQ(load_ctnodes_count + 3, backing_storage->load_ctnodes_count());
+
+    vector<PartialLabel> children{ root.left_label(), root.right_label() };
+    vector<optional<CTNodeStored>> nodes;
+    EXPECT_EQ(2, storage->load_ctnodes(trie.id(), children, storage, nodes));
+
+    vector<PartialLabel> grandchildren;
+    for (const auto &child : nodes) {
+        if (!child->left_label().empty()) {
+            grandchildren.push_back(child->left_label());
+        }
+        if (!child->right_label().empty()) {
+            grandchildren.push_back(child->right_label());
+        }
+    }
+    EXPECT_EQ(4, grandchildren.size());
+    EXPECT_EQ(
+        grandchildren.size(), storage->load_ctnodes(trie.id(), grandchildren, storage, nodes));
+    EXPECT_EQ(load_ctnodes_count + 3, backing_storage->load_ctnodes_count());
+}
+
+TEST(CompressedTrieTests, PrefetchPathSiblingsTest)
+{
+    auto backing_storage = make_shared<PathCountingStorage>();
+    CompressedTrie trie(backing_storage, TrieType::Stored);
+    partial_label_hash_batch_type label_payload_batch;
+    for (size_t i = 0; i < 50; i++) {
+        hash_type label_bytes{};
+        get_random_bytes(label_bytes.data(), label_bytes.size());
+        label_payload_batch.emplace_back(label_bytes, make_bytes<hash_type>(i, i + 1));
+    }
+    append_proof_batch_type append_proofs;
+    trie.insert(label_payload_batch, append_proofs);
+
+    auto storage = make_shared<MemoryStorageCache>(
+        backing_storage,
+        CacheBytes(1000 * MemoryStorageCache::NodeCharge()),
+        PrefetchPolicy{ 0, /* path_siblings */ true });
+
+    CTNodeStored root;
+    size_t load_ctnodes_count = backing_storage->load_ctnodes_count();
+    ASSERT_TRUE(storage->load_ctnode(trie.id(), {}, storage, root));
+    EXPECT_EQ(load_ctnodes_count + 1, backing_storage->load_ctnodes_count());
+
+    // Missing the left child of the root also loads the right child
+    CTNodeStored node;
+    ASSERT_TRUE(storage->load_ctnode(trie.id(), root.left_label(), storage, node));
+    EXPECT_EQ(load_ctnodes_count + 2, backing_storage->load_ctnodes_count());
+    ASSERT_TRUE(storage->load_ctnode(trie.id(), root.right_label(), storage, node));
+    EXPECT_EQ(root.right_label(), node.label());
+    EXPECT_EQ(load_ctnodes_count + 2, backing_storage->load_ctnodes_count());
+}
+
+TEST(CompressedTrieTests, PinnedLevelsTest)
+{
+    // The ShardedCache of the cache is too small to hold any node, so only pinned nodes are hit
+    auto backing_storage = make_shared<PathCountingStorage>();
+    auto storage = make_shared<MemoryStorageCache>(
+        backing_storage, CacheBytes(1), PrefetchPolicy{}, PinPolicy{ /* depth */ 3, 0 });
+    CompressedTrie trie(storage, TrieType::Stored);
+
+    auto insert_random_labels = [&trie](size_t count) {
+        partial_label_hash_batch_type label_payload_batch;
+        for (size_t i = 0; i < count; i++) {
+            hash_type label_bytes{};
+            get_random_bytes(label_bytes.data(), label_bytes.size());
+            label_payload_batch.emplace_back(label_bytes, make_bytes<hash_type>(i, i + 1));
+        }
+        append_proof_batch_type append_proofs;
+        trie.insert(label_payload_batch, append_proofs);
+    };
+
+    // Load the top three levels, which pins any of them that was not pinned when saved
+    auto load_top_levels = [&]() {
+        vector<PartialLabel> level{ PartialLabel{} };
+        vector<CTNodeStored> top_levels;
+        for (size_t depth = 0; depth < 3; depth++) {
+            vector<optional<CTNodeStored>> nodes;
+            EXPECT_EQ(level.size(), storage->load_ctnodes(trie.id(), level, storage, nodes));
+            level.clear();
+            for (const auto &node : nodes) {
+                top_levels.push_back(*node);
+                if (!node->left_label().empty()) {
+                    level.push_back(node->left_label());
+                }
+                if (!node->right_label().empty()) {
+                    level.push_back(node->right_label());
+                }
+            }
+        }
+        return top_levels;
+    };
+
+    insert_random_labels(200);
+    load_top_levels();
+    EXPECT_EQ(7, storage->pinned_node_count());
+    EXPECT_LT(0, storage->pinned_size_bytes());
+
+    // Cold lookups do not evict the pinned levels
+    vector<CTNodeStored> path;
+    for (size_t i = 0; i < 100; i++) {
+        hash_type label_bytes{};
+        get_random_bytes(label_bytes.data(), label_bytes.size());
+        storage->load_path(trie.id(), PartialLabel(label_bytes), storage, path);
+    }
+
+    size_t load_ctnodes_count = backing_storage->load_ctnodes_count();
+    load_top_levels();
+    EXPECT_EQ(load_ctnodes_count, backing_storage->load_ctnodes_count());
+
+    // Saving the pinned nodes through the cache refreshes them
+    insert_random_labels(50);
+    load_ctnodes_count = backing_storage->load_ctnodes_count();
+    auto top_levels = load_top_levels();
+    EXPECT_EQ(load_ctnodes_count, backing_storage->load_ctnodes_count());
+    for (const auto &node : top_levels) {
+        CTNodeStored backing_node;
+        ASSERT_TRUE(
+            backing_storage->load_ctnode(trie.id(), node.label(), backing_storage, backing_node));
+        EXPECT_EQ(backing_node.hash(), node.hash());
+    }
+
+    storage->delete_ozks(trie.id());
+    EXPECT_EQ(0, storage->pinned_node_count());
+    EXPECT_EQ(0, storage->pinned_size_bytes());
+}
+
+TEST(CompressedTrieTests, StoredLoadPathTest)
+{
+    auto storage = make_shared<PathCountingStorage>();
+    CompressedTrie stored_trie(storage, TrieType::Stored);
+    CompressedTrie linked_trie({}, TrieType::Linked);
+
+    vector<PartialLabel> labels;
+    partial_label_hash_batch_type label_payload_batch;
+    for (size_t i = 0; i < 100; i++) {
+        hash_type label_bytes{};
+        get_random_bytes(label_bytes.data(), label_bytes.size());
+        labels.emplace_back(label_bytes);
+        label_payload_batch.emplace_back(labels.back(), make_bytes<hash_type>(i, i + 1));
+    }
+    append_proof_batch_type append_proofs;
+    stored_trie.insert(label_payload_batch, append_proofs);
+    linked_trie.insert(label_payload_batch, append_proofs);
+
+    // Lookups that load the path in one call give the same result as lookups in a linked trie
+    for (size_t i = 0; i < 20; i++) {
+        hash_type label_bytes{};
+        get_random_bytes(label_bytes.data(), label_bytes.size());
+        labels.emplace_back(label_bytes);
+    }
+    for (const auto &label : labels) {
+        lookup_path_type stored_path;
+        lookup_path_type linked_path;
+        size_t load_path_count = storage->load_path_count();
+        EXPECT_EQ(linked_trie.lookup(label, linked_path), stored_trie.lookup(label, stored_path));
+        EXPECT_EQ(linked_path, stored_path);
+        EXPECT_EQ(load_path_count + 1, storage->load_path_count());
+    }
+
+    // The path starts at the root and contains the label and its sibling
+    vector<CTNodeStored> nodes;
+    EXPECT_LT(2, storage->load_path(stored_trie.id(), labels[0], storage, nodes));
+    EXPECT_TRUE(nodes[0].label().empty());
+    size_t found = 0;
+    for (const auto &node : nodes) {
+        found += node.label() == labels[0] ? 1 : 0;
+    }
+    EXPECT_EQ(1, found);
+
+    vector<optional<CTNodeStored>> loaded;
+    vector<PartialLabel> node_ids{ labels[0], labels.back(), labels[1] };
+    EXPECT_EQ(2, storage->load_ctnodes(stored_trie.id(), node_ids, storage, loaded));
+    ASSERT_EQ(3, loaded.size());
+    EXPECT_EQ(labels[0], loaded[0]->label());
+    EXPECT_FALSE(loaded[1].has_value());
+    EXPECT_EQ(labels[1], loaded[2]->label());
+}
+
+TEST(CompressedTrieTests, CachedLoadPathTest)
+{
+    auto backing_storage = make_shared<PathCountingStorage>();
+    CompressedTrie trie(backing_storage, TrieType::Stored);
+    partial_label_hash_batch_type label_payload_batch;
+    for (size_t i = 0; i < 50; i++) {
+        hash_type label_bytes{};
+        get_random_bytes(label_bytes.data(), label_bytes.size());
+        label_payload_batch.emplace_back(label_bytes, make_bytes<hash_type>(i, i + 1));
+    }
+    append_proof_batch_type append_proofs;
+    trie.insert(label_payload_batch, append_proofs);
+
+    auto storage = make_shared<MemoryStorageCache>(
+        backing_storage, CacheBytes(1000 * MemoryStorageCache::NodeCharge()));
+    auto loaded = CompressedTrie::LoadFromStorage(trie.id(), storage);
+    ASSERT_TRUE(loaded.second);
+    CompressedTrie &cached_trie = *loaded.first;
+
+    // A cold lookup loads the path from backing storage in a single call
+    PartialLabel label = label_payload_batch[0].first;
+    lookup_path_type path;
+    size_t load_path_count = backing_storage->load_path_count();
+    EXPECT_TRUE(cached_trie.lookup(label, path));
+    EXPECT_EQ(load_path_count + 1, backing_storage->load_path_count());
+
+    // A warm lookup does not touch backing storage
+    lookup_path_type cached_path;
+    size_t load_ctnodes_count = backing_storage->load_ctnodes_count();
+    EXPECT_TRUE(cached_trie.lookup(label, cached_path));
+    EXPECT_EQ(path, cached_path);
+    EXPECT_EQ(load_path_count + 1, backing_storage->load_path_count());
+    EXPECT_EQ(load_ctnodes_count, backing_storage->load_ctnodes_count());
+
+    // Cache misses go to backing storage as a single batch
+    auto cold_storage = make_shared<MemoryStorageCache>(
+        backing_storage, CacheBytes(1000 * MemoryStorageCache::NodeCharge()));
+    vector<PartialLabel> node_ids;
+    for (size_t i = 1; i < 10; i++) {
+        node_ids.push_back(label_payload_batch[i].first);
+    }
+    vector<optional<CTNodeStored>> nodes;
+    EXPECT_EQ(
+        node_ids.size(), cold_storage->load_ctnodes(trie.id(), node_ids, cold_storage, nodes));
+    EXPECT_EQ(load_ctnodes_count + 1, backing_storage->load_ctnodes_count());
+
+    // Now they are all cached
+    EXPECT_EQ(
+        node_ids.size(), cold_storage->load_ctnodes(trie.id(), node_ids, cold_storage, nodes));
+    EXPECT_EQ(load_ctnodes_count + 1, backing_storage->load_ctnodes_count());
+}
+
 void DoFailedLookupTest(CompressedTrie &trie)
 {
     partial_label_hash_batch_type label_payload_batch{
@@ -1343,9 +1664,10 @@ TEST(CompressedTrieTests, LinkedSaveStoredQueryWithUpdatesTest)
     shared_ptr<storage::BatchStorage> storage = make_shared<UpdatedNodesPerEpochStorage>();
     shared_ptr<storage::Storage> batching_storage =
         make_shared<storage::MemoryStorageBatchInserter>(storage);
-    shared_ptr<storage::Storage> cache1 =
-        make_shared<storage::MemoryStorageCache>(batching_storage, 100000);
-    shared_ptr<storage::Storage> cache2 = make_shared<storage::MemoryStorageCache>(storage, 100000);
+    shared_ptr<storage::Storage> cache1 = make_shared<storage::MemoryStorageCache>(
+        batching_storage, CacheBytes(100000 * MemoryStorageCache::NodeCharge()));
+    shared_ptr<storage::Storage> cache2 = make_shared<storage::MemoryStorageCache>(
+        storage, CacheBytes(100000 * MemoryStorageCache::NodeCharge()));
     CompressedTrie trie1(cache1, TrieType::Linked);
 
     vector<PartialLabel> labels;
@@ -76,3 +76,41 @@ TEST(ConfigTests, VRFSeedTest)
             invalid_argument);
     }
 }
+
+TEST(ConfigTests, ThreadPoolTest)
+{
+    // Without a thread pool the shared pool is used
+    {
+        OZKSConfig config;
+        EXPECT_EQ(ThreadPool::Shared(), config.thread_pool());
+    }
+
+    // Given thread pool
+    {
+        auto storage = make_shared<MemoryStorage>();
+        auto thread_pool = make_shared<ThreadPool>(2, "ozks-test");
+        OZKSConfig config(
+            PayloadCommitmentType::UncommitedPayload,
+            LabelType::HashedLabels,
+            TrieType::Stored,
+            storage,
+            {},
+            /* vrf_cache_size */ 0,
+            /* thread_count */ 0,
+            thread_pool);
+        EXPECT_EQ(thread_pool, config.thread_pool());
+        EXPECT_EQ(2, config.thread_pool()->pool_size_limit());
+        EXPECT_EQ(6, config.thread_pool()->enqueue([](int a) { return a * 2; }, 3).get());
+
+        config.set_thread_pool(nullptr);
+        EXPECT_EQ(ThreadPool::Shared(), config.thread_pool());
+    }
+
+    // The shared pool can be resized
+    {
+        size_t thread_count = ThreadPool::Shared()->pool_size_limit();
+        ThreadPool::ConfigureShared(3);
+        EXPECT_EQ(3, ThreadPool::Shared()->pool_size_limit());
+        ThreadPool::ConfigureShared(thread_count);
+    }
+}
@@ -529,3 +529,57 @@ TEST(CTNodeTests, StoredSaveLoadToVectorTest)
     EXPECT_EQ(node2.right()->label(), get<2>(result));
     EXPECT_EQ(save_size, get<3>(result));
 }
+
+TEST(CTNodeTests, StoredCompactSaveLoadTest)
+{
+    hash_type hash{};
+    hash[0] = byte{ 0x01 };
+    hash[31] = byte{ 0xfe };
+
+    hash_type label_bytes{};
+    for (size_t i = 0; i < label_bytes.size(); i++) {
+        label_bytes[i] = static_cast<byte>(i * 37 + 11);
+    }
+    PartialLabel full_label(label_bytes);
+    PartialLabel long_label(full_label, 130);
+
+    vector<CTNodeStored> nodes;
+    nodes.emplace_back(
+        nullptr,
+        PartialLabel{},
+        hash,
+        PartialLabel{ 0, 1, 1 },
+        PartialLabel(full_label, 1));
+    nodes.emplace_back(nullptr, long_label, hash, full_label, PartialLabel{});
+    nodes.emplace_back(nullptr, full_label, hash);
+
+    // A child does not need to extend the label of its parent
+    nodes.emplace_back(nullptr, long_label, hash, PartialLabel{}, PartialLabel{ 1, 0, 1 });
+
+    for (const auto &node : nodes) {
+        vector<byte> buffer(CTNodeStored::CompactMaxSaveSize);
+        size_t save_size = node.save_compact(buffer);
+        EXPECT_EQ(node.compact_save_size(), save_size);
+        buffer.resize(save_size);
+        EXPECT_TRUE(CTNodeStored::IsCompact(buffer));
+
+        CTNodeStored loaded;
+        EXPECT_EQ(save_size, CTNodeStored::LoadCompact(buffer, loaded));
+        EXPECT_EQ(node.label(), loaded.label());
+        EXPECT_EQ(node.hash(), loaded.hash());
+        EXPECT_EQ(node.left_label(), loaded.left_label());
+        EXPECT_EQ(node.right_label(), loaded.right_label());
+
+        // The compact format is smaller than the default format, which can be told apart
+        vector<byte> saved;
+        EXPECT_LT(save_size, node.save(saved));
+        EXPECT_FALSE(CTNodeStored::IsCompact(saved));
+
+        buffer.pop_back();
+        EXPECT_THROW(CTNodeStored::LoadCompact(buffer, loaded), runtime_error);
+        EXPECT_THROW(node.save_compact(buffer), invalid_argument);
+    }
+
+    // Short child labels take only a few bytes
+    EXPECT_EQ(2 + 1 + hash_size + 3 + 3, nodes[0].compact_save_size());
+}
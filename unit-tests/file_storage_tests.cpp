@@ -0,0 +1,246 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// oZKS
+#include "oZKS/compressed_trie.h"
+#include "oZKS/storage/file_storage.h"
+#include "oZKS/storage/memory_storage_batch_inserter.h"
+#include "oZKS/utilities.h"
+#include "storage_test_helpers.h"
+
+// GTest
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace ozks;
+using namespace ozks::storage;
+using namespace ozks::storage::tests;
+using namespace ozks::utils;
+
+namespace {
+    string make_directory(const string &name)
+    {
+        filesystem::remove_all(name);
+        return name;
+    }
+} // namespace
+
+TEST(FileStorageTests, StoreElementTest)
+{
+    string directory = make_directory("file_storage_store_element_test");
+
+    {
+        FileStorage storage(directory, 4096);
+        for (size_t i = 0; i < 100; i++) {
+            storage.save_store_element(1, make_key(i), make_store_value(i, 0));
+        }
+
+        vector<pair<vector<byte>, store_value_type>> store_elements;
+        for (size_t i = 0; i < 50; i++) {
+            store_elements.emplace_back(make_key(i), make_store_value(i, 1));
+        }
+        storage.save_store_elements(2, store_elements);
+
+        store_value_type value;
+        EXPECT_TRUE(storage.load_store_element(1, make_key(10), value));
+        EXPECT_EQ(make_store_value(10, 0).payload, value.payload);
+        EXPECT_EQ(make_store_value(10, 0).randomness, value.randomness);
+        EXPECT_TRUE(storage.load_store_element(2, make_key(10), value));
+        EXPECT_EQ(make_store_value(10, 1).payload, value.payload);
+        EXPECT_FALSE(storage.load_store_element(2, make_key(60), value));
+        EXPECT_FALSE(storage.load_store_element(3, make_key(10), value));
+        EXPECT_LT(1, storage.segment_count());
+    }
+
+    // The elements are recovered when the storage is opened again
+    {
+        FileStorage storage(directory, 4096);
+        store_value_type value;
+        EXPECT_TRUE(storage.load_store_element(1, make_key(99), value));
+        EXPECT_EQ(make_store_value(99, 0).payload, value.payload);
+        EXPECT_TRUE(storage.load_store_element(2, make_key(49), value));
+        EXPECT_EQ(make_store_value(49, 1).payload, value.payload);
+    }
+
+    filesystem::remove_all(directory);
+}
+
+TEST(FileStorageTests, DeleteAndCompactTest)
+{
+    string directory = make_directory("file_storage_delete_test");
+
+    {
+        FileStorage storage(directory, 4096);
+        for (size_t version = 0; version < 5; version++) {
+            for (size_t i = 0; i < 100; i++) {
+                storage.save_store_element(1, make_key(i), make_store_value(i, version));
+                storage.save_store_element(2, make_key(i), make_store_value(i, version));
+            }
+        }
+        storage.delete_ozks(2);
+
+        store_value_type value;
+        EXPECT_FALSE(storage.load_store_element(2, make_key(10), value));
+
+        // Most of the data is garbage now
+        storage.compact();
+        EXPECT_LT(storage.byte_count(), 3 * storage.live_byte_count());
+        EXPECT_TRUE(storage.load_store_element(1, make_key(10), value));
+        EXPECT_EQ(make_store_value(10, 4).payload, value.payload);
+    }
+
+    // Neither the deleted trie nor older versions come back after compaction and recovery
+    {
+        FileStorage storage(directory, 4096);
+        store_value_type value;
+        EXPECT_FALSE(storage.load_store_element(2, make_key(10), value));
+        for (size_t i = 0; i < 100; i++) {
+            EXPECT_TRUE(storage.load_store_element(1, make_key(i), value));
+            EXPECT_EQ(make_store_value(i, 4).payload, value.payload);
+        }
+
+        // A deleted trie can be used again
+        storage.save_store_element(2, make_key(10), make_store_value(10, 5));
+    }
+
+    {
+        FileStorage storage(directory, 4096);
+        store_value_type value;
+        EXPECT_TRUE(storage.load_store_element(2, make_key(10), value));
+        EXPECT_EQ(make_store_value(10, 5).payload, value.payload);
+        EXPECT_FALSE(storage.load_store_element(2, make_key(11), value));
+    }
+
+    filesystem::remove_all(directory);
+}
+
+TEST(FileStorageTests, IncompleteBatchTest)
+{
+    string directory = make_directory("file_storage_incomplete_batch_test");
+
+    string segment_path;
+    {
+        FileStorage storage(directory);
+        storage.save_store_element(1, make_key(1), make_store_value(1, 0));
+        EXPECT_EQ(1, storage.segment_count());
+        segment_path = filesystem::directory_iterator(directory)->path().string();
+    }
+
+    // Simulate a batch that was only partially written before a crash
+    {
+        FILE *file = fopen(segment_path.c_str(), "ab");
+        ASSERT_NE(nullptr, file);
+        const char partial_batch[] = "OZKB partial batch";
+        fwrite(partial_batch, 1, sizeof(partial_batch), file);
+        fclose(file);
+    }
+
+    {
+        FileStorage storage(directory);
+        store_value_type value;
+        EXPECT_TRUE(storage.load_store_element(1, make_key(1), value));
+        storage.save_store_element(1, make_key(2), make_store_value(2, 0));
+    }
+
+    {
+        FileStorage storage(directory);
+        store_value_type value;
+        EXPECT_TRUE(storage.load_store_element(1, make_key(1), value));
+        EXPECT_TRUE(storage.load_store_element(1, make_key(2), value));
+    }
+
+    filesystem::remove_all(directory);
+}
+
+TEST(FileStorageTests, ConcurrentTest)
+{
+    string directory = make_directory("file_storage_concurrent_test");
+
+    {
+        FileStorage storage(directory, 4096, false);
+        for (size_t i = 0; i < 100; i++) {
+            storage.save_store_element(1, make_key(i), make_store_value(i, 0));
+        }
+
+        // Readers always find every element while a writer replaces them and segments are
+        // compacted
+        vector<thread> threads;
+        threads.emplace_back([&storage]() {
+            for (size_t version = 1; version < 5; version++) {
+                for (size_t i = 0; i < 100; i++) {
+                    storage.save_store_element(1, make_key(i), make_store_value(i, version));
+                }
+                storage.compact();
+            }
+        });
+        for (size_t t = 0; t < 2; t++) {
+            threads.emplace_back([&storage]() {
+                for (size_t i = 0; i < 1000; i++) {
+                    store_value_type value;
+                    EXPECT_TRUE(storage.load_store_element(1, make_key(i % 100), value));
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    filesystem::remove_all(directory);
+}
+
+TEST(FileStorageTests, CompressedTrieTest)
+{
+    string directory = make_directory("file_storage_compressed_trie_test");
+
+    vector<PartialLabel> labels;
+    for (size_t i = 0; i < 50; i++) {
+        labels.push_back(make_bytes<PartialLabel>(i, i * 3, i * 7, i * 11, i * 13));
+    }
+
+    trie_id_type trie_id;
+    commitment_type commitment;
+    {
+        auto file_storage = make_shared<FileStorage>(directory);
+        auto storage = make_shared<MemoryStorageBatchInserter>(file_storage);
+        CompressedTrie trie(storage, TrieType::Stored);
+        trie_id = trie.id();
+
+        partial_label_hash_batch_type label_payload_batch;
+        for (size_t i = 0; i < labels.size(); i++) {
+            label_payload_batch.emplace_back(labels[i], make_bytes<hash_type>(i, i + 1, i + 2));
+        }
+        append_proof_batch_type append_proofs;
+        trie.insert(label_payload_batch, append_proofs);
+        trie.save_to_storage();
+        storage->flush(trie_id);
+
+        commitment = trie.get_commitment();
+        EXPECT_EQ(1, file_storage->get_compressed_trie_epoch(trie_id));
+    }
+
+    // The trie and its nodes are recovered when the storage is opened again
+    {
+        shared_ptr<Storage> storage = make_shared<FileStorage>(directory);
+        auto loaded = CompressedTrie::LoadFromStorage(trie_id, storage);
+        ASSERT_TRUE(loaded.second);
+        EXPECT_EQ(commitment, loaded.first->get_commitment());
+
+        lookup_path_type lookup_path;
+        for (const auto &label : labels) {
+            EXPECT_TRUE(loaded.first->lookup(label, lookup_path));
+        }
+    }
+
+    filesystem::remove_all(directory);
+}
@@ -0,0 +1,183 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// OZKS
+#include "oZKS/config.h"
+
+// GTest
+#include "gtest/gtest.h"
+
+#if !defined(OZKS_USE_OPENSSL_P256) && defined(OZKS_FOURQ_RUNTIME_DISPATCH)
+
+// FourQ
+#include "oZKS/fourq/FourQ_api.h"
+#include "oZKS/fourq/FourQ_internal.h"
+
+using namespace std;
+
+namespace {
+    // Two full 8-way batches and a remainder, so both the batched and the single-element
+    // kernels are exercised
+    constexpr unsigned int element_count = 19;
+
+    // Enough scalar multiplications for a full batch and a remainder
+    constexpr unsigned int scalar_count = 10;
+
+    uint64_t next_word(uint64_t &state)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return state;
+    }
+
+    /**
+    Fixed GF(p^2) operands: the edge values 0, 1 and p-1 followed by pseudo-random elements
+    */
+    void make_field_elements(uint64_t seed, f2elm_t *elements)
+    {
+        for (unsigned int i = 0; i < element_count; i++) {
+            for (unsigned int j = 0; j < 2; j++) {
+                elements[i][j][0] = next_word(seed);
+                elements[i][j][1] = next_word(seed) & 0x7FFFFFFFFFFFFFFFULL;
+            }
+        }
+
+        elements[0][0][0] = elements[0][0][1] = elements[0][1][0] = elements[0][1][1] = 0;
+        elements[1][0][0] = 1;
+        elements[1][0][1] = elements[1][1][0] = elements[1][1][1] = 0;
+        elements[2][0][0] = elements[2][1][0] = 0xFFFFFFFFFFFFFFFEULL;
+        elements[2][0][1] = elements[2][1][1] = 0x7FFFFFFFFFFFFFFFULL;
+    }
+
+    void append_element(f2elm_t a, vector<digit_t> &out)
+    {
+        // Different implementations may return either representation of zero
+        mod1271(a[0]);
+        mod1271(a[1]);
+        out.insert(out.end(), a[0], a[0] + NWORDS_FIELD);
+        out.insert(out.end(), a[1], a[1] + NWORDS_FIELD);
+    }
+
+    /**
+    Run the field arithmetic and scalar multiplications with the currently selected
+    implementation and collect all results
+    */
+    vector<digit_t> compute_results()
+    {
+        vector<digit_t> results;
+        f2elm_t a[element_count];
+        f2elm_t b[element_count];
+        f2elm_t c[element_count];
+        felm_t *pa[element_count];
+        felm_t *pb[element_count];
+        felm_t *pc[element_count];
+        make_field_elements(1, a);
+        make_field_elements(2, b);
+
+        for (unsigned int i = 0; i < element_count; i++) {
+            fp2mul1271(a[i], b[i], c[i]);
+            append_element(c[i], results);
+            fp2sqr1271(a[i], c[i]);
+            append_element(c[i], results);
+
+            pa[i] = a[i];
+            pb[i] = b[i];
+            pc[i] = c[i];
+        }
+
+        fp2mul1271_batch(pa, pb, pc, element_count);
+        for (unsigned int i = 0; i < element_count; i++) {
+            append_element(c[i], results);
+        }
+        fp2sqr1271_batch(pa, pc, element_count);
+        for (unsigned int i = 0; i < element_count; i++) {
+            append_element(c[i], results);
+        }
+
+        point_t G;
+        eccset(G);
+        vector<digit_t> scalars(scalar_count * NWORDS_ORDER);
+        uint64_t seed = 3;
+        for (auto &word : scalars) {
+            word = next_word(seed);
+        }
+
+        vector<point_affine> bases(scalar_count);
+        vector<point_affine> single(scalar_count);
+        vector<point_affine> batched(scalar_count);
+        for (unsigned int i = 0; i < scalar_count; i++) {
+            bases[i] = G[0];
+            EXPECT_TRUE(ecc_mul(G, scalars.data() + i * NWORDS_ORDER, &single[i], true));
+        }
+        EXPECT_TRUE(
+            ecc_mul_batch(bases.data(), scalars.data(), batched.data(), scalar_count, true));
+
+        for (unsigned int i = 0; i < scalar_count; i++) {
+            append_element(single[i].x, results);
+            append_element(single[i].y, results);
+            append_element(batched[i].x, results);
+            append_element(batched[i].y, results);
+        }
+
+        return results;
+    }
+
+    /**
+    Check that the given implementation gives the same results as the portable one
+    */
+    void compare_with_generic(FOURQ_IMPL impl)
+    {
+        FOURQ_IMPL original = fourq_current_impl();
+
+        ASSERT_TRUE(fourq_select_impl(FOURQ_IMPL_GENERIC));
+        vector<digit_t> expected = compute_results();
+
+        ASSERT_TRUE(fourq_select_impl(impl));
+        EXPECT_EQ(impl, fourq_current_impl());
+        vector<digit_t> results = compute_results();
+
+        ASSERT_TRUE(fourq_select_impl(original));
+        EXPECT_EQ(expected, results);
+    }
+} // namespace
+
+TEST(FourQDispatchTests, SelectTest)
+{
+    FOURQ_IMPL original = fourq_current_impl();
+    EXPECT_LE(original, fourq_best_impl());
+
+    // The portable implementation is always available
+    EXPECT_TRUE(fourq_select_impl(FOURQ_IMPL_GENERIC));
+    EXPECT_EQ(FOURQ_IMPL_GENERIC, fourq_current_impl());
+
+    EXPECT_TRUE(fourq_select_impl(original));
+    EXPECT_EQ(original, fourq_current_impl());
+}
+
+TEST(FourQDispatchTests, AsmMatchesGenericTest)
+{
+    // The plain assembly only uses baseline x64 instructions
+    compare_with_generic(FOURQ_IMPL_ASM);
+}
+
+TEST(FourQDispatchTests, AVX2MatchesGenericTest)
+{
+    if (FOURQ_IMPL_AVX2 > fourq_best_impl()) {
+        GTEST_SKIP() << "CPU does not support BMI2, ADX and AVX2";
+    }
+    compare_with_generic(FOURQ_IMPL_AVX2);
+}
+
+TEST(FourQDispatchTests, AVX512IFMAMatchesGenericTest)
+{
+    if (FOURQ_IMPL_AVX512IFMA > fourq_best_impl()) {
+        GTEST_SKIP() << "CPU does not support AVX-512 IFMA";
+    }
+    compare_with_generic(FOURQ_IMPL_AVX512IFMA);
+}
+
+#endif
@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <cstddef>
+#include <sstream>
+#include <vector>
+
+// oZKS
+#include "oZKS/key_filter.h"
+#include "oZKS/utilities.h"
+
+// GTest
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace ozks;
+using namespace ozks::utils;
+
+namespace {
+    hash_type make_key_hash(size_t i)
+    {
+        return compute_key_hash(make_bytes<key_type>(i, i >> 8, i >> 16));
+    }
+} // namespace
+
+TEST(KeyFilterTests, AddTest)
+{
+    KeyFilter key_filter(1000);
+    EXPECT_EQ(0, key_filter.key_count());
+    EXPECT_EQ(7, key_filter.hash_count());
+    EXPECT_LE(1000 * KeyFilter::default_bits_per_key / 8, key_filter.size_bytes());
+
+    for (size_t i = 0; i < 1000; i++) {
+        key_filter.add(make_key_hash(i));
+    }
+    EXPECT_EQ(1000, key_filter.key_count());
+
+    // Added key hashes are never missing
+    for (size_t i = 0; i < 1000; i++) {
+        EXPECT_TRUE(key_filter.might_contain(make_key_hash(i)));
+    }
+
+    // With ten bits per key about one percent of other key hashes are reported
+    size_t false_positives = 0;
+    for (size_t i = 1000; i < 11000; i++) {
+        if (key_filter.might_contain(make_key_hash(i))) {
+            false_positives++;
+        }
+    }
+    EXPECT_GT(300, false_positives);
+
+    key_filter.clear();
+    EXPECT_EQ(0, key_filter.key_count());
+    for (size_t i = 0; i < 1000; i++) {
+        EXPECT_FALSE(key_filter.might_contain(make_key_hash(i)));
+    }
+}
+
+TEST(KeyFilterTests, InvalidParametersTest)
+{
+    EXPECT_THROW(KeyFilter(1000, 0), invalid_argument);
+
+    // An empty filter still holds a block
+    KeyFilter key_filter(0);
+    EXPECT_LT(0, key_filter.size_bytes());
+    EXPECT_FALSE(key_filter.might_contain(make_key_hash(0)));
+    key_filter.add(make_key_hash(0));
+    EXPECT_TRUE(key_filter.might_contain(make_key_hash(0)));
+}
+
+TEST(KeyFilterTests, SaveLoadTest)
+{
+    KeyFilter key_filter(100, 16);
+    for (size_t i = 0; i < 100; i++) {
+        key_filter.add(make_key_hash(i));
+    }
+
+    stringstream ss;
+    size_t save_size = key_filter.save(ss);
+    auto loaded = KeyFilter::Load(ss);
+    EXPECT_EQ(save_size, loaded.second);
+    EXPECT_EQ(key_filter.key_count(), loaded.first.key_count());
+    EXPECT_EQ(key_filter.hash_count(), loaded.first.hash_count());
+    EXPECT_EQ(key_filter.size_bytes(), loaded.first.size_bytes());
+    for (size_t i = 0; i < 1000; i++) {
+        EXPECT_EQ(
+            key_filter.might_contain(make_key_hash(i)),
+            loaded.first.might_contain(make_key_hash(i)));
+    }
+
+    vector<byte> vec;
+    save_size = key_filter.save(vec);
+    EXPECT_EQ(save_size, vec.size());
+    loaded = KeyFilter::Load(vec);
+    EXPECT_EQ(save_size, loaded.second);
+    EXPECT_EQ(key_filter.key_count(), loaded.first.key_count());
+
+    // A truncated buffer is rejected
+    vec.resize(vec.size() / 2);
+    EXPECT_THROW(KeyFilter::Load(vec), runtime_error);
+}
@@ -0,0 +1,403 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// oZKS
+#include "oZKS/compressed_trie.h"
+#include "oZKS/storage/batch_storage.h"
+#include "oZKS/storage/memory_storage.h"
+#include "oZKS/storage/memory_storage_batch_inserter.h"
+#include "oZKS/utilities.h"
+
+// GTest
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace ozks;
+using namespace ozks::storage;
+using namespace ozks::utils;
+
+namespace {
+    /**
+    A batch storage backed by a MemoryStorage whose batch flushes block until the gate is opened
+    */
+    class GatedBatchStorage : public BatchStorage {
+    public:
+        GatedBatchStorage() : gate_(gate_promise_.get_future().share())
+        {}
+
+        void open_gate()
+        {
+            gate_promise_.set_value();
+        }
+
+        void set_fail_flush(bool fail_flush)
+        {
+            fail_flush_ = fail_flush;
+        }
+
+        bool load_ctnode(
+            trie_id_type trie_id,
+            const PartialLabel &node_id,
+            shared_ptr<Storage> storage,
+            CTNodeStored &node) override
+        {
+            return backing_.load_ctnode(trie_id, node_id, storage, node);
+        }
+
+        void save_ctnode(trie_id_type trie_id, const CTNodeStored &node) override
+        {
+            backing_.save_ctnode(trie_id, node);
+        }
+
+        bool load_compressed_trie(trie_id_type trie_id, CompressedTrie &trie) override
+        {
+            return backing_.load_compressed_trie(trie_id, trie);
+        }
+
+        void save_compressed_trie(const CompressedTrie &trie) override
+        {
+            backing_.save_compressed_trie(trie);
+        }
+
+        bool load_store_element(
+            trie_id_type trie_id, const vector<byte> &key, store_value_type &value) override
+        {
+            return backing_.load_store_element(trie_id, key, value);
+        }
+
+        void save_store_element(
+            trie_id_type trie_id, const vector<byte> &key, const store_value_type &value) override
+        {
+            backing_.save_store_element(trie_id, key, value);
+        }
+
+        void flush(trie_id_type) override
+        {}
+
+        void flush(
+            trie_id_type trie_id,
+            const vector<CTNodeStored> &nodes,
+            const vector<CompressedTrie> &tries,
+            const vector<pair<vector<byte>, store_value_type>> &store_elements) override
+        {
+            gate_.wait();
+            if (fail_flush_) {
+                throw runtime_error("Flush failed");
+            }
+
+            for (const auto &node : nodes) {
+                backing_.save_ctnode(trie_id, node);
+            }
+            for (const auto &trie : tries) {
+                backing_.save_compressed_trie(trie);
+            }
+            backing_.save_store_elements(trie_id, store_elements);
+        }
+
+        void add_ctnode(trie_id_type trie_id, const CTNodeStored &node) override
+        {
+            backing_.add_ctnode(trie_id, node);
+        }
+
+        void add_compressed_trie(const CompressedTrie &trie) override
+        {
+            backing_.add_compressed_trie(trie);
+        }
+
+        void add_store_element(
+            trie_id_type trie_id, const vector<byte> &key, const store_value_type &value) override
+        {
+            backing_.add_store_element(trie_id, key, value);
+        }
+
+        size_t get_compressed_trie_epoch(trie_id_type trie_id) override
+        {
+            return backing_.get_compressed_trie_epoch(trie_id);
+        }
+
+        void load_updated_elements(
+            size_t epoch, trie_id_type trie_id, shared_ptr<Storage> storage) override
+        {
+            backing_.load_updated_elements(epoch, trie_id, storage);
+        }
+
+        void delete_ozks(trie_id_type trie_id) override
+        {
+            backing_.delete_ozks(trie_id);
+        }
+
+    private:
+        MemoryStorage backing_;
+
+        promise<void> gate_promise_;
+
+        shared_future<void> gate_;
+
+        bool fail_flush_ = false;
+    };
+} // namespace
+
+TEST(MemoryStorageTests, ShardedMapTest)
+{
+    ShardedMap<StorageTrieKey, size_t, StorageTrieKeyHasher> map(5);
+    EXPECT_EQ(8, map.shard_count());
+
+    for (size_t i = 0; i < 100; i++) {
+        map.set(StorageTrieKey(i), i * 2);
+    }
+    EXPECT_EQ(100, map.size());
+
+    size_t value = 0;
+    EXPECT_TRUE(map.get(StorageTrieKey(10), value));
+    EXPECT_EQ(20, value);
+    EXPECT_FALSE(map.get(StorageTrieKey(100), value));
+
+    EXPECT_TRUE(map.erase(StorageTrieKey(10)));
+    EXPECT_FALSE(map.erase(StorageTrieKey(10)));
+    map.erase_if([](const StorageTrieKey &key) { return key.trie_id() % 2 == 0; });
+    EXPECT_EQ(50, map.size());
+}
+
+TEST(MemoryStorageTests, ShardedCacheTest)
+{
+    ShardedCache<StorageTrieKey, size_t, StorageTrieKeyHasher> cache(10000, 5);
+    EXPECT_EQ(8, cache.shard_count());
+    EXPECT_EQ(10000, cache.capacity_bytes());
+
+    cache.put(StorageTrieKey(1), make_shared<const size_t>(2), 100);
+    auto value = cache.get(StorageTrieKey(1));
+    ASSERT_NE(nullptr, value);
+    EXPECT_EQ(2, *value);
+    EXPECT_EQ(nullptr, cache.get(StorageTrieKey(2)));
+
+    // A value stays valid after it is removed from the cache
+    EXPECT_TRUE(cache.remove(StorageTrieKey(1)));
+    EXPECT_FALSE(cache.remove(StorageTrieKey(1)));
+    EXPECT_EQ(2, *value);
+    EXPECT_EQ(0, cache.size());
+    EXPECT_EQ(0, cache.size_bytes());
+
+    // Values larger than a shard are not cached
+    cache.put(StorageTrieKey(1), make_shared<const size_t>(2), 10000);
+    EXPECT_EQ(nullptr, cache.get(StorageTrieKey(1)));
+
+    // The cache stays within its budget
+    EXPECT_EQ(0, cache.eviction_count());
+    for (size_t i = 0; i < 1000; i++) {
+        cache.put(StorageTrieKey(i), make_shared<const size_t>(i), 100);
+    }
+    EXPECT_LT(0, cache.size());
+    EXPECT_GE(cache.capacity_bytes(), cache.size_bytes());
+    EXPECT_EQ(1000, cache.size() + cache.eviction_count());
+
+    cache.clear();
+    EXPECT_EQ(0, cache.size());
+    EXPECT_EQ(0, cache.size_bytes());
+}
+
+TEST(MemoryStorageTests, ShardedCacheScanTest)
+{
+    ShardedCache<StorageTrieKey, size_t, StorageTrieKeyHasher> cache(100000, 1);
+
+    // Entries that are used repeatedly survive a scan over entries that are used only once
+    for (size_t i = 0; i < 100; i++) {
+        cache.put(StorageTrieKey(i), make_shared<const size_t>(i), 100);
+    }
+    for (size_t round = 0; round < 2; round++) {
+        for (size_t i = 0; i < 100; i++) {
+            EXPECT_NE(nullptr, cache.get(StorageTrieKey(i)));
+        }
+    }
+    for (size_t i = 1000; i < 10000; i++) {
+        cache.put(StorageTrieKey(i), make_shared<const size_t>(i), 100);
+    }
+    for (size_t i = 0; i < 100; i++) {
+        EXPECT_NE(nullptr, cache.get(StorageTrieKey(i)));
+    }
+    EXPECT_GE(cache.capacity_bytes(), cache.size_bytes());
+}
+
+TEST(MemoryStorageTests, ConcurrentShardedCacheTest)
+{
+    ShardedCache<StorageTrieKey, size_t, StorageTrieKeyHasher> cache(100000, 4);
+
+    vector<thread> threads;
+    for (size_t t = 0; t < 4; t++) {
+        threads.emplace_back([&cache, t]() {
+            for (size_t i = 0; i < 10000; i++) {
+                StorageTrieKey key((i * 7 + t) % 2000);
+                auto value = cache.get(key);
+                if (nullptr == value) {
+                    cache.put(key, make_shared<const size_t>(key.trie_id()), 50);
+                } else {
+                    EXPECT_EQ(key.trie_id(), *value);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_GE(cache.capacity_bytes(), cache.size_bytes());
+}
+
+TEST(MemoryStorageTests, StoreElementBatchTest)
+{
+    MemoryStorage storage;
+    trie_id_type trie_id = 1;
+
+    vector<pair<vector<byte>, store_value_type>> store_elements;
+    for (size_t i = 0; i < 10; i++) {
+        store_elements.push_back(
+            { make_bytes<vector<byte>>(i, 0x01), { make_bytes<vector<byte>>(i), {} } });
+    }
+    storage.save_store_elements(trie_id, store_elements);
+    EXPECT_EQ(10, storage.store_element_count());
+
+    vector<vector<byte>> keys{ make_bytes<vector<byte>>(0x03, 0x01),
+                               make_bytes<vector<byte>>(0x03, 0x02),
+                               make_bytes<vector<byte>>(0x09, 0x01) };
+    vector<optional<store_value_type>> values;
+    EXPECT_EQ(2, storage.load_store_elements(trie_id, keys, values));
+    ASSERT_EQ(3, values.size());
+    EXPECT_EQ(make_bytes<vector<byte>>(0x03), values[0]->payload);
+    EXPECT_FALSE(values[1].has_value());
+    EXPECT_EQ(make_bytes<vector<byte>>(0x09), values[2]->payload);
+
+    // Elements of other tries are not visible
+    EXPECT_EQ(0, storage.load_store_elements(trie_id + 1, keys, values));
+
+    storage.delete_ozks(trie_id);
+    EXPECT_EQ(0, storage.store_element_count());
+}
+
+TEST(MemoryStorageTests, ConcurrentStoreElementsTest)
+{
+    MemoryStorage storage;
+    trie_id_type trie_id = 1;
+    constexpr size_t thread_count = 8;
+    constexpr size_t element_count = 2000;
+
+    // Writers and readers use the same instance without external locking
+    vector<thread> threads;
+    for (size_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&storage, trie_id, t]() {
+            for (size_t i = 0; i < element_count; i++) {
+                auto key = make_bytes<vector<byte>>(t, i, i >> 8);
+                storage.save_store_element(trie_id, key, { key, {} });
+
+                store_value_type value;
+                EXPECT_TRUE(storage.load_store_element(trie_id, key, value));
+                EXPECT_EQ(key, value.payload);
+
+                auto other_key = make_bytes<vector<byte>>((t + 1) % thread_count, i, i >> 8);
+                if (storage.load_store_element(trie_id, other_key, value)) {
+                    EXPECT_EQ(other_key, value.payload);
+                }
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(thread_count * element_count, storage.store_element_count());
+}
+
+TEST(MemoryStorageTests, DeleteTrieTest)
+{
+    MemoryStorage storage;
+
+    for (size_t i = 0; i < 10; i++) {
+        auto key = make_bytes<vector<byte>>(i);
+        storage.save_store_element(1, key, { key, {} });
+        if (i < 4) {
+            storage.save_store_element(2, key, { key, {} });
+        }
+    }
+    EXPECT_EQ(14, storage.store_element_count());
+    EXPECT_EQ(10, storage.store_element_count(1));
+    EXPECT_EQ(4, storage.store_element_count(2));
+    EXPECT_EQ(0, storage.store_element_count(3));
+
+    // Deleting a trie leaves the elements of other tries alone
+    storage.delete_ozks(1);
+    EXPECT_EQ(4, storage.store_element_count());
+    EXPECT_EQ(0, storage.store_element_count(1));
+    EXPECT_EQ(4, storage.store_element_count(2));
+
+    store_value_type value;
+    auto key = make_bytes<vector<byte>>(0x02);
+    EXPECT_FALSE(storage.load_store_element(1, key, value));
+    EXPECT_TRUE(storage.load_store_element(2, key, value));
+    EXPECT_EQ(key, value.payload);
+
+    // A deleted trie can be used again
+    storage.save_store_element(1, key, { key, {} });
+    EXPECT_EQ(1, storage.store_element_count(1));
+}
+
+TEST(MemoryStorageTests, AsyncFlushTest)
+{
+    auto backing_storage = make_shared<GatedBatchStorage>();
+    MemoryStorageBatchInserter storage(backing_storage, /* async_flush */ true);
+    EXPECT_TRUE(storage.async_flush());
+
+    auto key1 = make_bytes<vector<byte>>(0x01);
+    auto key2 = make_bytes<vector<byte>>(0x02);
+    storage.save_store_element(1, key1, { key1, {} });
+
+    // The flush returns before the backing storage has the element
+    storage.flush(1);
+    future<void> flushed = storage.flush_async(1);
+    EXPECT_EQ(2, storage.pending_flush_count());
+
+    // The element is still found while it is being flushed, and new elements go to a new buffer
+    store_value_type value;
+    EXPECT_FALSE(backing_storage->load_store_element(1, key1, value));
+    EXPECT_TRUE(storage.load_store_element(1, key1, value));
+    EXPECT_EQ(key1, value.payload);
+    storage.save_store_element(1, key2, { key2, {} });
+
+    vector<optional<store_value_type>> values;
+    vector<vector<byte>> keys{ key1, key2, make_bytes<vector<byte>>(0x03) };
+    EXPECT_EQ(2, storage.load_store_elements(1, keys, values));
+
+    backing_storage->open_gate();
+    flushed.get();
+    EXPECT_EQ(0, storage.pending_flush_count());
+    EXPECT_TRUE(backing_storage->load_store_element(1, key1, value));
+    EXPECT_FALSE(backing_storage->load_store_element(1, key2, value));
+
+    storage.flush(1);
+    storage.wait_for_flush();
+    EXPECT_TRUE(backing_storage->load_store_element(1, key2, value));
+}
+
+TEST(MemoryStorageTests, AsyncFlushErrorTest)
+{
+    auto backing_storage = make_shared<GatedBatchStorage>();
+    backing_storage->set_fail_flush(true);
+    backing_storage->open_gate();
+    MemoryStorageBatchInserter storage(backing_storage, /* async_flush */ true);
+
+    auto key = make_bytes<vector<byte>>(0x01);
+    storage.save_store_element(1, key, { key, {} });
+    future<void> flushed = storage.flush_async(1);
+    EXPECT_THROW(flushed.get(), runtime_error);
+
+    // The error is reported once more to whoever waits for the flushes next
+    EXPECT_THROW(storage.wait_for_flush(), runtime_error);
+    EXPECT_NO_THROW(storage.wait_for_flush());
+}
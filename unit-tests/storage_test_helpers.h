@@ -0,0 +1,37 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+// STD
+#include <cstddef>
+#include <vector>
+
+// OZKS
+#include "oZKS/defines.h"
+#include "oZKS/utilities.h"
+
+namespace ozks {
+    namespace storage {
+        namespace tests {
+            /**
+            Make a store value that differs for every index and version
+            */
+            inline store_value_type make_store_value(std::size_t i, std::size_t version)
+            {
+                store_value_type value;
+                value.payload = utils::make_bytes<payload_type>(i, i >> 8, version);
+                value.randomness[0] = static_cast<std::byte>(version);
+                return value;
+            }
+
+            /**
+            Make the store element key for the given index
+            */
+            inline std::vector<std::byte> make_key(std::size_t i)
+            {
+                return utils::make_bytes<std::vector<std::byte>>(i, i >> 8);
+            }
+        } // namespace tests
+    } // namespace storage
+} // namespace ozks
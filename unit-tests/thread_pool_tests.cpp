@@ -0,0 +1,193 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+// oZKS
+#include "oZKS/thread_pool.h"
+
+// GTest
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace ozks;
+
+TEST(ThreadPoolTests, EnqueueTest)
+{
+    ThreadPool tp(4);
+
+    vector<future<size_t>> results;
+    for (size_t i = 0; i < 1000; i++) {
+        results.push_back(tp.enqueue([](size_t a, size_t b) { return a * b; }, i, 2));
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        EXPECT_EQ(i * 2, results[i].get());
+    }
+
+    // Large callables do not fit in the task itself
+    array<size_t, 32> large{};
+    large[31] = 5;
+    EXPECT_EQ(5, tp.enqueue([large]() { return large[31]; }).get());
+
+    // Exceptions are reported through the future
+    auto failed = tp.enqueue([]() { throw runtime_error("failed"); });
+    EXPECT_THROW(failed.get(), runtime_error);
+
+    tp.wait_until_nothing_in_flight();
+}
+
+TEST(ThreadPoolTests, NestedEnqueueTest)
+{
+    ThreadPool tp(4);
+    atomic<size_t> count = 0;
+
+    // Tasks enqueued from a worker go to its own deque and are stolen by the other workers
+    vector<future<void>> results;
+    for (size_t i = 0; i < 8; i++) {
+        results.push_back(tp.enqueue([&tp, &count]() {
+            for (size_t j = 0; j < 100; j++) {
+                tp.enqueue([&count]() { count++; });
+            }
+        }));
+    }
+    for (auto &result : results) {
+        result.get();
+    }
+
+    tp.wait_until_nothing_in_flight();
+    EXPECT_EQ(800, count.load());
+}
+
+TEST(ThreadPoolTests, ParallelForTest)
+{
+    ThreadPool tp(4);
+
+    for (size_t grain : { 1, 7, 64, 10000 }) {
+        vector<size_t> values(5000, 0);
+        tp.parallel_for(10, values.size(), grain, [&values](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                values[i]++;
+            }
+        });
+
+        for (size_t i = 0; i < values.size(); i++) {
+            EXPECT_EQ(i < 10 ? 0 : 1, values[i]);
+        }
+    }
+
+    // Empty range
+    tp.parallel_for(5, 5, 1, [](size_t, size_t) { FAIL(); });
+
+    // The first exception is rethrown after all chunks are done
+    atomic<size_t> count = 0;
+    EXPECT_THROW(
+        tp.parallel_for(
+            0,
+            100,
+            1,
+            [&count](size_t begin, size_t) {
+                count++;
+                if (begin == 50) {
+                    throw invalid_argument("failed");
+                }
+            }),
+        invalid_argument);
+    EXPECT_GE(100, count.load());
+}
+
+TEST(ThreadPoolTests, NestedParallelForTest)
+{
+    ThreadPool tp(3);
+    vector<vector<size_t>> values(16, vector<size_t>(1000, 0));
+
+    tp.parallel_for(0, values.size(), 1, [&tp, &values](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            tp.parallel_for(0, values[i].size(), 10, [&values, i](size_t b, size_t e) {
+                for (size_t j = b; j < e; j++) {
+                    values[i][j] = i + j;
+                }
+            });
+        }
+    });
+
+    for (size_t i = 0; i < values.size(); i++) {
+        for (size_t j = 0; j < values[i].size(); j++) {
+            EXPECT_EQ(i + j, values[i][j]);
+        }
+    }
+}
+
+TEST(ThreadPoolTests, ParallelReduceTest)
+{
+    ThreadPool tp(4);
+    vector<size_t> values(10000);
+    iota(values.begin(), values.end(), size_t(1));
+
+    size_t sum = tp.parallel_reduce(
+        0,
+        values.size(),
+        100,
+        size_t(0),
+        [&values](size_t begin, size_t end) {
+            return accumulate(values.begin() + begin, values.begin() + end, size_t(0));
+        },
+        [](size_t a, size_t b) { return a + b; });
+    EXPECT_EQ(10000 * 10001 / 2, sum);
+
+    // Chunks are combined in order
+    vector<size_t> concatenated = tp.parallel_reduce(
+        0,
+        values.size(),
+        33,
+        vector<size_t>{},
+        [&values](size_t begin, size_t end) {
+            return vector<size_t>(values.begin() + begin, values.begin() + end);
+        },
+        [](vector<size_t> a, vector<size_t> b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+        });
+    EXPECT_EQ(values, concatenated);
+
+    EXPECT_EQ(7, tp.parallel_reduce(3, 3, 1, 7, [](size_t, size_t) { return 0; }, plus<int>()));
+}
+
+TEST(ThreadPoolTests, PoolSizeTest)
+{
+    ThreadPool tp(4);
+    EXPECT_EQ(4, tp.pool_size_limit());
+
+    auto run_tasks = [&tp]() {
+        vector<future<size_t>> results;
+        for (size_t i = 0; i < 200; i++) {
+            results.push_back(tp.enqueue([i]() { return i; }));
+        }
+        for (size_t i = 0; i < results.size(); i++) {
+            EXPECT_EQ(i, results[i].get());
+        }
+    };
+
+    tp.set_pool_size(1);
+    EXPECT_EQ(1, tp.pool_size_limit());
+    run_tasks();
+
+    tp.set_pool_size(6);
+    EXPECT_EQ(6, tp.pool_size_limit());
+    run_tasks();
+
+    tp.set_pool_size(2);
+    tp.set_pool_size(3);
+    EXPECT_EQ(3, tp.pool_size_limit());
+    run_tasks();
+
+    tp.set_queue_size_limit(4);
+    run_tasks();
+    tp.wait_until_empty();
+}
@@ -0,0 +1,121 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// oZKS
+#include "oZKS/compressed_trie.h"
+#include "oZKS/storage/memory_storage.h"
+#include "oZKS/trie_image.h"
+#include "oZKS/utilities.h"
+
+// GTest
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace ozks;
+using namespace ozks::storage;
+using namespace ozks::utils;
+
+namespace {
+    vector<PartialLabel> make_labels(size_t count, size_t seed)
+    {
+        vector<PartialLabel> labels;
+        for (size_t i = 0; i < count; i++) {
+            hash_type label_bytes{};
+            if (!random_bytes(label_bytes.data(), label_bytes.size())) {
+                throw runtime_error("Failed to get random bytes");
+            }
+            label_bytes[0] = static_cast<byte>(seed);
+            labels.emplace_back(label_bytes);
+        }
+        return labels;
+    }
+
+    void trie_image_test(TrieType trie_type)
+    {
+        string path = "trie_image_test.img";
+
+        CompressedTrie trie(make_shared<MemoryStorage>(), trie_type);
+        vector<PartialLabel> labels = make_labels(200, 0);
+        partial_label_hash_batch_type label_payload_batch;
+        for (size_t i = 0; i < labels.size(); i++) {
+            label_payload_batch.emplace_back(labels[i], make_bytes<hash_type>(i, i + 1, i + 2));
+        }
+        append_proof_batch_type append_proofs;
+        trie.insert(label_payload_batch, append_proofs);
+
+        TrieImage::Export(trie, path);
+        TrieImage image(path);
+        EXPECT_EQ(trie.id(), image.id());
+        EXPECT_EQ(trie.epoch(), image.epoch());
+        EXPECT_EQ(trie.get_commitment(), image.get_commitment());
+        EXPECT_LT(labels.size(), image.node_count());
+
+        // Both existing and missing labels give the same lookup path as the trie
+        vector<PartialLabel> missing_labels = make_labels(50, 1);
+        labels.insert(labels.end(), missing_labels.begin(), missing_labels.end());
+        for (const auto &label : labels) {
+            lookup_path_type expected_path;
+            lookup_path_type image_path;
+            bool found = trie.lookup(label, expected_path);
+            EXPECT_EQ(found, image.lookup(label, image_path));
+            EXPECT_EQ(expected_path, image_path);
+        }
+
+        filesystem::remove(path);
+    }
+} // namespace
+
+TEST(TrieImageTests, StoredLookupTest)
+{
+    trie_image_test(TrieType::Stored);
+}
+
+TEST(TrieImageTests, LinkedLookupTest)
+{
+    trie_image_test(TrieType::Linked);
+}
+
+TEST(TrieImageTests, EmptyTrieTest)
+{
+    string path = "trie_image_empty_test.img";
+
+    CompressedTrie trie(make_shared<MemoryStorage>(), TrieType::Stored);
+    TrieImage::Export(trie, path);
+    TrieImage image(path);
+    EXPECT_EQ(1, image.node_count());
+
+    PartialLabel label = make_labels(1, 0)[0];
+    lookup_path_type expected_path;
+    lookup_path_type image_path;
+    EXPECT_FALSE(trie.lookup(label, expected_path));
+    EXPECT_FALSE(image.lookup(label, image_path));
+    EXPECT_EQ(expected_path, image_path);
+
+    filesystem::remove(path);
+}
+
+TEST(TrieImageTests, InvalidImageTest)
+{
+    string path = "trie_image_invalid_test.img";
+
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        ASSERT_NE(nullptr, file);
+        const char contents[] = "this is not a trie image";
+        fwrite(contents, 1, sizeof(contents), file);
+        fclose(file);
+    }
+    EXPECT_THROW(TrieImage image(path), runtime_error);
+    EXPECT_THROW(TrieImage image("trie_image_missing_test.img"), runtime_error);
+
+    filesystem::remove(path);
+}
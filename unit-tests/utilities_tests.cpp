@@ -454,3 +454,24 @@ TEST(Utilities, Log2Test)
     EXPECT_EQ(4, get_log2(16));
     EXPECT_EQ(4, get_log2(20));
 }
+
+TEST(Utilities, GetNodeLabelsTest)
+{
+    VRFSecretKey vrf_sk;
+    vrf_sk.initialize();
+
+    vector<key_type> keys;
+    for (size_t i = 0; i < 11; i++) {
+        keys.push_back(make_bytes<key_type>(i, 0xAB, i * 3));
+    }
+
+    for (LabelType label_type : { LabelType::VRFLabels, LabelType::HashedLabels }) {
+        vector<hash_type> labels = get_node_labels(keys, vrf_sk, label_type);
+        ASSERT_EQ(keys.size(), labels.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            EXPECT_EQ(get_node_label(keys[i], vrf_sk, label_type), labels[i]);
+        }
+    }
+
+    EXPECT_TRUE(get_node_labels({}, vrf_sk, LabelType::VRFLabels).empty());
+}
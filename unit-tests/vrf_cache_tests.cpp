@@ -0,0 +1,348 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+// oZKS
+#include "oZKS/utilities.h"
+#include "oZKS/vrf_cache.h"
+
+// GTest
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace ozks;
+using namespace ozks::utils;
+
+namespace {
+    hash_type make_key_hash(size_t i)
+    {
+        return compute_key_hash(make_bytes<key_type>(i, i >> 8, i >> 16));
+    }
+} // namespace
+
+TEST(VRFCacheTests, AddGetTest)
+{
+    VRFSecretKey sk;
+    sk.initialize();
+
+    VRFCache cache(100);
+    EXPECT_EQ(100, cache.max_size());
+    EXPECT_EQ(0, cache.size());
+
+    hash_type key_hash = make_key_hash(1);
+    EXPECT_FALSE(cache.get(key_hash).has_value());
+    EXPECT_EQ(0, cache.cache_hits());
+    EXPECT_EQ(1, cache.cache_misses());
+
+    VRFProof proof = sk.get_vrf_proof(key_hash);
+    cache.add(key_hash, proof);
+    EXPECT_EQ(1, cache.size());
+
+    auto cached = cache.get(key_hash);
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_EQ(proof.gamma, cached->gamma);
+    EXPECT_EQ(proof.c, cached->c);
+    EXPECT_EQ(proof.s, cached->s);
+    EXPECT_EQ(1, cache.cache_hits());
+    EXPECT_EQ(1, cache.cache_misses());
+
+    cache.clear();
+    EXPECT_EQ(0, cache.size());
+    EXPECT_EQ(0, cache.cache_hits());
+    EXPECT_EQ(0, cache.cache_misses());
+    EXPECT_FALSE(cache.get(key_hash).has_value());
+}
+
+TEST(VRFCacheTests, EvictionTest)
+{
+    VRFCache cache(10, 1);
+    EXPECT_EQ(1, cache.shard_count());
+
+    VRFProof proof{};
+    for (size_t i = 0; i < 10; i++) {
+        cache.add(make_key_hash(i), proof);
+    }
+    EXPECT_EQ(10, cache.size());
+
+    // Touch the first element so that the second one is the least recently used
+    EXPECT_TRUE(cache.get(make_key_hash(0)).has_value());
+    cache.add(make_key_hash(10), proof);
+    EXPECT_EQ(10, cache.size());
+    EXPECT_TRUE(cache.get(make_key_hash(0)).has_value());
+    EXPECT_FALSE(cache.get(make_key_hash(1)).has_value());
+    EXPECT_EQ(1, cache.shard_stats()[0].evictions);
+}
+
+TEST(VRFCacheTests, ShardTest)
+{
+    // Zero-size cache has one shard and never stores anything
+    VRFCache empty_cache(0);
+    EXPECT_EQ(1, empty_cache.shard_count());
+    empty_cache.add(make_key_hash(0), VRFProof{});
+    EXPECT_EQ(0, empty_cache.size());
+    EXPECT_FALSE(empty_cache.get(make_key_hash(0)).has_value());
+    EXPECT_EQ(1, empty_cache.cache_misses());
+
+    // Small caches use fewer shards
+    EXPECT_EQ(3, VRFCache(3).shard_count());
+    EXPECT_EQ(VRFCache::default_shard_count, VRFCache(1000).shard_count());
+
+    VRFCache cache(1000, 8);
+    EXPECT_EQ(8, cache.shard_count());
+
+    size_t total_max_size = 0;
+    for (const auto &stats : cache.shard_stats()) {
+        total_max_size += stats.max_size;
+    }
+    EXPECT_EQ(1000, total_max_size);
+
+    VRFCache byte_cache = VRFCache::WithByteCapacity(100 * VRFCache::entry_byte_size);
+    EXPECT_EQ(100, byte_cache.max_size());
+    EXPECT_EQ(100 * VRFCache::entry_byte_size, byte_cache.max_byte_size());
+}
+
+TEST(VRFCacheTests, ConcurrentTest)
+{
+    VRFCache cache(256);
+    VRFProof proof{};
+
+    vector<thread> threads;
+    for (size_t t = 0; t < 8; t++) {
+        threads.emplace_back([&cache, &proof, t]() {
+            for (size_t i = 0; i < 1000; i++) {
+                hash_type key_hash = make_key_hash((t * 1000 + i) % 512);
+                if (!cache.get(key_hash).has_value()) {
+                    cache.add(key_hash, proof);
+                }
+            }
+        });
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    EXPECT_GE(256, cache.size());
+    EXPECT_EQ(8000, cache.cache_hits() + cache.cache_misses());
+}
+
+TEST(VRFCacheTests, BackingFileTest)
+{
+    string path = "vrf_cache_backing_file_test.bin";
+    vector<byte> key_id = make_bytes<vector<byte>>(1, 2, 3, 4);
+    VRFProof proof{};
+    proof.c[0] = byte{ 0x42 };
+
+    {
+        VRFCache cache(100);
+        cache.open_backing_file(path, key_id);
+        EXPECT_TRUE(cache.has_backing_file());
+        for (size_t i = 0; i < 20; i++) {
+            cache.add(make_key_hash(i), proof);
+        }
+    }
+
+    // A new cache with the same key_id sees the proofs after loading
+    {
+        VRFCache cache(100);
+        cache.open_backing_file(path, key_id);
+        cache.wait_for_backing_file_load();
+        EXPECT_TRUE(cache.backing_file_loaded());
+        cache.close_backing_file();
+        EXPECT_FALSE(cache.has_backing_file());
+        EXPECT_EQ(20, cache.size());
+        auto cached = cache.get(make_key_hash(7));
+        ASSERT_TRUE(cached.has_value());
+        EXPECT_EQ(proof.c, cached->c);
+    }
+
+    // Compaction keeps only the cached proofs
+    {
+        VRFCache cache(10, 1);
+        cache.open_backing_file(path, key_id);
+        cache.compact_backing_file();
+        EXPECT_TRUE(cache.backing_file_loaded());
+        EXPECT_EQ(10, cache.size());
+
+        // The most recently added proofs are the ones kept
+        EXPECT_TRUE(cache.get(make_key_hash(19)).has_value());
+        EXPECT_FALSE(cache.get(make_key_hash(0)).has_value());
+    }
+    {
+        VRFCache cache(100);
+        cache.open_backing_file(path, key_id);
+        cache.wait_for_backing_file_load();
+        EXPECT_TRUE(cache.backing_file_loaded());
+        cache.close_backing_file();
+        EXPECT_EQ(10, cache.size());
+    }
+
+    // A different key_id discards the contents
+    {
+        VRFCache cache(100);
+        cache.open_backing_file(path, make_bytes<vector<byte>>(5, 6, 7, 8));
+        cache.wait_for_backing_file_load();
+        cache.close_backing_file();
+        EXPECT_EQ(0, cache.size());
+    }
+
+    // Clearing the cache clears the file
+    {
+        VRFCache cache(100);
+        cache.open_backing_file(path, key_id);
+        cache.add(make_key_hash(0), proof);
+        cache.clear();
+        EXPECT_EQ(0, cache.size());
+    }
+    {
+        VRFCache cache(100);
+        cache.open_backing_file(path, key_id);
+        cache.wait_for_backing_file_load();
+        EXPECT_TRUE(cache.backing_file_loaded());
+        cache.close_backing_file();
+        EXPECT_EQ(0, cache.size());
+    }
+
+    remove(path.c_str());
+}
+
+TEST(VRFCacheTests, BackingFileFailureTest)
+{
+    string path = "vrf_cache_backing_file_failure_test.bin";
+    vector<byte> key_id = make_bytes<vector<byte>>(1, 2, 3, 4);
+    VRFProof proof{};
+
+    // A failed compaction keeps appending to the original file
+    {
+        VRFCache cache(100);
+        cache.open_backing_file(path, key_id);
+        for (size_t i = 0; i < 10; i++) {
+            cache.add(make_key_hash(i), proof);
+        }
+
+        filesystem::create_directory(path + ".tmp");
+        EXPECT_THROW(cache.compact_backing_file(), runtime_error);
+        filesystem::remove(path + ".tmp");
+
+        EXPECT_TRUE(cache.has_backing_file());
+        for (size_t i = 10; i < 20; i++) {
+            cache.add(make_key_hash(i), proof);
+        }
+    }
+    {
+        VRFCache cache(100);
+        cache.open_backing_file(path, key_id);
+        cache.wait_for_backing_file_load();
+        EXPECT_EQ(20, cache.size());
+        EXPECT_EQ(0, cache.backing_file_failures());
+    }
+
+    remove(path.c_str());
+
+#ifdef __linux__
+    // Writes to /dev/full always fail; the cache keeps working without the file
+    {
+        VRFCache cache(10000);
+        cache.open_backing_file("/dev/full", key_id);
+        for (size_t i = 0; i < 1000; i++) {
+            cache.add(make_key_hash(i), proof);
+        }
+        cache.flush_backing_file();
+
+        EXPECT_FALSE(cache.has_backing_file());
+        EXPECT_LT(0, cache.backing_file_failures());
+        EXPECT_EQ(1000, cache.size());
+        EXPECT_TRUE(cache.get(make_key_hash(999)).has_value());
+    }
+#endif
+}
+
+TEST(VRFCacheTests, BackingFileMultithreadedTest)
+{
+    string path = "vrf_cache_backing_file_multithreaded_test.bin";
+    vector<byte> key_id = make_bytes<vector<byte>>(1, 2, 3, 4);
+    VRFProof proof{};
+
+    {
+        VRFCache cache(10000);
+        cache.open_backing_file(path, key_id);
+        for (size_t i = 0; i < 1000; i++) {
+            cache.add(make_key_hash(i), proof);
+        }
+    }
+
+    // Proofs are added while other threads wait for the load and compact the file
+    VRFCache cache(10000);
+    cache.open_backing_file(path, key_id);
+    vector<thread> threads;
+    for (size_t t = 0; t < 4; t++) {
+        threads.emplace_back([&cache, &proof, t]() {
+            cache.wait_for_backing_file_load();
+            for (size_t i = 0; i < 250; i++) {
+                cache.add(make_key_hash(1000 + t * 250 + i), proof);
+            }
+        });
+    }
+    threads.emplace_back([&cache]() { cache.compact_backing_file(); });
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    EXPECT_TRUE(cache.backing_file_loaded());
+    EXPECT_EQ(2000, cache.size());
+    cache.close_backing_file();
+    EXPECT_FALSE(cache.has_backing_file());
+
+    VRFCache reloaded(10000);
+    reloaded.open_backing_file(path, key_id);
+    reloaded.wait_for_backing_file_load();
+    EXPECT_EQ(2000, reloaded.size());
+    reloaded.close_backing_file();
+
+    remove(path.c_str());
+}
+
+TEST(VRFCacheTests, PrewarmTest)
+{
+    VRFSecretKey sk;
+    sk.initialize();
+
+    vector<hash_type> key_hashes;
+    for (size_t i = 0; i < 50; i++) {
+        key_hashes.push_back(make_key_hash(i));
+    }
+
+    // Prewarming is disabled by default
+    VRFCache cache(100);
+    cache.prewarm(sk, key_hashes);
+    cache.wait_for_prewarm();
+    EXPECT_EQ(0, cache.size());
+
+    // Only key hashes within the budget are prewarmed
+    cache.set_prewarm_budget(40);
+    cache.prewarm(sk, key_hashes);
+    cache.wait_for_prewarm();
+    EXPECT_EQ(0, cache.prewarm_pending());
+    EXPECT_EQ(40, cache.size());
+
+    for (size_t i = 0; i < 40; i++) {
+        auto cached = cache.get(key_hashes[i]);
+        ASSERT_TRUE(cached.has_value());
+        VRFProof proof = sk.get_vrf_proof(key_hashes[i]);
+        EXPECT_EQ(proof.gamma, cached->gamma);
+        EXPECT_EQ(proof.c, cached->c);
+        EXPECT_EQ(proof.s, cached->s);
+    }
+    EXPECT_FALSE(cache.get(key_hashes[45]).has_value());
+
+    // Stopping discards pending work
+    cache.prewarm(sk, key_hashes);
+    cache.stop_prewarm();
+    EXPECT_EQ(0, cache.prewarm_pending());
+}
@@ -156,3 +156,38 @@ TEST(VRF, SeededKey)
     EXPECT_NE(hash1, hash3);
     EXPECT_NE(hash2, hash3);
 }
+
+TEST(VRF, BatchProofsAndValues)
+{
+    VRFSecretKey sk;
+    vector<hash_type> data(19);
+
+    // Secret key is uninitialized
+    EXPECT_THROW(sk.get_vrf_proofs(data), logic_error);
+    EXPECT_THROW(sk.get_vrf_values(data), logic_error);
+
+    sk.initialize();
+    VRFPublicKey pk = sk.get_vrf_public_key();
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = utils::compute_key_hash(utils::make_bytes<key_type>(i, i + 1, i + 2));
+    }
+
+    // Batch results must match the single-input results
+    vector<VRFProof> proofs = sk.get_vrf_proofs(data);
+    vector<hash_type> values = sk.get_vrf_values(data);
+    ASSERT_EQ(data.size(), proofs.size());
+    ASSERT_EQ(data.size(), values.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        VRFProof pf = sk.get_vrf_proof(data[i]);
+        EXPECT_EQ(pf.gamma, proofs[i].gamma);
+        EXPECT_EQ(pf.c, proofs[i].c);
+        EXPECT_EQ(pf.s, proofs[i].s);
+        EXPECT_TRUE(pk.verify_vrf_proof(data[i], proofs[i]));
+        EXPECT_EQ(sk.get_vrf_value(data[i]), values[i]);
+        EXPECT_EQ(proofs[i].compute_vrf_value(), values[i]);
+    }
+
+    // Empty batch
+    EXPECT_TRUE(sk.get_vrf_proofs({}).empty());
+    EXPECT_TRUE(sk.get_vrf_values({}).empty());
+}
@@ -0,0 +1,331 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// STD
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// oZKS
+#include "oZKS/compressed_trie.h"
+#include "oZKS/storage/memory_storage.h"
+#include "oZKS/storage/write_ahead_log_storage.h"
+#include "oZKS/utilities.h"
+#include "storage_test_helpers.h"
+
+// GTest
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace ozks;
+using namespace ozks::storage;
+using namespace ozks::storage::tests;
+using namespace ozks::utils;
+
+namespace {
+    /**
+    Memory storage that records the order in which store elements are saved
+    */
+    class RecordingStorage : public MemoryStorage {
+    public:
+        void save_store_elements(
+            trie_id_type trie_id,
+            const vector<pair<vector<byte>, store_value_type>> &store_elements) override
+        {
+            // Give concurrent flushes a chance to overtake each other
+            this_thread::yield();
+            MemoryStorage::save_store_elements(trie_id, store_elements);
+
+            lock_guard<mutex> lock(mtx_);
+            for (const auto &store_element : store_elements) {
+                saved_.push_back(store_element.second.payload);
+            }
+        }
+
+        vector<payload_type> saved() const
+        {
+            lock_guard<mutex> lock(mtx_);
+            return saved_;
+        }
+
+    private:
+        mutable mutex mtx_;
+
+        vector<payload_type> saved_;
+    };
+
+    string make_log_path(const string &name)
+    {
+        filesystem::remove(name);
+        return name;
+    }
+} // namespace
+
+TEST(WriteAheadLogStorageTests, ReplayTest)
+{
+    string log_path = make_log_path("write_ahead_log_replay_test.log");
+
+    {
+        auto memory_storage = make_shared<MemoryStorage>();
+        WriteAheadLogStorage storage(memory_storage, log_path);
+        for (size_t i = 0; i < 10; i++) {
+            storage.save_store_element(1, make_key(i), make_store_value(i, 0));
+        }
+
+        // Nothing reaches the wrapped storage before the flush
+        store_value_type value;
+        EXPECT_TRUE(storage.load_store_element(1, make_key(5), value));
+        EXPECT_FALSE(memory_storage->load_store_element(1, make_key(5), value));
+
+        storage.flush(1);
+        EXPECT_TRUE(memory_storage->load_store_element(1, make_key(5), value));
+        EXPECT_EQ(make_store_value(5, 0).payload, value.payload);
+        EXPECT_EQ(1, storage.sync_count());
+
+        // Elements that were never flushed are lost
+        storage.save_store_element(1, make_key(10), make_store_value(10, 0));
+        storage.save_store_element(1, make_key(0), make_store_value(0, 1));
+    }
+
+    // The flushed elements are applied to a new wrapped storage when the log is opened again
+    {
+        auto memory_storage = make_shared<MemoryStorage>();
+        WriteAheadLogStorage storage(memory_storage, log_path);
+        store_value_type value;
+        for (size_t i = 0; i < 10; i++) {
+            EXPECT_TRUE(memory_storage->load_store_element(1, make_key(i), value));
+            EXPECT_EQ(make_store_value(i, 0).payload, value.payload);
+            EXPECT_EQ(make_store_value(i, 0).randomness, value.randomness);
+        }
+        EXPECT_FALSE(storage.load_store_element(1, make_key(10), value));
+    }
+
+    filesystem::remove(log_path);
+}
+
+TEST(WriteAheadLogStorageTests, IncompleteRecordTest)
+{
+    string log_path = make_log_path("write_ahead_log_incomplete_record_test.log");
+
+    size_t log_size = 0;
+    {
+        WriteAheadLogStorage storage(make_shared<MemoryStorage>(), log_path);
+        storage.save_store_element(1, make_key(1), make_store_value(1, 0));
+        storage.flush(1);
+        log_size = storage.log_size();
+        EXPECT_EQ(log_size, filesystem::file_size(log_path));
+    }
+
+    // Simulate a record that was only partially written before a crash
+    {
+        FILE *file = fopen(log_path.c_str(), "ab");
+        ASSERT_NE(nullptr, file);
+        const char partial_record[] = "OZAL partial record";
+        fwrite(partial_record, 1, sizeof(partial_record), file);
+        fclose(file);
+    }
+
+    {
+        auto memory_storage = make_shared<MemoryStorage>();
+        WriteAheadLogStorage storage(memory_storage, log_path);
+        EXPECT_EQ(log_size, storage.log_size());
+
+        store_value_type value;
+        EXPECT_TRUE(memory_storage->load_store_element(1, make_key(1), value));
+        storage.save_store_element(1, make_key(2), make_store_value(2, 0));
+        storage.flush(1);
+    }
+
+    {
+        auto memory_storage = make_shared<MemoryStorage>();
+        WriteAheadLogStorage storage(memory_storage, log_path);
+        store_value_type value;
+        EXPECT_TRUE(memory_storage->load_store_element(1, make_key(1), value));
+        EXPECT_TRUE(memory_storage->load_store_element(1, make_key(2), value));
+    }
+
+    filesystem::remove(log_path);
+}
+
+TEST(WriteAheadLogStorageTests, DeleteAndCheckpointTest)
+{
+    string log_path = make_log_path("write_ahead_log_delete_test.log");
+
+    {
+        WriteAheadLogStorage storage(make_shared<MemoryStorage>(), log_path);
+        for (trie_id_type trie_id = 1; trie_id <= 2; trie_id++) {
+            storage.save_store_element(trie_id, make_key(1), make_store_value(1, trie_id));
+            storage.flush(trie_id);
+        }
+        storage.delete_ozks(2);
+    }
+
+    // A deleted trie does not come back when the log is replayed
+    {
+        auto memory_storage = make_shared<MemoryStorage>();
+        WriteAheadLogStorage storage(memory_storage, log_path);
+        store_value_type value;
+        EXPECT_TRUE(memory_storage->load_store_element(1, make_key(1), value));
+        EXPECT_FALSE(memory_storage->load_store_element(2, make_key(1), value));
+
+        storage.checkpoint();
+        EXPECT_EQ(0, storage.log_size());
+        storage.save_store_element(3, make_key(1), make_store_value(1, 3));
+        storage.flush(3);
+    }
+
+    // Only records written after the checkpoint are replayed
+    {
+        auto memory_storage = make_shared<MemoryStorage>();
+        WriteAheadLogStorage storage(memory_storage, log_path);
+        store_value_type value;
+        EXPECT_FALSE(memory_storage->load_store_element(1, make_key(1), value));
+        EXPECT_TRUE(memory_storage->load_store_element(3, make_key(1), value));
+    }
+
+    filesystem::remove(log_path);
+}
+
+TEST(WriteAheadLogStorageTests, GroupCommitTest)
+{
+    string log_path = make_log_path("write_ahead_log_group_commit_test.log");
+    constexpr size_t thread_count = 4;
+    constexpr size_t flush_count = 25;
+
+    {
+        WriteAheadLogStorage storage(make_shared<MemoryStorage>(), log_path);
+
+        // Each thread flushes its own trie; flushes that wait for a sync share the next one
+        vector<thread> threads;
+        for (size_t t = 0; t < thread_count; t++) {
+            threads.emplace_back([&storage, t]() {
+                for (size_t i = 0; i < flush_count; i++) {
+                    vector<pair<vector<byte>, store_value_type>> store_elements;
+                    store_elements.emplace_back(make_key(i), make_store_value(i, t));
+                    storage.flush(t + 1, {}, {}, store_elements);
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        EXPECT_GE(thread_count * flush_count, storage.sync_count());
+    }
+
+    {
+        auto memory_storage = make_shared<MemoryStorage>();
+        WriteAheadLogStorage storage(memory_storage, log_path);
+        store_value_type value;
+        for (size_t t = 0; t < thread_count; t++) {
+            for (size_t i = 0; i < flush_count; i++) {
+                EXPECT_TRUE(memory_storage->load_store_element(t + 1, make_key(i), value));
+                EXPECT_EQ(make_store_value(i, t).payload, value.payload);
+            }
+        }
+    }
+
+    filesystem::remove(log_path);
+}
+
+TEST(WriteAheadLogStorageTests, ApplyOrderTest)
+{
+    string log_path = make_log_path("write_ahead_log_apply_order_test.log");
+    constexpr size_t thread_count = 4;
+    constexpr size_t flush_count = 50;
+
+    vector<payload_type> applied;
+    {
+        auto recording_storage = make_shared<RecordingStorage>();
+        WriteAheadLogStorage storage(recording_storage, log_path, false);
+
+        // All threads flush the same key of the same trie
+        vector<thread> threads;
+        for (size_t t = 0; t < thread_count; t++) {
+            threads.emplace_back([&storage, t]() {
+                for (size_t i = 0; i < flush_count; i++) {
+                    vector<pair<vector<byte>, store_value_type>> store_elements;
+                    store_elements.emplace_back(make_key(0), make_store_value(i, t));
+                    storage.flush(1, {}, {}, store_elements);
+                }
+            });
+        }
+
+        // Checkpoints must not drop records that have not been applied yet
+        for (size_t i = 0; i < 10; i++) {
+            storage.checkpoint();
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        applied = recording_storage->saved();
+    }
+    EXPECT_EQ(thread_count * flush_count, applied.size());
+
+    // Replaying the log applies the records after the last checkpoint in log order, which must
+    // be the order in which the flushes applied them
+    {
+        auto recording_storage = make_shared<RecordingStorage>();
+        WriteAheadLogStorage storage(recording_storage, log_path, false);
+        vector<payload_type> replayed = recording_storage->saved();
+        ASSERT_GE(applied.size(), replayed.size());
+        EXPECT_TRUE(equal(replayed.begin(), replayed.end(), applied.end() - replayed.size()));
+    }
+
+    filesystem::remove(log_path);
+}
+
+TEST(WriteAheadLogStorageTests, CompressedTrieTest)
+{
+    string log_path = make_log_path("write_ahead_log_compressed_trie_test.log");
+
+    trie_id_type trie_id;
+    commitment_type commitment;
+    vector<PartialLabel> labels;
+    for (size_t i = 0; i < 50; i++) {
+        labels.push_back(make_bytes<PartialLabel>(i, i * 3, i * 7, i * 11, i * 13));
+    }
+
+    {
+        auto storage =
+            make_shared<WriteAheadLogStorage>(make_shared<MemoryStorage>(), log_path, false);
+        CompressedTrie trie(storage, TrieType::Stored);
+        trie_id = trie.id();
+
+        partial_label_hash_batch_type label_payload_batch;
+        for (size_t i = 0; i < labels.size(); i++) {
+            label_payload_batch.emplace_back(labels[i], make_bytes<hash_type>(i, i + 1, i + 2));
+        }
+        append_proof_batch_type append_proofs;
+        trie.insert(label_payload_batch, append_proofs);
+        trie.save_to_storage();
+        storage->flush(trie_id);
+
+        commitment = trie.get_commitment();
+    }
+
+    // The whole epoch is rebuilt from the log
+    {
+        auto memory_storage = make_shared<MemoryStorage>();
+        shared_ptr<Storage> storage =
+            make_shared<WriteAheadLogStorage>(memory_storage, log_path, false);
+        auto loaded = CompressedTrie::LoadFromStorage(trie_id, storage);
+        ASSERT_TRUE(loaded.second);
+        EXPECT_EQ(1, loaded.first->epoch());
+        EXPECT_EQ(commitment, loaded.first->get_commitment());
+
+        lookup_path_type lookup_path;
+        for (const auto &label : labels) {
+            EXPECT_TRUE(loaded.first->lookup(label, lookup_path));
+        }
+    }
+
+    filesystem::remove(log_path);
+}